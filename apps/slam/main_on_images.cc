@@ -183,7 +183,7 @@ int main(int argc, char* argv[])
 {
 
     if(argc < 2) {
-        std::cout << "Usage: $./bin/main_on_images data/sequence_${sequence_number}/"
+        std::cout << "Usage: $./bin/main_on_images data/sequence_${sequence_number}/ [map.lsdmap]"
                   << std::endl;
         exit(-1);
     }
@@ -232,6 +232,17 @@ int main(int argc, char* argv[])
     int runningIDX=0;
     float fakeTimeStamp = 0;
 
+    // warm start: relocalize in a previously saved map instead of initializing randomly.
+    if(argc >= 3)
+    {
+        runningIDX = system->loadMap(argv[2]);
+        if(runningIDX < 0)
+        {
+            std::cerr << "Could not load the map " << argv[2] << std::endl;
+            exit(-1);
+        }
+    }
+
     //ros::Rate r(hz);
 
     for(unsigned int i=0; i<files.size(); i++)
@@ -0,0 +1,117 @@
+/**
+* This file is part of LSD-SLAM.
+*
+* Copyright 2013 Jakob Engel <engelj at in dot tum dot de> (Technical University of Munich)
+* For more information see <http://vision.in.tum.de/lsdslam>
+*
+* LSD-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* LSD-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with LSD-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Replays pose graphs recorded by KeyFrameGraph::dumpMap (poseGraph.txt) with
+// every compiled-in linear solver, to compare their init / solve times.
+
+#include "global_mapping/key_frame_graph.h"
+#include "util/settings.h"
+
+#include <g2o/core/sparse_optimizer.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+using namespace lsd_slam;
+
+static const char* solverNames[] = {"csparse", "cholmod", "eigen", "pcg"};
+
+int main(int argc, char* argv[])
+{
+    int iterations = 20;
+    int threads = 0;
+    std::vector<std::string> files;
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if(arg == "-i" && i + 1 < argc)
+            iterations = atoi(argv[++i]);
+        else if(arg == "-t" && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else
+            files.push_back(arg);
+    }
+
+    if(files.empty()) {
+        std::cout << "Usage: $./bin/pose_graph_benchmark [-i iterations] [-t threads] "
+                  << "save/poseGraph.txt [...]" << std::endl;
+        exit(-1);
+    }
+
+#ifdef _OPENMP
+    if(threads > 0)
+        omp_set_num_threads(threads);
+#else
+    if(threads > 0)
+        printf("built without OpenMP, ignoring -t %d\n", threads);
+#endif
+
+    for(const std::string& file : files)
+    {
+        printf("%s:\n", file.c_str());
+
+        for(int s = POSE_GRAPH_SOLVER_CSPARSE; s <= POSE_GRAPH_SOLVER_PCG; s++)
+        {
+            PoseGraphSolver solver = (PoseGraphSolver)s;
+            if(!poseGraphSolverAvailable(solver))
+            {
+                printf("  %-8s not compiled in\n", solverNames[s]);
+                continue;
+            }
+
+            g2o::SparseOptimizer optimizer;
+            optimizer.setAlgorithm(createPoseGraphAlgorithm(solver));
+            optimizer.setVerbose(false);
+            if(!loadPoseGraph(file, optimizer))
+            {
+                printf("  could not parse %s\n", file.c_str());
+                break;
+            }
+
+            std::chrono::high_resolution_clock::time_point t0 =
+                std::chrono::high_resolution_clock::now();
+            optimizer.initializeOptimization();
+            std::chrono::high_resolution_clock::time_point t1 =
+                std::chrono::high_resolution_clock::now();
+            int its = optimizer.optimize(iterations);
+            std::chrono::high_resolution_clock::time_point t2 =
+                std::chrono::high_resolution_clock::now();
+            optimizer.computeActiveErrors();
+
+            printf("  %-8s %5d vertices %6d edges: init %8.2fms, solve %9.2fms (%d its), chi2 %g\n",
+                   solverNames[s],
+                   (int)optimizer.vertices().size(), (int)optimizer.edges().size(),
+                   std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count() / 1000.0f,
+                   std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() / 1000.0f,
+                   its, optimizer.activeChi2());
+        }
+    }
+
+    return 0;
+}
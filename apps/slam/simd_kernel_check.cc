@@ -0,0 +1,350 @@
+/**
+* This file is part of LSD-SLAM.
+*
+* Copyright 2013 Jakob Engel <engelj at in dot tum dot de> (Technical University of Munich)
+* For more information see <http://vision.in.tum.de/lsdslam>
+*
+* LSD-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* LSD-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with LSD-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Runs the SIMD tracking kernels this CPU supports against the scalar ones, on
+// a synthetic image and point cloud. Exits with 1 if one of them deviates by more
+// than the tolerance (-t for AVX2 / AVX-512, -a for the SSE / NEON kernels, which
+// use approximate reciprocals).
+
+#include "tracking/se3_tracker.h"
+#include "tracking/point_cloud_soa.h"
+#include "model/frame.h"
+#include "util/cpu_features.h"
+#include "util/settings.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+
+
+namespace lsd_slam
+{
+
+// calls the kernels of SE3Tracker for one SIMD level directly, instead of through
+// the simdLevel dispatch, so the check does not change how anything else runs.
+class SimdKernelCheck
+{
+public:
+    SimdKernelCheck(SE3Tracker& tracker) : t(tracker) {}
+
+    /**
+     * Runs the SIMD variants of calcResidualAndBuffers, calcWeightsAndResidual and
+     * calculateWarpUpdate up to supported on the given data, and compares them to the
+     * scalar ones; each kernel gets the scalar output of the one before as input.
+     * Prints the largest relative deviation per kernel, returns false if one is above
+     * tolerance (approximateTolerance for SSE / NEON, which use approximate reciprocals).
+     */
+    bool check(const PointCloudSoA& refData, Frame* frame, const Sophus::SE3f& referenceToFrame,
+               int level, SimdLevel supported, float tolerance, float approximateTolerance);
+
+private:
+    SE3Tracker& t;
+
+    float calcResidualAndBuffers(SimdLevel l, const PointCloudSoA& refData, Frame* frame,
+                                 const Sophus::SE3f& referenceToFrame, int level);
+    float calcWeightsAndResidual(SimdLevel l, const Sophus::SE3f& referenceToFrame);
+    void calculateWarpUpdate(SimdLevel l, NormalEquationsLeastSquares& ls);
+};
+
+float SimdKernelCheck::calcResidualAndBuffers(SimdLevel l, const PointCloudSoA& refData,
+        Frame* frame, const Sophus::SE3f& referenceToFrame, int level)
+{
+    switch(l)
+    {
+#if defined(ENABLE_NEON)
+    case SIMD_NEON:
+        return t.calcResidualAndBuffersNEON(refData, 0, refData.num, frame, referenceToFrame, level);
+#endif
+#if defined(ENABLE_SSE)
+    case SIMD_SSE:
+        return t.calcResidualAndBuffersSSE(refData, 0, refData.num, frame, referenceToFrame, level);
+#endif
+#if defined(ENABLE_AVX2)
+    case SIMD_AVX2:
+        return t.calcResidualAndBuffersAVX2(refData, 0, refData.num, frame, referenceToFrame, level);
+#endif
+#if defined(ENABLE_AVX512)
+    case SIMD_AVX512:
+        return t.calcResidualAndBuffersAVX512(refData, 0, refData.num, frame, referenceToFrame, level);
+#endif
+    default:
+        return t.calcResidualAndBuffers(refData, 0, refData.num, frame, referenceToFrame, level);
+    }
+}
+
+float SimdKernelCheck::calcWeightsAndResidual(SimdLevel l, const Sophus::SE3f& referenceToFrame)
+{
+    switch(l)
+    {
+#if defined(ENABLE_NEON)
+    case SIMD_NEON:
+        return t.calcWeightsAndResidualNEON(referenceToFrame);
+#endif
+#if defined(ENABLE_SSE)
+    case SIMD_SSE:
+        return t.calcWeightsAndResidualSSE(referenceToFrame);
+#endif
+#if defined(ENABLE_AVX2)
+    case SIMD_AVX2:
+        return t.calcWeightsAndResidualAVX2(referenceToFrame);
+#endif
+#if defined(ENABLE_AVX512)
+    case SIMD_AVX512:
+        return t.calcWeightsAndResidualAVX512(referenceToFrame);
+#endif
+    default:
+        return t.calcWeightsAndResidual(referenceToFrame);
+    }
+}
+
+void SimdKernelCheck::calculateWarpUpdate(SimdLevel l, NormalEquationsLeastSquares& ls)
+{
+    switch(l)
+    {
+#if defined(ENABLE_NEON)
+    case SIMD_NEON:
+        t.calculateWarpUpdateNEON(ls);
+        break;
+#endif
+#if defined(ENABLE_SSE)
+    case SIMD_SSE:
+        t.calculateWarpUpdateSSE(ls);
+        break;
+#endif
+#if defined(ENABLE_AVX2)
+    case SIMD_AVX2:
+        t.calculateWarpUpdateAVX2(ls);
+        break;
+#endif
+#if defined(ENABLE_AVX512)
+    case SIMD_AVX512:
+        t.calculateWarpUpdateAVX512(ls);
+        break;
+#endif
+    default:
+        t.calculateWarpUpdate(ls);
+    }
+}
+
+// max that keeps NaN, so a kernel producing NaN fails the check.
+static inline float maxDiff(float a, float b)
+{
+    return b <= a ? a : b;
+}
+
+// largest deviation of b from a, relative to the largest |a| (at least 1).
+static float maxRelativeDiff(const float* a, const float* b, int n)
+{
+    float diff = 0, scale = 1;
+    for(int i=0; i<n; i++)
+    {
+        diff = maxDiff(diff, fabsf(a[i] - b[i]));
+        scale = std::max(scale, fabsf(a[i]));
+    }
+    return diff / scale;
+}
+
+bool SimdKernelCheck::check(const PointCloudSoA& refData, Frame* frame,
+                            const Sophus::SE3f& referenceToFrame, int level, SimdLevel supported,
+                            float tolerance, float approximateTolerance)
+{
+    float* warpedBuffers[8] = {t.buf_warped_residual, t.buf_warped_dx, t.buf_warped_dy,
+                               t.buf_warped_x, t.buf_warped_y, t.buf_warped_z, t.buf_d, t.buf_idepthVar
+                              };
+
+    // scalar results.
+    float residual = calcResidualAndBuffers(SIMD_NONE, refData, frame, referenceToFrame, level);
+    int num = t.buf_warped_size;
+    float stats[5] = {t.pointUsage, t.lastGoodCount, t.lastBadCount,
+                      t.affineEstimation_a_lastIt, t.affineEstimation_b_lastIt
+                     };
+    std::vector<float> warped(8*num);
+    for(int k=0; k<8; k++)
+        memcpy(&warped[k*num], warpedBuffers[k], sizeof(float)*num);
+
+    float weightedResidual = calcWeightsAndResidual(SIMD_NONE, referenceToFrame);
+    std::vector<float> weights(t.buf_weight_p, t.buf_weight_p + num);
+
+    NormalEquationsLeastSquares ls;
+    calculateWarpUpdate(SIMD_NONE, ls);
+
+#if defined(ENABLE_NEON)
+    const SimdLevel levels[] = {SIMD_NEON};
+#else
+    const SimdLevel levels[] = {SIMD_SSE, SIMD_AVX2, SIMD_AVX512};
+#endif
+
+    bool ok = true;
+    for(SimdLevel l : levels)
+    {
+        if(l > supported)
+            break;
+
+        // calcResidualAndBuffers
+        float simdResidual = calcResidualAndBuffers(l, refData, frame, referenceToFrame, level);
+        float residualDiff = 0;
+        if(t.buf_warped_size != num)
+            residualDiff = 1e10;
+        else
+        {
+            float simdStats[5] = {t.pointUsage, t.lastGoodCount, t.lastBadCount,
+                                  t.affineEstimation_a_lastIt, t.affineEstimation_b_lastIt
+                                 };
+            residualDiff = maxRelativeDiff(&residual, &simdResidual, 1);
+            for(int k=0; k<4; k++)
+                residualDiff = maxDiff(residualDiff, maxRelativeDiff(&stats[k], &simdStats[k], 1));
+            // b is a brightness offset, and badly conditioned: compare it to the intensity range.
+            residualDiff = maxDiff(residualDiff, fabsf(stats[4] - simdStats[4]) / 255.0f);
+            for(int k=0; k<8; k++)
+                residualDiff = maxDiff(residualDiff,
+                                   maxRelativeDiff(&warped[k*num], warpedBuffers[k], num));
+        }
+
+        // calcWeightsAndResidual, on the scalar warped buffers.
+        t.buf_warped_size = num;
+        for(int k=0; k<8; k++)
+            memcpy(warpedBuffers[k], &warped[k*num], sizeof(float)*num);
+        float simdWeightedResidual = calcWeightsAndResidual(l, referenceToFrame);
+        float weightsDiff = maxDiff(maxRelativeDiff(&weightedResidual, &simdWeightedResidual, 1),
+                                    maxRelativeDiff(weights.data(), t.buf_weight_p, num));
+
+        // calculateWarpUpdate, on the scalar weights.
+        memcpy(t.buf_weight_p, weights.data(), sizeof(float)*num);
+        // only the normal equations are compared, solving them is the same code for all.
+        NormalEquationsLeastSquares simdLs;
+        calculateWarpUpdate(l, simdLs);
+        float updateDiff = maxDiff((simdLs.A - ls.A).norm() / std::max(1.0f, ls.A.norm()),
+                                   (simdLs.b - ls.b).norm() / std::max(1.0f, ls.b.norm()));
+        updateDiff = maxDiff(updateDiff, maxRelativeDiff(&ls.error, &simdLs.error, 1));
+
+        printf("%-6s calcResidualAndBuffers %g, calcWeightsAndResidual %g, calculateWarpUpdate %g\n",
+               simdLevelName(l), residualDiff, weightsDiff, updateDiff);
+        float levelTolerance = l >= SIMD_AVX2 ? tolerance : approximateTolerance;
+        ok = ok && residualDiff <= levelTolerance && weightsDiff <= levelTolerance &&
+             updateDiff <= levelTolerance;
+    }
+
+    return ok;
+}
+
+}
+
+
+using namespace lsd_slam;
+
+int main(int argc, char* argv[])
+{
+    float tolerance = 1e-3f;
+    float approximateTolerance = 5e-2f;
+    unsigned int seed = 1;
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if(arg == "-t" && i + 1 < argc)
+            tolerance = atof(argv[++i]);
+        else if(arg == "-a" && i + 1 < argc)
+            approximateTolerance = atof(argv[++i]);
+        else if(arg == "-s" && i + 1 < argc)
+            seed = atoi(argv[++i]);
+        else
+        {
+            std::cout << "Usage: $./bin/simd_kernel_check [-t tolerance] [-a approximateTolerance] [-s seed]" << std::endl;
+            exit(-1);
+        }
+    }
+
+    SimdLevel supported = detectSimdLevel();
+    printf("detected %s\n", simdLevelName(supported));
+
+    int w = 640, h = 480;
+    Eigen::Matrix3f K;
+    K << 500, 0, 320,
+         0, 500, 240,
+         0, 0, 1;
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> uniform(0, 1);
+
+    // smooth pattern plus noise, so there are gradients everywhere.
+    std::vector<float> image(w*h);
+    for(int y=0; y<h; y++)
+        for(int x=0; x<w; x++)
+            image[x+y*w] = 128 + 60*sinf(x*0.05f)*cosf(y*0.07f)
+                           + 30*sinf(x*0.013f + y*0.021f) + 5*uniform(rng);
+    Frame frame(0, w, h, K, 0, image.data());
+
+    SE3Tracker tracker(w, h, K);
+    tracker.affineEstimation_a = 1.02f;
+    tracker.affineEstimation_b = -1.5f;
+    SimdKernelCheck check(tracker);
+
+    Sophus::SE3f referenceToFrame = Sophus::SE3f::exp(
+                                        (Vector6() << 0.02, -0.01, 0.03, 0.01, 0.02, -0.015).finished());
+
+    bool ok = true;
+    for(int level = SE3TRACKING_MIN_LEVEL; level < SE3TRACKING_MAX_LEVEL; level++)
+    {
+        int wl = frame.width(level), hl = frame.height(level);
+        Eigen::Matrix3f KInv = frame.K(level).inverse();
+        const float* imageLvl = frame.image(level);
+
+        // random subset of the pixels at random depths, a point count that is not
+        // a multiple of the vector width, and one point behind the camera.
+        PointCloudSoA points;
+        points.reserve(wl*hl + 1);
+        int num = 0;
+        for(int y=2; y<hl-2; y++)
+            for(int x=2; x<wl-2; x++)
+            {
+                if(uniform(rng) < 0.4f)
+                    continue;
+                Eigen::Vector3f p = KInv * Eigen::Vector3f(x, y, 1) / (0.3f + uniform(rng));
+                points.x[num] = p[0];
+                points.y[num] = p[1];
+                points.z[num] = p[2];
+                points.color[num] = imageLvl[x+y*wl] + 4*uniform(rng);
+                points.var[num] = 0.01f*uniform(rng);
+                num++;
+            }
+        points.x[num] = 0;
+        points.y[num] = 0;
+        points.z[num] = -1;
+        points.color[num] = 1;
+        points.var[num] = 1;
+        num++;
+        if(num % PointCloudSoA::SIMD_WIDTH == 0)
+            num--;
+        points.setNum(num);
+
+        printf("level %d, %d points:\n", level, num);
+        ok = check.check(points, &frame, referenceToFrame, level, supported,
+                         tolerance, approximateTolerance) && ok;
+    }
+
+    printf(ok ? "all kernels within tolerance\n" : "kernels deviate by more than the tolerance\n");
+    return ok ? 0 : 1;
+}
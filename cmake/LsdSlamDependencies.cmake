@@ -51,8 +51,13 @@ if(G2O_SOLVER_CSPARSE AND NOT APPLE)
   add_definitions(-DHAVE_SOLVER_CSPARSE)
 endif()
 if(G2O_SOLVER_CHOLMOD)
-  list(APPEND G2O_LIBRARIES ${G2O_SOLVER_CHOLMOD})
-  add_definitions(-DHAVE_SOLVER_CHOLMOD)
+  # the cholmod solver headers and the library itself come from SuiteSparse
+  find_package(SuiteSparse)
+  if(SUITESPARSE_FOUND)
+    include_directories(${SUITESPARSE_INCLUDE_DIRS})
+    list(APPEND G2O_LIBRARIES ${G2O_SOLVER_CHOLMOD} ${SUITESPARSE_LIBRARIES})
+    add_definitions(-DHAVE_SOLVER_CHOLMOD)
+  endif()
 endif()
 if(G2O_SOLVER_EIGEN)
   list(APPEND G2O_LIBRARIES ${G2O_SOLVER_EIGEN})
@@ -94,7 +94,8 @@ endmacro(lsd_slam_add_executable)
 # add a test
 macro(lsd_slam_add_test target)
   lsd_slam_add_executable(${target} ${ARGN})
-  add_test(${target} ${CMAKE_CURRENT_BINARY_DIR}/${target})
+  # by target name, the binaries go to EXECUTABLE_OUTPUT_PATH, not the binary dir.
+  add_test(NAME ${target} COMMAND ${target})
 endmacro(lsd_slam_add_test)
 
 # commong build settings (mostly to deal with Windows )
@@ -106,6 +107,9 @@ macro(lsd_slam_common_build_setting)
     endif()
   else()
     option(LsdSlam_ENABLE_SSE "Enable SSE" ON)
+    # AVX2 / AVX-512 kernels are picked at runtime either way; turn this off
+    # for binaries that have to run on other (older) CPUs than the build machine.
+    option(LsdSlam_BUILD_NATIVE "Optimize for the build machine (-march=native)" ON)
     if(LsdSlam_ENABLE_SSE)
       add_definitions(-DENABLE_SSE)   # SSE code
     endif()
@@ -143,7 +147,7 @@ macro(lsd_slam_common_build_setting)
       # SSE is not supported on ARM!
       if(CMAKE_SYSTEM_PROCESSOR MATCHES "^arm")
         add_definitions(-mfpu=neon -mfloat-abi=softfp -march=armv7-a)  # vectorization for ARM
-      else()
+      elseif(LsdSlam_BUILD_NATIVE)
         add_definitions(-march=native)
       endif()
     endif()
@@ -20,6 +20,7 @@
 
 #include "depth_estimation/depth_map.h"
 
+#include <algorithm>
 #include <chrono>
 #include <stdio.h>
 #include <fstream>
@@ -28,15 +29,23 @@
 
 #include "util/settings.h"
 #include "depth_estimation/depth_map_pixel_hypothesis.h"
+#include "depth_estimation/depth_map_soa.h"
 #include "model/frame.h"
 #include "util/global_funcs.h"
 #include "io_wrapper/image_display.h"
 #include "global_mapping/key_frame_graph.h"
 
+#if defined(ENABLE_AVX2)
+#include <immintrin.h>
+#endif
+
 
 namespace lsd_slam
 {
 
+// propagateDepth splits source and target image into bands of this many rows.
+static const int propagationBandRows = 16;
+
 DepthMap::DepthMap(int w, int h, const Eigen::Matrix3f& K)
 {
     width = w;
@@ -44,11 +53,17 @@ DepthMap::DepthMap(int w, int h, const Eigen::Matrix3f& K)
 
     activeKeyFrame = 0;
     activeKeyFrameIsReactivated = false;
-    otherDepthMap = new DepthMapPixelHypothesis[width*height];
-    currentDepthMap = new DepthMapPixelHypothesis[width*height];
+    otherDepthMap = new DepthMapSoA(width, height);
+    currentDepthMap = new DepthMapSoA(width, height);
 
     validityIntegralBuffer =new int[width*height];
 
+    activePixels.reserve(width*height);
+    activePixelsRowStart.resize(height+1, 0);
+    activePixelsGradTH = 0;
+
+    numPropagationBands = (height + propagationBandRows - 1) / propagationBandRows;
+    propagationBins.resize(numPropagationBands*numPropagationBands);
 
 
     debugImageHypothesisHandling = cv::Mat(h,w, CV_8UC3);
@@ -92,8 +107,8 @@ DepthMap::~DepthMap()
     debugImageStereoLines.release();
     debugImageDepth.release();
 
-    delete[] otherDepthMap;
-    delete[] currentDepthMap;
+    delete otherDepthMap;
+    delete currentDepthMap;
 
     delete[] validityIntegralBuffer;
 
@@ -103,12 +118,37 @@ DepthMap::~DepthMap()
 
 void DepthMap::reset()
 {
-    for(DepthMapPixelHypothesis* pt = otherDepthMap+width*height-1;
-            pt >= otherDepthMap; pt--)
-        pt->isValid = false;
-    for(DepthMapPixelHypothesis* pt = currentDepthMap+width*height-1;
-            pt >= currentDepthMap; pt--)
-        pt->isValid = false;
+    otherDepthMap->invalidateAll();
+    currentDepthMap->invalidateAll();
+}
+
+
+void DepthMap::buildActivePixels()
+{
+    const float* keyFrameMaxGradBuf = activeKeyFrame->maxGradients(0);
+    activePixelsGradTH = MIN_ABS_GRAD_CREATE;
+
+    activePixels.clear();
+    for(int y=0; y<height; y++)
+    {
+        activePixelsRowStart[y] = activePixels.size();
+        for(int idx=y*width; idx<(y+1)*width; idx++)
+        {
+            if(keyFrameMaxGradBuf[idx] >= activePixelsGradTH
+                    || currentDepthMap->isValid(idx)
+                    || currentDepthMap->blacklisted[idx] < MIN_BLACKLIST)
+                activePixels.push_back(idx);
+        }
+    }
+    activePixelsRowStart[height] = activePixels.size();
+}
+
+
+void DepthMap::updateActivePixels()
+{
+    // minUseGrad may be changed at runtime; a lower threshold makes new pixels eligible.
+    if(activePixelsGradTH != MIN_ABS_GRAD_CREATE)
+        buildActivePixels();
 }
 
 
@@ -119,21 +159,23 @@ void DepthMap::observeDepthRow(int yMin, int yMax, RunningStats* stats)
     int successes = 0;
 
     for(int y=yMin; y<yMax; y++)
-        for(int x=3; x<width-3; x++)
+        for(int i=activePixelsRowStart[y]; i<activePixelsRowStart[y+1]; i++)
         {
-            int idx = x+y*width;
-            DepthMapPixelHypothesis* target = currentDepthMap+idx;
-            bool hasHypothesis = target->isValid;
+            int idx = activePixels[i];
+            int x = idx-y*width;
+            if(x < 3 || x >= width-3) continue;
+
+            bool hasHypothesis = currentDepthMap->isValid(idx);
 
             // ======== 1. check absolute grad =========
             if(hasHypothesis && keyFrameMaxGradBuf[idx] < MIN_ABS_GRAD_DECREASE)
             {
-                target->isValid = false;
+                currentDepthMap->setInvalid(idx);
                 continue;
             }
 
             if(keyFrameMaxGradBuf[idx] < MIN_ABS_GRAD_CREATE
-                    || target->blacklisted < MIN_BLACKLIST)
+                    || currentDepthMap->blacklisted[idx] < MIN_BLACKLIST)
                 continue;
 
 
@@ -151,6 +193,7 @@ void DepthMap::observeDepthRow(int yMin, int yMax, RunningStats* stats)
 }
 void DepthMap::observeDepth()
 {
+    updateActivePixels();
 
     threadReducer.reduce(boost::bind(&DepthMap::observeDepthRow, this, _1, _2, _3),
                          3, height-3, 10);
@@ -246,7 +289,6 @@ bool DepthMap::makeAndCheckEPL(const int x, const int y,
 bool DepthMap::observeDepthCreate(const int &x, const int &y, const int &idx,
                                   RunningStats* const &stats)
 {
-    DepthMapPixelHypothesis* target = currentDepthMap+idx;
 
     Frame* refFrame = activeKeyFrameIsReactivated ? newest_referenceFrame :
                       oldest_referenceFrame;
@@ -282,7 +324,7 @@ bool DepthMap::observeDepthCreate(const int &x, const int &y, const int &idx,
 
     if(error == -3 || error == -2)
     {
-        target->blacklisted--;
+        currentDepthMap->blacklisted[idx]--;
         if(enablePrintDebugInfo) stats->num_observe_blacklisted++;
     }
 
@@ -292,10 +334,10 @@ bool DepthMap::observeDepthCreate(const int &x, const int &y, const int &idx,
     result_idepth = UNZERO(result_idepth);
 
     // add hypothesis
-    *target = DepthMapPixelHypothesis(
-                  result_idepth,
-                  result_var,
-                  VALIDITY_COUNTER_INITIAL_OBSERVE);
+    currentDepthMap->set(idx, DepthMapPixelHypothesis(
+                             result_idepth,
+                             result_var,
+                             VALIDITY_COUNTER_INITIAL_OBSERVE));
 
     if(plotStereoImages)
         debugImageHypothesisHandling.at<cv::Vec3b>(y, x) = cv::Vec3b(255,255,
@@ -309,13 +351,13 @@ bool DepthMap::observeDepthCreate(const int &x, const int &y, const int &idx,
 bool DepthMap::observeDepthUpdate(const int &x, const int &y, const int &idx,
                                   const float* keyFrameMaxGradBuf, RunningStats* const &stats)
 {
-    DepthMapPixelHypothesis* target = currentDepthMap+idx;
+    DepthMapPixelHypothesis target = currentDepthMap->get(idx);
     Frame* refFrame;
 
 
     if(!activeKeyFrameIsReactivated)
     {
-        if((int)target->nextStereoFrameMinID - referenceFrameByID_offset >=
+        if((int)target.nextStereoFrameMinID - referenceFrameByID_offset >=
                 (int)referenceFrameByID.size())
         {
             if(plotStereoImages)
@@ -326,10 +368,10 @@ bool DepthMap::observeDepthUpdate(const int &x, const int &y, const int &idx,
             return false;
         }
 
-        if((int)target->nextStereoFrameMinID - referenceFrameByID_offset < 0)
+        if((int)target.nextStereoFrameMinID - referenceFrameByID_offset < 0)
             refFrame = oldest_referenceFrame;
         else
-            refFrame = referenceFrameByID[(int)target->nextStereoFrameMinID -
+            refFrame = referenceFrameByID[(int)target.nextStereoFrameMinID -
                                                                             referenceFrameByID_offset];
     }
     else
@@ -355,9 +397,9 @@ bool DepthMap::observeDepthUpdate(const int &x, const int &y, const int &idx,
     if(!isGood) return false;
 
     // which exact point to track, and where from.
-    float sv = sqrt(target->idepth_var_smoothed);
-    float min_idepth = target->idepth_smoothed - sv*STEREO_EPL_VAR_FAC;
-    float max_idepth = target->idepth_smoothed + sv*STEREO_EPL_VAR_FAC;
+    float sv = sqrt(target.idepth_var_smoothed);
+    float min_idepth = target.idepth_smoothed - sv*STEREO_EPL_VAR_FAC;
+    float max_idepth = target.idepth_smoothed + sv*STEREO_EPL_VAR_FAC;
     if(min_idepth < 0) min_idepth = 0;
     if(max_idepth > 1/MIN_DEPTH) max_idepth = 1/MIN_DEPTH;
 
@@ -367,11 +409,11 @@ bool DepthMap::observeDepthUpdate(const int &x, const int &y, const int &idx,
 
     float error = doLineStereo(
                       x,y,epx,epy,
-                      min_idepth, target->idepth_smoothed,max_idepth,
+                      min_idepth, target.idepth_smoothed,max_idepth,
                       refFrame, refFrame->image(0),
                       result_idepth, result_var, result_eplLength, stats);
 
-    float diff = result_idepth - target->idepth_smoothed;
+    float diff = result_idepth - target.idepth_smoothed;
 
 
     // if oob: (really out of bounds)
@@ -396,18 +438,19 @@ bool DepthMap::observeDepthUpdate(const int &x, const int &y, const int &idx,
                     255);	// PURPLE FOR NON-GOOD
 
 
-        target->validity_counter -= VALIDITY_COUNTER_DEC;
-        if(target->validity_counter < 0) target->validity_counter = 0;
+        target.validity_counter -= VALIDITY_COUNTER_DEC;
+        if(target.validity_counter < 0) target.validity_counter = 0;
 
 
-        target->nextStereoFrameMinID = 0;
+        target.nextStereoFrameMinID = 0;
 
-        target->idepth_var *= FAIL_VAR_INC_FAC;
-        if(target->idepth_var > MAX_VAR)
+        target.idepth_var *= FAIL_VAR_INC_FAC;
+        if(target.idepth_var > MAX_VAR)
         {
-            target->isValid = false;
-            target->blacklisted--;
+            target.isValid = false;
+            target.blacklisted--;
         }
+        currentDepthMap->set(idx, target);
         return false;
     }
 
@@ -433,15 +476,16 @@ bool DepthMap::observeDepthUpdate(const int &x, const int &y, const int &idx,
     }
 
     // if inconsistent
-    else if(DIFF_FAC_OBSERVE*diff*diff > result_var + target->idepth_var_smoothed)
+    else if(DIFF_FAC_OBSERVE*diff*diff > result_var + target.idepth_var_smoothed)
     {
         if(enablePrintDebugInfo) stats->num_observe_inconsistent++;
         if(plotStereoImages)
             debugImageHypothesisHandling.at<cv::Vec3b>(y, x) = cv::Vec3b(255,255,
                     0);	// Turkoise FOR big inconsistent
 
-        target->idepth_var *= FAIL_VAR_INC_FAC;
-        if(target->idepth_var > MAX_VAR) target->isValid = false;
+        target.idepth_var *= FAIL_VAR_INC_FAC;
+        if(target.idepth_var > MAX_VAR) target.isValid = false;
+        currentDepthMap->set(idx, target);
 
         return false;
     }
@@ -457,24 +501,24 @@ bool DepthMap::observeDepthUpdate(const int &x, const int &y, const int &idx,
 
         // do textbook ekf update:
         // increase var by a little (prediction-uncertainty)
-        float id_var = target->idepth_var*SUCC_VAR_INC_FAC;
+        float id_var = target.idepth_var*SUCC_VAR_INC_FAC;
 
         // update var with observation
         float w = result_var / (result_var + id_var);
-        float new_idepth = (1-w)*result_idepth + w*target->idepth;
-        target->idepth = UNZERO(new_idepth);
+        float new_idepth = (1-w)*result_idepth + w*target.idepth;
+        target.idepth = UNZERO(new_idepth);
 
         // variance can only decrease from observation; never increase.
         id_var = id_var * w;
-        if(id_var < target->idepth_var)
-            target->idepth_var = id_var;
+        if(id_var < target.idepth_var)
+            target.idepth_var = id_var;
 
         // increase validity!
-        target->validity_counter += VALIDITY_COUNTER_INC;
+        target.validity_counter += VALIDITY_COUNTER_INC;
         float absGrad = keyFrameMaxGradBuf[idx];
-        if(target->validity_counter > VALIDITY_COUNTER_MAX+absGrad*
+        if(target.validity_counter > VALIDITY_COUNTER_MAX+absGrad*
                 (VALIDITY_COUNTER_MAX_VARIABLE)/255.0f)
-            target->validity_counter = VALIDITY_COUNTER_MAX+absGrad*
+            target.validity_counter = VALIDITY_COUNTER_MAX+absGrad*
                                        (VALIDITY_COUNTER_MAX_VARIABLE)/255.0f;
 
         // increase Skip!
@@ -492,8 +536,9 @@ bool DepthMap::observeDepthUpdate(const int &x, const int &y, const int &idx,
                 inc *= 3;
 
 
-            target->nextStereoFrameMinID = refFrame->id() + inc;
+            target.nextStereoFrameMinID = refFrame->id() + inc;
         }
+        currentDepthMap->set(idx, target);
 
         if(plotStereoImages)
             debugImageHypothesisHandling.at<cv::Vec3b>(y, x) = cv::Vec3b(0,255,
@@ -524,13 +569,45 @@ void DepthMap::propagateDepth(Frame* new_keyframe)
     }
 
     // wipe depthmap
-    for(DepthMapPixelHypothesis* pt = otherDepthMap+width*height-1;
-            pt >= otherDepthMap; pt--)
+    otherDepthMap->clear();
+
+    for(std::vector<PropagatedHypothesis>& bin : propagationBins)
+        bin.clear();
+
+    // make sure these are built before the worker threads need them.
+    new_keyframe->maxGradients(0);
+    new_keyframe->image(0);
+
+    // reproject all hypotheses, binned by source and target band, then merge per target band.
+    threadReducer.reduce(boost::bind(&DepthMap::propagateDepthRow, this, new_keyframe,
+                                     _1, _2, _3), 0, height, propagationBandRows);
+    threadReducer.reduce(boost::bind(&DepthMap::propagateDepthMerge, this,
+                                     _1, _2, _3), 0, numPropagationBands, 1);
+
+    // swap!
+    std::swap(currentDepthMap, otherDepthMap);
+
+
+    if(enablePrintDebugInfo && printPropagationStatistics)
     {
-        pt->isValid = false;
-        pt->blacklisted = 0;
+        printf("PROPAGATE: %d: %d drop (%d oob, %d color); %d created; %d merged; %d occluded. %d col-dec, %d grad-dec.\n",
+               runningStats.num_prop_attempts,
+               runningStats.num_prop_removed_validity +
+               runningStats.num_prop_removed_out_of_bounds +
+               runningStats.num_prop_removed_colorDiff,
+               runningStats.num_prop_removed_out_of_bounds,
+               runningStats.num_prop_removed_colorDiff,
+               runningStats.num_prop_created,
+               runningStats.num_prop_merged,
+               runningStats.num_prop_occluded,
+               runningStats.num_prop_color_decreased,
+               runningStats.num_prop_grad_decreased);
     }
+}
 
+void DepthMap::propagateDepthRow(Frame* new_keyframe, int yMin, int yMax,
+                                 RunningStats* stats)
+{
     // re-usable values.
     SE3 oldToNew_SE3 = se3FromSim3(new_keyframe->pose->thisToParent_raw).inverse();
     Eigen::Vector3f trafoInv_t = oldToNew_SE3.translation().cast<float>();
@@ -546,24 +623,28 @@ void DepthMap::propagateDepth(Frame* new_keyframe)
     const float* newKFMaxGrad = new_keyframe->maxGradients(0);
     const float* newKFImageData = new_keyframe->image(0);
 
-
-
-
-
     // go through all pixels of OLD image, propagating forwards.
-    for(int y=0; y<height; y++)
-        for(int x=0; x<width; x++)
-        {
-            DepthMapPixelHypothesis* source = currentDepthMap + x + y*width;
+    for(int y=yMin; y<yMax; y++)
+    {
+        std::vector<PropagatedHypothesis>* bins = &propagationBins[(y/propagationBandRows)*
+                numPropagationBands];
 
-            if(!source->isValid)
+        for(int i=activePixelsRowStart[y]; i<activePixelsRowStart[y+1]; i++)
+        {
+            int idx = activePixels[i];
+            int x = idx-y*width;
+            if(!currentDepthMap->isValid(idx))
                 continue;
 
-            if(enablePrintDebugInfo) runningStats.num_prop_attempts++;
+            const float source_idepth_smoothed = currentDepthMap->idepth_smoothed[idx];
+            const float source_idepth_var = currentDepthMap->idepth_var[idx];
+            const int source_validity_counter = currentDepthMap->validity_counter[idx];
+
+            if(enablePrintDebugInfo) stats->num_prop_attempts++;
 
 
             Eigen::Vector3f pn = (trafoInv_R * Eigen::Vector3f(x*fxi + cxi,y*fyi + cyi,
-                                  1.0f)) / source->idepth_smoothed + trafoInv_t;
+                                  1.0f)) / source_idepth_smoothed + trafoInv_t;
 
             float new_idepth = 1.0f / pn[2];
 
@@ -574,7 +655,7 @@ void DepthMap::propagateDepth(Frame* new_keyframe)
             if(!(u_new > 2.1f && v_new > 2.1f && u_new < width-3.1f
                     && v_new < height-3.1f))
             {
-                if(enablePrintDebugInfo) runningStats.num_prop_removed_out_of_bounds++;
+                if(enablePrintDebugInfo) stats->num_prop_removed_out_of_bounds++;
                 continue;
             }
 
@@ -587,7 +668,7 @@ void DepthMap::propagateDepth(Frame* new_keyframe)
                                                                  SE3TRACKING_MIN_LEVEL)*(y >> SE3TRACKING_MIN_LEVEL)]
                         || destAbsGrad < MIN_ABS_GRAD_DECREASE)
                 {
-                    if(enablePrintDebugInfo) runningStats.num_prop_removed_colorDiff++;
+                    if(enablePrintDebugInfo) stats->num_prop_removed_colorDiff++;
                     continue;
                 }
             }
@@ -603,142 +684,334 @@ void DepthMap::propagateDepth(Frame* new_keyframe)
                                         MAX_DIFF_GRAD_MULT*destAbsGrad*destAbsGrad) > 1
                         || destAbsGrad < MIN_ABS_GRAD_DECREASE)
                 {
-                    if(enablePrintDebugInfo) runningStats.num_prop_removed_colorDiff++;
+                    if(enablePrintDebugInfo) stats->num_prop_removed_colorDiff++;
                     continue;
                 }
             }
 
-            DepthMapPixelHypothesis* targetBest = otherDepthMap +  newIDX;
-
             // large idepth = point is near = large increase in variance.
             // small idepth = point is far = small increase in variance.
-            float idepth_ratio_4 = new_idepth / source->idepth_smoothed;
+            float idepth_ratio_4 = new_idepth / source_idepth_smoothed;
             idepth_ratio_4 *= idepth_ratio_4;
             idepth_ratio_4 *= idepth_ratio_4;
 
-            float new_var =idepth_ratio_4*source->idepth_var;
+            float new_var =idepth_ratio_4*source_idepth_var;
 
+            PropagatedHypothesis p;
+            p.idx = newIDX;
+            p.idepth = new_idepth;
+            p.idepth_var = new_var;
+            p.validity_counter = source_validity_counter;
+            bins[(newIDX/width)/propagationBandRows].push_back(p);
+        }
+    }
+}
 
-            // check for occlusion
-            if(targetBest->isValid)
+void DepthMap::propagateDepthMerge(int bandMin, int bandMax, RunningStats* stats)
+{
+    // the hypotheses landing in one target band are merged in the order of their source pixels,
+    // exactly as if all were propagated one by one.
+    for(int band=bandMin; band<bandMax; band++)
+        for(int sourceBand=0; sourceBand<numPropagationBands; sourceBand++)
+            for(const PropagatedHypothesis& p :
+                    propagationBins[sourceBand*numPropagationBands + band])
             {
-                // if they occlude one another, one gets removed.
-                float diff = targetBest->idepth - new_idepth;
-                if(DIFF_FAC_PROP_MERGE*diff*diff >
-                        new_var +
-                        targetBest->idepth_var)
+                const int newIDX = p.idx;
+                const float new_idepth = p.idepth;
+                const float new_var = p.idepth_var;
+                const int source_validity_counter = p.validity_counter;
+                bool targetValid = otherDepthMap->isValid(newIDX);
+                const float target_idepth = otherDepthMap->idepth[newIDX];
+                const float target_idepth_var = otherDepthMap->idepth_var[newIDX];
+                const int target_validity_counter = otherDepthMap->validity_counter[newIDX];
+
+                // check for occlusion
+                if(targetValid)
                 {
-                    if(new_idepth < targetBest->idepth)
+                    // if they occlude one another, one gets removed.
+                    float diff = target_idepth - new_idepth;
+                    if(DIFF_FAC_PROP_MERGE*diff*diff >
+                            new_var +
+                            target_idepth_var)
                     {
-                        if(enablePrintDebugInfo) runningStats.num_prop_occluded++;
-                        continue;
-                    }
-                    else
-                    {
-                        if(enablePrintDebugInfo) runningStats.num_prop_occluded++;
-                        targetBest->isValid = false;
+                        if(new_idepth < target_idepth)
+                        {
+                            if(enablePrintDebugInfo) stats->num_prop_occluded++;
+                            continue;
+                        }
+                        else
+                        {
+                            if(enablePrintDebugInfo) stats->num_prop_occluded++;
+                            targetValid = false;
+                        }
                     }
                 }
-            }
 
 
-            if(!targetBest->isValid)
-            {
-                if(enablePrintDebugInfo) runningStats.num_prop_created++;
+                if(!targetValid)
+                {
+                    if(enablePrintDebugInfo) stats->num_prop_created++;
 
-                *targetBest = DepthMapPixelHypothesis(
-                                  new_idepth,
-                                  new_var,
-                                  source->validity_counter);
+                    otherDepthMap->set(newIDX, DepthMapPixelHypothesis(
+                                           new_idepth,
+                                           new_var,
+                                           source_validity_counter));
 
-            }
-            else
-            {
-                if(enablePrintDebugInfo) runningStats.num_prop_merged++;
+                }
+                else
+                {
+                    if(enablePrintDebugInfo) stats->num_prop_merged++;
 
-                // merge idepth ekf-style
-                float w = new_var / (targetBest->idepth_var + new_var);
-                float merged_new_idepth = w*targetBest->idepth + (1-w)*new_idepth;
+                    // merge idepth ekf-style
+                    float w = new_var / (target_idepth_var + new_var);
+                    float merged_new_idepth = w*target_idepth + (1-w)*new_idepth;
 
-                // merge validity
-                int merged_validity = source->validity_counter + targetBest->validity_counter;
-                if(merged_validity > VALIDITY_COUNTER_MAX+(VALIDITY_COUNTER_MAX_VARIABLE))
-                    merged_validity = VALIDITY_COUNTER_MAX+(VALIDITY_COUNTER_MAX_VARIABLE);
+                    // merge validity
+                    int merged_validity = source_validity_counter + target_validity_counter;
+                    if(merged_validity > VALIDITY_COUNTER_MAX+(VALIDITY_COUNTER_MAX_VARIABLE))
+                        merged_validity = VALIDITY_COUNTER_MAX+(VALIDITY_COUNTER_MAX_VARIABLE);
 
-                *targetBest = DepthMapPixelHypothesis(
-                                  merged_new_idepth,
-                                  1.0f/(1.0f/targetBest->idepth_var + 1.0f/new_var),
-                                  merged_validity);
+                    otherDepthMap->set(newIDX, DepthMapPixelHypothesis(
+                                           merged_new_idepth,
+                                           1.0f/(1.0f/target_idepth_var + 1.0f/new_var),
+                                           merged_validity));
+                }
             }
-        }
+}
 
-    // swap!
-    std::swap(currentDepthMap, otherDepthMap);
 
+// the column pass of buildRegIntegralBuffer works on tiles of this many columns.
+static const int integralTileWidth = 64;
 
-    if(enablePrintDebugInfo && printPropagationStatistics)
+// fill holes evaluates the 5x5 validity sums of up to this many consecutive pixels at once.
+static const int boxSumChunk = 64;
+
+// Kernels of the validity integral image (buildRegIntegralBuffer, regularizeDepthMapFillHoles).
+struct IntegralKernels
+{
+    /** out[i] = sum of validity_counter over the valid pixels idx .. idx+i, for i < n. */
+    void (*rowPrefix)(const DepthMapSoA* map, int idx, int n, int* out);
+    /** row[i] += above[i], for i < n. */
+    void (*addRow)(int* row, const int* above, int n);
+    /** out[i] = validity sum of the 5x5 window around pixel i, io points to the first
+      * pixel in the integral image. */
+    void (*boxSums)(const int* io, int width, int n, int* out);
+};
+
+
+static void rowPrefixScalar(const DepthMapSoA* map, int idx, int n, int* out)
+{
+    const int* counter = map->validity_counter + idx;
+    int sum = 0;
+    uint64_t valid = 0;
+    for(int i=0; i<n; i++, valid >>= 1)
     {
-        printf("PROPAGATE: %d: %d drop (%d oob, %d color); %d created; %d merged; %d occluded. %d col-dec, %d grad-dec.\n",
-               runningStats.num_prop_attempts,
-               runningStats.num_prop_removed_validity +
-               runningStats.num_prop_removed_out_of_bounds +
-               runningStats.num_prop_removed_colorDiff,
-               runningStats.num_prop_removed_out_of_bounds,
-               runningStats.num_prop_removed_colorDiff,
-               runningStats.num_prop_created,
-               runningStats.num_prop_merged,
-               runningStats.num_prop_occluded,
-               runningStats.num_prop_color_decreased,
-               runningStats.num_prop_grad_decreased);
+        if((i & 63) == 0)
+            valid = map->validBitsFrom(idx+i);
+        if(valid & 1)
+            sum += counter[i];
+        out[i] = sum;
     }
 }
 
+static void addRowScalar(int* row, const int* above, int n)
+{
+    for(int i=0; i<n; i++)
+        row[i] += above[i];
+}
+
+static void boxSumsScalar(const int* io, int width, int n, int* out)
+{
+    for(int i=0; i<n; i++)
+        out[i] = io[i+2+2*width] - io[i+2-3*width] - io[i-3+2*width] + io[i-3-3*width];
+}
+
+
+#if defined(ENABLE_SSE)
+static void rowPrefixSSE(const DepthMapSoA* map, int idx, int n, int* out)
+{
+    // lane masks for 4 validity bits.
+    static const int laneMasks[16][4] =
+    {
+        { 0, 0, 0, 0}, {-1, 0, 0, 0}, { 0,-1, 0, 0}, {-1,-1, 0, 0},
+        { 0, 0,-1, 0}, {-1, 0,-1, 0}, { 0,-1,-1, 0}, {-1,-1,-1, 0},
+        { 0, 0, 0,-1}, {-1, 0, 0,-1}, { 0,-1, 0,-1}, {-1,-1, 0,-1},
+        { 0, 0,-1,-1}, {-1, 0,-1,-1}, { 0,-1,-1,-1}, {-1,-1,-1,-1}
+    };
+
+    const int* counter = map->validity_counter + idx;
+    __m128i carry = _mm_setzero_si128();
+    uint64_t valid = 0;
+    int i=0;
+    for(; i+4 <= n; i+=4, valid >>= 4)
+    {
+        if((i & 63) == 0)
+            valid = map->validBitsFrom(idx+i);
+
+        __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i*)(counter+i)),
+                                  _mm_loadu_si128((const __m128i*)laneMasks[valid & 15]));
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+        v = _mm_add_epi32(v, carry);
+        _mm_storeu_si128((__m128i*)(out+i), v);
+        carry = _mm_shuffle_epi32(v, _MM_SHUFFLE(3,3,3,3));
+    }
+
+    int sum = _mm_cvtsi128_si32(carry);
+    for(; i<n; i++, valid >>= 1)
+    {
+        if((i & 63) == 0)
+            valid = map->validBitsFrom(idx+i);
+        if(valid & 1)
+            sum += counter[i];
+        out[i] = sum;
+    }
+}
+
+static void addRowSSE(int* row, const int* above, int n)
+{
+    int i=0;
+    for(; i+4 <= n; i+=4)
+        _mm_storeu_si128((__m128i*)(row+i), _mm_add_epi32(_mm_loadu_si128((
+                             const __m128i*)(row+i)), _mm_loadu_si128((const __m128i*)(above+i))));
+    for(; i<n; i++)
+        row[i] += above[i];
+}
+
+static void boxSumsSSE(const int* io, int width, int n, int* out)
+{
+    const int* br = io+2+2*width;
+    const int* tr = io+2-3*width;
+    const int* bl = io-3+2*width;
+    const int* tl = io-3-3*width;
+    int i=0;
+    for(; i+4 <= n; i+=4)
+    {
+        __m128i v = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(br+i)),
+                                  _mm_loadu_si128((const __m128i*)(tr+i)));
+        v = _mm_sub_epi32(v, _mm_loadu_si128((const __m128i*)(bl+i)));
+        v = _mm_add_epi32(v, _mm_loadu_si128((const __m128i*)(tl+i)));
+        _mm_storeu_si128((__m128i*)(out+i), v);
+    }
+    for(; i<n; i++)
+        out[i] = br[i] - tr[i] - bl[i] + tl[i];
+}
+
+
+TARGET_AVX2 static void addRowAVX2(int* row, const int* above, int n)
+{
+    int i=0;
+    for(; i+8 <= n; i+=8)
+        _mm256_storeu_si256((__m256i*)(row+i), _mm256_add_epi32(_mm256_loadu_si256((
+                                const __m256i*)(row+i)), _mm256_loadu_si256((const __m256i*)(above+i))));
+    for(; i<n; i++)
+        row[i] += above[i];
+}
+
+TARGET_AVX2 static void boxSumsAVX2(const int* io, int width, int n, int* out)
+{
+    const int* br = io+2+2*width;
+    const int* tr = io+2-3*width;
+    const int* bl = io-3+2*width;
+    const int* tl = io-3-3*width;
+    int i=0;
+    for(; i+8 <= n; i+=8)
+    {
+        __m256i v = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i*)(br+i)),
+                                     _mm256_loadu_si256((const __m256i*)(tr+i)));
+        v = _mm256_sub_epi32(v, _mm256_loadu_si256((const __m256i*)(bl+i)));
+        v = _mm256_add_epi32(v, _mm256_loadu_si256((const __m256i*)(tl+i)));
+        _mm256_storeu_si256((__m256i*)(out+i), v);
+    }
+    for(; i<n; i++)
+        out[i] = br[i] - tr[i] - bl[i] + tl[i];
+}
+#endif
+
+static IntegralKernels getIntegralKernels()
+{
+    IntegralKernels kernels;
+    kernels.rowPrefix = rowPrefixScalar;
+    kernels.addRow = addRowScalar;
+    kernels.boxSums = boxSumsScalar;
+
+#if defined(ENABLE_SSE)
+    // the prefix sum is a carried dependency, 8 lanes do not gain anything over 4.
+    if(simdLevel >= SIMD_AVX2)
+    {
+        kernels.rowPrefix = rowPrefixSSE;
+        kernels.addRow = addRowAVX2;
+        kernels.boxSums = boxSumsAVX2;
+    }
+    else if(USESSE)
+    {
+        kernels.rowPrefix = rowPrefixSSE;
+        kernels.addRow = addRowSSE;
+        kernels.boxSums = boxSumsSSE;
+    }
+#endif
+    return kernels;
+}
+
 
 void DepthMap::regularizeDepthMapFillHolesRow(int yMin, int yMax,
         RunningStats* stats)
 {
     // =========== regularize fill holes
     const float* keyFrameMaxGradBuf = activeKeyFrame->maxGradients(0);
+    IntegralKernels kernels = getIntegralKernels();
+
+    // 5x5 validity sums of the pixels chunkStart .. chunkStart+boxSumChunk-1 of the current row.
+    int boxSums[boxSumChunk];
 
     for(int y=yMin; y<yMax; y++)
     {
-        for(int x=3; x<width-2; x++)
+        int chunkStart = -boxSumChunk;
+        for(int i=activePixelsRowStart[y]; i<activePixelsRowStart[y+1]; i++)
         {
-            int idx = x+y*width;
-            DepthMapPixelHypothesis* dest = otherDepthMap + idx;
-            if(dest->isValid) continue;
+            int idx = activePixels[i];
+            int x = idx-y*width;
+            if(x < 3 || x >= width-2) continue;
+
+            if(otherDepthMap->isValid(idx)) continue;
             if(keyFrameMaxGradBuf[idx]<MIN_ABS_GRAD_DECREASE) continue;
 
-            int* io = validityIntegralBuffer + idx;
-            int val = io[2+2*width] - io[2-3*width] - io[-3+2*width] + io[-3-3*width];
+            if(x >= chunkStart+boxSumChunk)
+            {
+                chunkStart = x;
+                kernels.boxSums(validityIntegralBuffer + idx, width,
+                                std::min(boxSumChunk, width-2-x), boxSums);
+            }
+            int val = boxSums[x-chunkStart];
 
 
-            if((dest->blacklisted >= MIN_BLACKLIST && val > VAL_SUM_MIN_FOR_CREATE)
+            if((otherDepthMap->blacklisted[idx] >= MIN_BLACKLIST && val > VAL_SUM_MIN_FOR_CREATE)
                     || val > VAL_SUM_MIN_FOR_UNBLACKLIST)
             {
                 float sumIdepthObs = 0, sumIVarObs = 0;
                 int num = 0;
 
-                DepthMapPixelHypothesis* s1max = otherDepthMap + (x-2) + (y+3)*width;
-                for (DepthMapPixelHypothesis* s1 = otherDepthMap + (x-2) + (y-2)*width;
-                        s1 < s1max; s1+=width)
-                    for(DepthMapPixelHypothesis* source = s1; source < s1+5; source++)
+                const float* sourceIdepth = otherDepthMap->idepth;
+                const float* sourceIdepthVar = otherDepthMap->idepth_var;
+                int s1max = (x-2) + (y+3)*width;
+                for (int s1 = (x-2) + (y-2)*width; s1 < s1max; s1+=width)
+                    for(int source = s1; source < s1+5; source++)
                     {
-                        if(!source->isValid) continue;
+                        if(!otherDepthMap->isValid(source)) continue;
 
-                        sumIdepthObs += source->idepth /source->idepth_var;
-                        sumIVarObs += 1.0f/source->idepth_var;
+                        sumIdepthObs += sourceIdepth[source] /sourceIdepthVar[source];
+                        sumIVarObs += 1.0f/sourceIdepthVar[source];
                         num++;
                     }
 
                 float idepthObs = sumIdepthObs / sumIVarObs;
                 idepthObs = UNZERO(idepthObs);
 
-                currentDepthMap[idx] =
-                    DepthMapPixelHypothesis(
-                        idepthObs,
-                        VAR_RANDOM_INIT_INITIAL,
-                        0);
+                currentDepthMap->set(idx,
+                                     DepthMapPixelHypothesis(
+                                         idepthObs,
+                                         VAR_RANDOM_INIT_INITIAL,
+                                         0));
 
                 if(enablePrintDebugInfo) stats->num_reg_created++;
             }
@@ -749,13 +1022,13 @@ void DepthMap::regularizeDepthMapFillHolesRow(int yMin, int yMax,
 
 void DepthMap::regularizeDepthMapFillHoles()
 {
+    updateActivePixels();
 
     buildRegIntegralBuffer();
 
     runningStats.num_reg_created=0;
 
-    memcpy(otherDepthMap,currentDepthMap,
-           width*height*sizeof(DepthMapPixelHypothesis));
+    otherDepthMap->copyRegularizationInputFrom(*currentDepthMap);
     threadReducer.reduce(boost::bind(&DepthMap::regularizeDepthMapFillHolesRow,
                                      this, _1, _2, _3), 3, height-2, 10);
     if(enablePrintDebugInfo && printFillHolesStatistics)
@@ -768,22 +1041,24 @@ void DepthMap::regularizeDepthMapFillHoles()
 void DepthMap::buildRegIntegralBufferRow1(int yMin, int yMax,
         RunningStats* stats)
 {
-    // ============ build inegral buffers
-    int* validityIntegralBufferPT = validityIntegralBuffer+yMin*width;
-    DepthMapPixelHypothesis* ptSrc = currentDepthMap+yMin*width;
+    // ============ build inegral buffers, pass 1: prefix sums along the rows.
+    IntegralKernels kernels = getIntegralKernels();
     for(int y=yMin; y<yMax; y++)
-    {
-        int validityIntegralBufferSUM = 0;
+        kernels.rowPrefix(currentDepthMap, y*width, width,
+                          validityIntegralBuffer+y*width);
+}
 
-        for(int x=0; x<width; x++)
-        {
-            if(ptSrc->isValid)
-                validityIntegralBufferSUM += ptSrc->validity_counter;
 
-            *(validityIntegralBufferPT++) = validityIntegralBufferSUM;
-            ptSrc++;
-        }
-    }
+void DepthMap::buildRegIntegralBufferCols2(int tileMin, int tileMax,
+        RunningStats* stats)
+{
+    // pass 2: prefix sums along the columns, each tile of columns top to bottom.
+    IntegralKernels kernels = getIntegralKernels();
+    int xMin = tileMin*integralTileWidth;
+    int xMax = std::min(width, tileMax*integralTileWidth);
+    for(int y=1; y<height; y++)
+        kernels.addRow(validityIntegralBuffer + y*width + xMin,
+                       validityIntegralBuffer + (y-1)*width + xMin, xMax-xMin);
 }
 
 
@@ -792,13 +1067,9 @@ void DepthMap::buildRegIntegralBuffer()
     threadReducer.reduce(boost::bind(&DepthMap::buildRegIntegralBufferRow1, this,
                                      _1, _2,_3), 0, height);
 
-    int* validityIntegralBufferPT = validityIntegralBuffer;
-    int* validityIntegralBufferPT_T = validityIntegralBuffer+width;
-
-    int wh = height*width;
-    for(int idx=width; idx<wh; idx++)
-        *(validityIntegralBufferPT_T++) += *(validityIntegralBufferPT++);
-
+    int numTiles = (width + integralTileWidth - 1) / integralTileWidth;
+    threadReducer.reduce(boost::bind(&DepthMap::buildRegIntegralBufferCols2, this,
+                                     _1, _2,_3), 0, numTiles, 1);
 }
 
 
@@ -810,52 +1081,68 @@ template<bool removeOcclusions> void DepthMap::regularizeDepthMapRow(
 
     const float regDistVar = REG_DIST_VAR;
 
+    const DepthMapSoA* read = otherDepthMap;
+    const float* readIdepth = read->idepth;
+    const float* readIdepthVar = read->idepth_var;
+    const int* readValidity = read->validity_counter;
+
     for(int y=yMin; y<yMax; y++)
     {
-        for(int x=regularize_radius; x<width-regularize_radius; x++)
+        for(int i=activePixelsRowStart[y]; i<activePixelsRowStart[y+1]; i++)
         {
-            DepthMapPixelHypothesis* dest = currentDepthMap + x + y*width;
-            DepthMapPixelHypothesis* destRead = otherDepthMap + x + y*width;
+            int idx = activePixels[i];
+            int x = idx-y*width;
+            if(x < regularize_radius || x >= width-regularize_radius) continue;
 
             // if isValid need to do better examination and then update.
 
-            if(enablePrintDebugInfo && destRead->blacklisted < MIN_BLACKLIST)
+            if(enablePrintDebugInfo && read->blacklisted[idx] < MIN_BLACKLIST)
                 stats->num_reg_blacklisted++;
 
-            if(!destRead->isValid)
+            if(!read->isValid(idx))
                 continue;
 
+            // validity of the 5x5 neighbourhood, one row of 5 bits per dy.
+            uint32_t neighbourValid[2*regularize_radius+1];
+            for(int dy=-regularize_radius; dy<=regularize_radius; dy++)
+                neighbourValid[dy+regularize_radius] = read->validBitsFrom(idx-regularize_radius
+                                                       + dy*width);
+
+            const float destIdepth = readIdepth[idx];
+            const float destIdepthVar = readIdepthVar[idx];
+
             float sum=0, val_sum=0, sumIvar=0;//, min_varObs = 1e20;
             int numOccluding = 0, numNotOccluding = 0;
 
             for(int dx=-regularize_radius; dx<=regularize_radius; dx++)
                 for(int dy=-regularize_radius; dy<=regularize_radius; dy++)
                 {
-                    DepthMapPixelHypothesis* source = destRead + dx + dy*width;
+                    int source = idx + dx + dy*width;
 
-                    if(!source->isValid) continue;
+                    if(!((neighbourValid[dy+regularize_radius] >> (dx+regularize_radius)) & 1))
+                        continue;
 //					stats->num_reg_total++;
 
-                    float diff =source->idepth - destRead->idepth;
-                    if(DIFF_FAC_SMOOTHING*diff*diff > source->idepth_var + destRead->idepth_var)
+                    float diff =readIdepth[source] - destIdepth;
+                    if(DIFF_FAC_SMOOTHING*diff*diff > readIdepthVar[source] + destIdepthVar)
                     {
                         if(removeOcclusions)
                         {
-                            if(source->idepth > destRead->idepth)
+                            if(readIdepth[source] > destIdepth)
                                 numOccluding++;
                         }
                         continue;
                     }
 
-                    val_sum += source->validity_counter;
+                    val_sum += readValidity[source];
 
                     if(removeOcclusions)
                         numNotOccluding++;
 
                     float distFac = (float)(dx*dx+dy*dy)*regDistVar;
-                    float ivar = 1.0f/(source->idepth_var + distFac);
+                    float ivar = 1.0f/(readIdepthVar[source] + distFac);
 
-                    sum += source->idepth * ivar;
+                    sum += readIdepth[source] * ivar;
                     sumIvar += ivar;
 
 
@@ -863,9 +1150,9 @@ template<bool removeOcclusions> void DepthMap::regularizeDepthMapRow(
 
             if(val_sum < validityTH)
             {
-                dest->isValid = false;
+                currentDepthMap->setInvalid(idx);
                 if(enablePrintDebugInfo) stats->num_reg_deleted_secondary++;
-                dest->blacklisted--;
+                currentDepthMap->blacklisted[idx]--;
 
                 if(enablePrintDebugInfo) stats->num_reg_setBlacklisted++;
                 continue;
@@ -876,7 +1163,7 @@ template<bool removeOcclusions> void DepthMap::regularizeDepthMapRow(
             {
                 if(numOccluding > numNotOccluding)
                 {
-                    dest->isValid = false;
+                    currentDepthMap->setInvalid(idx);
                     if(enablePrintDebugInfo) stats->num_reg_deleted_occluded++;
 
                     continue;
@@ -888,8 +1175,8 @@ template<bool removeOcclusions> void DepthMap::regularizeDepthMapRow(
 
 
             // update!
-            dest->idepth_smoothed = sum;
-            dest->idepth_var_smoothed = 1.0f/sumIvar;
+            currentDepthMap->idepth_smoothed[idx] = sum;
+            currentDepthMap->idepth_var_smoothed[idx] = 1.0f/sumIvar;
 
             if(enablePrintDebugInfo) stats->num_reg_smeared++;
         }
@@ -910,8 +1197,9 @@ void DepthMap::regularizeDepthMap(bool removeOcclusions, int validityTH)
     runningStats.num_reg_blacklisted=0;
     runningStats.num_reg_setBlacklisted=0;
 
-    memcpy(otherDepthMap,currentDepthMap,
-           width*height*sizeof(DepthMapPixelHypothesis));
+    updateActivePixels();
+
+    otherDepthMap->copyRegularizationInputFrom(*currentDepthMap);
 
 
     if(removeOcclusions)
@@ -950,22 +1238,23 @@ void DepthMap::initializeRandomly(Frame* new_frame)
             if(maxGradients[x+y*width] > MIN_ABS_GRAD_CREATE)
             {
                 float idepth = 0.5f + 1.0f * ((rand() % 100001) / 100000.0f);
-                currentDepthMap[x+y*width] = DepthMapPixelHypothesis(
-                                                 idepth,
-                                                 idepth,
-                                                 VAR_RANDOM_INIT_INITIAL,
-                                                 VAR_RANDOM_INIT_INITIAL,
-                                                 20);
+                currentDepthMap->set(x+y*width, DepthMapPixelHypothesis(
+                                         idepth,
+                                         idepth,
+                                         VAR_RANDOM_INIT_INITIAL,
+                                         VAR_RANDOM_INIT_INITIAL,
+                                         20));
             }
             else
             {
-                currentDepthMap[x+y*width].isValid = false;
-                currentDepthMap[x+y*width].blacklisted = 0;
+                currentDepthMap->setInvalid(x+y*width);
+                currentDepthMap->blacklisted[x+y*width] = 0;
             }
         }
     }
 
 
+    buildActivePixels();
     activeKeyFrame->setDepth(currentDepthMap);
 }
 
@@ -982,7 +1271,7 @@ void DepthMap::setFromExistingKF(Frame* kf)
     const float* idepthVar = activeKeyFrame->idepthVar_reAct();
     const unsigned char* validity = activeKeyFrame->validity_reAct();
 
-    DepthMapPixelHypothesis* pt = currentDepthMap;
+    int idx = 0;
     activeKeyFrame->numMappedOnThis = 0;
     activeKeyFrame->numFramesTrackedOnThis = 0;
     activeKeyFrameImageData = activeKeyFrame->image(0);
@@ -994,25 +1283,26 @@ void DepthMap::setFromExistingKF(Frame* kf)
         {
             if(*idepthVar > 0)
             {
-                *pt = DepthMapPixelHypothesis(
-                          *idepth,
-                          *idepthVar,
-                          *validity);
+                currentDepthMap->set(idx, DepthMapPixelHypothesis(
+                                         *idepth,
+                                         *idepthVar,
+                                         *validity));
             }
             else
             {
-                currentDepthMap[x+y*width].isValid = false;
-                currentDepthMap[x+y*width].blacklisted = (*idepthVar == -2) ? MIN_BLACKLIST-1 :
-                        0;
+                currentDepthMap->setInvalid(idx);
+                currentDepthMap->blacklisted[idx] = (*idepthVar == -2) ? MIN_BLACKLIST-1 :
+                                                    0;
             }
 
             idepth++;
             idepthVar++;
             validity++;
-            pt++;
+            idx++;
         }
     }
 
+    buildActivePixels();
     regularizeDepthMap(false, VAL_SUM_MIN_FOR_KEEP);
 }
 
@@ -1053,22 +1343,23 @@ void DepthMap::initializeFromGTDepth(Frame* new_frame)
 
             if(!std::isnan(idepthValue) && idepthValue > 0)
             {
-                currentDepthMap[x+y*width] = DepthMapPixelHypothesis(
-                                                 idepthValue,
-                                                 idepthValue,
-                                                 VAR_GT_INIT_INITIAL,
-                                                 VAR_GT_INIT_INITIAL,
-                                                 20);
+                currentDepthMap->set(x+y*width, DepthMapPixelHypothesis(
+                                         idepthValue,
+                                         idepthValue,
+                                         VAR_GT_INIT_INITIAL,
+                                         VAR_GT_INIT_INITIAL,
+                                         20));
             }
             else
             {
-                currentDepthMap[x+y*width].isValid = false;
-                currentDepthMap[x+y*width].blacklisted = 0;
+                currentDepthMap->setInvalid(x+y*width);
+                currentDepthMap->blacklisted[x+y*width] = 0;
             }
         }
     }
 
 
+    buildActivePixels();
     activeKeyFrame->setDepth(currentDepthMap);
 }
 
@@ -1349,6 +1640,7 @@ void DepthMap::createKeyFrame(Frame* new_keyframe)
     activeKeyFramelock = activeKeyFrame->getActiveLock();
     activeKeyFrameImageData = new_keyframe->image(0);
     activeKeyFrameIsReactivated = false;
+    buildActivePixels();
 
 
 
@@ -1389,25 +1681,23 @@ void DepthMap::createKeyFrame(Frame* new_keyframe)
 
     // make mean inverse depth be one.
     float sumIdepth=0, numIdepth=0;
-    for(DepthMapPixelHypothesis* source = currentDepthMap;
-            source < currentDepthMap+width*height; source++)
+    for(int idx : activePixels)
     {
-        if(!source->isValid)
+        if(!currentDepthMap->isValid(idx))
             continue;
-        sumIdepth += source->idepth_smoothed;
+        sumIdepth += currentDepthMap->idepth_smoothed[idx];
         numIdepth++;
     }
     float rescaleFactor = numIdepth / sumIdepth;
     float rescaleFactor2 = rescaleFactor*rescaleFactor;
-    for(DepthMapPixelHypothesis* source = currentDepthMap;
-            source < currentDepthMap+width*height; source++)
+    for(int idx : activePixels)
     {
-        if(!source->isValid)
+        if(!currentDepthMap->isValid(idx))
             continue;
-        source->idepth *= rescaleFactor;
-        source->idepth_smoothed *= rescaleFactor;
-        source->idepth_var *= rescaleFactor2;
-        source->idepth_var_smoothed *= rescaleFactor2;
+        currentDepthMap->idepth[idx] *= rescaleFactor;
+        currentDepthMap->idepth_smoothed[idx] *= rescaleFactor;
+        currentDepthMap->idepth_var[idx] *= rescaleFactor2;
+        currentDepthMap->idepth_var_smoothed[idx] *= rescaleFactor2;
     }
     activeKeyFrame->pose->thisToParent_raw = sim3FromSE3(oldToNew_SE3.inverse(),
             rescaleFactor);
@@ -1557,12 +1847,12 @@ int DepthMap::debugPlotDepthMap()
         {
             int idx = x + y*width;
 
-            if(currentDepthMap[idx].blacklisted < MIN_BLACKLIST && debugDisplay == 2)
+            if(currentDepthMap->blacklisted[idx] < MIN_BLACKLIST && debugDisplay == 2)
                 debugImageDepth.at<cv::Vec3b>(y,x) = cv::Vec3b(0,0,255);
 
-            if(!currentDepthMap[idx].isValid) continue;
+            if(!currentDepthMap->isValid(idx)) continue;
 
-            cv::Vec3b color = currentDepthMap[idx].getVisualizationColor(refID);
+            cv::Vec3b color = currentDepthMap->get(idx).getVisualizationColor(refID);
             debugImageDepth.at<cv::Vec3b>(y,x) = color;
         }
 
@@ -1573,6 +1863,177 @@ int DepthMap::debugPlotDepthMap()
 
 
 
+// doLineStereo evaluates this many consecutive steps on the epipolar line at once.
+static const int stereoBlock = 8;
+
+// Kernels of DepthMap::doLineStereo, each for stereoBlock steps.
+struct StereoKernels
+{
+    /** out[i] = getInterpolatedElement(image, x[i], y[i], width). */
+    void (*interpolate)(const float* image, int width, const float* x,
+                        const float* y, float* out);
+    /** SSD of step i against realVals (p2, p1, 0, m1, m2) and the sum of products of its
+      * errors with those of the step before (see doLineStereo). samples holds the five samples
+      * before the block (the first one from cp-3*inc of the first step), then the ones at
+      * cp+2*inc of each step. */
+    void (*errors)(const float* samples, const float* realVals, float* errors,
+                   float* diffErrors);
+};
+
+
+static void interpolateScalar(const float* image, int width, const float* x,
+                              const float* y, float* out)
+{
+    for(int i=0; i<stereoBlock; i++)
+        out[i] = getInterpolatedElement(image, x[i], y[i], width);
+}
+
+static void stereoErrorsScalar(const float* samples, const float* realVals,
+                               float* errors, float* diffErrors)
+{
+    for(int i=0; i<stereoBlock; i++)
+    {
+        float ee = 0;
+        float diff = 0;
+        for(int k=0; k<5; k++)
+        {
+            float e = samples[i+5-k] - realVals[k];
+            float ePrev = samples[i+4-k] - realVals[k];
+            ee += e*e;
+            diff += e*ePrev;
+        }
+        errors[i] = ee;
+        diffErrors[i] = diff;
+    }
+}
+
+
+#if defined(ENABLE_SSE)
+static void interpolateSSE(const float* image, int width, const float* x,
+                           const float* y, float* out)
+{
+    __m128 one = _mm_set1_ps(1.0f);
+    for(int i=0; i<stereoBlock; i+=4)
+    {
+        __m128 px = _mm_loadu_ps(x+i);
+        __m128 py = _mm_loadu_ps(y+i);
+        __m128i ix = _mm_cvttps_epi32(px);
+        __m128i iy = _mm_cvttps_epi32(py);
+        __m128 dx = _mm_sub_ps(px, _mm_cvtepi32_ps(ix));
+        __m128 dy = _mm_sub_ps(py, _mm_cvtepi32_ps(iy));
+        __m128 dxdy = _mm_mul_ps(dx, dy);
+
+        // no 32bit multiply in SSE2, the offsets are done one by one.
+        EIGEN_ALIGN16 int ixs[4], iys[4];
+        _mm_store_si128((__m128i*)ixs, ix);
+        _mm_store_si128((__m128i*)iys, iy);
+        const float* bp0 = image + ixs[0] + iys[0]*width;
+        const float* bp1 = image + ixs[1] + iys[1]*width;
+        const float* bp2 = image + ixs[2] + iys[2]*width;
+        const float* bp3 = image + ixs[3] + iys[3]*width;
+
+        __m128 tl = _mm_setr_ps(bp0[0], bp1[0], bp2[0], bp3[0]);
+        __m128 tr = _mm_setr_ps(bp0[1], bp1[1], bp2[1], bp3[1]);
+        __m128 bl = _mm_setr_ps(bp0[width], bp1[width], bp2[width], bp3[width]);
+        __m128 br = _mm_setr_ps(bp0[width+1], bp1[width+1], bp2[width+1], bp3[width+1]);
+
+        __m128 res = _mm_mul_ps(dxdy, br);
+        res = _mm_add_ps(res, _mm_mul_ps(_mm_sub_ps(dy, dxdy), bl));
+        res = _mm_add_ps(res, _mm_mul_ps(_mm_sub_ps(dx, dxdy), tr));
+        res = _mm_add_ps(res, _mm_mul_ps(_mm_add_ps(_mm_sub_ps(_mm_sub_ps(one, dx), dy),
+                                         dxdy), tl));
+        _mm_storeu_ps(out+i, res);
+    }
+}
+
+static void stereoErrorsSSE(const float* samples, const float* realVals,
+                            float* errors, float* diffErrors)
+{
+    for(int i=0; i<stereoBlock; i+=4)
+    {
+        __m128 ee = _mm_setzero_ps();
+        __m128 diff = _mm_setzero_ps();
+        for(int k=0; k<5; k++)
+        {
+            __m128 real = _mm_set1_ps(realVals[k]);
+            __m128 e = _mm_sub_ps(_mm_loadu_ps(samples+i+5-k), real);
+            __m128 ePrev = _mm_sub_ps(_mm_loadu_ps(samples+i+4-k), real);
+            ee = _mm_add_ps(ee, _mm_mul_ps(e, e));
+            diff = _mm_add_ps(diff, _mm_mul_ps(e, ePrev));
+        }
+        _mm_storeu_ps(errors+i, ee);
+        _mm_storeu_ps(diffErrors+i, diff);
+    }
+}
+
+
+// same as the SSE kernels, all 8 steps at once and with gathers.
+TARGET_AVX2 static void interpolateAVX2(const float* image, int width,
+                                        const float* x, const float* y, float* out)
+{
+    __m256 px = _mm256_loadu_ps(x);
+    __m256 py = _mm256_loadu_ps(y);
+    __m256i ix = _mm256_cvttps_epi32(px);
+    __m256i iy = _mm256_cvttps_epi32(py);
+    __m256 dx = _mm256_sub_ps(px, _mm256_cvtepi32_ps(ix));
+    __m256 dy = _mm256_sub_ps(py, _mm256_cvtepi32_ps(iy));
+    __m256 dxdy = _mm256_mul_ps(dx, dy);
+
+    __m256i idx = _mm256_add_epi32(ix, _mm256_mullo_epi32(iy, _mm256_set1_epi32(width)));
+    __m256 tl = _mm256_i32gather_ps(image, idx, 4);
+    __m256 tr = _mm256_i32gather_ps(image+1, idx, 4);
+    __m256 bl = _mm256_i32gather_ps(image+width, idx, 4);
+    __m256 br = _mm256_i32gather_ps(image+width+1, idx, 4);
+
+    __m256 res = _mm256_mul_ps(dxdy, br);
+    res = _mm256_add_ps(res, _mm256_mul_ps(_mm256_sub_ps(dy, dxdy), bl));
+    res = _mm256_add_ps(res, _mm256_mul_ps(_mm256_sub_ps(dx, dxdy), tr));
+    res = _mm256_add_ps(res, _mm256_mul_ps(_mm256_add_ps(_mm256_sub_ps(_mm256_sub_ps(
+                                               _mm256_set1_ps(1.0f), dx), dy), dxdy), tl));
+    _mm256_storeu_ps(out, res);
+}
+
+TARGET_AVX2 static void stereoErrorsAVX2(const float* samples,
+        const float* realVals, float* errors, float* diffErrors)
+{
+    __m256 ee = _mm256_setzero_ps();
+    __m256 diff = _mm256_setzero_ps();
+    for(int k=0; k<5; k++)
+    {
+        __m256 real = _mm256_set1_ps(realVals[k]);
+        __m256 e = _mm256_sub_ps(_mm256_loadu_ps(samples+5-k), real);
+        __m256 ePrev = _mm256_sub_ps(_mm256_loadu_ps(samples+4-k), real);
+        ee = _mm256_add_ps(ee, _mm256_mul_ps(e, e));
+        diff = _mm256_add_ps(diff, _mm256_mul_ps(e, ePrev));
+    }
+    _mm256_storeu_ps(errors, ee);
+    _mm256_storeu_ps(diffErrors, diff);
+}
+#endif
+
+static StereoKernels getStereoKernels()
+{
+    StereoKernels kernels;
+    kernels.interpolate = interpolateScalar;
+    kernels.errors = stereoErrorsScalar;
+
+#if defined(ENABLE_SSE)
+    if(simdLevel >= SIMD_AVX2)
+    {
+        kernels.interpolate = interpolateAVX2;
+        kernels.errors = stereoErrorsAVX2;
+    }
+    else if(USESSE)
+    {
+        kernels.interpolate = interpolateSSE;
+        kernels.errors = stereoErrorsSSE;
+    }
+#endif
+    return kernels;
+}
+
+
+
 // find pixel in image (do stereo along epipolar line).
 // mat: NEW image
 // KinvP: point in OLD image (Kinv * (u_old, v_old, 1)), projected
@@ -1771,14 +2232,18 @@ inline float DepthMap::doLineStereo(
     float cpx = pFar[0];
     float cpy =  pFar[1];
 
-    float val_cp_m2 = getInterpolatedElement(referenceFrameImage,cpx-2*incx,
-                      cpy-2*incy, width);
-    float val_cp_m1 = getInterpolatedElement(referenceFrameImage,cpx-incx,
-                      cpy-incy, width);
-    float val_cp = getInterpolatedElement(referenceFrameImage,cpx, cpy, width);
-    float val_cp_p1 = getInterpolatedElement(referenceFrameImage,cpx+incx,
-                      cpy+incy, width);
-    float val_cp_p2;
+    // samples along the line: the five before the current block of steps (at cp-3*inc .. cp+inc
+    // of its first step), then the new one of each step (at cp+2*inc).
+    float samples[5 + stereoBlock];
+    samples[0] = NAN;	// there is no step before the first one.
+    samples[1] = getInterpolatedElement(referenceFrameImage,cpx-2*incx,
+                                        cpy-2*incy, width);
+    samples[2] = getInterpolatedElement(referenceFrameImage,cpx-incx,
+                                        cpy-incy, width);
+    samples[3] = getInterpolatedElement(referenceFrameImage,cpx, cpy, width);
+    samples[4] = getInterpolatedElement(referenceFrameImage,cpx+incx,
+                                        cpy+incy, width);
+    const float realVals[5] = {realVal_p2, realVal_p1, realVal, realVal_m1, realVal_m2};
 
 
 
@@ -1816,105 +2281,99 @@ inline float DepthMap::doLineStereo(
 
     float eeLast = -1; // final error of last comp.
 
-    // alternating intermediate vars
-    float e1A=NAN, e1B=NAN, e2A=NAN, e2B=NAN, e3A=NAN, e3B=NAN, e4A=NAN, e4B=NAN,
-          e5A=NAN, e5B=NAN;
-
     int loopCBest=-1, loopCSecond =-1;
-    while(((incx < 0) == (cpx > pClose[0]) && (incy < 0) == (cpy > pClose[1]))
-            || loopCounter == 0)
-    {
-        // interpolate one new point
-        val_cp_p2 = getInterpolatedElement(referenceFrameImage,cpx+2*incx, cpy+2*incy,
-                                           width);
-
 
-        // hacky but fast way to get error and differential error: switch buffer variables for last loop.
-        float ee = 0;
-        if(loopCounter%2==0)
+    // the steps are evaluated in blocks: first their positions (walking exactly as one
+    // step at a time), then all samples and errors at once, then the winner is picked.
+    StereoKernels kernels = getStereoKernels();
+    float stepX[stereoBlock], stepY[stereoBlock];
+    float sampleX[stereoBlock], sampleY[stereoBlock];
+    float errors[stereoBlock], diffErrors[stereoBlock];
+    while(true)
+    {
+        int numSteps = 0;
+        while(numSteps < stereoBlock
+                && (((incx < 0) == (cpx > pClose[0]) && (incy < 0) == (cpy > pClose[1]))
+                    || loopCounter + numSteps == 0))
         {
-            // calc error and accumulate sums.
-            e1A = val_cp_p2 - realVal_p2;
-            ee += e1A*e1A;
-            e2A = val_cp_p1 - realVal_p1;
-            ee += e2A*e2A;
-            e3A = val_cp - realVal;
-            ee += e3A*e3A;
-            e4A = val_cp_m1 - realVal_m1;
-            ee += e4A*e4A;
-            e5A = val_cp_m2 - realVal_m2;
-            ee += e5A*e5A;
+            stepX[numSteps] = cpx;
+            stepY[numSteps] = cpy;
+            sampleX[numSteps] = cpx+2*incx;
+            sampleY[numSteps] = cpy+2*incy;
+
+            cpx += incx;
+            cpy += incy;
+            numSteps++;
         }
-        else
+        if(numSteps == 0)
+            break;
+
+        // unused ones sample a valid position too.
+        for(int i=numSteps; i<stereoBlock; i++)
         {
-            // calc error and accumulate sums.
-            e1B = val_cp_p2 - realVal_p2;
-            ee += e1B*e1B;
-            e2B = val_cp_p1 - realVal_p1;
-            ee += e2B*e2B;
-            e3B = val_cp - realVal;
-            ee += e3B*e3B;
-            e4B = val_cp_m1 - realVal_m1;
-            ee += e4B*e4B;
-            e5B = val_cp_m2 - realVal_m2;
-            ee += e5B*e5B;
+            sampleX[i] = sampleX[0];
+            sampleY[i] = sampleY[0];
         }
 
+        kernels.interpolate(referenceFrameImage, width, sampleX, sampleY, samples+5);
+        kernels.errors(samples, realVals, errors, diffErrors);
 
-        // do I have a new winner??
-        // if so: set.
-        if(ee < best_match_err)
+        for(int i=0; i<numSteps; i++)
         {
-            // put to second-best
-            second_best_match_err=best_match_err;
-            loopCSecond = loopCBest;
-
-            // set best.
-            best_match_err = ee;
-            loopCBest = loopCounter;
-
-            best_match_errPre = eeLast;
-            best_match_DiffErrPre = e1A*e1B + e2A*e2B + e3A*e3B + e4A*e4B + e5A*e5B;
-            best_match_errPost = -1;
-            best_match_DiffErrPost = -1;
-
-            best_match_x = cpx;
-            best_match_y = cpy;
-            bestWasLastLoop = true;
-        }
-        // otherwise: the last might be the current winner, in which case i have to save these values.
-        else
-        {
-            if(bestWasLastLoop)
-            {
-                best_match_errPost = ee;
-                best_match_DiffErrPost = e1A*e1B + e2A*e2B + e3A*e3B + e4A*e4B + e5A*e5B;
-                bestWasLastLoop = false;
-            }
+            float ee = errors[i];
 
-            // collect second-best:
-            // just take the best of all that are NOT equal to current best.
-            if(ee < second_best_match_err)
+            // do I have a new winner??
+            // if so: set.
+            if(ee < best_match_err)
             {
-                second_best_match_err=ee;
-                loopCSecond = loopCounter;
+                // put to second-best
+                second_best_match_err=best_match_err;
+                loopCSecond = loopCBest;
+
+                // set best.
+                best_match_err = ee;
+                loopCBest = loopCounter;
+
+                best_match_errPre = eeLast;
+                best_match_DiffErrPre = diffErrors[i];
+                best_match_errPost = -1;
+                best_match_DiffErrPost = -1;
+
+                best_match_x = stepX[i];
+                best_match_y = stepY[i];
+                bestWasLastLoop = true;
             }
-        }
+            // otherwise: the last might be the current winner, in which case i have to save these values.
+            else
+            {
+                if(bestWasLastLoop)
+                {
+                    best_match_errPost = ee;
+                    best_match_DiffErrPost = diffErrors[i];
+                    bestWasLastLoop = false;
+                }
 
+                // collect second-best:
+                // just take the best of all that are NOT equal to current best.
+                if(ee < second_best_match_err)
+                {
+                    second_best_match_err=ee;
+                    loopCSecond = loopCounter;
+                }
+            }
 
-        // shift everything one further.
-        eeLast = ee;
-        val_cp_m2 = val_cp_m1;
-        val_cp_m1 = val_cp;
-        val_cp = val_cp_p1;
-        val_cp_p1 = val_cp_p2;
+            eeLast = ee;
+            loopCounter++;
+        }
 
-        if(enablePrintDebugInfo) stats->num_stereo_comparisons++;
+        if(enablePrintDebugInfo) stats->num_stereo_comparisons += numSteps;
 
-        cpx += incx;
-        cpy += incy;
+        if(numSteps < stereoBlock)
+            break;
 
-        loopCounter++;
+        // shift everything one block further.
+        for(int i=0; i<5; i++)
+            samples[i] = samples[numSteps+i];
     }
 
     // if error too big, will return -3, otherwise -2.
@@ -34,14 +34,14 @@ namespace lsd_slam
 
 typedef std::chrono::high_resolution_clock::time_point timepoint_t;
 
-class DepthMapPixelHypothesis;
+class DepthMapSoA;
 class Frame;
 class KeyFrameGraph;
 typedef time_t timeval;
 
 
 /**
- * Keeps a detailed depth map (consisting of DepthMapPixelHypothesis) and does
+ * Keeps a detailed depth map (DepthMapSoA, one DepthMapPixelHypothesis per pixel) and does
  * stereo comparisons and regularization to update it.
  */
 class DepthMap
@@ -125,10 +125,30 @@ private:
 
     // ============= internally used buffers for intermediate calculations etc. =============
     // for internal depth tracking, their memory is managed (created & deleted) by this object.
-    DepthMapPixelHypothesis* otherDepthMap;
-    DepthMapPixelHypothesis* currentDepthMap;
+    DepthMapSoA* otherDepthMap;
+    DepthMapSoA* currentDepthMap;
     int* validityIntegralBuffer;
 
+    // indices of all pixels of the active keyframe that can carry a hypothesis, sorted.
+    // hypotheses are only ever created on pixels with maxGradient >= minUseGrad,
+    // so this is those plus whatever was valid / blacklisted when the keyframe was set.
+    // the entries of row y are activePixels[activePixelsRowStart[y] .. activePixelsRowStart[y+1]).
+    std::vector<int> activePixels;
+    std::vector<int> activePixelsRowStart;
+    float activePixelsGradTH;
+
+    // a hypothesis of the old keyframe, reprojected into the new one by propagateDepth.
+    struct PropagatedHypothesis
+    {
+        int idx;
+        float idepth;
+        float idepth_var;
+        int validity_counter;
+    };
+    // propagateDepth works on bands of propagationBandRows rows. reprojected hypotheses are
+    // collected per (source band, target band) in propagationBins[source*numPropagationBands+target].
+    std::vector<std::vector<PropagatedHypothesis> > propagationBins;
+    int numPropagationBands;
 
 
     // ============ internal functions ==================================================
@@ -143,6 +163,8 @@ private:
 
 
     void propagateDepth(Frame* new_keyframe);
+    void propagateDepthRow(Frame* new_keyframe, int yMin, int yMax, RunningStats* stats);
+    void propagateDepthMerge(int bandMin, int bandMax, RunningStats* stats);
 
 
     void observeDepth();
@@ -162,10 +184,15 @@ private:
 
     void buildRegIntegralBuffer();
     void buildRegIntegralBufferRow1(int yMin, int yMax, RunningStats* stats);
+    void buildRegIntegralBufferCols2(int tileMin, int tileMax, RunningStats* stats);
     void regularizeDepthMapFillHoles();
     void regularizeDepthMapFillHolesRow(int yMin, int yMax, RunningStats* stats);
 
 
+    void buildActivePixels();
+    void updateActivePixels();
+
+
     void resetCounters();
 
     //float clocksPropagate, clocksPropagateKF, clocksObserve, msObserve, clocksReg1, clocksReg2, msReg1, msReg2, clocksFinalize;
@@ -0,0 +1,111 @@
+/**
+* This file is part of LSD-SLAM.
+*
+* Copyright 2013 Jakob Engel <engelj at in dot tum dot de> (Technical University of Munich)
+* For more information see <http://vision.in.tum.de/lsdslam>
+*
+* LSD-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* LSD-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with LSD-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "depth_estimation/depth_map_soa.h"
+#include <cstring>
+
+namespace lsd_slam
+{
+
+
+DepthMapSoA::DepthMapSoA(int width, int height)
+{
+    this->width = width;
+    this->height = height;
+    numWords = (width*height + 63) / 64;
+
+    // one block for all seven 4-byte planes, each starting on a 64 byte boundary.
+    int stride = ((width*height + 15) / 16) * 16;
+    block = new char[7*4*stride + 64];
+    char* aligned = (char*)(((uintptr_t)block + 63) & ~(uintptr_t)63);
+
+    blacklisted = (int*)aligned;
+    nextStereoFrameMinID = (float*)(blacklisted + stride);
+    validity_counter = (int*)(nextStereoFrameMinID + stride);
+    idepth = (float*)(validity_counter + stride);
+    idepth_var = idepth + stride;
+    idepth_smoothed = idepth_var + stride;
+    idepth_var_smoothed = idepth_smoothed + stride;
+
+    validBits = new std::atomic<uint64_t>[numWords];
+
+    clear();
+}
+
+DepthMapSoA::~DepthMapSoA()
+{
+    delete[] validBits;
+    delete[] block;
+}
+
+DepthMapPixelHypothesis DepthMapSoA::get(int idx) const
+{
+    DepthMapPixelHypothesis h;
+    h.isValid = isValid(idx);
+    h.blacklisted = blacklisted[idx];
+    h.nextStereoFrameMinID = nextStereoFrameMinID[idx];
+    h.validity_counter = validity_counter[idx];
+    h.idepth = idepth[idx];
+    h.idepth_var = idepth_var[idx];
+    h.idepth_smoothed = idepth_smoothed[idx];
+    h.idepth_var_smoothed = idepth_var_smoothed[idx];
+    return h;
+}
+
+void DepthMapSoA::set(int idx, const DepthMapPixelHypothesis& h)
+{
+    if(h.isValid)
+        setValid(idx);
+    else
+        setInvalid(idx);
+    blacklisted[idx] = h.blacklisted;
+    nextStereoFrameMinID[idx] = h.nextStereoFrameMinID;
+    validity_counter[idx] = h.validity_counter;
+    idepth[idx] = h.idepth;
+    idepth_var[idx] = h.idepth_var;
+    idepth_smoothed[idx] = h.idepth_smoothed;
+    idepth_var_smoothed[idx] = h.idepth_var_smoothed;
+}
+
+void DepthMapSoA::invalidateAll()
+{
+    for(int i=0; i<numWords; i++)
+        validBits[i].store(0, std::memory_order_relaxed);
+}
+
+void DepthMapSoA::clear()
+{
+    invalidateAll();
+    memset(blacklisted, 0, sizeof(int)*width*height);
+}
+
+void DepthMapSoA::copyRegularizationInputFrom(const DepthMapSoA& other)
+{
+    for(int i=0; i<numWords; i++)
+        validBits[i].store(other.validWord(i), std::memory_order_relaxed);
+
+    int n = width*height;
+    memcpy(blacklisted, other.blacklisted, sizeof(int)*n);
+    memcpy(validity_counter, other.validity_counter, sizeof(int)*n);
+    memcpy(idepth, other.idepth, sizeof(float)*n);
+    memcpy(idepth_var, other.idepth_var, sizeof(float)*n);
+}
+
+}
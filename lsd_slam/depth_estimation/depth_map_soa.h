@@ -0,0 +1,112 @@
+/**
+* This file is part of LSD-SLAM.
+*
+* Copyright 2013 Jakob Engel <engelj at in dot tum dot de> (Technical University of Munich)
+* For more information see <http://vision.in.tum.de/lsdslam>
+*
+* LSD-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* LSD-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with LSD-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include "depth_estimation/depth_map_pixel_hypothesis.h"
+
+
+namespace lsd_slam
+{
+
+/**
+ * Full-resolution map of DepthMapPixelHypothesis in structure-of-arrays layout:
+ * one bit per pixel for isValid, and one plane per other member.
+ *
+ * All planes are 64-byte aligned. Values in a plane are only meaningful where
+ * the pixel is valid (blacklisted: always).
+ *
+ * Rows are processed by different threads, and one 64 bit validity word can
+ * span two rows, so setValid / setInvalid are atomic; isValid is a plain
+ * (relaxed) load.
+ */
+class DepthMapSoA
+{
+public:
+    DepthMapSoA(int width, int height);
+    DepthMapSoA(const DepthMapSoA&) = delete;
+    DepthMapSoA& operator=(const DepthMapSoA&) = delete;
+    ~DepthMapSoA();
+
+    inline bool isValid(int idx) const
+    {
+        return (validBits[idx >> 6].load(std::memory_order_relaxed) >> (idx & 63)) & 1;
+    }
+    inline void setValid(int idx)
+    {
+        validBits[idx >> 6].fetch_or((uint64_t)1 << (idx & 63), std::memory_order_relaxed);
+    }
+    inline void setInvalid(int idx)
+    {
+        validBits[idx >> 6].fetch_and(~((uint64_t)1 << (idx & 63)), std::memory_order_relaxed);
+    }
+
+    /** the 64 validity bits of pixels [64*word, 64*word+64). */
+    inline uint64_t validWord(int word) const
+    {
+        return validBits[word].load(std::memory_order_relaxed);
+    }
+
+    /** the validity bits of pixels [idx, idx+64), bit i is pixel idx+i. */
+    inline uint64_t validBitsFrom(int idx) const
+    {
+        int word = idx >> 6;
+        int shift = idx & 63;
+        uint64_t bits = validWord(word) >> shift;
+        if(shift != 0 && word+1 < numWords)
+            bits |= validWord(word+1) << (64-shift);
+        return bits;
+    }
+
+    /** per-pixel access, for code that works on whole hypotheses. */
+    DepthMapPixelHypothesis get(int idx) const;
+    void set(int idx, const DepthMapPixelHypothesis& h);
+
+    /** sets all pixels invalid, keeps blacklisted. */
+    void invalidateAll();
+
+    /** sets all pixels invalid and not blacklisted. */
+    void clear();
+
+    /**
+     * copies what the regularization reads from its snapshot of the map:
+     * validity, blacklisted, validity_counter, idepth and idepth_var.
+     */
+    void copyRegularizationInputFrom(const DepthMapSoA& other);
+
+
+    int* blacklisted;
+    float* nextStereoFrameMinID;
+    int* validity_counter;
+    float* idepth;
+    float* idepth_var;
+    float* idepth_smoothed;
+    float* idepth_var_smoothed;
+
+    int width, height;
+    int numWords;
+
+private:
+    std::atomic<uint64_t>* validBits;
+    char* block;
+};
+
+}
@@ -42,52 +42,21 @@ VertexSim3::VertexSim3() : g2o::BaseVertex<7, Sophus::Sim3d>()
 
 bool VertexSim3::write(std::ostream& os) const
 {
-    // TODO
-    assert(false);
-    return false;
-//     Sim3 cam2world(estimate().inverse());
-//     Vector7d lv=cam2world.log();
-//     for (int i=0; i<7; i++){
-//       os << lv[i] << " ";
-//     }
-//     for (int i=0; i<2; i++)
-//     {
-//       os << _focal_length[i] << " ";
-//     }
-//     for (int i=0; i<2; i++)
-//     {
-//       os << _principle_point[i] << " ";
-//     }
-//     return os.good();
+    // the estimate (camToWorld) as its 7 log parameters.
+    g2o::Vector7d lv = estimate().log();
+    for (int i=0; i<7; i++)
+        os << lv[i] << " ";
+    return os.good();
 }
 
 bool VertexSim3::read(std::istream& is)
 {
-    // TODO
-    assert(false);
-    return false;
-//     Vector7d cam2world;
-//     for (int i=0; i<6; i++){
-//       is >> cam2world[i];
-//     }
-//     is >> cam2world[6];
-// //    if (! is) {
-// //      // if the scale is not specified we set it to 1;
-// //      std::cerr << "!s";
-// //      cam2world[6]=0.;
-// //    }
-//
-//     for (int i=0; i<2; i++)
-//     {
-//       is >> _focal_length[i];
-//     }
-//     for (int i=0; i<2; i++)
-//     {
-//       is >> _principle_point[i];
-//     }
-//
-//     setEstimate(Sim3(cam2world).inverse());
-//     return true;
+    g2o::Vector7d lv;
+    for (int i=0; i<7; i++)
+        is >> lv[i];
+
+    setEstimate(Sophus::Sim3d::exp(lv));
+    return !is.fail();
 }
 
 
@@ -98,42 +67,31 @@ EdgeSim3::EdgeSim3() :
 
 bool EdgeSim3::write(std::ostream& os) const
 {
-    // TODO
-    assert(false);
-    return false;
-//     Sim3 cam2world(measurement().inverse());
-//     Vector7d v7 = cam2world.log();
-//     for (int i=0; i<7; i++)
-//     {
-//       os  << v7[i] << " ";
-//     }
-//     for (int i=0; i<7; i++)
-//       for (int j=i; j<7; j++){
-//         os << " " <<  information()(i,j);
-//     }
-//     return os.good();
+    // the measurement as its 7 log parameters, then the upper triangle of the information.
+    g2o::Vector7d v7 = measurement().log();
+    for (int i=0; i<7; i++)
+        os << v7[i] << " ";
+    for (int i=0; i<7; i++)
+        for (int j=i; j<7; j++)
+            os << " " << information()(i,j);
+    return os.good();
 }
 
 bool EdgeSim3::read(std::istream& is)
 {
-    // TODO
-    assert(false);
-    return false;
-//     Vector7d v7;
-//     for (int i=0; i<7; i++){
-//       is >> v7[i];
-//     }
-//
-//     Sim3 cam2world(v7);
-//     setMeasurement(cam2world.inverse());
-//
-//     for (int i=0; i<7; i++)
-//       for (int j=i; j<7; j++)
-//       {
-//         is >> information()(i,j);
-//         if (i!=j)
-//           information()(j,i)=information()(i,j);
-//       }
-//     return true;
+    g2o::Vector7d v7;
+    for (int i=0; i<7; i++)
+        is >> v7[i];
+
+    setMeasurement(Sophus::Sim3d::exp(v7));
+
+    for (int i=0; i<7; i++)
+        for (int j=i; j<7; j++)
+        {
+            is >> information()(i,j);
+            if (i!=j)
+                information()(j,i)=information()(i,j);
+        }
+    return !is.fail();
 }
 }
@@ -24,6 +24,12 @@
 #include <g2o/core/sparse_optimizer.h>
 #include <g2o/solvers/pcg/linear_solver_pcg.h>
 #include <g2o/solvers/csparse/linear_solver_csparse.h>
+#ifdef HAVE_SOLVER_CHOLMOD
+#include <g2o/solvers/cholmod/linear_solver_cholmod.h>
+#endif
+#ifdef HAVE_SOLVER_EIGEN
+#include <g2o/solvers/eigen/linear_solver_eigen.h>
+#endif
 #include <g2o/core/block_solver.h>
 #include <g2o/core/solver.h>
 #include <g2o/core/optimization_algorithm_dogleg.h>
@@ -36,6 +42,8 @@
 
 #include <g2o/types/sim3/sim3.h>
 #include "global_mapping/g2o_type_sim3_sophus.h"
+#include "global_mapping/key_frame_map_file.h"
+#include "util/mapped_file.h"
 
 
 #include "io_wrapper/image_display.h"
@@ -49,6 +57,14 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <cstring>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "util/global_funcs.h"
 #include "util/snprintf.h"
@@ -63,28 +79,179 @@ KFConstraintStruct::~KFConstraintStruct()
         delete edge;
 }
 
-KeyFrameGraph::KeyFrameGraph()
-    : nextEdgeId(0)
+template<typename LinearSolver>
+static g2o::OptimizationAlgorithm* createLevenberg(LinearSolver* solver)
 {
     typedef g2o::BlockSolver_7_3 BlockSolver;
-    typedef g2o::LinearSolverCSparse<BlockSolver::PoseMatrixType> LinearSolver;
-    //typedef g2o::LinearSolverPCG<BlockSolver::PoseMatrixType> LinearSolver;
-    LinearSolver* solver = new LinearSolver();
     BlockSolver* blockSolver = new BlockSolver(solver);
     g2o::OptimizationAlgorithmLevenberg* algorithm = new
     g2o::OptimizationAlgorithmLevenberg(blockSolver);
-    graph.setAlgorithm(algorithm);
 
-    graph.setVerbose(false); // printOptimizationInfo
     solver->setWriteDebug(true);
     blockSolver->setWriteDebug(true);
     algorithm->setWriteDebug(true);
+    return algorithm;
+}
+
+bool poseGraphSolverAvailable(PoseGraphSolver solver)
+{
+    switch(solver)
+    {
+    case POSE_GRAPH_SOLVER_CHOLMOD:
+#ifdef HAVE_SOLVER_CHOLMOD
+        return true;
+#else
+        return false;
+#endif
+    case POSE_GRAPH_SOLVER_EIGEN:
+#ifdef HAVE_SOLVER_EIGEN
+        return true;
+#else
+        return false;
+#endif
+    default:
+        return true;
+    }
+}
+
+g2o::OptimizationAlgorithm* createPoseGraphAlgorithm(PoseGraphSolver solver)
+{
+    typedef g2o::BlockSolver_7_3::PoseMatrixType PoseMatrixType;
+
+    switch(solver)
+    {
+#ifdef HAVE_SOLVER_CHOLMOD
+    case POSE_GRAPH_SOLVER_CHOLMOD:
+        return createLevenberg(new g2o::LinearSolverCholmod<PoseMatrixType>());
+#endif
+#ifdef HAVE_SOLVER_EIGEN
+    case POSE_GRAPH_SOLVER_EIGEN:
+        return createLevenberg(new g2o::LinearSolverEigen<PoseMatrixType>());
+#endif
+    case POSE_GRAPH_SOLVER_PCG:
+        return createLevenberg(new g2o::LinearSolverPCG<PoseMatrixType>());
+    default:
+        if(solver != POSE_GRAPH_SOLVER_CSPARSE)
+            printf("Warning: pose-graph solver %d not compiled in, using CSparse.\n", (int)solver);
+        return createLevenberg(new g2o::LinearSolverCSparse<PoseMatrixType>());
+    }
+}
+
+bool loadPoseGraph(const std::string& filename, g2o::SparseOptimizer& optimizer)
+{
+    std::ifstream file(filename);
+    if(!file.is_open())
+    {
+        printf("could not open pose graph %s\n", filename.c_str());
+        return false;
+    }
+
+    int nextEdgeId = 0;
+    std::string line;
+    while(std::getline(file, line))
+    {
+        std::istringstream is(line);
+        std::string tag;
+        is >> tag;
+
+        if(tag == "VERTEX_SIM3_SOPHUS")
+        {
+            int id;
+            is >> id;
+            VertexSim3* vertex = new VertexSim3();
+            vertex->setId(id);
+            vertex->setMarginalized(false);
+            if(!vertex->read(is) || !optimizer.addVertex(vertex))
+            {
+                delete vertex;
+                return false;
+            }
+        }
+        else if(tag == "FIX")
+        {
+            int id;
+            is >> id;
+            g2o::OptimizableGraph::Vertex* vertex =
+                static_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id));
+            if(vertex == 0)
+                return false;
+            vertex->setFixed(true);
+        }
+        else if(tag == "EDGE_SIM3_SOPHUS")
+        {
+            int id1, id2;
+            float huberDelta;
+            is >> id1 >> id2 >> huberDelta;
+            g2o::HyperGraph::Vertex* v1 = optimizer.vertex(id1);
+            g2o::HyperGraph::Vertex* v2 = optimizer.vertex(id2);
+            if(v1 == 0 || v2 == 0)
+                return false;
+
+            EdgeSim3* edge = new EdgeSim3();
+            edge->setId(nextEdgeId++);
+            edge->resize(2);
+            edge->setVertex(0, v1);
+            edge->setVertex(1, v2);
+            if(huberDelta > 0)
+            {
+                g2o::RobustKernelHuber* kernel = new g2o::RobustKernelHuber();
+                kernel->setDelta(huberDelta);
+                edge->setRobustKernel(kernel);
+            }
+            if(!edge->read(is) || !optimizer.addEdge(edge))
+            {
+                delete edge;
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static void packSim3(const Sophus::Sim3d& sim3, double* out)
+{
+    Eigen::Map<Eigen::Vector4d> quaternion(out);
+    Eigen::Map<Eigen::Vector3d> translation(out+4);
+    quaternion = sim3.quaternion().coeffs();
+    translation = sim3.translation();
+}
+
+static Sophus::Sim3d unpackSim3(const double* in)
+{
+    return Sophus::Sim3d(Sophus::RxSO3d(Eigen::Quaterniond(in[3], in[0], in[1], in[2])),
+                         Eigen::Vector3d(in[4], in[5], in[6]));
+}
+
+// appends data to the map file, starting at the next aligned position. returns its offset.
+static uint64_t writeMapArray(std::ofstream& file, const void* data, size_t bytes)
+{
+    static const char zeros[KEYFRAME_MAP_ALIGNMENT] = {0};
+
+    uint64_t pos = file.tellp();
+    uint64_t padding = (KEYFRAME_MAP_ALIGNMENT - pos % KEYFRAME_MAP_ALIGNMENT) %
+                       KEYFRAME_MAP_ALIGNMENT;
+    file.write(zeros, padding);
+    file.write(static_cast<const char*>(data), bytes);
+    return pos + padding;
+}
+
+KeyFrameGraph::KeyFrameGraph()
+    : nextEdgeId(0)
+{
+    graph.setAlgorithm(createPoseGraphAlgorithm(poseGraphSolver));
+    graph.setVerbose(false); // printOptimizationInfo
 
 
     totalPoints=0;
     totalEdges=0;
     totalVertices=0;
 
+    optimizedFullGraph = true;
+    needFullOptimization = true;
+    needInitialization = true;
+    hessianStructureBuilt = false;
+    msLastInitialization = msLastSolve = 0;
 
 }
 
@@ -241,9 +408,345 @@ void KeyFrameGraph::dumpMap(std::string folder)
     fle << usedPixels;
     fle.close();
 
+    savePoseGraph(folder+"/poseGraph.txt");
+
     printf("DUMP MAP: dumped %d edges\n", (int)edgesAll.size());
 }
 
+void KeyFrameGraph::savePoseGraph(std::string filename)
+{
+    std::ofstream fle(filename);
+    fle << std::setprecision(17);
+
+    keyframesAllMutex.lock_shared();
+    for(Frame* keyframe : keyframesAll)
+    {
+        VertexSim3* vertex = keyframe->pose->graphVertex;
+        if(vertex == nullptr)
+            continue;
+
+        fle << "VERTEX_SIM3_SOPHUS " << vertex->id() << " ";
+        vertex->write(fle);
+        fle << "\n";
+        if(vertex->fixed())
+            fle << "FIX " << vertex->id() << "\n";
+    }
+    keyframesAllMutex.unlock_shared();
+
+    edgesListsMutex.lock_shared();
+    for(KFConstraintStruct* e : edgesAll)
+    {
+        if(e->firstFrame->pose->graphVertex == nullptr
+                || e->secondFrame->pose->graphVertex == nullptr)
+            continue;
+
+        fle << "EDGE_SIM3_SOPHUS " << e->firstFrame->id() << " " << e->secondFrame->id()
+            << " " << (e->robustKernel != 0 ? e->robustKernel->delta() : 0) << " ";
+        e->edge->write(fle);
+        fle << "\n";
+    }
+    edgesListsMutex.unlock_shared();
+
+    fle.close();
+}
+
+bool KeyFrameGraph::saveMap(std::string filename)
+{
+    std::chrono::high_resolution_clock::time_point tv_start =
+        std::chrono::high_resolution_clock::now();
+
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if(!file.is_open())
+    {
+        printf("SAVE MAP: could not open %s\n", filename.c_str());
+        return false;
+    }
+
+    KeyFrameMapHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, KEYFRAME_MAP_MAGIC, sizeof(header.magic));
+    header.version = KEYFRAME_MAP_VERSION;
+    header.headerSize = sizeof(KeyFrameMapHeader);
+    header.keyFrameSize = sizeof(KeyFrameMapKeyFrame);
+    header.edgeSize = sizeof(KeyFrameMapEdge);
+
+    // placeholder, rewritten once the tables are written.
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    std::vector<KeyFrameMapKeyFrame> keyframes;
+    std::unordered_set<Frame*> savedKeyframes;
+
+    keyframesAllMutex.lock_shared();
+    for(Frame* keyframe : keyframesAll)
+    {
+        boost::shared_lock<boost::shared_mutex> lock = keyframe->getActiveLock();
+
+        // without re-activation data, the keyframe could not be used after loading.
+        if(!keyframe->hasIDepthBeenSet() || keyframe->validity_reAct() == 0)
+            continue;
+
+        if(keyframes.empty())
+        {
+            header.width = keyframe->width();
+            header.height = keyframe->height();
+            Eigen::Map<Eigen::Matrix<float, 3, 3, Eigen::RowMajor> > K(header.K);
+            K = keyframe->K();
+        }
+        int size = keyframe->width()*keyframe->height();
+
+        KeyFrameMapKeyFrame record;
+        memset(&record, 0, sizeof(record));
+        record.id = keyframe->id();
+        record.trackingParentId = keyframe->hasTrackingParent() ?
+                                  keyframe->pose->trackingParent->frameID : -1;
+        record.timestamp = keyframe->timestamp();
+        packSim3(keyframe->getScaledCamToWorld().cast<double>(), record.camToWorld);
+        record.numFramesTrackedOnThis = keyframe->numFramesTrackedOnThis;
+        record.numMappedOnThisTotal = keyframe->numMappedOnThisTotal;
+
+        record.image = writeMapArray(file, keyframe->image(0), size*sizeof(float));
+        record.idepth = writeMapArray(file, keyframe->idepth(0), size*sizeof(float));
+        record.idepthVar = writeMapArray(file, keyframe->idepthVar(0), size*sizeof(float));
+        record.idepth_reAct = writeMapArray(file, keyframe->idepth_reAct(), size*sizeof(float));
+        record.idepthVar_reAct = writeMapArray(file, keyframe->idepthVar_reAct(),
+                                               size*sizeof(float));
+        record.validity_reAct = writeMapArray(file, keyframe->validity_reAct(), size);
+
+        keyframe->permaRef_mutex.lock();
+        const PointCloudSoA& permaRef = keyframe->permaRef_pointData;
+        const float* permaRefArrays[5] = {permaRef.x, permaRef.y, permaRef.z, permaRef.color, permaRef.var};
+        record.numPermaRef = permaRef.num;
+        for(int i=0; i<5; i++)
+            record.permaRef[i] = writeMapArray(file, permaRefArrays[i], permaRef.num*sizeof(float));
+        keyframe->permaRef_mutex.unlock();
+
+        keyframes.push_back(record);
+        savedKeyframes.insert(keyframe);
+    }
+    keyframesAllMutex.unlock_shared();
+
+    std::vector<KeyFrameMapEdge> edges;
+    edgesListsMutex.lock_shared();
+    for(KFConstraintStruct* e : edgesAll)
+    {
+        if(savedKeyframes.count(e->firstFrame) == 0 || savedKeyframes.count(e->secondFrame) == 0)
+            continue;
+
+        KeyFrameMapEdge record;
+        memset(&record, 0, sizeof(record));
+        record.firstId = e->firstFrame->id();
+        record.secondId = e->secondFrame->id();
+        packSim3(e->secondToFirst, record.secondToFirst);
+        Eigen::Map<Eigen::Matrix<double, 7, 7, Eigen::RowMajor> > information(record.information);
+        information = e->information;
+        record.huberDelta = e->robustKernel != 0 ? e->robustKernel->delta() : 0;
+        record.usage = e->usage;
+        record.meanResidual = e->meanResidual;
+        record.meanResidualD = e->meanResidualD;
+        record.meanResidualP = e->meanResidualP;
+        record.reciprocalConsistency = e->reciprocalConsistency;
+        edges.push_back(record);
+    }
+    edgesListsMutex.unlock_shared();
+
+    header.numKeyFrames = keyframes.size();
+    header.keyFramesOffset = writeMapArray(file, keyframes.data(),
+                                           keyframes.size()*sizeof(KeyFrameMapKeyFrame));
+    header.numEdges = edges.size();
+    header.edgesOffset = writeMapArray(file, edges.data(), edges.size()*sizeof(KeyFrameMapEdge));
+    header.fileSize = file.tellp();
+
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.close();
+
+    if(file.fail())
+    {
+        printf("SAVE MAP: failed writing %s\n", filename.c_str());
+        return false;
+    }
+
+    std::chrono::high_resolution_clock::time_point tv_end =
+        std::chrono::high_resolution_clock::now();
+    printf("SAVE MAP: saved %d keyframes and %d constraints to %s (%.1fms)\n",
+           (int)keyframes.size(), (int)edges.size(), filename.c_str(),
+           std::chrono::duration_cast<std::chrono::microseconds>(tv_end - tv_start).count() / 1000.0f);
+    return true;
+}
+
+bool KeyFrameGraph::loadMap(std::string filename, int width, int height,
+                            const Eigen::Matrix3f& K, std::vector<Frame*>& loadedKeyFrames)
+{
+    std::chrono::high_resolution_clock::time_point tv_start =
+        std::chrono::high_resolution_clock::now();
+
+    MappedFile file;
+    if(!file.open(filename))
+    {
+        printf("LOAD MAP: could not open %s\n", filename.c_str());
+        return false;
+    }
+
+    const KeyFrameMapHeader* header = file.at<KeyFrameMapHeader>(0);
+    if(header == 0 || memcmp(header->magic, KEYFRAME_MAP_MAGIC, sizeof(header->magic)) != 0
+            || header->version != KEYFRAME_MAP_VERSION
+            || header->headerSize != sizeof(KeyFrameMapHeader)
+            || header->keyFrameSize != sizeof(KeyFrameMapKeyFrame)
+            || header->edgeSize != sizeof(KeyFrameMapEdge)
+            || header->fileSize != file.size())
+    {
+        printf("LOAD MAP: %s is no map of version %d (or it was truncated)!\n",
+               filename.c_str(), KEYFRAME_MAP_VERSION);
+        return false;
+    }
+
+    if(header->width != width || header->height != height)
+    {
+        printf("LOAD MAP: the map has images of %dx%d, not %dx%d!\n",
+               header->width, header->height, width, height);
+        return false;
+    }
+    if(!Eigen::Map<const Eigen::Matrix<float, 3, 3, Eigen::RowMajor> >(header->K).isApprox(K, 1e-4f))
+        printf("LOAD MAP: WARNING: the map was made with different camera intrinsics!\n");
+
+    const KeyFrameMapKeyFrame* records = file.at<KeyFrameMapKeyFrame>(header->keyFramesOffset,
+                                         header->numKeyFrames);
+    const KeyFrameMapEdge* edgeRecords = file.at<KeyFrameMapEdge>(header->edgesOffset,
+                                         header->numEdges);
+    if(records == 0 || edgeRecords == 0)
+    {
+        printf("LOAD MAP: %s is corrupt!\n", filename.c_str());
+        return false;
+    }
+
+
+    // create all keyframes first, nothing is added to the graph unless the whole map is valid.
+    int size = width*height;
+    std::vector< std::shared_ptr<Frame> > keyframes;
+    std::unordered_map<int, Frame*> keyframeById;
+    for(unsigned int i=0; i<header->numKeyFrames; i++)
+    {
+        const KeyFrameMapKeyFrame& record = records[i];
+
+        const float* image = file.at<float>(record.image, size);
+        const float* idepth = file.at<float>(record.idepth, size);
+        const float* idepthVar = file.at<float>(record.idepthVar, size);
+        const float* idepth_reAct = file.at<float>(record.idepth_reAct, size);
+        const float* idepthVar_reAct = file.at<float>(record.idepthVar_reAct, size);
+        const unsigned char* validity_reAct = file.at<unsigned char>(record.validity_reAct, size);
+
+        bool valid = image != 0 && idepth != 0 && idepthVar != 0 && idepth_reAct != 0
+                     && idepthVar_reAct != 0 && validity_reAct != 0
+                     && record.numPermaRef >= 0 && keyframeById.count(record.id) == 0;
+        const float* permaRef[5];
+        for(int j=0; j<5; j++)
+        {
+            permaRef[j] = file.at<float>(record.permaRef[j], record.numPermaRef);
+            valid = valid && permaRef[j] != 0;
+        }
+        if(!valid)
+        {
+            printf("LOAD MAP: keyframe %d in %s is corrupt!\n", i, filename.c_str());
+            return false;
+        }
+
+        std::shared_ptr<Frame> keyframe(new Frame(record.id, width, height, K,
+                                        record.timestamp, image));
+        keyframe->setDepthFromMap(idepth, idepthVar, idepth_reAct, idepthVar_reAct,
+                                  validity_reAct);
+        keyframe->numFramesTrackedOnThis = record.numFramesTrackedOnThis;
+        keyframe->numMappedOnThisTotal = record.numMappedOnThisTotal;
+
+        PointCloudSoA& permaRefData = keyframe->permaRef_pointData;
+        permaRefData.reserve(record.numPermaRef);
+        float* permaRefArrays[5] = {permaRefData.x, permaRefData.y, permaRefData.z, permaRefData.color, permaRefData.var};
+        for(int j=0; j<5; j++)
+            memcpy(permaRefArrays[j], permaRef[j], record.numPermaRef*sizeof(float));
+        permaRefData.setNum(record.numPermaRef);
+
+        keyframes.push_back(keyframe);
+        keyframeById[record.id] = keyframe.get();
+    }
+
+    for(unsigned int i=0; i<header->numEdges; i++)
+    {
+        if(keyframeById.count(edgeRecords[i].firstId) == 0
+                || keyframeById.count(edgeRecords[i].secondId) == 0)
+        {
+            printf("LOAD MAP: constraint %d in %s connects unknown keyframes!\n", i,
+                   filename.c_str());
+            return false;
+        }
+    }
+
+
+    // poses are restored as they were optimized, not re-chained from the tracking parents.
+    for(unsigned int i=0; i<keyframes.size(); i++)
+    {
+        Frame* keyframe = keyframes[i].get();
+        auto parent = keyframeById.find(records[i].trackingParentId);
+        if(parent != keyframeById.end() && parent->second != keyframe)
+            keyframe->pose->trackingParent = parent->second->pose;
+
+        Sim3 camToWorld = toSophus(unpackSim3(records[i].camToWorld));
+        keyframe->pose->setOptimizedCamToWorld(camToWorld);
+        keyframe->lastConstraintTrackedCamToWorld = camToWorld;
+    }
+
+    idToKeyFrameMutex.lock();
+    for(const std::shared_ptr<Frame>& keyframe : keyframes)
+        idToKeyFrame.insert(std::make_pair(keyframe->id(), keyframe));
+    idToKeyFrameMutex.unlock();
+
+    keyframesAllMutex.lock();
+    for(const std::shared_ptr<Frame>& keyframe : keyframes)
+    {
+        keyframe->idxInKeyframes = keyframesAll.size();
+        keyframesAll.push_back(keyframe.get());
+        totalPoints += keyframe->numPoints;
+        totalVertices ++;
+    }
+    keyframesAllMutex.unlock();
+
+    for(const std::shared_ptr<Frame>& keyframe : keyframes)
+    {
+        addFrame(keyframe.get());
+        addKeyFrame(keyframe.get());
+        loadedKeyFrames.push_back(keyframe.get());
+    }
+
+    for(unsigned int i=0; i<header->numEdges; i++)
+    {
+        const KeyFrameMapEdge& record = edgeRecords[i];
+
+        KFConstraintStruct* e = new KFConstraintStruct();
+        e->firstFrame = keyframeById[record.firstId];
+        e->secondFrame = keyframeById[record.secondId];
+        e->secondToFirst = unpackSim3(record.secondToFirst);
+        e->information = Eigen::Map<const Eigen::Matrix<double, 7, 7, Eigen::RowMajor> >
+                         (record.information);
+        if(record.huberDelta > 0)
+        {
+            e->robustKernel = new g2o::RobustKernelHuber();
+            e->robustKernel->setDelta(record.huberDelta);
+        }
+        e->usage = record.usage;
+        e->meanResidual = record.meanResidual;
+        e->meanResidualD = record.meanResidualD;
+        e->meanResidualP = record.meanResidualP;
+        e->reciprocalConsistency = record.reciprocalConsistency;
+
+        insertConstraint(e);
+    }
+
+    std::chrono::high_resolution_clock::time_point tv_end =
+        std::chrono::high_resolution_clock::now();
+    printf("LOAD MAP: loaded %d keyframes and %d constraints from %s (%.1fms)\n",
+           (int)header->numKeyFrames, (int)header->numEdges, filename.c_str(),
+           std::chrono::duration_cast<std::chrono::microseconds>(tv_end - tv_start).count() / 1000.0f);
+    return true;
+}
+
 
 
 void KeyFrameGraph::addKeyFrame(Frame* frame)
@@ -312,6 +815,25 @@ bool KeyFrameGraph::addElementsFromBuffer()
 {
     bool added = false;
 
+    // the new elements close a loop if they connect keyframes of the graph
+    // that are further apart than the incremental optimization reaches.
+    if(!needFullOptimization && incrementalOptimizationHops > 0)
+    {
+        std::unordered_set<Frame*> newKeyframes(newKeyframesBuffer.begin(),
+                                                newKeyframesBuffer.end());
+        std::vector<Frame*> connectedKeyframes;
+        for (auto edge : newEdgeBuffer)
+        {
+            if(newKeyframes.count(edge->firstFrame) == 0)
+                connectedKeyframes.push_back(edge->firstFrame);
+            if(newKeyframes.count(edge->secondFrame) == 0)
+                connectedKeyframes.push_back(edge->secondFrame);
+        }
+
+        if(!withinGraphDistance(connectedKeyframes, incrementalOptimizationHops))
+            needFullOptimization = true;
+    }
+
     keyframesForRetrackMutex.lock();
     for (auto newKF : newKeyframesBuffer)
     {
@@ -320,6 +842,8 @@ bool KeyFrameGraph::addElementsFromBuffer()
         newKF->pose->isInGraph = true;
 
         keyframesForRetrack.push_back(newKF);
+        incrementalSeeds.insert(newKF);
+        uninitializedVertices.insert(newKF->pose->graphVertex);
 
         added = true;
     }
@@ -329,6 +853,13 @@ bool KeyFrameGraph::addElementsFromBuffer()
     for (auto edge : newEdgeBuffer)
     {
         graph.addEdge(edge->edge);
+        uninitializedEdges.insert(edge->edge);
+
+        constraintsOfKeyFrame[edge->firstFrame].push_back(edge);
+        constraintsOfKeyFrame[edge->secondFrame].push_back(edge);
+        incrementalSeeds.insert(edge->firstFrame);
+        incrementalSeeds.insert(edge->secondFrame);
+
         added = true;
     }
     newEdgeBuffer.clear();
@@ -336,6 +867,117 @@ bool KeyFrameGraph::addElementsFromBuffer()
     return added;
 }
 
+bool KeyFrameGraph::withinGraphDistance(const std::vector<Frame*>& frames,
+                                        int maxHops)
+{
+    if(frames.size() < 2)
+        return true;
+
+    std::unordered_set<Frame*> notReached(frames.begin(), frames.end());
+    notReached.erase(frames[0]);
+
+    // breadth-first search from the first frame, until all others are reached.
+    std::unordered_map<Frame*, int> distances;
+    std::deque<Frame*> queue;
+    distances[frames[0]] = 0;
+    queue.push_back(frames[0]);
+    while(!queue.empty() && !notReached.empty())
+    {
+        Frame* frame = queue.front();
+        queue.pop_front();
+
+        int distance = distances[frame];
+        auto constraints = constraintsOfKeyFrame.find(frame);
+        if(distance >= maxHops || constraints == constraintsOfKeyFrame.end())
+            continue;
+
+        for(KFConstraintStruct* constraint : constraints->second)
+        {
+            Frame* other = constraint->firstFrame == frame ?
+                           constraint->secondFrame : constraint->firstFrame;
+            if(distances.count(other) != 0)
+                continue;
+
+            distances[other] = distance + 1;
+            notReached.erase(other);
+            queue.push_back(other);
+        }
+    }
+
+    return notReached.empty();
+}
+
+void KeyFrameGraph::releaseIncrementalRegion()
+{
+    for(g2o::OptimizableGraph::Vertex* vertex : incrementalFixedVertices)
+        vertex->setFixed(false);
+    incrementalFixedVertices.clear();
+}
+
+void KeyFrameGraph::buildIncrementalRegion()
+{
+    incrementalKeyFrames.clear();
+    incrementalEdges.clear();
+
+    // all keyframes within incrementalOptimizationHops of the seeds are optimized ...
+    std::unordered_map<Frame*, int> distances;
+    std::deque<Frame*> queue;
+    for(Frame* seed : incrementalSeeds)
+    {
+        distances[seed] = 0;
+        queue.push_back(seed);
+    }
+    while(!queue.empty())
+    {
+        Frame* frame = queue.front();
+        queue.pop_front();
+        incrementalKeyFrames.push_back(frame);
+
+        int distance = distances[frame];
+        auto constraints = constraintsOfKeyFrame.find(frame);
+        if(constraints == constraintsOfKeyFrame.end())
+            continue;
+
+        for(KFConstraintStruct* constraint : constraints->second)
+        {
+            incrementalEdges.insert(constraint->edge);
+
+            Frame* other = constraint->firstFrame == frame ?
+                           constraint->secondFrame : constraint->firstFrame;
+            if(distance < incrementalOptimizationHops && distances.count(other) == 0)
+            {
+                distances[other] = distance + 1;
+                queue.push_back(other);
+            }
+        }
+    }
+
+    // ... while the keyframes just outside, that are constrained by them, are kept fixed.
+    for(Frame* frame : incrementalKeyFrames)
+    {
+        auto constraints = constraintsOfKeyFrame.find(frame);
+        if(constraints == constraintsOfKeyFrame.end())
+            continue;
+
+        for(KFConstraintStruct* constraint : constraints->second)
+        {
+            Frame* other = constraint->firstFrame == frame ?
+                           constraint->secondFrame : constraint->firstFrame;
+            g2o::OptimizableGraph::Vertex* vertex = other->pose->graphVertex;
+            if(distances.count(other) != 0 || vertex->fixed())
+                continue;
+
+            vertex->setFixed(true);
+            incrementalFixedVertices.push_back(vertex);
+        }
+    }
+}
+
+void KeyFrameGraph::requestFullOptimization()
+{
+    needFullOptimization = true;
+}
+
 int KeyFrameGraph::optimize(int num_iterations)
 {
     // Abort if graph is empty, g2o shows an error otherwise
@@ -343,11 +985,83 @@ int KeyFrameGraph::optimize(int num_iterations)
         return 0;
 
     graph.setVerbose(false); // printOptimizationInfo
-    graph.initializeOptimization();
 
+#ifdef _OPENMP
+    if(poseGraphThreads > 0)
+        omp_set_num_threads(poseGraphThreads);
+#endif
+
+    // decide what to optimize, whenever the graph has changed.
+    if(needFullOptimization || !incrementalSeeds.empty())
+    {
+        bool wasFullGraph = optimizedFullGraph;
+        releaseIncrementalRegion();
+        optimizedFullGraph = needFullOptimization || incrementalOptimizationHops <= 0;
+        if(!optimizedFullGraph)
+            buildIncrementalRegion();
+
+        // only a full graph that grew can be extended, a new region is a different graph.
+        if(!wasFullGraph || !optimizedFullGraph)
+            needInitialization = true;
+
+        needFullOptimization = false;
+        incrementalSeeds.clear();
+    }
+
+    if(!optimizedFullGraph && incrementalEdges.empty())
+        return 0;
+
+    std::chrono::high_resolution_clock::time_point tv_start, tv_init, tv_end;
+    tv_start = std::chrono::high_resolution_clock::now();
+
+    // online: re-use the hessian structure of the last optimize().
+    bool online = false;
+    size_t numAdded = uninitializedVertices.size() + uninitializedEdges.size();
+    if(needInitialization || !hessianStructureBuilt
+            || numAdded > OPTIMIZATION_REINIT_GROWTH * graph.activeEdges().size())
+    {
+        if(optimizedFullGraph)
+            graph.initializeOptimization();
+        else
+            graph.initializeOptimization(incrementalEdges);
+
+        needInitialization = false;
+        hessianStructureBuilt = false;
+        uninitializedVertices.clear();
+        uninitializedEdges.clear();
+    }
+    else
+    {
+        // as initializeOptimization(), leave out vertices without edges (yet).
+        g2o::HyperGraph::VertexSet vertices;
+        for(auto it = uninitializedVertices.begin(); it != uninitializedVertices.end();)
+        {
+            if(static_cast<g2o::OptimizableGraph::Vertex*>(*it)->edges().empty())
+                ++it;
+            else
+            {
+                vertices.insert(*it);
+                it = uninitializedVertices.erase(it);
+            }
+        }
+
+        if(!vertices.empty() || !uninitializedEdges.empty())
+            graph.updateInitialization(vertices, uninitializedEdges);
+        uninitializedEdges.clear();
+        online = true;
+    }
+
+    tv_init = std::chrono::high_resolution_clock::now();
+
+    int its = graph.optimize(num_iterations, online);
+    if(its >= 0)
+        hessianStructureBuilt = true;
 
-    return graph.optimize(num_iterations, false);
+    tv_end = std::chrono::high_resolution_clock::now();
+    msLastInitialization = std::chrono::duration<float, std::milli>(tv_init - tv_start).count();
+    msLastSolve = std::chrono::duration<float, std::milli>(tv_end - tv_init).count();
 
+    return its;
 }
 
 
@@ -20,12 +20,15 @@
 
 #pragma once
 #include <vector>
+#include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/shared_mutex.hpp>
 #include "util/eigen_core_include.h"
 #include <g2o/core/sparse_optimizer.h>
 #include "util/sophus_util.h"
+#include "util/settings.h"
 #include "deque"
 
 
@@ -80,6 +83,20 @@ struct KFConstraintStruct
 
 
 
+/**
+ * Creates the Levenberg-Marquardt algorithm of the pose-graph optimization with
+ * the given sparse linear solver, or with CSparse if that one was not compiled in.
+ */
+g2o::OptimizationAlgorithm* createPoseGraphAlgorithm(PoseGraphSolver solver);
+
+/** Whether createPoseGraphAlgorithm() can use the given solver. */
+bool poseGraphSolverAvailable(PoseGraphSolver solver);
+
+/** Loads a pose graph written by KeyFrameGraph::savePoseGraph() into optimizer. */
+bool loadPoseGraph(const std::string& filename, g2o::SparseOptimizer& optimizer);
+
+
+
 /**
  * Graph consisting of KeyFrames and constraints, performing optimization.
  */
@@ -101,6 +118,28 @@ public:
 
     void dumpMap(std::string folder);
 
+    /**
+     * Writes the vertices and constraints of the pose graph as text, one per line
+     * (VERTEX_SIM3_SOPHUS id estimate, FIX id, EDGE_SIM3_SOPHUS id1 id2 huberDelta
+     * measurement information). Read by loadPoseGraph(), e.g. for benchmarking solvers.
+     */
+    void savePoseGraph(std::string filename);
+
+    /**
+     * Writes all finished keyframes (image, depth, re-activation data, permaRef points
+     * and pose) and the constraints between them to a binary map file, see
+     * key_frame_map_file.h. Poses must not change meanwhile (poseConsistencyMutex).
+     */
+    bool saveMap(std::string filename);
+
+    /**
+     * Adds the keyframes and constraints of a map written by saveMap() to the graph,
+     * as finished keyframes, which are returned in loadedKeyFrames. Fails if the map
+     * was made with a different image size.
+     */
+    bool loadMap(std::string filename, int width, int height,
+                 const Eigen::Matrix3f& K, std::vector<Frame*>& loadedKeyFrames);
+
     /**
      * Adds a new constraint to the graph.
      *
@@ -114,10 +153,23 @@ public:
 
 
     /** Optimizes the graph. Does not update the keyframe poses,
-     *  only the vertex poses. You must call updateKeyFramePoses() afterwards. */
+     *  only the vertex poses. You must call updateKeyFramePoses() afterwards.
+     *  With incrementalOptimizationHops > 0, only the keyframes close to the elements added
+     *  since the last call are optimized, unless they closed a loop (see optimizedFullGraph). */
     int optimize(int num_iterations);
     bool addElementsFromBuffer();
 
+    /** Makes the next optimize() optimize the whole graph, e.g. for the final optimization. */
+    void requestFullOptimization();
+
+    /** Whether the last optimize() optimized the whole graph; otherwise it only moved incrementalKeyFrames. */
+    bool optimizedFullGraph;
+    /** The keyframes optimized by the last incremental optimize(). */
+    std::vector<Frame*> incrementalKeyFrames;
+
+    /** Time the last optimize() spent (re-)initializing g2o, and solving. */
+    float msLastInitialization, msLastSolve;
+
 
     /**
      * Creates a hash map of keyframe -> distance to given frame.
@@ -175,6 +227,28 @@ private:
     /** Pose graph representation in g2o */
     g2o::SparseOptimizer graph;
 
+    /** Frees the boundary vertices fixed for the current incremental region. */
+    void releaseIncrementalRegion();
+    /** Sets the incremental region: keyframes within incrementalOptimizationHops of incrementalSeeds. */
+    void buildIncrementalRegion();
+    /** Whether all keyframes in frames are within maxHops of the first one (through the edges in the graph). */
+    bool withinGraphDistance(const std::vector<Frame*>& frames, int maxHops);
+
+    // incremental optimization; only used by addElementsFromBuffer() and optimize(),
+    // i.e. with the g2o graph locked.
+    std::unordered_map< Frame*, std::vector<KFConstraintStruct*> > constraintsOfKeyFrame;
+    std::unordered_set< Frame* > incrementalSeeds;	// keyframes touched by elements added since the region was set.
+    bool needFullOptimization;	// set by loop closures.
+    g2o::HyperGraph::EdgeSet incrementalEdges;
+    std::vector< g2o::OptimizableGraph::Vertex* > incrementalFixedVertices;	// boundary, fixed only while the region is active.
+
+    // g2o keeps its active graph and hessian structure between optimize() calls,
+    // it is only initialized from scratch when what is optimized changed.
+    bool needInitialization;
+    bool hessianStructureBuilt;	// by an optimize() since the last initialization.
+    g2o::HyperGraph::VertexSet uninitializedVertices;	// added since the last initialization.
+    g2o::HyperGraph::EdgeSet uninitializedEdges;
+
     std::vector< Frame* > newKeyframesBuffer;
     std::vector< KFConstraintStruct* > newEdgeBuffer;
 
@@ -0,0 +1,92 @@
+/**
+* This file is part of LSD-SLAM.
+*
+* Copyright 2013 Jakob Engel <engelj at in dot tum dot de> (Technical University of Munich)
+* For more information see <http://vision.in.tum.de/lsdslam>
+*
+* LSD-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* LSD-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with LSD-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <cstdint>
+
+
+namespace lsd_slam
+{
+
+/*
+ * Binary map format written by KeyFrameGraph::saveMap() and memory-mapped by
+ * KeyFrameGraph::loadMap(). In host byte order, layout:
+ *
+ *   KeyFrameMapHeader
+ *   per keyframe: image, idepth, idepthVar, idepth_reAct, idepthVar_reAct (float[width*height]),
+ *                 validity_reAct (uint8[width*height]),
+ *                 permaRef x, y, z, color, var (float[numPermaRef])
+ *   KeyFrameMapKeyFrame[numKeyFrames]
+ *   KeyFrameMapEdge[numEdges]
+ *
+ * Every array and table starts at a multiple of KEYFRAME_MAP_ALIGNMENT, so it can be
+ * read in place from the mapping. Sim(3)s are stored as the scaled quaternion
+ * (x, y, z, w; its norm is the scale) followed by the translation.
+ * Bump KEYFRAME_MAP_VERSION whenever one of the structs below changes.
+ */
+#define KEYFRAME_MAP_MAGIC "LSDSLMAP"
+#define KEYFRAME_MAP_VERSION 1
+#define KEYFRAME_MAP_ALIGNMENT 64
+
+struct KeyFrameMapHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize, keyFrameSize, edgeSize;	// sizeof the structs, as a sanity check.
+
+    int32_t width, height;
+    float K[9];	// row-major.
+
+    uint32_t numKeyFrames, numEdges;
+    uint64_t keyFramesOffset, edgesOffset;
+    uint64_t fileSize;
+};
+
+struct KeyFrameMapKeyFrame
+{
+    int32_t id;
+    int32_t trackingParentId;	// -1: none.
+    double timestamp;
+    double camToWorld[7];
+
+    int32_t numFramesTrackedOnThis;
+    int32_t numMappedOnThisTotal;
+    int32_t numPermaRef;
+    int32_t reserved;
+
+    // offsets of the arrays.
+    uint64_t image, idepth, idepthVar;
+    uint64_t idepth_reAct, idepthVar_reAct, validity_reAct;
+    uint64_t permaRef[5];
+};
+
+struct KeyFrameMapEdge
+{
+    int32_t firstId, secondId;
+    double secondToFirst[7];
+    double information[49];	// row-major.
+
+    float huberDelta;	// 0: no robust kernel.
+    float usage;
+    float meanResidual, meanResidualD, meanResidualP;
+    float reciprocalConsistency;
+};
+
+}
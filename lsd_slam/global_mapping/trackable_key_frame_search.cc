@@ -21,6 +21,9 @@
 #include "global_mapping/trackable_key_frame_search.h"
 
 #include <chrono>
+#include <algorithm>
+#include <climits>
+#include <cmath>
 
 #include "global_mapping/key_frame_graph.h"
 #include "model/frame.h"
@@ -54,6 +57,179 @@ TrackableKeyFrameSearch::~TrackableKeyFrameSearch()
 
 
 
+// cell coordinates are clamped to 21 bit, so the three of them fit into one key.
+static const int KF_INDEX_CELL_MAX = (1<<20) - 1;
+
+static inline int kfIndexCellCoord(double x, double cellSizeInv)
+{
+    double c = floor(x * cellSizeInv);
+    if(!(c > -KF_INDEX_CELL_MAX)) return -KF_INDEX_CELL_MAX;	// also catches NaN.
+    if(c > KF_INDEX_CELL_MAX) return KF_INDEX_CELL_MAX;
+    return (int)c;
+}
+
+static inline long long kfIndexCellKey(int x, int y, int z)
+{
+    return ((long long)(x + KF_INDEX_CELL_MAX) << 42)
+           | ((long long)(y + KF_INDEX_CELL_MAX) << 21)
+           | (long long)(z + KF_INDEX_CELL_MAX);
+}
+
+
+TrackableKeyFrameSearch::KFIndexEntry TrackableKeyFrameSearch::locateInIndex(
+    Frame* keyframe, int* cellXYZ)
+{
+    Sim3 camToWorld = keyframe->getScaledCamToWorld();
+    double distFac = keyframe->meanIdepth / camToWorld.scale();
+
+    KFIndexEntry entry;
+    entry.bin = INT_MIN;
+    entry.cell = 0;
+    if(!(distFac > 0) || !std::isfinite(distFac))
+        return entry;
+
+    // distFac = m * 2^e with m in [0.5, 1): the bin is floor(log2(distFac)), exactly.
+    int e;
+    frexp(distFac, &e);
+    entry.bin = e-1;
+
+    double cellSizeInv = ldexp(1.0, entry.bin);
+    Eigen::Vector3d pos = camToWorld.translation();
+    for(int k=0; k<3; k++)
+        cellXYZ[k] = kfIndexCellCoord(pos[k], cellSizeInv);
+    entry.cell = kfIndexCellKey(cellXYZ[0], cellXYZ[1], cellXYZ[2]);
+    return entry;
+}
+
+void TrackableKeyFrameSearch::insertIntoIndex(Frame* keyframe,
+        const KFIndexEntry& entry, const int* cellXYZ)
+{
+    if(entry.bin == INT_MIN)
+        unbinnedFrames.push_back(keyframe);
+    else
+    {
+        KFIndexCell& cell = indexBins[entry.bin][entry.cell];
+        cell.x = cellXYZ[0];
+        cell.y = cellXYZ[1];
+        cell.z = cellXYZ[2];
+        cell.frames.push_back(keyframe);
+    }
+    indexEntries[keyframe] = entry;
+}
+
+void TrackableKeyFrameSearch::removeFromIndex(Frame* keyframe)
+{
+    auto entry = indexEntries.find(keyframe);
+    if(entry == indexEntries.end())
+        return;
+
+    if(entry->second.bin == INT_MIN)
+    {
+        unbinnedFrames.erase(std::find(unbinnedFrames.begin(), unbinnedFrames.end(),
+                                       keyframe));
+    }
+    else
+    {
+        auto bin = indexBins.find(entry->second.bin);
+        auto cell = bin->second.find(entry->second.cell);
+        std::vector<Frame*>& frames = cell->second.frames;
+        *std::find(frames.begin(), frames.end(), keyframe) = frames.back();
+        frames.pop_back();
+
+        if(frames.empty())
+            bin->second.erase(cell);
+        if(bin->second.empty())
+            indexBins.erase(bin);
+    }
+    indexEntries.erase(entry);
+}
+
+void TrackableKeyFrameSearch::addKeyFrame(Frame* keyframe)
+{
+    int cellXYZ[3];
+    KFIndexEntry entry = locateInIndex(keyframe, cellXYZ);
+
+    indexMutex.lock();
+    removeFromIndex(keyframe);
+    insertIntoIndex(keyframe, entry, cellXYZ);
+    indexMutex.unlock();
+}
+
+void TrackableKeyFrameSearch::updateKeyFramePoses()
+{
+    indexMutex.lock();
+    std::vector<Frame*> keyframes;
+    keyframes.reserve(indexEntries.size());
+    for(auto& entry : indexEntries)
+        keyframes.push_back(entry.first);
+
+    int cellXYZ[3];
+    for(Frame* keyframe : keyframes)
+    {
+        KFIndexEntry entry = locateInIndex(keyframe, cellXYZ);
+        const KFIndexEntry& old = indexEntries[keyframe];
+        if(old.bin == entry.bin && old.cell == entry.cell)
+            continue;
+
+        removeFromIndex(keyframe);
+        insertIntoIndex(keyframe, entry, cellXYZ);
+    }
+    indexMutex.unlock();
+}
+
+void TrackableKeyFrameSearch::collectIndexCandidates(
+    const Eigen::Vector3d& pos, float distanceTH, float distFacReciprocal,
+    std::vector<Frame*>& out)
+{
+    out.insert(out.end(), unbinnedFrames.begin(), unbinnedFrames.end());
+
+    bool posValid = std::isfinite(pos[0]) && std::isfinite(pos[1])
+                    && std::isfinite(pos[2]);
+    for(auto& bin : indexBins)
+    {
+        // smallest distFac in the bin gives the largest world-space radius.
+        double cellSizeInv = ldexp(1.0, bin.first);
+        double distFacMin = std::min(cellSizeInv, (double)distFacReciprocal);
+        double radius = sqrt((double)distanceTH) / distFacMin;
+
+        int lo[3], hi[3];
+        for(int k=0; k<3; k++)
+        {
+            lo[k] = kfIndexCellCoord(pos[k] - radius, cellSizeInv);
+            hi[k] = kfIndexCellCoord(pos[k] + radius, cellSizeInv);
+        }
+        double numCells = (double)(hi[0]-lo[0]+1) * (hi[1]-lo[1]+1) * (hi[2]-lo[2]+1);
+
+        if(!posValid || !(distFacMin > 0) || !std::isfinite(radius))
+        {
+            // degenerate query: take the whole bin, the exact test decides.
+            for(auto& cell : bin.second)
+                out.insert(out.end(), cell.second.frames.begin(), cell.second.frames.end());
+        }
+        else if(numCells > bin.second.size())
+        {
+            // fewer occupied cells than cells in the query box.
+            for(auto& cell : bin.second)
+                if(cell.second.x >= lo[0] && cell.second.x <= hi[0]
+                        && cell.second.y >= lo[1] && cell.second.y <= hi[1]
+                        && cell.second.z >= lo[2] && cell.second.z <= hi[2])
+                    out.insert(out.end(), cell.second.frames.begin(), cell.second.frames.end());
+        }
+        else
+        {
+            for(int x=lo[0]; x<=hi[0]; x++)
+                for(int y=lo[1]; y<=hi[1]; y++)
+                    for(int z=lo[2]; z<=hi[2]; z++)
+                    {
+                        auto cell = bin.second.find(kfIndexCellKey(x,y,z));
+                        if(cell != bin.second.end())
+                            out.insert(out.end(), cell->second.frames.begin(), cell->second.frames.end());
+                    }
+        }
+    }
+}
+
+
 std::vector<TrackableKFStruct>
 TrackableKeyFrameSearch::findEuclideanOverlapFrames(Frame* frame,
         float distanceTH, float angleTH, bool checkBothScales)
@@ -63,45 +239,53 @@ TrackableKeyFrameSearch::findEuclideanOverlapFrames(Frame* frame,
     float cosAngleTH = cosf(angleTH*0.5f*(fowX + fowY));
 
 
-    Eigen::Vector3d pos = frame->getScaledCamToWorld().translation();
-    Eigen::Vector3d viewingDir =
-        frame->getScaledCamToWorld().rotationMatrix().rightCols<1>();
+    Sim3 camToWorld = frame->getScaledCamToWorld();
+    Eigen::Vector3d pos = camToWorld.translation();
+    Eigen::Vector3d viewingDir = camToWorld.rotationMatrix().rightCols<1>();
 
     std::vector<TrackableKFStruct> potentialReferenceFrames;
 
     float distFacReciprocal = 1;
     if(checkBothScales)
-        distFacReciprocal = frame->meanIdepth / frame->getScaledCamToWorld().scale();
+        distFacReciprocal = frame->meanIdepth / camToWorld.scale();
+
+    // get the keyframes that may be close enough from the spatial index, in
+    // the order of keyframesAll.
+    std::vector<Frame*> candidates;
+    indexMutex.lock_shared();
+    collectIndexCandidates(pos, distanceTH,
+                           checkBothScales ? distFacReciprocal : INFINITY, candidates);
+    indexMutex.unlock_shared();
+    std::sort(candidates.begin(), candidates.end(), [](Frame* a, Frame* b)
+    {
+        return a->idxInKeyframes < b->idxInKeyframes;
+    });
 
     // for each frame, calculate the rough score, consisting of pose, scale and angle overlap.
-    graph->keyframesAllMutex.lock_shared();
-    for(unsigned int i=0; i<graph->keyframesAll.size(); i++)
+    for(Frame* other : candidates)
     {
-        Eigen::Vector3d otherPos =
-            graph->keyframesAll[i]->getScaledCamToWorld().translation();
+        Sim3 otherCamToWorld = other->getScaledCamToWorld();
+        Eigen::Vector3d otherPos = otherCamToWorld.translation();
 
         // get distance between the frames, scaled to fit the potential reference frame.
-        float distFac = graph->keyframesAll[i]->meanIdepth /
-                        graph->keyframesAll[i]->getScaledCamToWorld().scale();
+        float distFac = other->meanIdepth / otherCamToWorld.scale();
         if(checkBothScales && distFacReciprocal < distFac) distFac = distFacReciprocal;
         Eigen::Vector3d dist = (pos - otherPos) * distFac;
         float dNorm2 = dist.dot(dist);
         if(dNorm2 > distanceTH) continue;
 
         Eigen::Vector3d otherViewingDir =
-            graph->keyframesAll[i]->getScaledCamToWorld().rotationMatrix().rightCols<1>();
+            otherCamToWorld.rotationMatrix().rightCols<1>();
         float dirDotProd = otherViewingDir.dot(viewingDir);
         if(dirDotProd < cosAngleTH) continue;
 
         potentialReferenceFrames.push_back(TrackableKFStruct());
-        potentialReferenceFrames.back().ref = graph->keyframesAll[i];
+        potentialReferenceFrames.back().ref = other;
         potentialReferenceFrames.back().refToFrame = se3FromSim3(
-                    graph->keyframesAll[i]->getScaledCamToWorld().inverse() *
-                    frame->getScaledCamToWorld()).inverse();
+                    otherCamToWorld.inverse() * camToWorld).inverse();
         potentialReferenceFrames.back().dist = dNorm2;
         potentialReferenceFrames.back().angle = dirDotProd;
     }
-    graph->keyframesAllMutex.unlock_shared();
 
     return potentialReferenceFrames;
 }
@@ -22,6 +22,8 @@
 #include <vector>
 #include <unordered_map>
 #include <unordered_set>
+#include <map>
+#include <boost/thread/shared_mutex.hpp>
 #include "util/sophus_util.h"
 
 #ifdef HAVE_FABMAP
@@ -69,6 +71,15 @@ public:
             Frame* &fabMapResult_out, bool includeFABMAP=true, bool closenessTH=1.0);
     Frame* findRePositionCandidate(Frame* frame, float maxScore=1);
 
+    /**
+     * Adds a finished keyframe to the spatial index, or re-inserts it if it
+     * is already in there (e.g. a re-activated keyframe with a new depth map).
+     */
+    void addKeyFrame(Frame* keyframe);
+
+    /** Re-inserts all keyframes of the index at their current pose. Call after merging a graph optimization. */
+    void updateKeyFramePoses();
+
 
     inline float getRefFrameScore(float distanceSquared, float usage)
     {
@@ -88,6 +99,37 @@ private:
     std::vector<TrackableKFStruct> findEuclideanOverlapFrames(Frame* frame,
             float distanceTH, float angleTH, bool checkBothScales = false);
 
+
+    // ============== spatial index over the keyframe camera centers ==============
+    // findEuclideanOverlapFrames scales the distance to a keyframe by its
+    // distFac = meanIdepth / scale, so the world-space search radius differs per
+    // keyframe. keyframes are therefore binned by floor(log2(distFac)), and each
+    // bin hashes the camera centers into cubic cells of side 1/2^bin, i.e. the
+    // largest mean depth in the bin.
+    struct KFIndexCell
+    {
+        int x, y, z;
+        std::vector<Frame*> frames;
+    };
+    struct KFIndexEntry
+    {
+        int bin;	// INT_MIN: distFac invalid, frame is in unbinnedFrames.
+        long long cell;
+    };
+
+    /** Bin and cell (key and coordinates) of keyframe at its current pose. */
+    KFIndexEntry locateInIndex(Frame* keyframe, int* cellXYZ);
+    void insertIntoIndex(Frame* keyframe, const KFIndexEntry& entry, const int* cellXYZ);
+    void removeFromIndex(Frame* keyframe);
+    /** All indexed keyframes that may be within distanceTH of pos (a superset, in no particular order). */
+    void collectIndexCandidates(const Eigen::Vector3d& pos, float distanceTH,
+                                float distFacReciprocal, std::vector<Frame*>& out);
+
+    boost::shared_mutex indexMutex;
+    std::map<int, std::unordered_map<long long, KFIndexCell> > indexBins;
+    std::unordered_map<Frame*, KFIndexEntry> indexEntries;
+    std::vector<Frame*> unbinnedFrames;
+
 #ifdef HAVE_FABMAP
     std::unordered_map<int, Frame*> fabmapIDToKeyframe;
     FabMap fabMap;
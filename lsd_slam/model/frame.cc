@@ -20,8 +20,13 @@
 
 #include "model/frame.h"
 #include "model/frame_memory.h"
-#include "depth_estimation/depth_map_pixel_hypothesis.h"
+#include "depth_estimation/depth_map_soa.h"
 #include "tracking/tracking_reference.h"
+#include <algorithm>
+
+#if defined(ENABLE_AVX2)
+#include <immintrin.h>
+#endif
 
 namespace lsd_slam
 {
@@ -29,25 +34,388 @@ namespace lsd_slam
 int privateFrameAllocCount = 0;
 
 
+// rows per tile of Frame::buildPyramidLevel: that many bytes per tile (2 source rows,
+// image, gradients, max gradients and the temp buffer are 36 bytes per pixel).
+static const int pyramidTileBytes = 256 << 10;
+static const int pyramidBytesPerPixel = 36;
 
+// Kernels of Frame::buildPyramidLevel. Ranges are 1D pixel indices into the level
+// (so neighbours in x wrap around into the next / previous row, as they always did);
+// all of them handle any width, the SIMD ones finish the remainder with the scalar one.
+struct PyramidKernels
+{
+    /** dest[x] = mean of the 2x2 block at 2x in the two source rows, for x < destWidth. */
+    void (*downsampleRows)(const float* source, int sourceWidth, float* dest,
+                           int destWidth, int numRows);
+    /** gradients (dx, dy, image, 0) and / or their length, for pixels [begin, end). Both may be 0. */
+    void (*gradients)(const float* image, int width, int begin, int end,
+                      Eigen::Vector4f* gradients, float* absGradients);
+    /** temp = max of absGradients above, at and below, for pixels [begin, end). */
+    void (*verticalMax)(const float* absGradients, int width, int begin, int end,
+                        float* temp);
+    /** maxGradients = max of temp left, at and right, for pixels [begin, end). Returns how
+      * many are >= MIN_ABS_GRAD_CREATE. */
+    int (*horizontalMax)(const float* temp, int begin, int end, float* maxGradients);
+};
+
+
+static void downsampleRowsScalar(const float* source, int sourceWidth,
+                                 float* dest, int destWidth, int numRows)
+{
+    for(int y=0; y<numRows; y++)
+    {
+        const float* top = source + 2*y*sourceWidth;
+        const float* bottom = top + sourceWidth;
+        for(int x=0; x<destWidth; x++)
+            dest[y*destWidth + x] = ((top[2*x] + bottom[2*x]) +
+                                     (top[2*x+1] + bottom[2*x+1])) * 0.25f;
+    }
+}
 
+template<bool withGradients, bool withAbsGradients>
+static void gradientsScalarT(const float* image, int width, int begin, int end,
+                             Eigen::Vector4f* gradients, float* absGradients)
+{
+    for(int i=begin; i<end; i++)
+    {
+        float dx = 0.5f*(image[i+1] - image[i-1]);
+        float dy = 0.5f*(image[i+width] - image[i-width]);
+        if(withGradients)
+        {
+            float* g = (float*)(gradients + i);
+            g[0] = dx;
+            g[1] = dy;
+            g[2] = image[i];
+            g[3] = 0;
+        }
+        if(withAbsGradients)
+            absGradients[i] = sqrtf(dx*dx + dy*dy);
+    }
+}
 
-Frame::Frame(int id, int width, int height, const Eigen::Matrix3f& K,
-             double timestamp, const unsigned char* image)
+static void gradientsScalar(const float* image, int width, int begin, int end,
+                            Eigen::Vector4f* gradients, float* absGradients)
 {
-    initialize(id, width, height, K, timestamp);
+    if(gradients != 0 && absGradients != 0)
+        gradientsScalarT<true, true>(image, width, begin, end, gradients, absGradients);
+    else if(gradients != 0)
+        gradientsScalarT<true, false>(image, width, begin, end, gradients, absGradients);
+    else if(absGradients != 0)
+        gradientsScalarT<false, true>(image, width, begin, end, gradients, absGradients);
+}
 
-    data.image[0] = FrameMemory::getInstance().getFloatBuffer(
-                        data.width[0]*data.height[0]);
-    float* maxPt = data.image[0] + data.width[0]*data.height[0];
+static void verticalMaxScalar(const float* absGradients, int width, int begin,
+                              int end, float* temp)
+{
+    for(int i=begin; i<end; i++)
+    {
+        float g1 = absGradients[i-width];
+        float g2 = absGradients[i];
+        if(g1 < g2) g1 = g2;
+        float g3 = absGradients[i+width];
+        temp[i] = g1 < g3 ? g3 : g1;
+    }
+}
 
-    for(float* pt = data.image[0]; pt < maxPt; pt++)
+static int horizontalMaxScalar(const float* temp, int begin, int end,
+                               float* maxGradients)
+{
+    int numMappable = 0;
+    for(int i=begin; i<end; i++)
     {
-        *pt = *image;
-        image++;
+        float g1 = temp[i-1];
+        float g2 = temp[i];
+        if(g1 < g2) g1 = g2;
+        float g3 = temp[i+1];
+        if(g1 < g3) g1 = g3;
+
+        maxGradients[i] = g1;
+        if(g1 >= MIN_ABS_GRAD_CREATE)
+            numMappable++;
     }
+    return numMappable;
+}
 
-    data.imageValid[0] = true;
+
+#if defined(ENABLE_SSE)
+static void downsampleRowsSSE(const float* source, int sourceWidth, float* dest,
+                              int destWidth, int numRows)
+{
+    __m128 p025 = _mm_set1_ps(0.25f);
+    for(int y=0; y<numRows; y++)
+    {
+        const float* top = source + 2*y*sourceWidth;
+        const float* bottom = top + sourceWidth;
+        float* d = dest + y*destWidth;
+
+        // four dest pixels at a time.
+        int x = 0;
+        for(; x+4 <= destWidth; x+=4)
+        {
+            __m128 left = _mm_add_ps(_mm_loadu_ps(top+2*x), _mm_loadu_ps(bottom+2*x));
+            __m128 right = _mm_add_ps(_mm_loadu_ps(top+2*x+4), _mm_loadu_ps(bottom+2*x+4));
+
+            __m128 sumA = _mm_shuffle_ps(left, right, _MM_SHUFFLE(2,0,2,0));
+            __m128 sumB = _mm_shuffle_ps(left, right, _MM_SHUFFLE(3,1,3,1));
+            _mm_storeu_ps(d+x, _mm_mul_ps(_mm_add_ps(sumA, sumB), p025));
+        }
+        downsampleRowsScalar(top+2*x, sourceWidth, d+x, destWidth-x, 1);
+    }
+}
+
+static void gradientsSSE(const float* image, int width, int begin, int end,
+                         Eigen::Vector4f* gradients, float* absGradients)
+{
+    __m128 half = _mm_set1_ps(0.5f);
+    int i = begin;
+    for(; i+4 <= end; i+=4)
+    {
+        __m128 dx = _mm_mul_ps(half, _mm_sub_ps(_mm_loadu_ps(image+i+1),
+                                                _mm_loadu_ps(image+i-1)));
+        __m128 dy = _mm_mul_ps(half, _mm_sub_ps(_mm_loadu_ps(image+i+width),
+                                                _mm_loadu_ps(image+i-width)));
+        if(gradients != 0)
+        {
+            __m128 g0 = dx, g1 = dy, g2 = _mm_loadu_ps(image+i), g3 = _mm_setzero_ps();
+            _MM_TRANSPOSE4_PS(g0, g1, g2, g3);
+            _mm_store_ps((float*)(gradients+i), g0);
+            _mm_store_ps((float*)(gradients+i+1), g1);
+            _mm_store_ps((float*)(gradients+i+2), g2);
+            _mm_store_ps((float*)(gradients+i+3), g3);
+        }
+        if(absGradients != 0)
+            _mm_storeu_ps(absGradients+i, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx),
+                          _mm_mul_ps(dy, dy))));
+    }
+    gradientsScalar(image, width, i, end, gradients, absGradients);
+}
+
+static void verticalMaxSSE(const float* absGradients, int width, int begin,
+                           int end, float* temp)
+{
+    int i = begin;
+    for(; i+4 <= end; i+=4)
+        _mm_storeu_ps(temp+i, _mm_max_ps(_mm_max_ps(_mm_loadu_ps(absGradients+i-width),
+                                         _mm_loadu_ps(absGradients+i)), _mm_loadu_ps(absGradients+i+width)));
+    verticalMaxScalar(absGradients, width, i, end, temp);
+}
+
+static int horizontalMaxSSE(const float* temp, int begin, int end,
+                            float* maxGradients)
+{
+    static const int bitCount[16] = {0,1,1,2, 1,2,2,3, 1,2,2,3, 2,3,3,4};
+    __m128 minGrad = _mm_set1_ps(MIN_ABS_GRAD_CREATE);
+
+    int numMappable = 0;
+    int i = begin;
+    for(; i+4 <= end; i+=4)
+    {
+        __m128 g = _mm_max_ps(_mm_max_ps(_mm_loadu_ps(temp+i-1), _mm_loadu_ps(temp+i)),
+                              _mm_loadu_ps(temp+i+1));
+        _mm_storeu_ps(maxGradients+i, g);
+        numMappable += bitCount[_mm_movemask_ps(_mm_cmpge_ps(g, minGrad))];
+    }
+    return numMappable + horizontalMaxScalar(temp, i, end, maxGradients);
+}
+
+
+// same as the SSE kernels, 8 pixels at a time.
+TARGET_AVX2 static void downsampleRowsAVX2(const float* source, int sourceWidth,
+        float* dest, int destWidth, int numRows)
+{
+    __m256 p025 = _mm256_set1_ps(0.25f);
+    for(int y=0; y<numRows; y++)
+    {
+        const float* top = source + 2*y*sourceWidth;
+        const float* bottom = top + sourceWidth;
+        float* d = dest + y*destWidth;
+
+        int x = 0;
+        for(; x+8 <= destWidth; x+=8)
+        {
+            __m256 left = _mm256_add_ps(_mm256_loadu_ps(top+2*x), _mm256_loadu_ps(bottom+2*x));
+            __m256 right = _mm256_add_ps(_mm256_loadu_ps(top+2*x+8),
+                                         _mm256_loadu_ps(bottom+2*x+8));
+
+            // hadd works on 128bit halves, so the 64bit quarters come out as
+            // left[0:4], right[0:4], left[4:8], right[4:8].
+            __m256 sum = _mm256_hadd_ps(left, right);
+            sum = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(sum),
+                                   _MM_SHUFFLE(3,1,2,0)));
+            _mm256_storeu_ps(d+x, _mm256_mul_ps(sum, p025));
+        }
+        downsampleRowsScalar(top+2*x, sourceWidth, d+x, destWidth-x, 1);
+    }
+}
+
+TARGET_AVX2 static void gradientsAVX2(const float* image, int width, int begin,
+                                      int end, Eigen::Vector4f* gradients, float* absGradients)
+{
+    __m256 half = _mm256_set1_ps(0.5f);
+    __m256 zero = _mm256_setzero_ps();
+    int i = begin;
+    for(; i+8 <= end; i+=8)
+    {
+        __m256 dx = _mm256_mul_ps(half, _mm256_sub_ps(_mm256_loadu_ps(image+i+1),
+                                  _mm256_loadu_ps(image+i-1)));
+        __m256 dy = _mm256_mul_ps(half, _mm256_sub_ps(_mm256_loadu_ps(image+i+width),
+                                  _mm256_loadu_ps(image+i-width)));
+        if(gradients != 0)
+        {
+            // 4x4 transposes within the 128bit halves, then pixels 0-3 from the lower
+            // and 4-7 from the upper halves.
+            __m256 c = _mm256_loadu_ps(image+i);
+            __m256 t0 = _mm256_unpacklo_ps(dx, dy);
+            __m256 t1 = _mm256_unpackhi_ps(dx, dy);
+            __m256 t2 = _mm256_unpacklo_ps(c, zero);
+            __m256 t3 = _mm256_unpackhi_ps(c, zero);
+            __m256 p04 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1,0,1,0));
+            __m256 p15 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3,2,3,2));
+            __m256 p26 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1,0,1,0));
+            __m256 p37 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3,2,3,2));
+
+            float* g = (float*)(gradients+i);
+            _mm256_storeu_ps(g, _mm256_permute2f128_ps(p04, p15, 0x20));
+            _mm256_storeu_ps(g+8, _mm256_permute2f128_ps(p26, p37, 0x20));
+            _mm256_storeu_ps(g+16, _mm256_permute2f128_ps(p04, p15, 0x31));
+            _mm256_storeu_ps(g+24, _mm256_permute2f128_ps(p26, p37, 0x31));
+        }
+        if(absGradients != 0)
+            _mm256_storeu_ps(absGradients+i, _mm256_sqrt_ps(_mm256_add_ps(
+                                 _mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy))));
+    }
+    gradientsScalar(image, width, i, end, gradients, absGradients);
+}
+
+TARGET_AVX2 static void verticalMaxAVX2(const float* absGradients, int width,
+                                        int begin, int end, float* temp)
+{
+    int i = begin;
+    for(; i+8 <= end; i+=8)
+        _mm256_storeu_ps(temp+i, _mm256_max_ps(_mm256_max_ps(
+                _mm256_loadu_ps(absGradients+i-width), _mm256_loadu_ps(absGradients+i)),
+                         _mm256_loadu_ps(absGradients+i+width)));
+    verticalMaxScalar(absGradients, width, i, end, temp);
+}
+
+TARGET_AVX2 static int horizontalMaxAVX2(const float* temp, int begin, int end,
+        float* maxGradients)
+{
+    __m256 minGrad = _mm256_set1_ps(MIN_ABS_GRAD_CREATE);
+
+    int numMappable = 0;
+    int i = begin;
+    for(; i+8 <= end; i+=8)
+    {
+        __m256 g = _mm256_max_ps(_mm256_max_ps(_mm256_loadu_ps(temp+i-1),
+                                               _mm256_loadu_ps(temp+i)), _mm256_loadu_ps(temp+i+1));
+        _mm256_storeu_ps(maxGradients+i, g);
+        numMappable += _mm_popcnt_u32(_mm256_movemask_ps(_mm256_cmp_ps(g, minGrad,
+                                      _CMP_GE_OQ)));
+    }
+    return numMappable + horizontalMaxScalar(temp, i, end, maxGradients);
+}
+
+#elif defined(ENABLE_NEON)
+static void downsampleRowsNEON(const float* source, int sourceWidth, float* dest,
+                               int destWidth, int numRows)
+{
+    // the assembly needs whole blocks of 8 source pixels per row.
+    if (sourceWidth % 8 != 0 || destWidth*2 != sourceWidth)
+    {
+        downsampleRowsScalar(source, sourceWidth, dest, destWidth, numRows);
+        return;
+    }
+
+    static const float p025[] = {0.25, 0.25, 0.25, 0.25};
+    int width_iteration_count = sourceWidth / 8;
+    int height_iteration_count = numRows;
+    const float* cur_px = source;
+    const float* next_row_px = source + sourceWidth;
+
+    __asm__ __volatile__
+    (
+        "vldmia %[p025], {q10}                        \n\t" // p025(q10)
+
+        ".height_loop:                                \n\t"
+
+        "mov r5, %[width_iteration_count]             \n\t" // store width_iteration_count
+        ".width_loop:                                 \n\t"
+
+        "vldmia   %[cur_px]!, {q0-q1}             \n\t" // top_left(q0), top_right(q1)
+        "vldmia   %[next_row_px]!, {q2-q3}        \n\t" // bottom_left(q2), bottom_right(q3)
+
+        "vadd.f32 q0, q0, q2                      \n\t" // left(q0)
+        "vadd.f32 q1, q1, q3                      \n\t" // right(q1)
+
+        "vpadd.f32 d0, d0, d1                     \n\t" // pairwise add into sum(q0)
+        "vpadd.f32 d1, d2, d3                     \n\t"
+        "vmul.f32 q0, q0, q10                     \n\t" // multiply with 0.25 to get average
+
+        "vstmia %[dest]!, {q0}                    \n\t"
+
+        "subs     %[width_iteration_count], %[width_iteration_count], #1 \n\t"
+        "bne      .width_loop                     \n\t"
+        "mov      %[width_iteration_count], r5    \n\t" // restore width_iteration_count
+
+        // Advance one more line
+        "add      %[cur_px], %[cur_px], %[rowSize]    \n\t"
+        "add      %[next_row_px], %[next_row_px], %[rowSize] \n\t"
+
+        "subs     %[height_iteration_count], %[height_iteration_count], #1 \n\t"
+        "bne      .height_loop                       \n\t"
+
+        : /* outputs */ [cur_px]"+&r"(cur_px),
+        [next_row_px]"+&r"(next_row_px),
+        [width_iteration_count]"+&r"(width_iteration_count),
+        [height_iteration_count]"+&r"(height_iteration_count),
+        [dest]"+&r"(dest)
+        : /* inputs  */ [p025]"r"(p025),
+        [rowSize]"r"(sourceWidth * sizeof(float))
+        : /* clobber */ "memory", "cc", "r5",
+        "q0", "q1", "q2", "q3", "q10"
+    );
+}
+#endif
+
+static PyramidKernels getPyramidKernels()
+{
+    PyramidKernels kernels;
+    kernels.downsampleRows = downsampleRowsScalar;
+    kernels.gradients = gradientsScalar;
+    kernels.verticalMax = verticalMaxScalar;
+    kernels.horizontalMax = horizontalMaxScalar;
+
+#if defined(ENABLE_SSE)
+    if(simdLevel >= SIMD_AVX2)
+    {
+        kernels.downsampleRows = downsampleRowsAVX2;
+        kernels.gradients = gradientsAVX2;
+        kernels.verticalMax = verticalMaxAVX2;
+        kernels.horizontalMax = horizontalMaxAVX2;
+    }
+    else if(USESSE)
+    {
+        kernels.downsampleRows = downsampleRowsSSE;
+        kernels.gradients = gradientsSSE;
+        kernels.verticalMax = verticalMaxSSE;
+        kernels.horizontalMax = horizontalMaxSSE;
+    }
+#elif defined(ENABLE_NEON)
+    kernels.downsampleRows = downsampleRowsNEON;
+#endif
+    return kernels;
+}
+
+
+
+
+
+Frame::Frame(int id, int width, int height, const Eigen::Matrix3f& K,
+             double timestamp, const unsigned char* image)
+{
+    initialize(id, width, height, K, timestamp);
+    setImage(image);
 
     privateFrameAllocCount++;
 
@@ -79,12 +447,55 @@ Frame::~Frame()
     if(enablePrintDebugInfo && printMemoryDebugInfo)
         printf("DELETING frame %d\n", this->id());
 
+    releaseAll();
+
+    privateFrameAllocCount--;
+    if(enablePrintDebugInfo && printMemoryDebugInfo)
+        printf("DELETED frame %d, now there are %d\n", this->id(),
+               privateFrameAllocCount);
+}
+
+
+void Frame::setImage(const unsigned char* image)
+{
+    data.image[0] = FrameMemory::getInstance().getFloatBuffer(
+                        data.width[0]*data.height[0]);
+    float* maxPt = data.image[0] + data.width[0]*data.height[0];
+
+    for(float* pt = data.image[0]; pt < maxPt; pt++)
+    {
+        *pt = *image;
+        image++;
+    }
+
+    data.imageValid[0] = true;
+}
+
+void Frame::reset(int id, int width, int height, const Eigen::Matrix3f& K,
+                  double timestamp, const unsigned char* image)
+{
+    initialize(id, width, height, K, timestamp);
+    setImage(image);
+
+    neighbors.clear();
+    trackingFailed.clear();
+}
+
+void Frame::releaseAll()
+{
     FrameMemory::getInstance().deactivateFrame(this);
+    if(data.swappedOut)
+        FrameMemory::getInstance().freeSwap(data.swapOffset, data.swapBytes);
+    data.swappedOut = false;
 
-    if(!pose->isRegisteredToGraph)
-        delete pose;
-    else
-        pose->frame = 0;
+    if(pose != 0)
+    {
+        if(!pose->isRegisteredToGraph)
+            FrameMemory::getInstance().returnPoseStruct(pose);
+        else
+            pose->frame = 0;
+        pose = 0;
+    }
 
     for (int level = 0; level < PYRAMID_LEVELS; ++ level)
     {
@@ -94,27 +505,31 @@ Frame::~Frame()
         FrameMemory::getInstance().returnBuffer(data.maxGradients[level]);
         FrameMemory::getInstance().returnBuffer(data.idepth[level]);
         FrameMemory::getInstance().returnBuffer(data.idepthVar[level]);
+
+        data.image[level] = 0;
+        data.gradients[level] = 0;
+        data.maxGradients[level] = 0;
+        data.idepth[level] = 0;
+        data.idepthVar[level] = 0;
     }
 
     FrameMemory::getInstance().returnBuffer((float*)data.validity_reAct);
     FrameMemory::getInstance().returnBuffer(data.idepth_reAct);
     FrameMemory::getInstance().returnBuffer(data.idepthVar_reAct);
+    clear_refPixelWasGood();
 
-    if(permaRef_colorAndVarData != 0)
-        delete permaRef_colorAndVarData;
-    if(permaRef_posData != 0)
-        delete permaRef_posData;
+    data.validity_reAct = 0;
+    data.idepth_reAct = 0;
+    data.idepthVar_reAct = 0;
 
-    privateFrameAllocCount--;
-    if(enablePrintDebugInfo && printMemoryDebugInfo)
-        printf("DELETED frame %d, now there are %d\n", this->id(),
-               privateFrameAllocCount);
+    permaRef_pointData.release();
 }
 
 
-void Frame::takeReActivationData(DepthMapPixelHypothesis* depthMap)
+void Frame::takeReActivationData(const DepthMapSoA* depthMap)
 {
     boost::shared_lock<boost::shared_mutex> lock = getActiveLock();
+    swapIn();
 
     if(data.validity_reAct == 0)
         data.validity_reAct = (unsigned char*) FrameMemory::getInstance().getBuffer(
@@ -130,25 +545,30 @@ void Frame::takeReActivationData(DepthMapPixelHypothesis* depthMap)
 
 
     float* id_pt = data.idepth_reAct;
-    float* id_pt_max = data.idepth_reAct + (data.width[0]*data.height[0]);
     float* idv_pt = data.idepthVar_reAct;
     unsigned char* val_pt = data.validity_reAct;
+    int size = data.width[0]*data.height[0];
 
-    for (; id_pt < id_pt_max; ++ id_pt, ++ idv_pt, ++ val_pt, ++depthMap)
+    for(int word=0; word*64 < size; word++)
     {
-        if(depthMap->isValid)
-        {
-            *id_pt = depthMap->idepth;
-            *idv_pt = depthMap->idepth_var;
-            *val_pt = depthMap->validity_counter;
-        }
-        else if(depthMap->blacklisted < MIN_BLACKLIST)
-        {
-            *idv_pt = -2;
-        }
-        else
+        uint64_t valid = depthMap->validWord(word);
+        int end = std::min(size, word*64+64);
+        for(int idx=word*64; idx<end; idx++, valid >>= 1)
         {
-            *idv_pt = -1;
+            if(valid & 1)
+            {
+                id_pt[idx] = depthMap->idepth[idx];
+                idv_pt[idx] = depthMap->idepth_var[idx];
+                val_pt[idx] = depthMap->validity_counter[idx];
+            }
+            else if(depthMap->blacklisted[idx] < MIN_BLACKLIST)
+            {
+                idv_pt[idx] = -2;
+            }
+            else
+            {
+                idv_pt[idx] = -1;
+            }
         }
     }
 
@@ -164,22 +584,7 @@ void Frame::setPermaRef(TrackingReference* reference)
 
     permaRef_mutex.lock();
 
-    if(permaRef_colorAndVarData != 0)
-        delete permaRef_colorAndVarData;
-    if(permaRef_posData != 0)
-        delete permaRef_posData;
-
-    permaRefNumPts = reference->numData[QUICK_KF_CHECK_LVL];
-    permaRef_colorAndVarData = new Eigen::Vector2f[permaRefNumPts];
-    permaRef_posData = new Eigen::Vector3f[permaRefNumPts];
-
-    memcpy(permaRef_colorAndVarData,
-           reference->colorAndVarData[QUICK_KF_CHECK_LVL],
-           sizeof(Eigen::Vector2f) * permaRefNumPts);
-
-    memcpy(permaRef_posData,
-           reference->posData[QUICK_KF_CHECK_LVL],
-           sizeof(Eigen::Vector3f) * permaRefNumPts);
+    permaRef_pointData.copyFrom(reference->pointData[QUICK_KF_CHECK_LVL]);
 
     permaRef_mutex.unlock();
 }
@@ -208,10 +613,11 @@ void Frame::calculateMeanInformation()
 }
 
 
-void Frame::setDepth(const DepthMapPixelHypothesis* newDepth)
+void Frame::setDepth(const DepthMapSoA* newDepth)
 {
 
     boost::shared_lock<boost::shared_mutex> lock = getActiveLock();
+    swapIn();
     boost::unique_lock<boost::mutex> lock2(buildMutex);
 
     if(data.idepth[0] == 0)
@@ -223,26 +629,40 @@ void Frame::setDepth(const DepthMapPixelHypothesis* newDepth)
 
     float* pyrIDepth = data.idepth[0];
     float* pyrIDepthVar = data.idepthVar[0];
-    float* pyrIDepthMax = pyrIDepth + (data.width[0]*data.height[0]);
+    const float* newIDepth = newDepth->idepth_smoothed;
+    const float* newIDepthVar = newDepth->idepth_var_smoothed;
+    int size = data.width[0]*data.height[0];
 
     float sumIdepth=0;
     int numIdepth=0;
 
-    for (; pyrIDepth < pyrIDepthMax;
-            ++ pyrIDepth, ++ pyrIDepthVar, ++ newDepth) //, ++ pyrRefID)
+    // validity is one bit per pixel: blocks of 64 invalid pixels are filled at once.
+    for(int word=0; word*64 < size; word++)
     {
-        if (newDepth->isValid && newDepth->idepth_smoothed >= -0.05)
+        uint64_t valid = newDepth->validWord(word);
+        int end = std::min(size, word*64+64);
+        if(valid == 0)
         {
-            *pyrIDepth = newDepth->idepth_smoothed;
-            *pyrIDepthVar = newDepth->idepth_var_smoothed;
-
-            numIdepth++;
-            sumIdepth += newDepth->idepth_smoothed;
+            std::fill(pyrIDepth+word*64, pyrIDepth+end, -1.0f);
+            std::fill(pyrIDepthVar+word*64, pyrIDepthVar+end, -1.0f);
+            continue;
         }
-        else
+
+        for(int idx=word*64; idx<end; idx++, valid >>= 1)
         {
-            *pyrIDepth = -1;
-            *pyrIDepthVar = -1;
+            if ((valid & 1) && newIDepth[idx] >= -0.05)
+            {
+                pyrIDepth[idx] = newIDepth[idx];
+                pyrIDepthVar[idx] = newIDepthVar[idx];
+
+                numIdepth++;
+                sumIdepth += newIDepth[idx];
+            }
+            else
+            {
+                pyrIDepth[idx] = -1;
+                pyrIDepthVar[idx] = -1;
+            }
         }
     }
 
@@ -310,6 +730,51 @@ void Frame::setDepthFromGroundTruth(const float* depth, float cov_scale)
     data.hasIDepthBeenSet = true;
 }
 
+void Frame::setDepthFromMap(const float* idepth, const float* idepthVar,
+                            const float* idepth_reAct, const float* idepthVar_reAct,
+                            const unsigned char* validity_reAct)
+{
+    boost::shared_lock<boost::shared_mutex> lock = getActiveLock();
+    boost::unique_lock<boost::mutex> lock2(buildMutex);
+
+    int size = data.width[0]*data.height[0];
+    if(data.idepth[0] == 0)
+        data.idepth[0] = FrameMemory::getInstance().getFloatBuffer(size);
+    if(data.idepthVar[0] == 0)
+        data.idepthVar[0] = FrameMemory::getInstance().getFloatBuffer(size);
+    if(data.validity_reAct == 0)
+        data.validity_reAct = (unsigned char*) FrameMemory::getInstance().getBuffer(size);
+    if(data.idepth_reAct == 0)
+        data.idepth_reAct = FrameMemory::getInstance().getFloatBuffer(size);
+    if(data.idepthVar_reAct == 0)
+        data.idepthVar_reAct = FrameMemory::getInstance().getFloatBuffer(size);
+
+    memcpy(data.idepth[0], idepth, size * sizeof(float));
+    memcpy(data.idepthVar[0], idepthVar, size * sizeof(float));
+    memcpy(data.idepth_reAct, idepth_reAct, size * sizeof(float));
+    memcpy(data.idepthVar_reAct, idepthVar_reAct, size * sizeof(float));
+    memcpy(data.validity_reAct, validity_reAct, size);
+
+    float sumIdepth=0;
+    int numIdepth=0;
+    for(int i=0; i<size; i++)
+    {
+        if(idepthVar[i] > 0)
+        {
+            sumIdepth += idepth[i];
+            numIdepth++;
+        }
+    }
+    meanIdepth = sumIdepth / numIdepth;
+    numPoints = numIdepth;
+
+    data.idepthValid[0] = true;
+    data.idepthVarValid[0] = true;
+    release(IDEPTH | IDEPTH_VAR, true, true);
+    data.hasIDepthBeenSet = true;
+    data.reActivationDataValid = true;
+}
+
 void Frame::prepareForStereoWith(Frame* other, const Sim3& thisToOther,
                                  const Eigen::Matrix3f& K, const int level)
 {
@@ -339,17 +804,11 @@ void Frame::prepareForStereoWith(Frame* other, const Sim3& thisToOther,
 
 void Frame::require(int dataFlags, int level)
 {
-    if ((dataFlags & IMAGE) && ! data.imageValid[level])
+    if (((dataFlags & IMAGE) && ! data.imageValid[level])
+            || ((dataFlags & GRADIENTS) && ! data.gradientsValid[level])
+            || ((dataFlags & MAX_GRADIENTS) && ! data.maxGradientsValid[level]))
     {
-        buildImage(level);
-    }
-    if ((dataFlags & GRADIENTS) && ! data.gradientsValid[level])
-    {
-        buildGradients(level);
-    }
-    if ((dataFlags & MAX_GRADIENTS) && ! data.maxGradientsValid[level])
-    {
-        buildMaxGradients(level);
+        buildPyramidLevel(level, dataFlags);
     }
     if (((dataFlags & IDEPTH) && ! data.idepthValid[level])
             || ((dataFlags & IDEPTH_VAR) && ! data.idepthVarValid[level]))
@@ -415,12 +874,135 @@ bool Frame::minimizeInMemory()
     return false;
 }
 
+int Frame::swappableArrays(void** arrays[6], size_t bytes[6], bool depth,
+                           bool reActivationData)
+{
+    size_t size = data.width[0]*data.height[0];
+    int num = 0;
+
+    arrays[num] = reinterpret_cast<void**>(&data.image[0]);
+    bytes[num++] = size*sizeof(float);
+    if(depth)
+    {
+        arrays[num] = reinterpret_cast<void**>(&data.idepth[0]);
+        bytes[num++] = size*sizeof(float);
+        arrays[num] = reinterpret_cast<void**>(&data.idepthVar[0]);
+        bytes[num++] = size*sizeof(float);
+    }
+    if(reActivationData)
+    {
+        arrays[num] = reinterpret_cast<void**>(&data.idepth_reAct);
+        bytes[num++] = size*sizeof(float);
+        arrays[num] = reinterpret_cast<void**>(&data.idepthVar_reAct);
+        bytes[num++] = size*sizeof(float);
+        arrays[num] = reinterpret_cast<void**>(&data.validity_reAct);
+        bytes[num++] = size;
+    }
+    return num;
+}
+
+bool Frame::swapOut()
+{
+    if(!activeMutex.timed_lock(boost::posix_time::milliseconds(10)))
+        return false;
+    buildMutex.lock();
+
+    bool swapped = false;
+    if(!data.swappedOut && data.imageValid[0])
+    {
+        bool depth = data.hasIDepthBeenSet && data.idepthValid[0] && data.idepthVarValid[0];
+        bool reActivationData = data.reActivationDataValid;
+
+        void** arrays[6];
+        size_t bytes[6];
+        int num = swappableArrays(arrays, bytes, depth, reActivationData);
+        size_t totalBytes = 0;
+        for(int i=0; i<num; i++)
+            totalBytes += bytes[i];
+
+        int64_t offset = FrameMemory::getInstance().allocateSwap(totalBytes);
+        bool written = offset >= 0;
+        for(int64_t pos = offset, i=0; written && i<num; pos += bytes[i], i++)
+            written = FrameMemory::getInstance().writeSwap(pos, *arrays[i], bytes[i]);
+
+        if(written)
+        {
+            if(enablePrintDebugInfo && printMemoryDebugInfo)
+                printf("swapping out frame %d\n", id());
+
+            FrameMemory::getInstance().dropSwapPages(offset, totalBytes);
+
+            for(int i=0; i<num; i++)
+            {
+                FrameMemory::getInstance().returnBuffer(*arrays[i]);
+                *arrays[i] = 0;
+            }
+
+            data.imageValid[0] = false;
+            if(depth)
+                data.idepthValid[0] = data.idepthVarValid[0] = false;
+            data.reActivationDataValid = false;
+
+            data.swappedOut = true;
+            data.swappedDepth = depth;
+            data.swappedReActivationData = reActivationData;
+            data.swapOffset = offset;
+            data.swapBytes = totalBytes;
+            swapped = true;
+        }
+        else if(offset >= 0)
+            FrameMemory::getInstance().freeSwap(offset, totalBytes);
+    }
+
+    buildMutex.unlock();
+    activeMutex.unlock();
+    return swapped;
+}
+
+void Frame::swapIn()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(buildMutex);
+        if(!data.swappedOut)
+            return;
+
+        if(enablePrintDebugInfo && printMemoryDebugInfo)
+            printf("swapping in frame %d\n", id());
+
+        void** arrays[6];
+        size_t bytes[6];
+        int num = swappableArrays(arrays, bytes, data.swappedDepth,
+                                  data.swappedReActivationData);
+
+        int64_t pos = data.swapOffset;
+        for(int i=0; i<num; i++)
+        {
+            *arrays[i] = FrameMemory::getInstance().getBuffer(bytes[i]);
+            if(!FrameMemory::getInstance().readSwap(pos, *arrays[i], bytes[i]))
+                printfAssert("Frame::swapIn(): could not read from the swap file!");
+            pos += bytes[i];
+        }
+        FrameMemory::getInstance().dropSwapPages(data.swapOffset, data.swapBytes);
+        FrameMemory::getInstance().freeSwap(data.swapOffset, data.swapBytes);
+
+        data.imageValid[0] = true;
+        if(data.swappedDepth)
+            data.idepthValid[0] = data.idepthVarValid[0] = true;
+        if(data.swappedReActivationData)
+            data.reActivationDataValid = true;
+        data.swappedOut = false;
+    }
+
+    // it is not active, so it has to be cold to be swapped out again.
+    FrameMemory::getInstance().frameSwappedIn(this);
+}
+
 void Frame::initialize(int id, int width, int height, const Eigen::Matrix3f& K,
                        double timestamp)
 {
     data.id = id;
 
-    pose = new FramePoseStruct(this);
+    pose = FrameMemory::getInstance().getPoseStruct(this);
 
     data.K[0] = K;
     data.fx[0] = K(0,0);
@@ -488,9 +1070,10 @@ void Frame::initialize(int id, int width, int height, const Eigen::Matrix3f& K,
 
     data.refPixelWasGood = 0;
 
-    permaRefNumPts = 0;
-    permaRef_colorAndVarData = 0;
-    permaRef_posData = 0;
+    data.swappedOut = false;
+    data.swappedDepth = data.swappedReActivationData = false;
+    data.swapOffset = -1;
+    data.swapBytes = 0;
 
     meanIdepth = 1;
     numPoints = 0;
@@ -504,6 +1087,7 @@ void Frame::initialize(int id, int width, int height, const Eigen::Matrix3f& K,
     lastConstraintTrackedCamToWorld = Sim3();
 
     isActive = false;
+    isCold = false;
 }
 
 void Frame::setDepth_Allocate()
@@ -511,146 +1095,122 @@ void Frame::setDepth_Allocate()
     return;
 }
 
-void Frame::buildImage(int level)
+void Frame::buildPyramidLevel(int level, int dataFlags)
 {
-    if (level == 0)
+    if (! data.imageValid[level])
     {
-        printf("Frame::buildImage(0): Loading image from disk is not implemented yet! No-op.\n");
-        return;
+        if (level == 0)
+        {
+            if(data.swappedOut)
+                swapIn();
+            if (! data.imageValid[0])
+            {
+                printf("Frame::buildPyramidLevel(0): the image has been released! No-op.\n");
+                return;
+            }
+        }
+        else
+            require(IMAGE, level - 1);
     }
 
-    require(IMAGE, level - 1);
     boost::unique_lock<boost::mutex> lock2(buildMutex);
 
-    if(data.imageValid[level])
+    bool newImage = ! data.imageValid[level];
+    bool newGradients = (dataFlags & GRADIENTS) && ! data.gradientsValid[level];
+    bool newMaxGradients = (dataFlags & MAX_GRADIENTS)
+                           && ! data.maxGradientsValid[level];
+    if(!newImage && !newGradients && !newMaxGradients)
         return;
 
     if(enablePrintDebugInfo && printFrameBuildDebugInfo)
-        printf("CREATE Image lvl %d for frame %d\n", level, id());
-
-    int width = data.width[level - 1];
-    int height = data.height[level - 1];
-    const float* source = data.image[level - 1];
-
-    if (data.image[level] == 0)
-        data.image[level] = FrameMemory::getInstance().getFloatBuffer(
-                                data.width[level] * data.height[level]);
-    float* dest = data.image[level];
-
-#if defined(ENABLE_SSE)
-    // I assume all all subsampled width's are a multiple of 8.
-    // if this is not the case, this still works except for the last * pixel, which will produce a segfault.
-    // in that case, reduce this loop and calculate the last 0-3 dest pixels by hand....
-    if (width % 8 == 0)
-    {
-        __m128 p025 = _mm_setr_ps(0.25f,0.25f,0.25f,0.25f);
-
-        const float* maxY = source+width*height;
-        for(const float* y = source; y < maxY; y+=width*2)
-        {
-            const float* maxX = y+width;
-            for(const float* x=y; x < maxX; x += 8)
-            {
-                // i am calculating four dest pixels at a time.
+        printf("CREATE%s%s%s lvl %d for frame %d\n", newImage ? " Image" : "",
+               newGradients ? " Gradients" : "", newMaxGradients ? " AbsGrad" : "", level, id());
 
-                __m128 top_left = _mm_load_ps((float*)x);
-                __m128 bot_left = _mm_load_ps((float*)x+width);
-                __m128 left = _mm_add_ps(top_left,bot_left);
-
-                __m128 top_right = _mm_load_ps((float*)x+4);
-                __m128 bot_right = _mm_load_ps((float*)x+width+4);
-                __m128 right = _mm_add_ps(top_right,bot_right);
-
-                __m128 sumA = _mm_shuffle_ps(left,right, _MM_SHUFFLE(2,0,2,0));
-                __m128 sumB = _mm_shuffle_ps(left,right, _MM_SHUFFLE(3,1,3,1));
+    int width = data.width[level];
+    int height = data.height[level];
 
-                __m128 sum = _mm_add_ps(sumA,sumB);
-                sum = _mm_mul_ps(sum,p025);
+    if (newImage && data.image[level] == 0)
+        data.image[level] = FrameMemory::getInstance().getFloatBuffer(width * height);
+    if (newGradients && data.gradients[level] == 0)
+        data.gradients[level] = (Eigen::Vector4f*)FrameMemory::getInstance().getBuffer(
+                                    sizeof(Eigen::Vector4f) * width * height);
+    if (newMaxGradients && data.maxGradients[level] == 0)
+        data.maxGradients[level] = FrameMemory::getInstance().getFloatBuffer(
+                                       width * height);
 
-                _mm_store_ps(dest, sum);
-                dest += 4;
-            }
-        }
+    float* image = data.image[level];
+    Eigen::Vector4f* gradients = newGradients ? data.gradients[level] : 0;
+    // holds the gradient length until it is overwritten by the max of it.
+    float* maxGradients = newMaxGradients ? data.maxGradients[level] : 0;
+    float* maxGradTemp = newMaxGradients ? FrameMemory::getInstance().getFloatBuffer(
+                             width * height) : 0;
 
-        data.imageValid[level] = true;
-        return;
+    // the first and last row have no gradient.
+    if(gradients != 0)
+    {
+        std::fill_n(gradients, width, Eigen::Vector4f::Zero());
+        std::fill_n(gradients + width*(height-1), width, Eigen::Vector4f::Zero());
     }
-#elif defined(ENABLE_NEON)
-    // I assume all all subsampled width's are a multiple of 8.
-    // if this is not the case, this still works except for the last * pixel, which will produce a segfault.
-    // in that case, reduce this loop and calculate the last 0-3 dest pixels by hand....
-    if (width % 8 == 0)
+    if(maxGradients != 0)
     {
-        static const float p025[] = {0.25, 0.25, 0.25, 0.25};
-        int width_iteration_count = width / 8;
-        int height_iteration_count = height / 2;
-        const float* cur_px = source;
-        const float* next_row_px = source + width;
-
-        __asm__ __volatile__
-        (
-            "vldmia %[p025], {q10}                        \n\t" // p025(q10)
-
-            ".height_loop:                                \n\t"
-
-            "mov r5, %[width_iteration_count]             \n\t" // store width_iteration_count
-            ".width_loop:                                 \n\t"
-
-            "vldmia   %[cur_px]!, {q0-q1}             \n\t" // top_left(q0), top_right(q1)
-            "vldmia   %[next_row_px]!, {q2-q3}        \n\t" // bottom_left(q2), bottom_right(q3)
-
-            "vadd.f32 q0, q0, q2                      \n\t" // left(q0)
-            "vadd.f32 q1, q1, q3                      \n\t" // right(q1)
-
-            "vpadd.f32 d0, d0, d1                     \n\t" // pairwise add into sum(q0)
-            "vpadd.f32 d1, d2, d3                     \n\t"
-            "vmul.f32 q0, q0, q10                     \n\t" // multiply with 0.25 to get average
-
-            "vstmia %[dest]!, {q0}                    \n\t"
-
-            "subs     %[width_iteration_count], %[width_iteration_count], #1 \n\t"
-            "bne      .width_loop                     \n\t"
-            "mov      %[width_iteration_count], r5    \n\t" // restore width_iteration_count
-
-            // Advance one more line
-            "add      %[cur_px], %[cur_px], %[rowSize]    \n\t"
-            "add      %[next_row_px], %[next_row_px], %[rowSize] \n\t"
-
-            "subs     %[height_iteration_count], %[height_iteration_count], #1 \n\t"
-            "bne      .height_loop                       \n\t"
-
-            : /* outputs */ [cur_px]"+&r"(cur_px),
-            [next_row_px]"+&r"(next_row_px),
-            [width_iteration_count]"+&r"(width_iteration_count),
-            [height_iteration_count]"+&r"(height_iteration_count),
-            [dest]"+&r"(dest)
-            : /* inputs  */ [p025]"r"(p025),
-            [rowSize]"r"(width * sizeof(float))
-            : /* clobber */ "memory", "cc", "r5",
-            "q0", "q1", "q2", "q3", "q10"
-        );
-
-        data.imageValid[level] = true;
-        return;
+        memset(maxGradients, 0, sizeof(float) * width);
+        memset(maxGradients + width*(height-1), 0, sizeof(float) * width);
     }
-#endif
 
-    int wh = width*height;
-    const float* s;
-    for(int y=0; y<wh; y+=width*2)
+    // each stage lags a row behind the one before, as it needs the row below:
+    // gradients the image, the vertical max the gradient length and the horizontal
+    // max the vertical one (as x wraps around into the next row).
+    PyramidKernels kernels = getPyramidKernels();
+    int tileRows = std::max(4, pyramidTileBytes / (pyramidBytesPerPixel * width));
+    int gradientRow = 1, verticalMaxRow = 1, horizontalMaxRow = 1;
+    int numMappablePixels = 0;
+    for(int tileStart = 0; tileStart < height; tileStart += tileRows)
     {
-        for(int x=0; x<width; x+=2)
-        {
-            s = source + x + y;
-            *dest = (s[0] +
-                     s[1] +
-                     s[width] +
-                     s[1+width]) * 0.25f;
-            dest++;
-        }
+        int tileEnd = std::min(height, tileStart + tileRows);
+        bool lastTile = tileEnd == height;
+
+        if(newImage)
+            kernels.downsampleRows(data.image[level-1] + 2*tileStart*data.width[level-1],
+                                   data.width[level-1], image + tileStart*width, width, tileEnd - tileStart);
+
+        if(!newGradients && !newMaxGradients)
+            continue;
+
+        int gradientEnd = std::min(height-1, tileEnd-1);
+        kernels.gradients(image, width, gradientRow*width, gradientEnd*width,
+                          gradients, maxGradients);
+        gradientRow = gradientEnd;
+
+        if(!newMaxGradients)
+            continue;
+
+        int verticalMaxEnd = lastTile ? height-1 : tileEnd-2;
+        kernels.verticalMax(maxGradients, width, verticalMaxRow*width,
+                            verticalMaxEnd*width, maxGradTemp);
+        verticalMaxRow = verticalMaxEnd;
+
+        // the first and last pixel in between the borders keep the gradient length.
+        int horizontalMaxEnd = lastTile ? height-1 : verticalMaxEnd-1;
+        int begin = std::max(horizontalMaxRow*width, width+1);
+        int end = std::min(horizontalMaxEnd*width, width*(height-1)-1);
+        if(end > begin)
+            numMappablePixels += kernels.horizontalMax(maxGradTemp, begin, end,
+                                 maxGradients);
+        horizontalMaxRow = horizontalMaxEnd;
     }
 
-    data.imageValid[level] = true;
+    if(newImage)
+        data.imageValid[level] = true;
+    if(newGradients)
+        data.gradientsValid[level] = true;
+    if(newMaxGradients)
+    {
+        FrameMemory::getInstance().returnBuffer(maxGradTemp);
+
+        if(level==0)
+            this->numMappablePixels = numMappablePixels;
+        data.maxGradientsValid[level] = true;
+    }
 }
 
 void Frame::releaseImage(int level)
@@ -664,46 +1224,6 @@ void Frame::releaseImage(int level)
     data.image[level] = 0;
 }
 
-void Frame::buildGradients(int level)
-{
-    require(IMAGE, level);
-    boost::unique_lock<boost::mutex> lock2(buildMutex);
-
-    if(data.gradientsValid[level])
-        return;
-
-    if(enablePrintDebugInfo && printFrameBuildDebugInfo)
-        printf("CREATE Gradients lvl %d for frame %d\n", level, id());
-
-    int width = data.width[level];
-    int height = data.height[level];
-    if(data.gradients[level] == 0)
-        data.gradients[level] = (Eigen::Vector4f*)FrameMemory::getInstance().getBuffer(
-                                    sizeof(Eigen::Vector4f) * width * height);
-    const float* img_pt = data.image[level] + width;
-    const float* img_pt_max = data.image[level] + width*(height-1);
-    Eigen::Vector4f* gradxyii_pt = data.gradients[level] + width;
-
-    // in each iteration i need -1,0,p1,mw,pw
-    float val_m1 = *(img_pt-1);
-    float val_00 = *img_pt;
-    float val_p1;
-
-    for(; img_pt < img_pt_max; img_pt++, gradxyii_pt++)
-    {
-        val_p1 = *(img_pt+1);
-
-        *((float*)gradxyii_pt) = 0.5f*(val_p1 - val_m1);
-        *(((float*)gradxyii_pt)+1) = 0.5f*(*(img_pt+width) - *(img_pt-width));
-        *(((float*)gradxyii_pt)+2) = val_00;
-
-        val_m1 = val_00;
-        val_00 = val_p1;
-    }
-
-    data.gradientsValid[level] = true;
-}
-
 void Frame::releaseGradients(int level)
 {
     FrameMemory::getInstance().returnBuffer(reinterpret_cast<float*>
@@ -713,86 +1233,6 @@ void Frame::releaseGradients(int level)
 
 
 
-void Frame::buildMaxGradients(int level)
-{
-    require(GRADIENTS, level);
-    boost::unique_lock<boost::mutex> lock2(buildMutex);
-
-    if(data.maxGradientsValid[level]) return;
-
-    if(enablePrintDebugInfo && printFrameBuildDebugInfo)
-        printf("CREATE AbsGrad lvl %d for frame %d\n", level, id());
-
-    int width = data.width[level];
-    int height = data.height[level];
-    if (data.maxGradients[level] == 0)
-        data.maxGradients[level] = FrameMemory::getInstance().getFloatBuffer(
-                                       width * height);
-
-    float* maxGradTemp = FrameMemory::getInstance().getFloatBuffer(width * height);
-
-
-    // 1. write abs gradients in real data.
-    Eigen::Vector4f* gradxyii_pt = data.gradients[level] + width;
-    float* maxgrad_pt = data.maxGradients[level] + width;
-    float* maxgrad_pt_max = data.maxGradients[level] + width*(height-1);
-
-    for(; maxgrad_pt < maxgrad_pt_max; maxgrad_pt++, gradxyii_pt++)
-    {
-        float dx = *((float*)gradxyii_pt);
-        float dy = *(1+(float*)gradxyii_pt);
-        *maxgrad_pt = sqrtf(dx*dx + dy*dy);
-    }
-
-    // 2. smear up/down direction into temp buffer
-    maxgrad_pt = data.maxGradients[level] + width+1;
-    maxgrad_pt_max = data.maxGradients[level] + width*(height-1)-1;
-    float* maxgrad_t_pt = maxGradTemp + width+1;
-    for(; maxgrad_pt<maxgrad_pt_max; maxgrad_pt++, maxgrad_t_pt++)
-    {
-        float g1 = maxgrad_pt[-width];
-        float g2 = maxgrad_pt[0];
-        if(g1 < g2) g1 = g2;
-        float g3 = maxgrad_pt[width];
-        if(g1 < g3)
-            *maxgrad_t_pt = g3;
-        else
-            *maxgrad_t_pt = g1;
-    }
-
-    float numMappablePixels = 0;
-    // 2. smear left/right direction into real data
-    maxgrad_pt = data.maxGradients[level] + width+1;
-    maxgrad_pt_max = data.maxGradients[level] + width*(height-1)-1;
-    maxgrad_t_pt = maxGradTemp + width+1;
-    for(; maxgrad_pt<maxgrad_pt_max; maxgrad_pt++, maxgrad_t_pt++)
-    {
-        float g1 = maxgrad_t_pt[-1];
-        float g2 = maxgrad_t_pt[0];
-        if(g1 < g2) g1 = g2;
-        float g3 = maxgrad_t_pt[1];
-        if(g1 < g3)
-        {
-            *maxgrad_pt = g3;
-            if(g3 >= MIN_ABS_GRAD_CREATE)
-                numMappablePixels++;
-        }
-        else
-        {
-            *maxgrad_pt = g1;
-            if(g1 >= MIN_ABS_GRAD_CREATE)
-                numMappablePixels++;
-        }
-    }
-
-    if(level==0)
-        this->numMappablePixels = numMappablePixels;
-
-    FrameMemory::getInstance().returnBuffer(maxGradTemp);
-
-    data.maxGradientsValid[level] = true;
-}
-
 void Frame::releaseMaxGradients(int level)
 {
     FrameMemory::getInstance().returnBuffer(data.maxGradients[level]);
@@ -808,7 +1248,10 @@ void Frame::buildIDepthAndIDepthVar(int level)
     }
     if (level == 0)
     {
-        printf("Frame::buildIDepthAndIDepthVar(0): Loading depth from disk is not implemented yet! No-op.\n");
+        if(data.swappedOut)
+            swapIn();
+        else
+            printf("Frame::buildIDepthAndIDepthVar(0): the depth has been released! No-op.\n");
         return;
     }
 
@@ -25,6 +25,7 @@
 #include <boost/thread/shared_mutex.hpp>
 #include "model/frame_pose_struct.h"
 #include "model/frame_memory.h"
+#include "tracking/point_cloud_soa.h"
 #include "unordered_set"
 #include "util/settings.h"
 
@@ -33,7 +34,7 @@ namespace lsd_slam
 {
 
 
-class DepthMapPixelHypothesis;
+class DepthMapSoA;
 class TrackingReference;
 /**
  */
@@ -55,7 +56,7 @@ public:
 
 
     /** Sets or updates idepth and idepthVar on level zero. Invalidates higher levels. */
-    void setDepth(const DepthMapPixelHypothesis* newDepth);
+    void setDepth(const DepthMapSoA* newDepth);
 
     /** Calculates mean information for statistical purposes. */
     void calculateMeanInformation();
@@ -63,6 +64,12 @@ public:
     /** Sets ground truth depth (real, not inverse!) from a float array on level zero. Invalidates higher levels. */
     void setDepthFromGroundTruth(const float* depth, float cov_scale = 1.0f);
 
+    /** Restores a keyframe's depth from a map file: idepth and idepthVar on level zero,
+      * and the re-activation data. Invalidates higher levels. */
+    void setDepthFromMap(const float* idepth, const float* idepthVar,
+                         const float* idepth_reAct, const float* idepthVar_reAct,
+                         const unsigned char* validity_reAct);
+
     /** Prepares this frame for stereo comparisons with the other frame (computes some intermediate values that will be needed) */
     void prepareForStereoWith(Frame* other, const Sim3& thisToOther,
                               const Eigen::Matrix3f& K, const int level);
@@ -132,7 +139,7 @@ public:
 
 
     void setPermaRef(TrackingReference* reference);
-    void takeReActivationData(DepthMapPixelHypothesis* depthMap);
+    void takeReActivationData(const DepthMapSoA* depthMap);
 
 
     // shared_lock this as long as any minimizable arrays are being used.
@@ -178,9 +185,7 @@ public:
     // Tracking Reference for quick test. Always available, never taken out of memory.
     // this is used for re-localization and re-Keyframe positioning.
     boost::mutex permaRef_mutex;
-    Eigen::Vector3f* permaRef_posData;	// (x,y,z)
-    Eigen::Vector2f* permaRef_colorAndVarData;	// (I, Var)
-    int permaRefNumPts;
+    PointCloudSoA permaRef_pointData;	// x[], y[], z[], I[], Var[]
 
 
 
@@ -219,15 +224,21 @@ private:
 
     void initialize(int id, int width, int height, const Eigen::Matrix3f& K,
                     double timestamp);
+    /** Allocates image level 0 and converts the image to it. */
+    void setImage(const unsigned char* image);
+
+    /** Re-initializes a frame that was kept by FrameMemory, same as the constructor. */
+    void reset(int id, int width, int height, const Eigen::Matrix3f& K,
+               double timestamp, const unsigned char* image);
+    /** Returns all buffers and the pose struct, same as the destructor, but keeps the object. */
+    void releaseAll();
     void setDepth_Allocate();
 
-    void buildImage(int level);
+    /** Builds what is missing of IMAGE, GRADIENTS and MAX_GRADIENTS (as in dataFlags) on
+      * one level, in a single pass over tiles of rows. The image is always built. */
+    void buildPyramidLevel(int level, int dataFlags);
     void releaseImage(int level);
-
-    void buildGradients(int level);
     void releaseGradients(int level);
-
-    void buildMaxGradients(int level);
     void releaseMaxGradients(int level);
 
     void buildIDepthAndIDepthVar(int level);
@@ -236,6 +247,14 @@ private:
 
     void printfAssert(const char* message) const;
 
+    /** Stores the level-0 data in the swap file of FrameMemory and releases it.
+      * Fails if an active-lock is held, or if the swap file can't be used. */
+    bool swapOut();
+    /** Loads swapped-out level-0 data again (no-op if not swapped out). */
+    void swapIn();
+    /** The level-0 arrays that are swapped out (in swap file order), returns their number. */
+    int swappableArrays(void** arrays[6], size_t bytes[6], bool depth, bool reActivationData);
+
     struct Data
     {
         int id;
@@ -283,6 +302,12 @@ private:
         // data from initial tracking, indicating which pixels in the reference frame ware good or not.
         // deleted as soon as frame is used for mapping.
         bool* refPixelWasGood;
+
+        // level-0 data swapped out by FrameMemory (see swapOut()).
+        bool swappedOut;
+        bool swappedDepth, swappedReActivationData;
+        int64_t swapOffset;
+        size_t swapBytes;
     };
     Data data;
 
@@ -293,6 +318,7 @@ private:
 
     boost::shared_mutex activeMutex;
     bool isActive;
+    bool isCold;	// in FrameMemory::coldFrames.
 
     /** Releases everything which can be recalculated, but keeps the minimal
       * representation in memory. Use release(Frame::ALL, false) to store on disk instead.
@@ -399,18 +425,24 @@ inline const float* Frame::idepth(int level)
 }
 inline const unsigned char* Frame::validity_reAct()
 {
+    if(data.swappedOut)
+        swapIn();
     if( !data.reActivationDataValid)
         return 0;
     return data.validity_reAct;
 }
 inline const float* Frame::idepth_reAct()
 {
+    if(data.swappedOut)
+        swapIn();
     if( !data.reActivationDataValid)
         return 0;
     return data.idepth_reAct;
 }
 inline const float* Frame::idepthVar_reAct()
 {
+    if(data.swappedOut)
+        swapIn();
     if( !data.reActivationDataValid)
         return 0;
     return data.idepthVar_reAct;
@@ -21,15 +21,141 @@
 #include "model/frame_memory.h"
 #include "model/frame.h"
 #include <memory>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
 #include <Eigen/Core>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
 namespace lsd_slam
 {
 
+// the swap file grows in steps of this many bytes, each step re-maps it.
+static const size_t swapFileGrowth = 256 << 20;
+static const size_t swapPageSize = 4096;
+
+
+// buffers are 16-byte aligned (as by aligned_malloc), their header is in front of them.
+static const size_t bufferHeaderSize = 64;
+
+// returned buffers each thread keeps per size class, before they go to the shared free list.
+static const int threadCacheBuffers = 4;
+// larger buffers always go to the shared free lists: the memory budget can only free
+// those (freeAvailableBuffer()), and they are too large for the lock to matter anyway.
+static const unsigned int threadCacheMaxBytes = 64 << 10;
+
+// frames / pose structs kept for re-use, beyond that they are deleted.
+static const size_t maxAvailableFrames = 32;
+static const size_t maxAvailablePoseStructs = 256;
+
+
+/** Allocates from the FrameMemory buffer pool, used for the shared_ptr control blocks of getFrame(). */
+template<typename T>
+struct FrameMemoryAllocator
+{
+    typedef T value_type;
+
+    FrameMemoryAllocator() {}
+    template<typename U>
+    FrameMemoryAllocator(const FrameMemoryAllocator<U>&) {}
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(FrameMemory::getInstance().getBuffer(sizeof(T) * n));
+    }
+    void deallocate(T* p, size_t)
+    {
+        FrameMemory::getInstance().returnBuffer(p);
+    }
+};
+template<typename T, typename U>
+bool operator==(const FrameMemoryAllocator<T>&, const FrameMemoryAllocator<U>&)
+{
+    return true;
+}
+template<typename T, typename U>
+bool operator!=(const FrameMemoryAllocator<T>&, const FrameMemoryAllocator<U>&)
+{
+    return false;
+}
+
+struct ReturnFrame
+{
+    void operator()(Frame* frame) const
+    {
+        FrameMemory::getInstance().returnFrame(frame);
+    }
+};
+
+
+/** Buffers returned by one thread, per size class, linked through BufferHeader::next. */
+struct ThreadBufferCache
+{
+    FrameMemory::BufferHeader* buffers[FrameMemory::MAX_SIZE_CLASSES];
+    int numBuffers[FrameMemory::MAX_SIZE_CLASSES];
+
+    ThreadBufferCache()
+    {
+        for(int i=0; i<FrameMemory::MAX_SIZE_CLASSES; i++)
+        {
+            buffers[i] = 0;
+            numBuffers[i] = 0;
+        }
+    }
+
+    /** Gives all buffers back to the shared free lists. */
+    void flush()
+    {
+        for(int i=0; i<FrameMemory::MAX_SIZE_CLASSES; i++)
+        {
+            if(buffers[i] == 0)
+                continue;
+
+            FrameMemory::BufferHeader* last = buffers[i];
+            while(last->next != 0)
+                last = last->next;
+            FrameMemory::getInstance().pushAvailable(buffers[i], last, i);
+
+            buffers[i] = 0;
+            numBuffers[i] = 0;
+        }
+    }
+
+    ~ThreadBufferCache()
+    {
+        flush();
+    }
+};
+
+static thread_local ThreadBufferCache threadBufferCache;
 
 
 FrameMemory::FrameMemory()
 {
+    numSizeClasses = 0;
+    for(int i=0; i<MAX_SIZE_CLASSES; i++)
+    {
+        classSizes[i] = 0;
+        availableBuffers[i] = 0;
+    }
+
+    allocatedBytes = 0;
+    pooledBytes = 0;
+    poolHits = 0;
+    poolMisses = 0;
+
+    availableFrames.reserve(maxAvailableFrames);
+    availablePoseStructs.reserve(maxAvailablePoseStructs);
+
+    swapUnavailable = false;
+    swapFd = -1;
+    swapMapping = 0;
+    swapSize = swapUsed = 0;
 }
 
 FrameMemory& FrameMemory::getInstance()
@@ -40,62 +166,105 @@ FrameMemory& FrameMemory::getInstance()
 
 void FrameMemory::releaseBuffes()
 {
-    boost::unique_lock<boost::mutex> lock(accessMutex);
-    int total = 0;
+    // the frames return their buffers, so they go first.
+    std::vector<Frame*> frames;
+    std::vector<FramePoseStruct*> poses;
+    framePoolMutex.lock();
+    frames.swap(availableFrames);
+    poses.swap(availablePoseStructs);
+    framePoolMutex.unlock();
 
+    for(Frame* frame : frames)
+        delete frame;
+    for(FramePoseStruct* pose : poses)
+        delete pose;
 
-    for(auto p : availableBuffers)
-    {
-        if(printMemoryDebugInfo)
-            printf("deleting %d buffers of size %d!\n", (int)p.second.size(),
-                   (int)p.first);
-
-        total += p.second.size() * p.first;
+    threadBufferCache.flush();
 
-        for(unsigned int i=0; i<p.second.size(); i++)
+    size_t total = 0;
+    for(int c=0; c<numSizeClasses; c++)
+    {
+        int num = 0;
+        BufferHeader* header = takeAvailable(c);
+        while(header != 0)
         {
-            //delete (char*)p.second[i];
-            Eigen::internal::aligned_free(p.second[i]);
-            bufferSizes.erase(p.second[i]);
+            BufferHeader* next = header->next;
+            pooledBytes -= header->size;
+            total += header->size;
+            freeBuffer(header);
+            header = next;
+            num++;
         }
 
-        p.second.clear();
+        if(printMemoryDebugInfo && num > 0)
+            printf("deleting %d buffers of size %d!\n", num, (int)classSizes[c]);
     }
-    availableBuffers.clear();
 
     if(printMemoryDebugInfo)
         printf("released %.1f MB!\n", total / (1000000.0f));
+
+    closeSwap();
+}
+
+FrameMemoryStats FrameMemory::getStats() const
+{
+    FrameMemoryStats stats;
+    stats.hits = poolHits;
+    stats.misses = poolMisses;
+    stats.allocatedBytes = allocatedBytes;
+    stats.pooledBytes = pooledBytes;
+    return stats;
 }
 
 
 void* FrameMemory::getBuffer(unsigned int sizeInByte)
 {
-    boost::unique_lock<boost::mutex> lock(accessMutex);
-
-    if (availableBuffers.count(sizeInByte) > 0)
+    int sizeClass = getSizeClass(sizeInByte);
+    if(sizeClass >= 0)
     {
-        std::vector< void* >& availableOfSize = availableBuffers.at(sizeInByte);
-        if (availableOfSize.empty())
+        ThreadBufferCache& cache = threadBufferCache;
+        if(cache.buffers[sizeClass] == 0)
         {
-            void* buffer = allocateBuffer(sizeInByte);
-//			assert(buffer != 0);
-            return buffer;
+            // take all shared ones, keep a few (only the one to return if they are
+            // not cached) and put the rest back.
+            int keep = sizeInByte <= threadCacheMaxBytes ? threadCacheBuffers : 1;
+            BufferHeader* taken = takeAvailable(sizeClass);
+            if(taken != 0)
+            {
+                BufferHeader* last = taken;
+                int num = 1;
+                while(last->next != 0 && num < keep)
+                {
+                    last = last->next;
+                    num++;
+                }
+                if(last->next != 0)
+                {
+                    BufferHeader* rest = last->next;
+                    BufferHeader* restLast = rest;
+                    while(restLast->next != 0)
+                        restLast = restLast->next;
+                    pushAvailable(rest, restLast, sizeClass);
+                    last->next = 0;
+                }
+                cache.buffers[sizeClass] = taken;
+                cache.numBuffers[sizeClass] = num;
+            }
         }
-        else
-        {
-            void* buffer = availableOfSize.back();
-            availableOfSize.pop_back();
 
-//			assert(buffer != 0);
-            return buffer;
+        BufferHeader* header = cache.buffers[sizeClass];
+        if(header != 0)
+        {
+            cache.buffers[sizeClass] = header->next;
+            cache.numBuffers[sizeClass]--;
+            pooledBytes -= sizeInByte;
+            poolHits.fetch_add(1, std::memory_order_relaxed);
+            return reinterpret_cast<char*>(header) + bufferHeaderSize;
         }
     }
-    else
-    {
-        void* buffer = allocateBuffer(sizeInByte);
-//		assert(buffer != 0);
-        return buffer;
-    }
+
+    poolMisses.fetch_add(1, std::memory_order_relaxed);
+    return allocateBuffer(sizeInByte, sizeClass);
 }
 
 float* FrameMemory::getFloatBuffer(unsigned int size)
@@ -107,28 +276,191 @@ void FrameMemory::returnBuffer(void* buffer)
 {
     if(buffer==0) return;
 
-    boost::unique_lock<boost::mutex> lock(accessMutex);
+    BufferHeader* header = reinterpret_cast<BufferHeader*>(static_cast<char*>
+                           (buffer) - bufferHeaderSize);
+    int sizeClass = header->sizeClass;
+    if(sizeClass < 0)
+    {
+        freeBuffer(header);
+        return;
+    }
 
-    unsigned int size = bufferSizes.at(buffer);
-    //printf("returnFloatBuffer(%d)\n", size);
-    if (availableBuffers.count(size) > 0)
-        availableBuffers.at(size).push_back(buffer);
-    else
+    pooledBytes += header->size;
+
+    ThreadBufferCache& cache = threadBufferCache;
+    if(header->size <= threadCacheMaxBytes && cache.numBuffers[sizeClass] < threadCacheBuffers)
     {
-        std::vector< void* > availableOfSize;
-        availableOfSize.push_back(buffer);
-        availableBuffers.insert(std::make_pair(size, availableOfSize));
+        header->next = cache.buffers[sizeClass];
+        cache.buffers[sizeClass] = header;
+        cache.numBuffers[sizeClass]++;
     }
+    else
+        pushAvailable(header, header, sizeClass);
 }
 
-void* FrameMemory::allocateBuffer(unsigned int size)
+void* FrameMemory::allocateBuffer(unsigned int size, int sizeClass)
 {
     //printf("allocateFloatBuffer(%d)\n", size);
 
-    //void* buffer = (void*)(new char[size]);
-    void* buffer = Eigen::internal::aligned_malloc(sizeof(char)*size);
-    bufferSizes.insert(std::make_pair(buffer, size));
-    return buffer;
+    BufferHeader* header = static_cast<BufferHeader*>(Eigen::internal::aligned_malloc(
+                               bufferHeaderSize + size));
+    header->next = 0;
+    header->size = size;
+    header->sizeClass = sizeClass;
+    allocatedBytes += size;
+    return reinterpret_cast<char*>(header) + bufferHeaderSize;
+}
+
+void FrameMemory::freeBuffer(BufferHeader* header)
+{
+    allocatedBytes -= header->size;
+    Eigen::internal::aligned_free(header);
+}
+
+int FrameMemory::getSizeClass(unsigned int sizeInByte)
+{
+    int num = numSizeClasses.load(std::memory_order_acquire);
+    for(int i=0; i<num; i++)
+        if(classSizes[i] == sizeInByte)
+            return i;
+
+    boost::unique_lock<boost::mutex> lock(sizeClassMutex);
+    num = numSizeClasses.load(std::memory_order_relaxed);
+    for(int i=0; i<num; i++)
+        if(classSizes[i] == sizeInByte)
+            return i;
+
+    if(num == MAX_SIZE_CLASSES)
+        return -1;
+
+    classSizes[num] = sizeInByte;
+    numSizeClasses.store(num+1, std::memory_order_release);
+    return num;
+}
+
+void FrameMemory::pushAvailable(BufferHeader* first, BufferHeader* last,
+                                int sizeClass)
+{
+    // only whole lists are taken, so the head can't be popped and re-pushed in between.
+    BufferHeader* head = availableBuffers[sizeClass].load(std::memory_order_relaxed);
+    do
+    {
+        last->next = head;
+    }
+    while(!availableBuffers[sizeClass].compare_exchange_weak(head, first,
+            std::memory_order_release, std::memory_order_relaxed));
+}
+
+FrameMemory::BufferHeader* FrameMemory::takeAvailable(int sizeClass)
+{
+    return availableBuffers[sizeClass].exchange(0, std::memory_order_acquire);
+}
+
+std::shared_ptr<Frame> FrameMemory::getFrame(int id, int width, int height,
+        const Eigen::Matrix3f& K, double timestamp, const unsigned char* image)
+{
+    Frame* frame = 0;
+    framePoolMutex.lock();
+    if(!availableFrames.empty())
+    {
+        frame = availableFrames.back();
+        availableFrames.pop_back();
+    }
+    framePoolMutex.unlock();
+
+    if(frame != 0 && (frame->width() != width || frame->height() != height))
+    {
+        // the camera changed, none of the pooled ones fits.
+        delete frame;
+        frame = 0;
+    }
+
+    if(frame != 0)
+        frame->reset(id, width, height, K, timestamp, image);
+    else
+        frame = new Frame(id, width, height, K, timestamp, image);
+
+    return std::shared_ptr<Frame>(frame, ReturnFrame(), FrameMemoryAllocator<Frame>());
+}
+
+void FrameMemory::returnFrame(Frame* frame)
+{
+    framePoolMutex.lock();
+    bool keep = availableFrames.size() < maxAvailableFrames;
+    framePoolMutex.unlock();
+
+    if(!keep)
+    {
+        delete frame;
+        return;
+    }
+
+    frame->releaseAll();
+
+    framePoolMutex.lock();
+    availableFrames.push_back(frame);
+    framePoolMutex.unlock();
+}
+
+FramePoseStruct* FrameMemory::getPoseStruct(Frame* frame)
+{
+    FramePoseStruct* pose = 0;
+    framePoolMutex.lock();
+    if(!availablePoseStructs.empty())
+    {
+        pose = availablePoseStructs.back();
+        availablePoseStructs.pop_back();
+    }
+    framePoolMutex.unlock();
+
+    if(pose == 0)
+        return new FramePoseStruct(frame);
+
+    pose->reset(frame);
+    return pose;
+}
+
+void FrameMemory::returnPoseStruct(FramePoseStruct* pose)
+{
+    framePoolMutex.lock();
+    if(availablePoseStructs.size() < maxAvailablePoseStructs)
+    {
+        availablePoseStructs.push_back(pose);
+        pose = 0;
+    }
+    framePoolMutex.unlock();
+
+    delete pose;
+}
+
+bool FrameMemory::freeAvailableBuffer()
+{
+    int largest = -1;
+    int num = numSizeClasses;
+    for(int c=0; c<num; c++)
+    {
+        if(availableBuffers[c].load(std::memory_order_relaxed) != 0
+                && (largest < 0 || classSizes[c] > classSizes[largest]))
+            largest = c;
+    }
+    if(largest < 0)
+        return false;
+
+    BufferHeader* taken = takeAvailable(largest);
+    if(taken == 0)
+        return true;	// someone else took them in the meantime, try again.
+
+    if(taken->next != 0)
+    {
+        BufferHeader* last = taken->next;
+        while(last->next != 0)
+            last = last->next;
+        pushAvailable(taken->next, last, largest);
+    }
+
+    pooledBytes -= taken->size;
+    freeBuffer(taken);
+    return true;
 }
 
 boost::shared_lock<boost::shared_mutex> FrameMemory::activateFrame(
@@ -136,16 +468,26 @@ boost::shared_lock<boost::shared_mutex> FrameMemory::activateFrame(
 {
     boost::unique_lock<boost::mutex> lock(activeFramesMutex);
     if(frame->isActive)
-        activeFrames.remove(frame);
-    activeFrames.push_front(frame);
+        removeFrame(activeFrames, frame);
+    else if(frame->isCold)
+    {
+        removeFrame(coldFrames, frame);
+        frame->isCold = false;
+    }
+    pushFrontFrame(activeFrames, frame);
     frame->isActive = true;
     return boost::shared_lock<boost::shared_mutex>(frame->activeMutex);
 }
 void FrameMemory::deactivateFrame(Frame* frame)
 {
     boost::unique_lock<boost::mutex> lock(activeFramesMutex);
+    if(frame->isCold)
+    {
+        removeFrame(coldFrames, frame);
+        frame->isCold = false;
+    }
     if(!frame->isActive) return;
-    activeFrames.remove(frame);
+    removeFrame(activeFrames, frame);
 
     while(!frame->minimizeInMemory())
         printf("cannot deactivateFrame frame %d, as some acvite-lock is lingering. May cause deadlock!\n",
@@ -169,8 +511,235 @@ void FrameMemory::pruneActiveFrames()
             }
         }
         activeFrames.back()->isActive = false;
-        activeFrames.pop_back();
+        activeFrames.back()->isCold = true;
+        coldFrames.splice(coldFrames.begin(), activeFrames, --activeFrames.end());
+    }
+
+    enforceMemoryBudget();
+}
+
+void FrameMemory::frameSwappedIn(Frame* frame)
+{
+    boost::unique_lock<boost::mutex> lock(activeFramesMutex);
+    if(frame->isActive || frame->isCold)
+        return;
+
+    frame->isCold = true;
+    pushFrontFrame(coldFrames, frame);
+}
+
+void FrameMemory::pushFrontFrame(std::list<Frame*>& list, Frame* frame)
+{
+    if(spareNodes.empty())
+        list.push_front(frame);
+    else
+    {
+        list.splice(list.begin(), spareNodes, spareNodes.begin());
+        list.front() = frame;
+    }
+}
+
+std::list<Frame*>::iterator FrameMemory::eraseFrame(std::list<Frame*>& list,
+        std::list<Frame*>::iterator it)
+{
+    std::list<Frame*>::iterator next = it;
+    ++next;
+    spareNodes.splice(spareNodes.begin(), list, it);
+    return next;
+}
+
+void FrameMemory::removeFrame(std::list<Frame*>& list, Frame* frame)
+{
+    std::list<Frame*>::iterator it = std::find(list.begin(), list.end(), frame);
+    if(it != list.end())
+        spareNodes.splice(spareNodes.begin(), list, it);
+}
+
+void FrameMemory::enforceMemoryBudget()
+{
+    if(frameMemoryBudgetMB <= 0)
+        return;
+    size_t budget = (size_t)frameMemoryBudgetMB * 1000000;
+
+    int numSwappedOut = 0;
+    std::list<Frame*>::iterator it = coldFrames.end();
+    while(true)
+    {
+        if(allocatedBytes <= budget)
+            break;
+
+        // pooled buffers first, they are not used anyway.
+        if(freeAvailableBuffer())
+            continue;
+
+        // then the least recently active keyframe; its buffers go to the pool.
+        if(it == coldFrames.begin())
+            break;
+        --it;
+
+        Frame* frame = *it;
+        if(frame->idxInKeyframes < 0)
+        {
+            // not a finished keyframe (yet), it will be cold again after it was used.
+            frame->isCold = false;
+            it = eraseFrame(coldFrames, it);
+        }
+        else if(frame->swapOut())
+        {
+            frame->isCold = false;
+            it = eraseFrame(coldFrames, it);
+            numSwappedOut++;
+        }
+        // else: still locked by someone, skip it.
+    }
+
+    if(numSwappedOut > 0 && enablePrintDebugInfo && printMemoryDebugInfo)
+        printf("swapped out %d keyframes, %.1f MB in memory now\n", numSwappedOut,
+               allocatedBytes.load() / 1000000.0f);
+}
+
+int64_t FrameMemory::allocateSwap(size_t bytes)
+{
+#ifdef _WIN32
+    return -1;
+#else
+    boost::unique_lock<boost::mutex> lock(swapMutex);
+
+    // page aligned slots, so they can be dropped from memory on their own.
+    size_t slotSize = (bytes + swapPageSize - 1) / swapPageSize * swapPageSize;
+
+    std::vector< int64_t >& freeSlots = freeSwapSlots[slotSize];
+    if(!freeSlots.empty())
+    {
+        int64_t offset = freeSlots.back();
+        freeSlots.pop_back();
+        return offset;
+    }
+
+    if(swapUsed + slotSize > swapSize && !growSwap(swapUsed + slotSize))
+        return -1;
+
+    int64_t offset = swapUsed;
+    swapUsed += slotSize;
+    return offset;
+#endif
+}
+
+void FrameMemory::freeSwap(int64_t offset, size_t bytes)
+{
+    boost::unique_lock<boost::mutex> lock(swapMutex);
+    size_t slotSize = (bytes + swapPageSize - 1) / swapPageSize * swapPageSize;
+    freeSwapSlots[slotSize].push_back(offset);
+}
+
+bool FrameMemory::writeSwap(int64_t offset, const void* data, size_t bytes)
+{
+#ifdef _WIN32
+    return false;
+#else
+    boost::unique_lock<boost::mutex> lock(swapMutex);
+    if(swapMapping == 0 || offset < 0 || offset + bytes > swapSize)
+        return false;
+
+    memcpy(swapMapping + offset, data, bytes);
+    return true;
+#endif
+}
+
+bool FrameMemory::readSwap(int64_t offset, void* data, size_t bytes)
+{
+#ifdef _WIN32
+    return false;
+#else
+    boost::unique_lock<boost::mutex> lock(swapMutex);
+    if(swapMapping == 0 || offset < 0 || offset + bytes > swapSize)
+        return false;
+
+    memcpy(data, swapMapping + offset, bytes);
+    return true;
+#endif
+}
+
+void FrameMemory::dropSwapPages(int64_t offset, size_t bytes)
+{
+#ifndef _WIN32
+    boost::unique_lock<boost::mutex> lock(swapMutex);
+
+    // madvise needs page aligned ranges, which only whole slots are.
+    size_t slotSize = (bytes + swapPageSize - 1) / swapPageSize * swapPageSize;
+    if(swapMapping == 0 || offset < 0 || offset + slotSize > swapSize)
+        return;
+
+    // the pages stay in the page cache (and are written back) without counting
+    // as our memory.
+    if(madvise(swapMapping + offset, slotSize, MADV_DONTNEED) != 0)
+        printf("FrameMemory: could not drop swap pages at %lld (%s)!\n",
+               (long long)offset, strerror(errno));
+#endif
+}
+
+bool FrameMemory::growSwap(size_t minSize)
+{
+#ifdef _WIN32
+    return false;
+#else
+    if(swapUnavailable)
+        return false;
+
+    if(swapFd < 0)
+    {
+        swapFileName = frameSwapFile.empty() ? packagePath + "frame_swap.bin" : frameSwapFile;
+        swapFd = open(swapFileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if(swapFd < 0)
+        {
+            printf("FrameMemory: could not create swap file %s, keyframes stay in memory!\n",
+                   swapFileName.c_str());
+            swapUnavailable = true;
+            return false;
+        }
     }
+
+    size_t newSize = std::max(minSize, swapSize + swapFileGrowth);
+    if(ftruncate(swapFd, newSize) != 0)
+    {
+        printf("FrameMemory: could not grow swap file %s to %.1f MB!\n",
+               swapFileName.c_str(), newSize / 1000000.0f);
+        return false;
+    }
+
+    // map the grown file before dropping the old mapping, so nothing is lost if that fails.
+    void* mapping = mmap(0, newSize, PROT_READ | PROT_WRITE, MAP_SHARED, swapFd, 0);
+    if(mapping == MAP_FAILED)
+    {
+        printf("FrameMemory: could not map swap file %s!\n", swapFileName.c_str());
+        return false;
+    }
+    if(swapMapping != 0)
+        munmap(swapMapping, swapSize);
+
+    swapMapping = static_cast<char*>(mapping);
+    swapSize = newSize;
+    return true;
+#endif
+}
+
+void FrameMemory::closeSwap()
+{
+#ifndef _WIN32
+    boost::unique_lock<boost::mutex> lock(swapMutex);
+    if(swapMapping != 0)
+        munmap(swapMapping, swapSize);
+    if(swapFd >= 0)
+    {
+        close(swapFd);
+        unlink(swapFileName.c_str());
+    }
+
+    swapFd = -1;
+    swapMapping = 0;
+    swapSize = swapUsed = 0;
+    freeSwapSlots.clear();
+#endif
 }
 
 }
@@ -20,18 +20,51 @@
 
 #pragma once
 #include <unordered_map>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
 #include <vector>
 #include <boost/thread/mutex.hpp>
 #include <deque>
 #include <list>
 #include <boost/thread/shared_mutex.hpp>
+#include "util/eigen_core_include.h"
 
 
 namespace lsd_slam
 {
 
-/** Singleton class for re-using buffers in the Frame class. */
+/** Buffer pool statistics, see FrameMemory::getStats(). */
+struct FrameMemoryStats
+{
+    uint64_t hits;	// buffers re-used from the pool.
+    uint64_t misses;	// buffers that had to be allocated.
+    size_t allocatedBytes;	// all buffers, in use or pooled.
+    size_t pooledBytes;	// returned buffers, including the ones in per-thread caches.
+};
+
+/**
+ * Singleton class for re-using buffers in the Frame class.
+ *
+ * Buffers are pooled per size class (one class per distinct buffer size, there
+ * are only a few). Each thread keeps a few returned small buffers per class for
+ * itself; beyond that, and all large buffers, go to a lock-free free list per
+ * class, from which threads take all buffers at once when their own cache is
+ * empty (so there is no ABA problem).
+ * Every buffer has a small header in front of it with its size and class, so
+ * returnBuffer() needs no lookup.
+ *
+ * Tracked frames themselves (and their pose structs) are re-used as well, see getFrame().
+ *
+ * Also keeps the resident size of all buffers within frameMemoryBudgetMB: frames that
+ * drop out of activeFrames are kept in coldFrames (least recently active at the back),
+ * and over budget, the level-0 data of cold keyframes is swapped out to a memory-mapped
+ * backing file (Frame::swapOut()), until a Frame::require() swaps it in again.
+ */
 class Frame;
+class FramePoseStruct;
+struct ThreadBufferCache;
 class FrameMemory
 {
 public:
@@ -50,23 +83,117 @@ public:
       * Corresponds to "delete[] buffer". */
     void returnBuffer(void* buffer);
 
+    /** Corresponds to "std::shared_ptr<Frame>(new Frame(...))", but re-uses a frame of the
+      * same size whose last shared_ptr was dropped, if there is one. */
+    std::shared_ptr<Frame> getFrame(int id, int width, int height,
+                                    const Eigen::Matrix3f& K, double timestamp, const unsigned char* image);
+
+    /** Deleter of the frames from getFrame(): keeps them for re-use (or deletes them if
+      * enough are kept already). */
+    void returnFrame(Frame* frame);
+
+    /** Allocates or fetches a pose struct for frame. Corresponds to "new FramePoseStruct(frame)". */
+    FramePoseStruct* getPoseStruct(Frame* frame);
+
+    /** Returns a pose struct that is not registered to the graph for re-use.
+      * Corresponds to "delete pose". */
+    void returnPoseStruct(FramePoseStruct* pose);
+
 
     boost::shared_lock<boost::shared_mutex> activateFrame(Frame* frame);
     void deactivateFrame(Frame* frame);
+    /** Minimizes the least recently active frames, then enforces frameMemoryBudgetMB. */
     void pruneActiveFrames();
 
+    /** Called by a cold frame that was swapped in, so it can be swapped out again. */
+    void frameSwappedIn(Frame* frame);
+
+    /** Reserves bytes in the swap file, returns the offset or -1 if it can't be used. */
+    int64_t allocateSwap(size_t bytes);
+    void freeSwap(int64_t offset, size_t bytes);
+    /** Copies to / from the swap file at offset (as returned by allocateSwap). */
+    bool writeSwap(int64_t offset, const void* data, size_t bytes);
+    bool readSwap(int64_t offset, void* data, size_t bytes);
+    /** Drops the pages of a slot from memory (they stay in the page cache, without
+      * counting as ours). Call once the slot is completely written or read. */
+    void dropSwapPages(int64_t offset, size_t bytes);
+
+    /** Frees all pooled frames and buffers, except the buffers in other threads' caches. */
     void releaseBuffes();
+
+    FrameMemoryStats getStats() const;
 private:
+    friend struct ThreadBufferCache;
+
+    enum { MAX_SIZE_CLASSES = 64 };
+
+    /** In front of every buffer, padded to keep the alignment of the buffer. */
+    struct BufferHeader
+    {
+        BufferHeader* next;	// in a free list.
+        unsigned int size;
+        int sizeClass;	// -1 if all classes were taken, then it is freed when returned.
+    };
+
     FrameMemory();
-    void* allocateBuffer(unsigned int sizeInByte);
+    void* allocateBuffer(unsigned int sizeInByte, int sizeClass);
+    void freeBuffer(BufferHeader* header);
+
+    /** Returns the class of buffers with this size, registers it if it's new. -1 if all are taken. */
+    int getSizeClass(unsigned int sizeInByte);
+    /** Pushes the list first..last onto the free list of sizeClass. */
+    void pushAvailable(BufferHeader* first, BufferHeader* last, int sizeClass);
+    /** Takes the whole free list of sizeClass. */
+    BufferHeader* takeAvailable(int sizeClass);
+
+    // list operations for activeFrames / coldFrames, which keep the unused nodes in
+    // spareNodes so tracking does not allocate. activeFramesMutex must be locked.
+    void pushFrontFrame(std::list<Frame*>& list, Frame* frame);
+    void removeFrame(std::list<Frame*>& list, Frame* frame);
+    std::list<Frame*>::iterator eraseFrame(std::list<Frame*>& list,
+                                           std::list<Frame*>::iterator it);
 
-    boost::mutex accessMutex;
-    std::unordered_map< void*, unsigned int > bufferSizes;
-    std::unordered_map< unsigned int, std::vector< void* > > availableBuffers;
+    /** Frees pooled buffers, then swaps out cold keyframes, while over budget. activeFramesMutex must be locked. */
+    void enforceMemoryBudget();
+    /** Frees one pooled buffer (the largest) from the shared free lists, returns false if there is none. */
+    bool freeAvailableBuffer();
+    bool growSwap(size_t minSize);
+    /** Unmaps and deletes the swap file. Only call once no frame is swapped out anymore. */
+    void closeSwap();
+
+    // classSizes[i] is written once, before numSizeClasses is increased past i.
+    boost::mutex sizeClassMutex;
+    unsigned int classSizes[MAX_SIZE_CLASSES];
+    std::atomic<int> numSizeClasses;
+    std::atomic<BufferHeader*> availableBuffers[MAX_SIZE_CLASSES];
+
+    std::atomic<size_t> allocatedBytes;	// all buffers, including the available ones.
+    std::atomic<size_t> pooledBytes;
+    std::atomic<uint64_t> poolHits;
+    std::atomic<uint64_t> poolMisses;
+
+    // frames and pose structs, kept for re-use. all frames have the same size.
+    boost::mutex framePoolMutex;
+    std::vector<Frame*> availableFrames;
+    std::vector<FramePoseStruct*> availablePoseStructs;
 
 
     boost::mutex activeFramesMutex;
     std::list<Frame*> activeFrames;
+    std::list<Frame*> coldFrames;	// minimized, but level 0 still in memory.
+    std::list<Frame*> spareNodes;
+
+
+    // swap file, mapped as a whole. only accessed within swapMutex, as it is
+    // re-mapped when it grows.
+    boost::mutex swapMutex;
+    std::string swapFileName;
+    bool swapUnavailable;	// could not be created, don't try again.
+    int swapFd;
+    char* swapMapping;
+    size_t swapSize;
+    size_t swapUsed;
+    std::unordered_map< size_t, std::vector< int64_t > > freeSwapSlots;
 };
 
 }
@@ -32,17 +32,7 @@ int privateFramePoseStructAllocCount = 0;
 
 FramePoseStruct::FramePoseStruct(Frame* frame)
 {
-    cacheValidFor = -1;
-    isOptimized = false;
-    thisToParent_raw = camToWorld = camToWorld_new = Sim3();
-    this->frame = frame;
-    frameID = frame->id();
-    trackingParent = 0;
-    isRegisteredToGraph = false;
-    hasUnmergedPose = false;
-    isInGraph = false;
-
-    this->graphVertex = nullptr;
+    reset(frame);
 
     privateFramePoseStructAllocCount++;
     if(enablePrintDebugInfo && printMemoryDebugInfo)
@@ -58,6 +48,21 @@ FramePoseStruct::~FramePoseStruct()
                privateFramePoseStructAllocCount);
 }
 
+void FramePoseStruct::reset(Frame* frame)
+{
+    cacheValidFor = -1;
+    isOptimized = false;
+    thisToParent_raw = camToWorld = camToWorld_new = Sim3();
+    this->frame = frame;
+    frameID = frame->id();
+    trackingParent = 0;
+    isRegisteredToGraph = false;
+    hasUnmergedPose = false;
+    isInGraph = false;
+
+    this->graphVertex = nullptr;
+}
+
 void FramePoseStruct::setPoseGraphOptResult(const Sim3& camToWorld)
 {
     if(!isInGraph)
@@ -79,6 +84,13 @@ void FramePoseStruct::applyPoseGraphOptResult()
     hasUnmergedPose = false;
     cacheValidCounter++;
 }
+void FramePoseStruct::setOptimizedCamToWorld(const Sim3& camToWorld)
+{
+    this->camToWorld = camToWorld;
+    isOptimized = true;
+    hasUnmergedPose = false;
+    cacheValidCounter++;
+}
 void FramePoseStruct::invalidateCache()
 {
     cacheValidFor = -1;
@@ -34,6 +34,9 @@ public:
     FramePoseStruct(Frame* frame);
     virtual ~FramePoseStruct();
 
+    /** Re-initializes a pose struct that was kept by FrameMemory, same as the constructor. */
+    void reset(Frame* frame);
+
     // parent, the frame originally tracked on. never changes.
     FramePoseStruct* trackingParent;
 
@@ -60,6 +63,8 @@ public:
 
     void setPoseGraphOptResult(const Sim3& camToWorld);
     void applyPoseGraphOptResult();
+    /** Sets an already optimized absolute pose, e.g. of a keyframe loaded from a map. */
+    void setOptimizedCamToWorld(const Sim3& camToWorld);
     Sim3 getCamToWorld(int recursionDepth = 0);
     void invalidateCache();
 private:
@@ -23,10 +23,13 @@
 #include "model/frame.h"
 #include "tracking/se3_tracker.h"
 #include "tracking/sim3_tracker.h"
+#include "tracking/motion_model.h"
 #include "depth_estimation/depth_map.h"
 #include "tracking/tracking_reference.h"
 #include "live_slam_wrapper.h"
 #include "util/global_funcs.h"
+#include "util/cpu_features.h"
+#include "util/index_thread_reduce.h"
 #include "global_mapping/key_frame_graph.h"
 #include "global_mapping/trackable_key_frame_search.h"
 #include "global_mapping/g2o_type_sim3_sophus.h"
@@ -63,6 +66,10 @@ SlamSystem::SlamSystem(int w, int h, Eigen::Matrix3f K, bool enableSLAM)
         assert(false);
     }
 
+    simdLevel = detectSimdLevel();
+    printf("Using %s code path for tracking and pyramid building.\n",
+           simdLevelName(simdLevel));
+
     this->width = w;
     this->height = h;
     this->K = K;
@@ -84,6 +91,7 @@ SlamSystem::SlamSystem(int w, int h, Eigen::Matrix3f K, bool enableSLAM)
     // Do not use more than 4 levels for odometry tracking
     for (int level = 4; level < PYRAMID_LEVELS; ++level)
         tracker->settings.maxItsPerLvl[level] = 0;
+    motionModel = new MotionModel(K);
     trackingReference = new TrackingReference();
     mappingTrackingReference = new TrackingReference();
 
@@ -91,19 +99,29 @@ SlamSystem::SlamSystem(int w, int h, Eigen::Matrix3f K, bool enableSLAM)
     if(SLAMEnabled)
     {
         trackableKeyFrameSearch = new TrackableKeyFrameSearch(keyFrameGraph,w,h,K);
-        constraintTracker = new Sim3Tracker(w,h,K);
-        constraintSE3Tracker = new SE3Tracker(w,h,K);
         newKFTrackingReference = new TrackingReference();
-        candidateTrackingReference = new TrackingReference();
+
+        constraintSearchWorkers.resize(std::max(1, constraintSearchThreads));
+        for(unsigned int i=0; i<constraintSearchWorkers.size(); i++)
+        {
+            ConstraintSearchWorker& worker = constraintSearchWorkers[i];
+            worker.sim3Tracker = new Sim3Tracker(w,h,K);
+            worker.reciprocalSim3Tracker = new Sim3Tracker(w,h,K);
+            worker.se3Tracker = new SE3Tracker(w,h,K);
+            worker.candidateTrackingReference = new TrackingReference();
+        }
+        // at least two threads: when no candidates are spread over the workers,
+        // tryTrackSim3 uses the pool to track both directions at once.
+        constraintCandidateReducer = new IndexThreadReduce(
+            std::max(2, (int)constraintSearchWorkers.size()));
     }
     else
     {
-        constraintSE3Tracker = 0;
         trackableKeyFrameSearch = 0;
-        constraintTracker = 0;
         newKFTrackingReference = 0;
-        candidateTrackingReference = 0;
+        constraintCandidateReducer = 0;
     }
+    inCandidatePool = false;
 
 
     outputWrapper = 0;
@@ -130,6 +148,10 @@ SlamSystem::SlamSystem(int w, int h, Eigen::Matrix3f K, bool enableSLAM)
             nFindReferences = 0;
     nAvgTrackFrame = nAvgOptimizationIteration = nAvgFindConstraintsItaration =
                          nAvgFindReferences = 0;
+    msOptimizationInit = msOptimizationSolve = 0;
+    for(int level = 0; level < PYRAMID_LEVELS; ++level)
+        nTrackResidualCalls[level] = nTrackIterations[level] = 0;
+    nTrackEarlyExits = 0;
     // gettimeofday(&lastHzUpdate, NULL);
     lastHzUpdate = std::chrono::high_resolution_clock::now();
 
@@ -152,15 +174,21 @@ SlamSystem::~SlamSystem()
     printf("DONE waiting for SlamSystem's threads to exit\n");
 
     if(trackableKeyFrameSearch != 0) delete trackableKeyFrameSearch;
-    if(constraintTracker != 0) delete constraintTracker;
-    if(constraintSE3Tracker != 0) delete constraintSE3Tracker;
+    if(constraintCandidateReducer != 0) delete constraintCandidateReducer;
+    for(ConstraintSearchWorker& worker : constraintSearchWorkers)
+    {
+        delete worker.sim3Tracker;
+        delete worker.reciprocalSim3Tracker;
+        delete worker.se3Tracker;
+        delete worker.candidateTrackingReference;
+    }
     if(newKFTrackingReference != 0) delete newKFTrackingReference;
-    if(candidateTrackingReference != 0) delete candidateTrackingReference;
 
     delete mappingTrackingReference;
     delete map;
     delete trackingReference;
     delete tracker;
+    delete motionModel;
 
     // make shure to reset all shared pointers to all frames before deleting the keyframegraph!
     unmappedTrackedFrames.clear();
@@ -193,6 +221,9 @@ void SlamSystem::mergeOptimizationOffset()
             keyFrameGraph->keyframesAll[i]->pose->applyPoseGraphOptResult();
         keyFrameGraph->keyframesAllMutex.unlock_shared();
 
+        if(trackableKeyFrameSearch != 0)
+            trackableKeyFrameSearch->updateKeyFramePoses();
+
         haveUnmergedOptimizationOffset = false;
         needPublish = true;
     }
@@ -382,6 +413,9 @@ void SlamSystem::optimizationThreadLoop()
         if(doFinalOptimization)
         {
             printf("doing final optimization iteration!\n");
+            g2oGraphAccessMutex.lock();
+            keyFrameGraph->requestFullOptimization();
+            g2oGraphAccessMutex.unlock();
             optimizationIteration(50, 0.001);
             doFinalOptimization = false;
         }
@@ -425,11 +459,15 @@ void SlamSystem::finishCurrentKeyframe()
             keyFrameGraph->totalVertices ++;
             keyFrameGraph->keyframesAllMutex.unlock();
 
+            trackableKeyFrameSearch->addKeyFrame(currentKeyFrame.get());
+
             newKeyFrameMutex.lock();
             newKeyFrames.push_back(currentKeyFrame.get());
             newKeyFrameCreatedSignal.notify_all();
             newKeyFrameMutex.unlock();
         }
+        else
+            trackableKeyFrameSearch->addKeyFrame(currentKeyFrame.get());	// re-activated: new depth, hence new meanIdepth.
     }
 
     if(outputWrapper!= 0)
@@ -648,6 +686,7 @@ void SlamSystem::addTimingSamples()
                     (now - lastHzUpdate).count();
     if(sPassed > 1.0f)
     {
+        int nTrackedSinceLast = nTrackFrame;
         nAvgTrackFrame = 0.8*nAvgTrackFrame + 0.2*(nTrackFrame / sPassed);
         nTrackFrame = 0;
         nAvgOptimizationIteration = 0.8*nAvgOptimizationIteration + 0.2*
@@ -675,16 +714,40 @@ void SlamSystem::addTimingSamples()
 
         if(enablePrintDebugInfo && printOverallTiming)
         {
-            printf("MapIt: %3.1fms (%.1fHz); Track: %3.1fms (%.1fHz); Create: %3.1fms (%.1fHz); FindRef: %3.1fms (%.1fHz); PermaTrk: %3.1fms (%.1fHz); Opt: %3.1fms (%.1fHz); FindConst: %3.1fms (%.1fHz);\n",
+            printf("MapIt: %3.1fms (%.1fHz); Track: %3.1fms (%.1fHz); Create: %3.1fms (%.1fHz); FindRef: %3.1fms (%.1fHz); PermaTrk: %3.1fms (%.1fHz); Opt: %3.1fms (init %.1fms, solve %.1fms) (%.1fHz); FindConst: %3.1fms (%.1fHz); SIMD: %s\n",
                    map->msUpdate, map->nAvgUpdate,
                    msTrackFrame, nAvgTrackFrame,
                    map->msCreate+map->msFinalize, map->nAvgCreate,
                    msFindReferences, nAvgFindReferences,
                    trackableKeyFrameSearch != 0 ? trackableKeyFrameSearch->msTrackPermaRef : 0,
                    trackableKeyFrameSearch != 0 ? trackableKeyFrameSearch->nAvgTrackPermaRef : 0,
-                   msOptimizationIteration, nAvgOptimizationIteration,
-                   msFindConstraintsItaration, nAvgFindConstraintsItaration);
+                   msOptimizationIteration, msOptimizationInit, msOptimizationSolve,
+                   nAvgOptimizationIteration,
+                   msFindConstraintsItaration, nAvgFindConstraintsItaration,
+                   simdLevelName(simdLevel));
+
+            if(nTrackedSinceLast > 0)
+            {
+                printf("Track per frame: ");
+                for(int level = SE3TRACKING_MAX_LEVEL-1; level >= SE3TRACKING_MIN_LEVEL; --level)
+                    printf("lvl %d: %.1f res (%.1f its); ", level,
+                           nTrackResidualCalls[level] / (float)nTrackedSinceLast,
+                           nTrackIterations[level] / (float)nTrackedSinceLast);
+                printf("early exit: %.0f%%\n", 100.0f*nTrackEarlyExits / nTrackedSinceLast);
+            }
+
+            if(printMemoryDebugInfo)
+            {
+                FrameMemoryStats memory = FrameMemory::getInstance().getStats();
+                printf("FrameMemory: %.1f MB (%.1f MB pooled); pool hits: %llu, misses: %llu\n",
+                       memory.allocatedBytes / 1000000.0f, memory.pooledBytes / 1000000.0f,
+                       (unsigned long long)memory.hits, (unsigned long long)memory.misses);
+            }
         }
+
+        for(int level = 0; level < PYRAMID_LEVELS; ++level)
+            nTrackResidualCalls[level] = nTrackIterations[level] = 0;
+        nTrackEarlyExits = 0;
     }
 
 }
@@ -803,6 +866,7 @@ bool SlamSystem::doMappingIteration()
     if(dumpMap)
     {
         keyFrameGraph->dumpMap(packagePath+"/save");
+        saveMap(packagePath+"/save/map.lsdmap");
         dumpMap = false;
     }
 
@@ -938,9 +1002,9 @@ void SlamSystem::randomInit(uchar* image, double timeStamp, int id)
 void SlamSystem::trackFrame(uchar* image, unsigned int frameID,
                             bool blockUntilMapped, double timestamp)
 {
-    // Create new frame
-    std::shared_ptr<Frame> trackingNewFrame(new Frame(frameID, width, height, K,
-                                            timestamp, image));
+    // Create new frame (re-using one that was dropped)
+    std::shared_ptr<Frame> trackingNewFrame = FrameMemory::getInstance().getFrame(
+                frameID, width, height, K, timestamp, image);
 
     if(!trackingIsGood)
     {
@@ -972,12 +1036,30 @@ void SlamSystem::trackFrame(uchar* image, unsigned int frameID,
                trackingReferencePose->frameID);
 
 
+    // initial estimate: the motion model prediction, or the pose of the last frame.
+    int trackingStartLevel = SE3TRACKING_MAX_LEVEL-1;
+    SE3 predictedCamToWorld;
     poseConsistencyMutex.lock_shared();
-    SE3 frameToReference_initialEstimate = se3FromSim3(
-            trackingReferencePose->getCamToWorld().inverse() *
-            keyFrameGraph->allFramePoses.back()->getCamToWorld());
+    bool usePrediction = useMotionModel
+                         && motionModel->predictCamToWorld(trackingNewFrame->id(),
+                                 trackingNewFrame->timestamp(), predictedCamToWorld);
+    SE3 frameToReference_initialEstimate = usePrediction ?
+                                           se3FromSim3(trackingReferencePose->getCamToWorld().inverse()) *
+                                           predictedCamToWorld :
+                                           se3FromSim3(trackingReferencePose->getCamToWorld().inverse() *
+                                                   keyFrameGraph->allFramePoses.back()->getCamToWorld());
     poseConsistencyMutex.unlock_shared();
 
+    if(usePrediction && motionModel->isConfident())
+    {
+        // skip the coarse levels, down to and including the first one that is iterated on.
+        while(trackingStartLevel > SE3TRACKING_MIN_LEVEL
+                && tracker->settings.maxItsPerLvl[trackingStartLevel] == 0)
+            trackingStartLevel--;
+        if(trackingStartLevel > SE3TRACKING_MIN_LEVEL)
+            trackingStartLevel--;
+    }
+
 
 
     std::chrono::high_resolution_clock::time_point tv_start, tv_end;
@@ -987,7 +1069,8 @@ void SlamSystem::trackFrame(uchar* image, unsigned int frameID,
     SE3 newRefToFrame_poseUpdate = tracker->trackFrame(
                                        trackingReference,
                                        trackingNewFrame.get(),
-                                       frameToReference_initialEstimate);
+                                       frameToReference_initialEstimate,
+                                       trackingStartLevel);
 
 
     // gettimeofday(&tv_end, NULL);
@@ -996,6 +1079,13 @@ void SlamSystem::trackFrame(uchar* image, unsigned int frameID,
                    0.1*std::chrono::duration_cast<std::chrono::milliseconds>
                    (tv_end - tv_start).count();
     nTrackFrame++;
+    for(int level = 0; level < PYRAMID_LEVELS; ++level)
+    {
+        nTrackResidualCalls[level] += tracker->numCalcResidualCalls[level];
+        nTrackIterations[level] += tracker->numCalcWarpUpdateCalls[level];
+    }
+    if(tracker->lastExitedEarly)
+        nTrackEarlyExits++;
 
     tracking_lastResidual = tracker->lastResidual;
     tracking_lastUsage = tracker->pointUsage;
@@ -1016,6 +1106,7 @@ void SlamSystem::trackFrame(uchar* image, unsigned int frameID,
                tracker->diverged ? "DIVERGED" : "NOT DIVERGED");
 
         trackingReference->invalidate();
+        motionModel->reset();
 
         trackingIsGood = false;
         nextRelocIdx = -1;
@@ -1047,6 +1138,13 @@ void SlamSystem::trackFrame(uchar* image, unsigned int frameID,
     }
 
     keyFrameGraph->addFrame(trackingNewFrame.get());
+    if(useMotionModel)
+    {
+        poseConsistencyMutex.lock_shared();
+        motionModel->addTrackedFrame(trackingNewFrame.get(),
+                                     trackingReference->keyframe->meanIdepth);
+        poseConsistencyMutex.unlock_shared();
+    }
 
 
     //Sim3 lastTrackedCamToWorld = mostCurrentTrackedFrame->getScaledCamToWorld();//  mostCurrentTrackedFrame->TrackingParent->getScaledCamToWorld() * sim3FromSE3(mostCurrentTrackedFrame->thisToParent_SE3TrackingResult, 1.0);
@@ -1117,26 +1215,60 @@ void SlamSystem::trackFrame(uchar* image, unsigned int frameID,
 }
 
 
+void SlamSystem::trackSim3Reciprocal(
+    int first, int end,
+    ConstraintSearchWorker* worker,
+    TrackingReference* A, TrackingReference* B,
+    int lvlStart, int lvlEnd,
+    Sim3* AtoB, Sim3* BtoA)
+{
+    // each direction has its own tracker and reference, they only share
+    // (read-only) the two keyframes.
+    for(int direction=first; direction<end; direction++)
+    {
+        if(direction == 0)
+            *BtoA = worker->sim3Tracker->trackFrameSim3(
+                        A,
+                        B->keyframe,
+                        *BtoA,
+                        lvlStart,lvlEnd);
+        else
+            *AtoB = worker->reciprocalSim3Tracker->trackFrameSim3(
+                        B,
+                        A->keyframe,
+                        *AtoB,
+                        lvlStart,lvlEnd);
+    }
+}
+
 float SlamSystem::tryTrackSim3(
+    ConstraintSearchWorker& worker,
     TrackingReference* A, TrackingReference* B,
     int lvlStart, int lvlEnd,
     bool useSSE,
     Sim3 &AtoB, Sim3 &BtoA,
     KFConstraintStruct* e1, KFConstraintStruct* e2 )
 {
-    BtoA = constraintTracker->trackFrameSim3(
-               A,
-               B->keyframe,
-               BtoA,
-               lvlStart,lvlEnd);
-    Matrix7x7 BtoAInfo = constraintTracker->lastSim3Hessian;
-    float BtoA_meanResidual = constraintTracker->lastResidual;
-    float BtoA_meanDResidual = constraintTracker->lastDepthResidual;
-    float BtoA_meanPResidual = constraintTracker->lastPhotometricResidual;
-    float BtoA_usage = constraintTracker->pointUsage;
-
-
-    if (constraintTracker->diverged ||
+    // track both directions at once; if one of them fails, the time of the
+    // other one is lost, but the latency of a test is that of a single track.
+    // inside forEachCandidate the pool is busy with the candidates, there each
+    // worker tracks one direction after the other.
+    if(constraintCandidateReducer != 0 && !inCandidatePool)
+        constraintCandidateReducer->reduce([&](int first, int end, RunningStats*)
+        {
+            trackSim3Reciprocal(first, end, &worker, A, B, lvlStart, lvlEnd, &AtoB, &BtoA);
+        }, 0, 2, 1);
+    else
+        trackSim3Reciprocal(0, 2, &worker, A, B, lvlStart, lvlEnd, &AtoB, &BtoA);
+
+    Matrix7x7 BtoAInfo = worker.sim3Tracker->lastSim3Hessian;
+    float BtoA_meanResidual = worker.sim3Tracker->lastResidual;
+    float BtoA_meanDResidual = worker.sim3Tracker->lastDepthResidual;
+    float BtoA_meanPResidual = worker.sim3Tracker->lastPhotometricResidual;
+    float BtoA_usage = worker.sim3Tracker->pointUsage;
+
+
+    if (worker.sim3Tracker->diverged ||
             BtoA.scale() > 1 / Sophus::SophusConstants<sophusType>::epsilon() ||
             BtoA.scale() < Sophus::SophusConstants<sophusType>::epsilon() ||
             BtoAInfo(0,0) == 0 ||
@@ -1146,19 +1278,14 @@ float SlamSystem::tryTrackSim3(
     }
 
 
-    AtoB = constraintTracker->trackFrameSim3(
-               B,
-               A->keyframe,
-               AtoB,
-               lvlStart,lvlEnd);
-    Matrix7x7 AtoBInfo = constraintTracker->lastSim3Hessian;
-    float AtoB_meanResidual = constraintTracker->lastResidual;
-    float AtoB_meanDResidual = constraintTracker->lastDepthResidual;
-    float AtoB_meanPResidual = constraintTracker->lastPhotometricResidual;
-    float AtoB_usage = constraintTracker->pointUsage;
+    Matrix7x7 AtoBInfo = worker.reciprocalSim3Tracker->lastSim3Hessian;
+    float AtoB_meanResidual = worker.reciprocalSim3Tracker->lastResidual;
+    float AtoB_meanDResidual = worker.reciprocalSim3Tracker->lastDepthResidual;
+    float AtoB_meanPResidual = worker.reciprocalSim3Tracker->lastPhotometricResidual;
+    float AtoB_usage = worker.reciprocalSim3Tracker->pointUsage;
 
 
-    if (constraintTracker->diverged ||
+    if (worker.reciprocalSim3Tracker->diverged ||
             AtoB.scale() > 1 / Sophus::SophusConstants<sophusType>::epsilon() ||
             AtoB.scale() < Sophus::SophusConstants<sophusType>::epsilon() ||
             AtoBInfo(0,0) == 0 ||
@@ -1205,18 +1332,20 @@ float SlamSystem::tryTrackSim3(
 
 
 void SlamSystem::testConstraint(
+    ConstraintSearchWorker& worker,
     Frame* candidate,
     KFConstraintStruct* &e1_out, KFConstraintStruct* &e2_out,
     const Sim3& candidateToFrame_initialEstimate,
     float strictness)
 {
+    TrackingReference* candidateTrackingReference = worker.candidateTrackingReference;
     candidateTrackingReference->importFrame(candidate);
 
     Sim3 FtoC = candidateToFrame_initialEstimate.inverse(),
          CtoF = candidateToFrame_initialEstimate;
     Matrix7x7 FtoCInfo, CtoFInfo;
 
-    float err_level3 = tryTrackSim3(
+    float err_level3 = tryTrackSim3(worker,
                            newKFTrackingReference, candidateTrackingReference,	// A = frame; b = candidate
                            SIM3TRACKING_MAX_LEVEL-1, 3,
                            USESSE,
@@ -1231,13 +1360,10 @@ void SlamSystem::testConstraint(
                    sqrtf(err_level3));
 
         e1_out = e2_out = 0;
-
-        newKFTrackingReference->keyframe->trackingFailed.insert(std::pair<Frame*,Sim3>
-                (candidate, candidateToFrame_initialEstimate));
         return;
     }
 
-    float err_level2 = tryTrackSim3(
+    float err_level2 = tryTrackSim3(worker,
                            newKFTrackingReference, candidateTrackingReference,	// A = frame; b = candidate
                            2, 2,
                            USESSE,
@@ -1252,8 +1378,6 @@ void SlamSystem::testConstraint(
                    sqrtf(err_level3), sqrtf(err_level2));
 
         e1_out = e2_out = 0;
-        newKFTrackingReference->keyframe->trackingFailed.insert(std::pair<Frame*,Sim3>
-                (candidate, candidateToFrame_initialEstimate));
         return;
     }
 
@@ -1261,7 +1385,7 @@ void SlamSystem::testConstraint(
     e2_out = new KFConstraintStruct();
 
 
-    float err_level1 = tryTrackSim3(
+    float err_level1 = tryTrackSim3(worker,
                            newKFTrackingReference, candidateTrackingReference,	// A = frame; b = candidate
                            1, 1,
                            USESSE,
@@ -1278,8 +1402,6 @@ void SlamSystem::testConstraint(
         delete e1_out;
         delete e2_out;
         e1_out = e2_out = 0;
-        newKFTrackingReference->keyframe->trackingFailed.insert(std::pair<Frame*,Sim3>
-                (candidate, candidateToFrame_initialEstimate));
         return;
     }
 
@@ -1297,6 +1419,29 @@ void SlamSystem::testConstraint(
     e2_out->robustKernel->setDelta(kernelDelta);
 }
 
+void SlamSystem::forEachCandidate(int num,
+                                  const boost::function<void(ConstraintSearchWorker&, int)>& job)
+{
+    int numChunks = std::min((int)constraintSearchWorkers.size(), num);
+    if(constraintCandidateReducer == 0 || numChunks <= 1)
+    {
+        for(int i=0; i<num; i++)
+            job(constraintSearchWorkers[0], i);
+        return;
+    }
+
+    // one chunk per worker, the chunk index picks the worker.
+    int chunkSize = (num + numChunks - 1) / numChunks;
+    inCandidatePool = true;
+    constraintCandidateReducer->reduce([&](int first, int end, RunningStats*)
+    {
+        ConstraintSearchWorker& worker = constraintSearchWorkers[first / chunkSize];
+        for(int i=first; i<end; i++)
+            job(worker, i);
+    }, 0, num, chunkSize);
+    inCandidatePool = false;
+}
+
 int SlamSystem::findConstraintsForNewKeyFrames(Frame* newKeyFrame,
         bool forceParent, bool useFABMAP, float closeCandidatesTH)
 {
@@ -1375,6 +1520,7 @@ int SlamSystem::findConstraintsForNewKeyFrames(Frame* newKeyFrame,
 
     SO3 disturbance = SO3::exp(Sophus::Vector3d(0.05,0,0));
 
+    std::vector<Frame*> closeChecks;
     for (Frame* candidate : candidates)
     {
         if (candidate->id() == newKeyFrame->id())
@@ -1387,33 +1533,49 @@ int SlamSystem::findConstraintsForNewKeyFrames(Frame* newKeyFrame,
         if(candidate->idxInKeyframes < INITIALIZATION_PHASE_COUNT)
             continue;
 
+        closeChecks.push_back(candidate);
+    }
+
+    // 0: trackable both ways, 1: failed, 2: inconsistent.
+    std::vector<int> closeCheckResults(closeChecks.size());
+    forEachCandidate(closeChecks.size(), [&](ConstraintSearchWorker& worker, int i)
+    {
+        Frame* candidate = closeChecks[i];
+        const Sim3& candidateToFrame_initialEstimate =
+            candidateToFrame_initialEstimateMap.at(candidate);
+
         SE3 c2f_init = se3FromSim3(
-                           candidateToFrame_initialEstimateMap[candidate].inverse()).inverse();
+                           candidateToFrame_initialEstimate.inverse()).inverse();
         c2f_init.so3() = c2f_init.so3() * disturbance;
-        SE3 c2f = constraintSE3Tracker->trackFrameOnPermaref(candidate, newKeyFrame,
+        SE3 c2f = worker.se3Tracker->trackFrameOnPermaref(candidate, newKeyFrame,
                   c2f_init);
-        if(!constraintSE3Tracker->trackingWasGood) {
-            closeFailed++;
-            continue;
+        if(!worker.se3Tracker->trackingWasGood) {
+            closeCheckResults[i] = 1;
+            return;
         }
 
 
         SE3 f2c_init = se3FromSim3(
-                           candidateToFrame_initialEstimateMap[candidate]).inverse();
+                           candidateToFrame_initialEstimate).inverse();
         f2c_init.so3() = disturbance * f2c_init.so3();
-        SE3 f2c = constraintSE3Tracker->trackFrameOnPermaref(newKeyFrame, candidate,
+        SE3 f2c = worker.se3Tracker->trackFrameOnPermaref(newKeyFrame, candidate,
                   f2c_init);
-        if(!constraintSE3Tracker->trackingWasGood) {
-            closeFailed++;
-            continue;
+        if(!worker.se3Tracker->trackingWasGood) {
+            closeCheckResults[i] = 1;
+            return;
         }
 
-        if((f2c.so3() * c2f.so3()).log().norm() >= 0.09) {
-            closeInconsistent++;
-            continue;
-        }
+        closeCheckResults[i] = (f2c.so3() * c2f.so3()).log().norm() >= 0.09 ? 2 : 0;
+    });
 
-        closeCandidates.insert(candidate);
+    for(unsigned int i=0; i<closeChecks.size(); i++)
+    {
+        if(closeCheckResults[i] == 1)
+            closeFailed++;
+        else if(closeCheckResults[i] == 2)
+            closeInconsistent++;
+        else
+            closeCandidates.insert(closeChecks[i]);
     }
 
 
@@ -1572,16 +1734,23 @@ int SlamSystem::findConstraintsForNewKeyFrames(Frame* newKeyFrame,
     // make tracking reference for newKeyFrame.
     newKFTrackingReference->importFrame(newKeyFrame);
 
-
-    for (Frame* candidate : closeCandidates)
+    // all candidates of a kind are tested at once, the results are then taken
+    // in candidate order, so they do not depend on thread timing.
+    std::vector<Frame*> closeTests(closeCandidates.begin(), closeCandidates.end());
+    std::vector<KFConstraintStruct*> closeE1(closeTests.size()), closeE2(closeTests.size());
+    forEachCandidate(closeTests.size(), [&](ConstraintSearchWorker& worker, int i)
     {
-        KFConstraintStruct* e1=0;
-        KFConstraintStruct* e2=0;
-
         testConstraint(
-            candidate, e1, e2,
-            candidateToFrame_initialEstimateMap[candidate],
+            worker, closeTests[i], closeE1[i], closeE2[i],
+            candidateToFrame_initialEstimateMap.at(closeTests[i]),
             loopclosureStrictness);
+    });
+
+    for (unsigned int i=0; i<closeTests.size(); i++)
+    {
+        Frame* candidate = closeTests[i];
+        KFConstraintStruct* e1=closeE1[i];
+        KFConstraintStruct* e2=closeE2[i];
 
         if(enablePrintDebugInfo && printConstraintSearchInfo)
             printf(" CLOSE (%d)\n", distancesToNewKeyFrame.at(candidate));
@@ -1604,18 +1773,26 @@ int SlamSystem::findConstraintsForNewKeyFrames(Frame* newKeyFrame,
                 }
             }
         }
+        else
+            newKeyFrame->trackingFailed.insert(std::pair<Frame*,Sim3>
+                                               (candidate, candidateToFrame_initialEstimateMap[candidate]));
     }
 
 
-    for (Frame* candidate : farCandidates)
+    std::vector<KFConstraintStruct*> farE1(farCandidates.size()), farE2(farCandidates.size());
+    forEachCandidate(farCandidates.size(), [&](ConstraintSearchWorker& worker, int i)
     {
-        KFConstraintStruct* e1=0;
-        KFConstraintStruct* e2=0;
-
         testConstraint(
-            candidate, e1, e2,
+            worker, farCandidates[i], farE1[i], farE2[i],
             Sim3(),
             loopclosureStrictness);
+    });
+
+    for (unsigned int i=0; i<farCandidates.size(); i++)
+    {
+        Frame* candidate = farCandidates[i];
+        KFConstraintStruct* e1=farE1[i];
+        KFConstraintStruct* e2=farE2[i];
 
         if(enablePrintDebugInfo && printConstraintSearchInfo)
             printf(" FAR (%d)\n", distancesToNewKeyFrame.at(candidate));
@@ -1625,6 +1802,8 @@ int SlamSystem::findConstraintsForNewKeyFrames(Frame* newKeyFrame,
             constraints.push_back(e1);
             constraints.push_back(e2);
         }
+        else
+            newKeyFrame->trackingFailed.insert(std::pair<Frame*,Sim3>(candidate, Sim3()));
     }
 
 
@@ -1634,7 +1813,7 @@ int SlamSystem::findConstraintsForNewKeyFrames(Frame* newKeyFrame,
         KFConstraintStruct* e1=0;
         KFConstraintStruct* e2=0;
         testConstraint(
-            parent, e1, e2,
+            constraintSearchWorkers[0], parent, e1, e2,
             candidateToFrame_initialEstimateMap[parent],
             100);
         if(enablePrintDebugInfo && printConstraintSearchInfo)
@@ -1647,6 +1826,9 @@ int SlamSystem::findConstraintsForNewKeyFrames(Frame* newKeyFrame,
         }
         else
         {
+            newKeyFrame->trackingFailed.insert(std::pair<Frame*,Sim3>
+                                               (parent, candidateToFrame_initialEstimateMap[parent]));
+
             float downweightFac = 5;
             const float kernelDelta = 5 * sqrt(6000*loopclosureStrictness) / downweightFac;
             printf("warning: reciprocal tracking on new frame failed badly, added odometry edge (Hacky).\n");
@@ -1693,7 +1875,8 @@ int SlamSystem::findConstraintsForNewKeyFrames(Frame* newKeyFrame,
     newConstraintMutex.unlock();
 
     newKFTrackingReference->invalidate();
-    candidateTrackingReference->invalidate();
+    for(ConstraintSearchWorker& worker : constraintSearchWorkers)
+        worker.candidateTrackingReference->invalidate();
 
 
 
@@ -1721,6 +1904,8 @@ bool SlamSystem::optimizationIteration(int itsPerTry, float minChange)
 
     // Do the optimization. This can take quite some time!
     int its = keyFrameGraph->optimize(itsPerTry);
+    msOptimizationInit = 0.9*msOptimizationInit + 0.1*keyFrameGraph->msLastInitialization;
+    msOptimizationSolve = 0.9*msOptimizationSolve + 0.1*keyFrameGraph->msLastSolve;
 
 
     // save the optimization result.
@@ -1729,19 +1914,23 @@ bool SlamSystem::optimizationIteration(int itsPerTry, float minChange)
     float maxChange = 0;
     float sumChange = 0;
     float sum = 0;
-    for(size_t i=0; i<keyFrameGraph->keyframesAll.size(); i++)
+
+    // an incremental optimization only moved the keyframes of its region.
+    const std::vector<Frame*>& optimizedKeyFrames = keyFrameGraph->optimizedFullGraph ?
+            keyFrameGraph->keyframesAll : keyFrameGraph->incrementalKeyFrames;
+    for(Frame* keyframe : optimizedKeyFrames)
     {
         // set edge error sum to zero
-        keyFrameGraph->keyframesAll[i]->edgeErrorSum = 0;
-        keyFrameGraph->keyframesAll[i]->edgesNum = 0;
+        keyframe->edgeErrorSum = 0;
+        keyframe->edgesNum = 0;
 
-        if(!keyFrameGraph->keyframesAll[i]->pose->isInGraph) continue;
+        if(!keyframe->pose->isInGraph) continue;
 
 
 
         // get change from last optimization
-        Sim3 a = keyFrameGraph->keyframesAll[i]->pose->graphVertex->estimate();
-        Sim3 b = keyFrameGraph->keyframesAll[i]->getScaledCamToWorld();
+        Sim3 a = keyframe->pose->graphVertex->estimate();
+        Sim3 b = keyframe->getScaledCamToWorld();
         Sophus::Vector7f diff = (a*b.inverse()).log().cast<float>();
 
 
@@ -1754,14 +1943,14 @@ bool SlamSystem::optimizationIteration(int itsPerTry, float minChange)
         sum +=7;
 
         // set change
-        keyFrameGraph->keyframesAll[i]->pose->setPoseGraphOptResult(
-            keyFrameGraph->keyframesAll[i]->pose->graphVertex->estimate());
+        keyframe->pose->setPoseGraphOptResult(
+            keyframe->pose->graphVertex->estimate());
 
         // add error
-        for(auto edge : keyFrameGraph->keyframesAll[i]->pose->graphVertex->edges())
+        for(auto edge : keyframe->pose->graphVertex->edges())
         {
-            keyFrameGraph->keyframesAll[i]->edgeErrorSum += ((EdgeSim3*)(edge))->chi2();
-            keyFrameGraph->keyframesAll[i]->edgesNum++;
+            keyframe->edgeErrorSum += ((EdgeSim3*)(edge))->chi2();
+            keyframe->edgesNum++;
         }
     }
 
@@ -1792,12 +1981,60 @@ bool SlamSystem::optimizationIteration(int itsPerTry, float minChange)
 void SlamSystem::optimizeGraph()
 {
     boost::unique_lock<boost::mutex> g2oLock(g2oGraphAccessMutex);
+    keyFrameGraph->requestFullOptimization();
     keyFrameGraph->optimize(1000);
     g2oLock.unlock();
     mergeOptimizationOffset();
 }
 
 
+bool SlamSystem::saveMap(const std::string& filename)
+{
+    poseConsistencyMutex.lock_shared();
+    bool saved = keyFrameGraph->saveMap(filename);
+    poseConsistencyMutex.unlock_shared();
+    return saved;
+}
+
+int SlamSystem::loadMap(const std::string& filename)
+{
+    if(!SLAMEnabled || currentKeyFrame != 0)
+    {
+        printf("can only load a map with SLAM enabled, before the first frame!\n");
+        return -1;
+    }
+
+    std::vector<Frame*> loadedKeyFrames;
+    newConstraintMutex.lock();
+    bool loaded = keyFrameGraph->loadMap(filename, width, height, K, loadedKeyFrames);
+    newConstraintMutex.unlock();
+    if(!loaded || loadedKeyFrames.empty())
+        return -1;
+
+    int nextFrameID = 0;
+    for(Frame* keyframe : loadedKeyFrames)
+    {
+        trackableKeyFrameSearch->addKeyFrame(keyframe);
+        nextFrameID = std::max(nextFrameID, keyframe->id() + 1);
+        if(outputWrapper != 0)
+            outputWrapper->publishKeyframe(keyframe);
+    }
+
+    // no depth map yet: the mapping thread starts the relocalizer on the loaded keyframes,
+    // as soon as frames come in, and re-activates the keyframe it finds.
+    currentKeyFrameMutex.lock();
+    keyFrameGraph->idToKeyFrameMutex.lock_shared();
+    currentKeyFrame = keyFrameGraph->idToKeyFrame.find(loadedKeyFrames.back()->id())->second;
+    keyFrameGraph->idToKeyFrameMutex.unlock_shared();
+    trackingIsGood = false;
+    nextRelocIdx = -1;
+    currentKeyFrameMutex.unlock();
+
+    publishKeyframeGraph();
+
+    return nextFrameID;
+}
+
 SE3 SlamSystem::getCurrentPoseEstimate()
 {
     SE3 camToWorld = SE3();
@@ -26,6 +26,7 @@
 #include <boost/thread/shared_mutex.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
+#include <boost/function.hpp>
 #include "util/settings.h"
 #include "io_wrapper/timestamp.h"
 #include "opencv2/core/core.hpp"
@@ -49,6 +50,8 @@ class LiveSLAMWrapper;
 class Output3DWrapper;
 class TrackableKeyFrameSearch;
 class FramePoseStruct;
+class MotionModel;
+class IndexThreadReduce;
 struct KFConstraintStruct;
 
 
@@ -92,6 +95,17 @@ public:
     /** Does an offline optimization step. */
     void optimizeGraph();
 
+    /** Saves all finished keyframes and constraints to a binary map file (see KeyFrameGraph::saveMap). */
+    bool saveMap(const std::string& filename);
+
+    /**
+     * Warm-starts from a map saved with saveMap(), instead of randomInit() / gtDepthInit():
+     * the system starts out relocalizing against the loaded keyframes.
+     * Returns the first frame id that is not used by the map (ids passed to trackFrame()
+     * must start there), or -1 if the map could not be loaded.
+     */
+    int loadMap(const std::string& filename);
+
     inline Frame* getCurrentKeyframe() {
         return currentKeyFrame.get();   // not thread-safe!
     }
@@ -123,6 +137,11 @@ public:
         nFindReferences;
     float nAvgTrackFrame, nAvgOptimizationIteration, nAvgFindConstraintsItaration,
           nAvgFindReferences;
+    // parts of msOptimizationIteration: g2o (re-)initialization and solve.
+    float msOptimizationInit, msOptimizationSolve;
+    // summed over the frames tracked since the last timing print.
+    int nTrackResidualCalls[PYRAMID_LEVELS], nTrackIterations[PYRAMID_LEVELS],
+        nTrackEarlyExits;
     std::chrono::high_resolution_clock::time_point lastHzUpdate;
 
 
@@ -133,6 +152,7 @@ private:
     TrackingReference*
     trackingReference; // tracking reference for current keyframe. only used by tracking.
     SE3Tracker* tracker;
+    MotionModel* motionModel;	// initial estimate for tracker, if useMotionModel.
 
 
 
@@ -148,10 +168,19 @@ private:
 
     // ============= EXCLUSIVELY FIND-CONSTRAINT THREAD (+ init) =============
     TrackableKeyFrameSearch* trackableKeyFrameSearch;
-    Sim3Tracker* constraintTracker;
-    SE3Tracker* constraintSE3Tracker;
-    TrackingReference* newKFTrackingReference;
-    TrackingReference* candidateTrackingReference;
+    TrackingReference* newKFTrackingReference;	// shared (read-only) by all workers.
+
+    // trackers and candidate reference of one constraint-search worker.
+    struct ConstraintSearchWorker
+    {
+        Sim3Tracker* sim3Tracker;
+        Sim3Tracker* reciprocalSim3Tracker;	// tracks B->A in tryTrackSim3, while sim3Tracker tracks A->B.
+        SE3Tracker* se3Tracker;
+        TrackingReference* candidateTrackingReference;
+    };
+    std::vector<ConstraintSearchWorker> constraintSearchWorkers;
+    IndexThreadReduce* constraintCandidateReducer;	// spreads the candidates over the workers, or the two directions of tryTrackSim3.
+    bool inCandidatePool;	// set while forEachCandidate runs jobs on constraintCandidateReducer.
 
 
 
@@ -266,18 +295,33 @@ private:
     void constraintSearchThreadLoop();
     /** Calculates a scale independent error norm for reciprocal tracking results a and b with associated information matrices. */
     float tryTrackSim3(
+        ConstraintSearchWorker& worker,
         TrackingReference* A, TrackingReference* B,
         int lvlStart, int lvlEnd,
         bool useSSE,
         Sim3 &AtoB, Sim3 &BtoA,
         KFConstraintStruct* e1=0, KFConstraintStruct* e2=0);
 
+    /** Tracks of tryTrackSim3 for the directions in [first, end): direction 0 tracks B on A, direction 1 A on B. */
+    void trackSim3Reciprocal(
+        int first, int end,
+        ConstraintSearchWorker* worker,
+        TrackingReference* A, TrackingReference* B,
+        int lvlStart, int lvlEnd,
+        Sim3* AtoB, Sim3* BtoA);
+
+    /** Failures are not added to trackingFailed of the new keyframe, that is left to the (single threaded) caller. */
     void testConstraint(
+        ConstraintSearchWorker& worker,
         Frame* candidate,
         KFConstraintStruct* &e1_out, KFConstraintStruct* &e2_out,
         const Sim3& candidateToFrame_initialEstimate,
         float strictness);
 
+    /** Calls job(worker, i) for all i in [0, num), spread over the constraint-search workers in contiguous chunks. */
+    void forEachCandidate(int num,
+                          const boost::function<void(ConstraintSearchWorker&, int)>& job);
+
     void optimizationThreadLoop();
 
 
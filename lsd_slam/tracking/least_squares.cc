@@ -57,6 +57,16 @@ inline void NormalEquationsLeastSquares::update(const Vector6& J,
     num_constraints += 1;
 }
 
+void NormalEquationsLeastSquares::updateSummed(const Matrix6x6& JtJ,
+        const Vector6& Jtr, const float& err, const size_t num)
+{
+    A_opt.add(JtJ);
+    b -= Jtr;
+
+    error += err;
+    num_constraints += num;
+}
+
 void NormalEquationsLeastSquares::combine(const NormalEquationsLeastSquares&
         other)
 {
@@ -281,6 +291,24 @@ inline void OptimizedSelfAdjointMatrix6x6f::operator +=(const
 #endif
 }
 
+void OptimizedSelfAdjointMatrix6x6f::add(const Eigen::Matrix<float, 6, 6>& m)
+{
+    size_t idx = 0;
+
+    // same 2x2 block layout as in toEigen(); the lower entry of the
+    // diagonal blocks is never read back, so it is filled from the upper one.
+    for(size_t i = 0; i < 6; i += 2)
+    {
+        for(size_t j = i; j < 6; j += 2)
+        {
+            data[idx++] += m(i, j  );
+            data[idx++] += m(i, j+1);
+            data[idx++] += i == j ? m(i, j+1) : m(i+1, j);
+            data[idx++] += m(i+1, j+1);
+        }
+    }
+}
+
 void OptimizedSelfAdjointMatrix6x6f::toEigen(Eigen::Matrix<float, 6, 6>& m)
 const
 {
@@ -331,6 +359,16 @@ inline void NormalEquationsLeastSquares4::update(const Vector4& J,
     num_constraints += 1;
 }
 
+void NormalEquationsLeastSquares4::updateSummed(const Matrix4x4& JtJ,
+        const Vector4& Jtr, const float& err, const size_t num)
+{
+    A += JtJ;
+    b -= Jtr;
+
+    error += err;
+    num_constraints += num;
+}
+
 void NormalEquationsLeastSquares4::combine(const NormalEquationsLeastSquares4&
         other)
 {
@@ -51,6 +51,9 @@ public:
 
     void operator +=(const OptimizedSelfAdjointMatrix6x6f& other);
 
+    /** adds a (symmetric) matrix, only the upper triangle of m is used. */
+    void add(const Eigen::Matrix<float, 6, 6>& m);
+
     void setZero();
 
     void toEigen(Eigen::Matrix<float, 6, 6>& m) const;
@@ -85,6 +88,13 @@ public:
     virtual void initialize(const size_t maxnum_constraints);
     virtual void update(const Vector6& J, const float& res,
                         const float& weight = 1.0f);
+
+    /**
+     * Adds num constraints that were already summed up by the caller:
+     * JtJ = sum(w*J*J^T) (upper triangle), Jtr = sum(w*r*J), err = sum(w*r*r).
+     */
+    void updateSummed(const Matrix6x6& JtJ, const Vector6& Jtr,
+                      const float& err, const size_t num);
     virtual void finish();
     virtual void finishNoDivide();
     virtual void solve(Vector6& x);
@@ -116,6 +126,13 @@ public:
     virtual void update(const Vector4& J, const float& res,
                         const float& weight = 1.0f);
 
+    /**
+     * Adds num constraints that were already summed up by the caller,
+     * as NormalEquationsLeastSquares::updateSummed (JtJ complete, not only the upper triangle).
+     */
+    void updateSummed(const Matrix4x4& JtJ, const Vector4& Jtr,
+                      const float& err, const size_t num);
+
     void combine(const NormalEquationsLeastSquares4& other);
 
     virtual void finishNoDivide();
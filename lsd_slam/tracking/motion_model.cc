@@ -0,0 +1,101 @@
+/**
+* This file is part of LSD-SLAM.
+*
+* Copyright 2013 Jakob Engel <engelj at in dot tum dot de> (Technical University of Munich)
+* For more information see <http://vision.in.tum.de/lsdslam>
+*
+* LSD-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* LSD-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with LSD-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "tracking/motion_model.h"
+#include "model/frame.h"
+#include "model/frame_pose_struct.h"
+
+namespace lsd_slam
+{
+
+
+MotionModel::MotionModel(const Eigen::Matrix3f& K)
+{
+    fx = K(0,0);
+    reset();
+}
+
+void MotionModel::reset()
+{
+    lastPose = secondLastPose = 0;
+    lastTimestamp = secondLastTimestamp = 0;
+    predictionFrameID = -1;
+    numAccuratePredictions = 0;
+    lastPredictionError = -1;
+}
+
+void MotionModel::addTrackedFrame(Frame* frame, float meanIdepth)
+{
+    lastPredictionError = -1;
+    if(predictionFrameID == frame->id())
+    {
+        // reprojection error of the prediction, for a point at mean depth.
+        SE3::Tangent err = (prediction.inverse() * se3FromSim3(
+                                    frame->pose->getCamToWorld())).log();
+        lastPredictionError = fx * (err.tail<3>().norm() + err.head<3>().norm() * meanIdepth);
+
+        if(lastPredictionError < MOTION_MODEL_CONFIDENT_PIXEL_ERROR)
+            numAccuratePredictions++;
+        else
+            numAccuratePredictions = 0;
+    }
+    else
+        numAccuratePredictions = 0;
+    predictionFrameID = -1;
+
+    secondLastPose = lastPose;
+    secondLastTimestamp = lastTimestamp;
+    lastPose = frame->pose;
+    lastTimestamp = frame->timestamp();
+}
+
+bool MotionModel::predictCamToWorld(int frameID, double timestamp,
+                                    SE3& out_camToWorld)
+{
+    if(lastPose == 0 || secondLastPose == 0)
+        return false;
+
+    SE3 lastCamToWorld = se3FromSim3(lastPose->getCamToWorld());
+    SE3 lastMotion = se3FromSim3(secondLastPose->getCamToWorld()).inverse() *
+                     lastCamToWorld;
+
+    // scale the last motion to the time passed since the last frame. without
+    // (valid) timestamps, assume frames at a constant rate.
+    double steps;
+    if(timestamp > lastTimestamp && lastTimestamp > secondLastTimestamp)
+        steps = (timestamp - lastTimestamp) / (lastTimestamp - secondLastTimestamp);
+    else
+        steps = std::max(1, frameID - lastPose->frameID) / (double)std::max(1,
+                lastPose->frameID - secondLastPose->frameID);
+    steps = std::min(steps, 3.0) * MOTION_MODEL_VELOCITY_DECAY;
+
+    prediction = lastCamToWorld * SE3::exp(steps * lastMotion.log());
+    predictionFrameID = frameID;
+
+    out_camToWorld = prediction;
+    return true;
+}
+
+bool MotionModel::isConfident() const
+{
+    return numAccuratePredictions >= MOTION_MODEL_CONFIDENT_FRAMES;
+}
+
+}
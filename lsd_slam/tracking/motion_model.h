@@ -0,0 +1,79 @@
+/**
+* This file is part of LSD-SLAM.
+*
+* Copyright 2013 Jakob Engel <engelj at in dot tum dot de> (Technical University of Munich)
+* For more information see <http://vision.in.tum.de/lsdslam>
+*
+* LSD-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* LSD-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with LSD-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "util/settings.h"
+#include "util/sophus_util.h"
+
+
+namespace lsd_slam
+{
+
+class Frame;
+class FramePoseStruct;
+
+/**
+ * Predicts the pose of a new frame from the poses of the last two tracked
+ * frames, assuming a (decaying) constant velocity, and keeps track of how
+ * well these predictions matched the tracking result.
+ *
+ * Only keeps pointers to the FramePoseStructs, so the prediction always
+ * uses their current (possibly re-optimized) poses.
+ * Only used by the tracking thread.
+ */
+class MotionModel
+{
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    MotionModel(const Eigen::Matrix3f& K);
+
+    /** forgets the history, e.g. when tracking was lost. */
+    void reset();
+
+    /** to be called with every successfully tracked frame, in order. */
+    void addTrackedFrame(Frame* frame, float meanIdepth);
+
+    /**
+     * camToWorld predicted for a frame with the given id and timestamp.
+     * returns false if there is not enough history; out_camToWorld is not set then.
+     */
+    bool predictCamToWorld(int frameID, double timestamp, SE3& out_camToWorld);
+
+    /** whether the last MOTION_MODEL_CONFIDENT_FRAMES predictions were accurate. */
+    bool isConfident() const;
+
+    /** error of the last prediction, in full resolution pixels (-1 if there was none). */
+    float lastPredictionError;
+
+private:
+    float fx;
+
+    FramePoseStruct* lastPose;
+    FramePoseStruct* secondLastPose;
+    double lastTimestamp, secondLastTimestamp;
+
+    SE3 prediction;
+    int predictionFrameID;
+
+    int numAccuratePredictions;
+};
+
+}
@@ -0,0 +1,132 @@
+/**
+* This file is part of LSD-SLAM.
+*
+* Copyright 2013 Jakob Engel <engelj at in dot tum dot de> (Technical University of Munich)
+* For more information see <http://vision.in.tum.de/lsdslam>
+*
+* LSD-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* LSD-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with LSD-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "tracking/point_cloud_soa.h"
+#include <cstdint>
+#include <cstring>
+
+namespace lsd_slam
+{
+
+
+PointCloudSoA::PointCloudSoA()
+{
+    x = y = z = color = var = 0;
+    gradX = gradY = 0;
+    for(int k=0; k<6; k++) jac[k] = 0;
+    hasJacobians = false;
+    num = 0;
+    capacity = 0;
+    block = 0;
+    jacBlock = 0;
+}
+
+PointCloudSoA::~PointCloudSoA()
+{
+    release();
+}
+
+void PointCloudSoA::release()
+{
+    if(block != 0)
+        delete[] block;
+    if(jacBlock != 0)
+        delete[] jacBlock;
+    x = y = z = color = var = 0;
+    gradX = gradY = 0;
+    for(int k=0; k<6; k++) jac[k] = 0;
+    hasJacobians = false;
+    block = 0;
+    jacBlock = 0;
+    num = 0;
+    capacity = 0;
+}
+
+void PointCloudSoA::reserve(int n)
+{
+    if(n <= capacity && block != 0)
+        return;
+
+    release();
+
+    // one block for all seven arrays, each starting on a 64 byte boundary.
+    capacity = ((n + SIMD_WIDTH - 1) / SIMD_WIDTH) * SIMD_WIDTH;
+    if(capacity == 0) capacity = SIMD_WIDTH;
+    block = new float[7*capacity + 16];
+    float* aligned = (float*)(((uintptr_t)block + 63) & ~(uintptr_t)63);
+
+    x = aligned;
+    y = x + capacity;
+    z = y + capacity;
+    color = z + capacity;
+    var = color + capacity;
+    gradX = var + capacity;
+    gradY = gradX + capacity;
+
+    setNum(0);
+}
+
+void PointCloudSoA::reserveJacobians()
+{
+    if(jacBlock != 0)
+        return;
+
+    jacBlock = new float[6*capacity + 16];
+    float* aligned = (float*)(((uintptr_t)jacBlock + 63) & ~(uintptr_t)63);
+
+    for(int k=0; k<6; k++)
+        jac[k] = aligned + k*capacity;
+
+    setNum(num);
+}
+
+void PointCloudSoA::copyFrom(const PointCloudSoA& other)
+{
+    reserve(other.num);
+
+    int n = ((other.num + SIMD_WIDTH - 1) / SIMD_WIDTH) * SIMD_WIDTH;
+    memcpy(x, other.x, sizeof(float)*n);
+    memcpy(y, other.y, sizeof(float)*n);
+    memcpy(z, other.z, sizeof(float)*n);
+    memcpy(color, other.color, sizeof(float)*n);
+    memcpy(var, other.var, sizeof(float)*n);
+    memcpy(gradX, other.gradX, sizeof(float)*n);
+    memcpy(gradY, other.gradY, sizeof(float)*n);
+    num = other.num;
+    hasJacobians = false;	// not copied, only the forward compositional tracking uses copies.
+}
+
+void PointCloudSoA::setNum(int n)
+{
+    num = n;
+    for(int i=n; i<capacity && (i % SIMD_WIDTH) != 0; i++)
+    {
+        x[i] = y[i] = 0;
+        z[i] = 1;
+        color[i] = var[i] = 0;
+        gradX[i] = gradY[i] = 0;
+        if(jacBlock != 0)
+        {
+            for(int k=0; k<6; k++) jac[k][i] = 0;
+        }
+    }
+}
+
+}
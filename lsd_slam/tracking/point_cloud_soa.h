@@ -0,0 +1,84 @@
+/**
+* This file is part of LSD-SLAM.
+*
+* Copyright 2013 Jakob Engel <engelj at in dot tum dot de> (Technical University of Munich)
+* For more information see <http://vision.in.tum.de/lsdslam>
+*
+* LSD-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* LSD-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with LSD-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+
+namespace lsd_slam
+{
+
+/**
+ * Point cloud of one pyramid level in structure-of-arrays layout:
+ * x, y, z (position in the reference frame), color (I), var (idepth variance)
+ * and gradX, gradY (image gradient at the point).
+ *
+ * All arrays are 64-byte aligned and have room for a multiple of SIMD_WIDTH
+ * points, the slots past the end are padded with a harmless point (z=1, rest 0),
+ * so vectorized kernels can use aligned full-width loads everywhere.
+ *
+ * Optionally (reserveJacobians()), the photometric jacobian of the point w.r.t.
+ * the pose at the identity is kept as well, for inverse compositional tracking.
+ */
+class PointCloudSoA
+{
+public:
+    enum { SIMD_WIDTH = 16 };
+
+    PointCloudSoA();
+    PointCloudSoA(const PointCloudSoA&) = delete;
+    PointCloudSoA& operator=(const PointCloudSoA&) = delete;
+    ~PointCloudSoA();
+
+    /** makes room for at least n points. the content is lost if it has to grow. */
+    void reserve(int n);
+
+    /** copies the points of other (same as reserve(other.num) + memcpy). */
+    void copyFrom(const PointCloudSoA& other);
+
+    /** sets num and pads the slots after it up to the next multiple of SIMD_WIDTH. */
+    void setNum(int n);
+
+    /** makes room for jac for capacity points. */
+    void reserveJacobians();
+
+    void release();
+
+    float* x;
+    float* y;
+    float* z;
+    float* color;
+    float* var;
+    float* gradX;	// raw image gradient, not scaled with fx, fy.
+    float* gradY;
+
+    // only valid if hasJacobians: jac[k] = d I / d xi_k at the identity
+    // (gradient already scaled with fx, fy).
+    float* jac[6];
+    bool hasJacobians;
+
+    int num;
+    int capacity;
+
+private:
+    float* block;
+    float* jacBlock;
+};
+
+}
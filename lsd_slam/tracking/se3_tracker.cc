@@ -26,6 +26,11 @@
 #include "util/snprintf.h"
 #include "io_wrapper/image_display.h"
 #include "tracking/least_squares.h"
+#include "util/index_thread_reduce.h"
+
+#if defined(ENABLE_AVX2)
+#include <immintrin.h>
+#endif
 
 namespace lsd_slam
 {
@@ -35,13 +40,54 @@ namespace lsd_slam
 #define callOptimized(function, arguments) function##NEON arguments
 #else
 #if defined(ENABLE_SSE)
-#define callOptimized(function, arguments) (USESSE ? function##SSE arguments : function arguments)
+#define callOptimized(function, arguments) (simdLevel >= SIMD_AVX512 ? function##AVX512 arguments : \
+        (simdLevel >= SIMD_AVX2 ? function##AVX2 arguments : \
+        (USESSE ? function##SSE arguments : function arguments)))
 #else
 #define callOptimized(function, arguments) function arguments
 #endif
 #endif
 
 
+#if defined(ENABLE_AVX2)
+TARGET_AVX2 static inline float hsumAVX2(__m256 v)
+{
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    return _mm_cvtss_f32(s);
+}
+
+// permutations moving the lanes set in an 8bit mask to the front, used to
+// append only the valid lanes of a vector to the warped buffers.
+static struct LeftPackTableAVX2
+{
+    int idx[256][8];
+
+    LeftPackTableAVX2()
+    {
+        for(int mask=0; mask<256; mask++)
+        {
+            int n = 0;
+            for(int lane=0; lane<8; lane++)
+                if(mask & (1<<lane))
+                    idx[mask][n++] = lane;
+            for(; n<8; n++)
+                idx[mask][n] = 0;
+        }
+    }
+} leftPackTableAVX2;
+#endif
+
+#if defined(ENABLE_AVX512)
+// mask of the first min(remaining,16) lanes.
+static inline __mmask16 laneMaskAVX512(int remaining)
+{
+    return remaining >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << remaining) - 1);
+}
+#endif
+
+
 SE3Tracker::SE3Tracker(int w, int h, Eigen::Matrix3f K)
 {
     width = w;
@@ -63,19 +109,24 @@ SE3Tracker::SE3Tracker(int w, int h, Eigen::Matrix3f K)
     cyi = KInv(1,2);
 
 
-    buf_warped_residual = new float[w*h];
-    buf_warped_dx = new float[w*h];
-    buf_warped_dy = new float[w*h];
-    buf_warped_x = new float[w*h];
-    buf_warped_y = new float[w*h];
-    buf_warped_z = new float[w*h];
+    // a few floats of slack, the vectorized kernels append full vectors.
+    buf_warped_residual = new float[w*h+8];
+    buf_warped_dx = new float[w*h+8];
+    buf_warped_dy = new float[w*h+8];
+    buf_warped_x = new float[w*h+8];
+    buf_warped_y = new float[w*h+8];
+    buf_warped_z = new float[w*h+8];
 
-    buf_d = new float[w*h];
-    buf_idepthVar = new float[w*h];
-    buf_weight_p = new float[w*h];
+    buf_d = new float[w*h+8];
+    buf_idepthVar = new float[w*h+8];
+    buf_weight_p = new float[w*h+8];
 
     buf_warped_size = 0;
 
+    threadReducer = 0;
+    fusedInverseCompositional = false;
+    lsAccumulated = false;
+
     debugImageWeights = cv::Mat(height,width,CV_8UC3);
     debugImageResiduals = cv::Mat(height,width,CV_8UC3);
     debugImageSecondFrame = cv::Mat(height,width,CV_8UC3);
@@ -85,6 +136,9 @@ SE3Tracker::SE3Tracker(int w, int h, Eigen::Matrix3f K)
 
 
     lastResidual = 0;
+    lastExitedEarly = false;
+    for(int lvl=0; lvl < PYRAMID_LEVELS; lvl++)
+        numCalcResidualCalls[lvl] = numCalcWarpUpdateCalls[lvl] = 0;
     iterationNumber = 0;
     pointUsage = 0;
     lastGoodCount = lastBadCount = 0;
@@ -111,6 +165,9 @@ SE3Tracker::~SE3Tracker()
     delete[] buf_d;
     delete[] buf_idepthVar;
     delete[] buf_weight_p;
+
+    if(threadReducer != 0)
+        delete threadReducer;
 }
 
 
@@ -136,24 +193,23 @@ float SE3Tracker::checkPermaRefOverlap(
     Eigen::Matrix3f rotMat = referenceToFrame.rotationMatrix();
     Eigen::Vector3f transVec = referenceToFrame.translation();
 
-    const Eigen::Vector3f* refPoint_max = reference->permaRef_posData +
-                                          reference->permaRefNumPts;
-    const Eigen::Vector3f* refPoint = reference->permaRef_posData;
+    const PointCloudSoA& refData = reference->permaRef_pointData;
 
     float usageCount = 0;
-    for(; refPoint<refPoint_max; refPoint++)
+    for(int i=0; i<refData.num; i++)
     {
-        Eigen::Vector3f Wxp = rotMat * (*refPoint) + transVec;
+        Eigen::Vector3f refPoint(refData.x[i], refData.y[i], refData.z[i]);
+        Eigen::Vector3f Wxp = rotMat * refPoint + transVec;
         float u_new = (Wxp[0]/Wxp[2])*fx_l + cx_l;
         float v_new = (Wxp[1]/Wxp[2])*fy_l + cy_l;
         if((u_new > 0 && v_new > 0 && u_new < w2 && v_new < h2))
         {
-            float depthChange = (*refPoint)[2] / Wxp[2];
+            float depthChange = refPoint[2] / Wxp[2];
             usageCount += depthChange < 1 ? depthChange : 1;
         }
     }
 
-    pointUsage = usageCount / (float)reference->permaRefNumPts;
+    pointUsage = usageCount / (float)refData.num;
     return pointUsage;
 }
 
@@ -179,8 +235,8 @@ SE3 SE3Tracker::trackFrameOnPermaref(
     diverged = false;
     trackingWasGood = true;
 
-    callOptimized(calcResidualAndBuffers, (reference->permaRef_posData,
-                                           reference->permaRef_colorAndVarData, 0, reference->permaRefNumPts, frame,
+    callOptimized(calcResidualAndBuffers, (reference->permaRef_pointData,
+                                           0, reference->permaRef_pointData.num, frame,
                                            referenceToFrame, QUICK_KF_CHECK_LVL, false));
     if(buf_warped_size < MIN_GOODPERALL_PIXEL_ABSMIN * (width>>QUICK_KF_CHECK_LVL)
             *(height>>QUICK_KF_CHECK_LVL))
@@ -218,8 +274,8 @@ SE3 SE3Tracker::trackFrameOnPermaref(
                                                 referenceToFrame;
 
             // re-evaluate residual
-            callOptimized(calcResidualAndBuffers, (reference->permaRef_posData,
-                                                   reference->permaRef_colorAndVarData, 0, reference->permaRefNumPts, frame,
+            callOptimized(calcResidualAndBuffers, (reference->permaRef_pointData,
+                                                   0, reference->permaRef_pointData.num, frame,
                                                    new_referenceToFrame, QUICK_KF_CHECK_LVL, false));
             if(buf_warped_size < MIN_GOODPERALL_PIXEL_ABSMIN * (width>>QUICK_KF_CHECK_LVL)
                     *(height>>QUICK_KF_CHECK_LVL))
@@ -291,7 +347,8 @@ SE3 SE3Tracker::trackFrameOnPermaref(
 SE3 SE3Tracker::trackFrame(
     TrackingReference* reference,
     Frame* frame,
-    const SE3& frameToReference_initialEstimate)
+    const SE3& frameToReference_initialEstimate,
+    int startLevel)
 {
 
     boost::shared_lock<boost::shared_mutex> lock = frame->getActiveLock();
@@ -318,27 +375,39 @@ SE3 SE3Tracker::trackFrame(
     // ============ track frame ============
     Sophus::SE3f referenceToFrame =
         frameToReference_initialEstimate.inverse().cast<float>();
-    NormalEquationsLeastSquares ls;
+    // ls holds the normal equations at referenceToFrame, ls_new the ones of
+    // the increment currently being tried (only filled by the fused pass).
+    NormalEquationsLeastSquares ls, ls_new;
 
 
-    int numCalcResidualCalls[PYRAMID_LEVELS];
-    int numCalcWarpUpdateCalls[PYRAMID_LEVELS];
+    for(int lvl=0; lvl < PYRAMID_LEVELS; lvl++)
+        numCalcResidualCalls[lvl] = numCalcWarpUpdateCalls[lvl] = 0;
+    lastExitedEarly = false;
 
     float last_residual = 0;
 
+    startLevel = std::max(SE3TRACKING_MIN_LEVEL, std::min(SE3TRACKING_MAX_LEVEL-1,
+                          startLevel));
 
-    for(int lvl=SE3TRACKING_MAX_LEVEL-1; lvl >= SE3TRACKING_MIN_LEVEL; lvl--)
+    for(int lvl=startLevel; lvl >= SE3TRACKING_MIN_LEVEL; lvl--)
     {
-        numCalcResidualCalls[lvl] = 0;
-        numCalcWarpUpdateCalls[lvl] = 0;
+        // after an early exit, the finest level is still evaluated once, for the
+        // good / bad statistics and refPixelWasGood.
+        if(lastExitedEarly && lvl > SE3TRACKING_MIN_LEVEL)
+            continue;
 
         reference->makePointCloud(lvl);
 
-        callOptimized(calcResidualAndBuffers, (reference->posData[lvl],
-                                               reference->colorAndVarData[lvl],
-                                               SE3TRACKING_MIN_LEVEL == lvl ? reference->pointPosInXYGrid[lvl] : 0,
-                                               reference->numData[lvl], frame, referenceToFrame, lvl, (plotTracking
-                                                       && lvl == SE3TRACKING_MIN_LEVEL)));
+        // the update rule differs, so the mode is fixed for the whole level.
+        bool plotResidual = plotTracking && lvl == SE3TRACKING_MIN_LEVEL;
+        bool inverseCompositional = useInverseCompositionalTracking
+                                    && reference->pointData[lvl].hasJacobians
+                                    && canUseFusedPass(plotResidual);
+
+        float lastErr = calcResidualAndUpdate(ls, reference->pointData[lvl],
+                                              SE3TRACKING_MIN_LEVEL == lvl ? reference->pointPosInXYGrid[lvl] : 0,
+                                              reference->numData[lvl], frame, referenceToFrame, lvl,
+                                              inverseCompositional, plotResidual);
         if(buf_warped_size < MIN_GOODPERALL_PIXEL_ABSMIN * (width>>lvl)*(height>>lvl))
         {
             diverged = true;
@@ -351,17 +420,27 @@ SE3 SE3Tracker::trackFrame(
             affineEstimation_a = affineEstimation_a_lastIt;
             affineEstimation_b = affineEstimation_b_lastIt;
         }
-        float lastErr = callOptimized(calcWeightsAndResidual,(referenceToFrame));
 
         numCalcResidualCalls[lvl]++;
 
+        if(lastExitedEarly
+                || (lvl > SE3TRACKING_MIN_LEVEL && lastErr < settings.skipLevelResidual))
+        {
+            last_residual = lastErr;
+            continue;
+        }
+
 
         float LM_lambda = settings.lambdaInitial[lvl];
+        bool levelConverged = false;
+        float lastIncNorm = 0;
 
         for(int iteration=0; iteration < settings.maxItsPerLvl[lvl]; iteration++)
         {
-
-            callOptimized(calculateWarpUpdate,(ls));
+            // the fused pass already accumulated ls while evaluating the residual at
+            // referenceToFrame, the buffered one left the warped buffers of it.
+            if(!lsAccumulated)
+                callOptimized(calculateWarpUpdate,(ls));
 
             numCalcWarpUpdateCalls[lvl]++;
 
@@ -378,17 +457,19 @@ SE3 SE3Tracker::trackFrame(
                 incTry++;
 
                 // apply increment. pretty sure this way round is correct, but hard to test.
-                Sophus::SE3f new_referenceToFrame = Sophus::SE3f::exp((inc)) *
-                                                    referenceToFrame;
-                //Sophus::SE3f new_referenceToFrame = referenceToFrame * Sophus::SE3f::exp((inc));
-
-
-                // re-evaluate residual
-                callOptimized(calcResidualAndBuffers, (reference->posData[lvl],
-                                                       reference->colorAndVarData[lvl],
-                                                       SE3TRACKING_MIN_LEVEL == lvl ? reference->pointPosInXYGrid[lvl] : 0,
-                                                       reference->numData[lvl], frame, new_referenceToFrame, lvl, (plotTracking
-                                                               && lvl == SE3TRACKING_MIN_LEVEL)));
+                // inverse compositional: inc is the negated step of the reference
+                // warp, which is applied inverted on the right.
+                Sophus::SE3f new_referenceToFrame = inverseCompositional ?
+                                                    referenceToFrame * Sophus::SE3f::exp((inc)) :
+                                                    Sophus::SE3f::exp((inc)) * referenceToFrame;
+
+
+                // re-evaluate residual (with the fused pass also the normal equations,
+                // in case the increment is accepted)
+                float error = calcResidualAndUpdate(ls_new, reference->pointData[lvl],
+                                                    SE3TRACKING_MIN_LEVEL == lvl ? reference->pointPosInXYGrid[lvl] : 0,
+                                                    reference->numData[lvl], frame, new_referenceToFrame, lvl,
+                                                    inverseCompositional, plotResidual);
                 if(buf_warped_size < MIN_GOODPERALL_PIXEL_ABSMIN* (width>>lvl)*(height>>lvl))
                 {
                     diverged = true;
@@ -396,7 +477,6 @@ SE3 SE3Tracker::trackFrame(
                     return SE3();
                 }
 
-                float error = callOptimized(calcWeightsAndResidual,(new_referenceToFrame));
                 numCalcResidualCalls[lvl]++;
 
 
@@ -405,6 +485,9 @@ SE3 SE3Tracker::trackFrame(
                 {
                     // accept inc
                     referenceToFrame = new_referenceToFrame;
+                    if(lsAccumulated)
+                        ls = ls_new;
+                    lastIncNorm = sqrt(inc.dot(inc));
                     if(useAffineLightningEstimation)
                     {
                         affineEstimation_a = affineEstimation_a_lastIt;
@@ -432,6 +515,7 @@ SE3 SE3Tracker::trackFrame(
                                    lvl,iteration);
                         }
                         iteration = settings.maxItsPerLvl[lvl];
+                        levelConverged = true;
                     }
 
                     last_residual = lastErr = error;
@@ -460,6 +544,7 @@ SE3 SE3Tracker::trackFrame(
                                    lvl,iteration);
                         }
                         iteration = settings.maxItsPerLvl[lvl];
+                        levelConverged = true;
                         break;
                     }
 
@@ -470,6 +555,14 @@ SE3 SE3Tracker::trackFrame(
                 }
             }
         }
+
+        if(lvl == settings.earlyExitLevel && lvl > SE3TRACKING_MIN_LEVEL
+                && levelConverged && lastIncNorm < settings.earlyExitIncrement)
+        {
+            if(enablePrintDebugInfo && printTrackingIterationInfo)
+                printf("(%d): EARLY EXIT, last increment %f.\n", lvl, lastIncNorm);
+            lastExitedEarly = true;
+        }
     }
 
 
@@ -606,6 +699,133 @@ float SE3Tracker::calcWeightsAndResidualSSE(
 #endif
 
 
+#if defined(ENABLE_AVX2)
+TARGET_AVX2 float SE3Tracker::calcWeightsAndResidualAVX2(
+    const Sophus::SE3f& referenceToFrame)
+{
+    const __m256 txs = _mm256_set1_ps((float)(referenceToFrame.translation()[0]));
+    const __m256 tys = _mm256_set1_ps((float)(referenceToFrame.translation()[1]));
+    const __m256 tzs = _mm256_set1_ps((float)(referenceToFrame.translation()[2]));
+
+    const __m256 ones = _mm256_set1_ps(1.0f);
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    const __m256i laneIdx = _mm256_setr_epi32(0,1,2,3,4,5,6,7);
+
+    const __m256 depthVarFacs = _mm256_set1_ps((float)settings.var_weight);
+    const __m256 sigma_i2s = _mm256_set1_ps((float)cameraPixelNoise2);
+    const __m256 huber_res_ponlys = _mm256_set1_ps((float)(settings.huber_d/2));
+
+    __m256 sumResP = _mm256_setzero_ps();
+
+    for(int i=0; i<buf_warped_size; i+=8)
+    {
+        // lanes past the end of the buffers are neither loaded nor stored.
+        const __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(buf_warped_size-i),
+                              laneIdx);
+
+        __m256 pzs = _mm256_maskload_ps(buf_warped_z+i, valid);
+        __m256 pxs = _mm256_maskload_ps(buf_warped_x+i, valid);
+        __m256 pys = _mm256_maskload_ps(buf_warped_y+i, valid);
+        __m256 rps = _mm256_maskload_ps(buf_warped_residual+i, valid);
+
+        // float g0 = (tx * pz - tz * px) / (pz*pz*d);
+        // float g1 = (ty * pz - tz * py) / (pz*pz*d);
+        __m256 pz2ds = _mm256_mul_ps(_mm256_mul_ps(pzs, pzs),
+                                     _mm256_maskload_ps(buf_d+i, valid));
+        __m256 g0s = _mm256_div_ps(_mm256_fmsub_ps(pzs, txs, _mm256_mul_ps(pxs, tzs)),
+                                   pz2ds);
+        __m256 g1s = _mm256_div_ps(_mm256_fmsub_ps(pzs, tys, _mm256_mul_ps(pys, tzs)),
+                                   pz2ds);
+
+        // float drpdd = gx * g0 + gy * g1;	// ommitting the minus
+        __m256 drpdds = _mm256_fmadd_ps(g0s, _mm256_maskload_ps(buf_warped_dx+i, valid),
+                                        _mm256_mul_ps(g1s, _mm256_maskload_ps(buf_warped_dy+i, valid)));
+
+        // float w_p = 1.0f / (sigma_i2 + s * drpdd * drpdd);
+        __m256 w_ps = _mm256_div_ps(ones, _mm256_fmadd_ps(_mm256_mul_ps(drpdds, drpdds),
+                                    _mm256_mul_ps(depthVarFacs, _mm256_maskload_ps(buf_idepthVar+i, valid)),
+                                    sigma_i2s));
+
+        // float weighted_rp = fabs(rp*sqrtf(w_p));
+        __m256 weighted_rps = _mm256_andnot_ps(signMask,
+                                               _mm256_mul_ps(rps, _mm256_sqrt_ps(w_ps)));
+
+        // float wh = fabs(weighted_rp < huber_res_ponly ? 1 : huber_res_ponly / weighted_rp);
+        __m256 whs = _mm256_blendv_ps(_mm256_div_ps(huber_res_ponlys, weighted_rps), ones,
+                                      _mm256_cmp_ps(weighted_rps, huber_res_ponlys, _CMP_LT_OQ));
+
+        // *(buf_weight_p+i) = wh * w_p;
+        __m256 weights = _mm256_mul_ps(whs, w_ps);
+        _mm256_maskstore_ps(buf_weight_p+i, valid, weights);
+
+        // sumRes += wh * w_p * rp*rp;
+        sumResP = _mm256_add_ps(sumResP, _mm256_and_ps(_mm256_castsi256_ps(valid),
+                                _mm256_mul_ps(weights, _mm256_mul_ps(rps, rps))));
+    }
+
+    return hsumAVX2(sumResP) / buf_warped_size;
+}
+#endif
+
+
+
+#if defined(ENABLE_AVX512)
+TARGET_AVX512 float SE3Tracker::calcWeightsAndResidualAVX512(
+    const Sophus::SE3f& referenceToFrame)
+{
+    const __m512 txs = _mm512_set1_ps((float)(referenceToFrame.translation()[0]));
+    const __m512 tys = _mm512_set1_ps((float)(referenceToFrame.translation()[1]));
+    const __m512 tzs = _mm512_set1_ps((float)(referenceToFrame.translation()[2]));
+
+    const __m512 ones = _mm512_set1_ps(1.0f);
+
+    const __m512 depthVarFacs = _mm512_set1_ps((float)settings.var_weight);
+    const __m512 sigma_i2s = _mm512_set1_ps((float)cameraPixelNoise2);
+    const __m512 huber_res_ponlys = _mm512_set1_ps((float)(settings.huber_d/2));
+
+    __m512 sumResP = _mm512_setzero_ps();
+
+    for(int i=0; i<buf_warped_size; i+=16)
+    {
+        const __mmask16 valid = laneMaskAVX512(buf_warped_size-i);
+
+        __m512 pzs = _mm512_maskz_loadu_ps(valid, buf_warped_z+i);
+        __m512 pxs = _mm512_maskz_loadu_ps(valid, buf_warped_x+i);
+        __m512 pys = _mm512_maskz_loadu_ps(valid, buf_warped_y+i);
+        __m512 rps = _mm512_maskz_loadu_ps(valid, buf_warped_residual+i);
+
+        __m512 pz2ds = _mm512_mul_ps(_mm512_mul_ps(pzs, pzs),
+                                     _mm512_maskz_loadu_ps(valid, buf_d+i));
+        __m512 g0s = _mm512_div_ps(_mm512_fmsub_ps(pzs, txs, _mm512_mul_ps(pxs, tzs)),
+                                   pz2ds);
+        __m512 g1s = _mm512_div_ps(_mm512_fmsub_ps(pzs, tys, _mm512_mul_ps(pys, tzs)),
+                                   pz2ds);
+
+        __m512 drpdds = _mm512_fmadd_ps(g0s, _mm512_maskz_loadu_ps(valid, buf_warped_dx+i),
+                                        _mm512_mul_ps(g1s, _mm512_maskz_loadu_ps(valid, buf_warped_dy+i)));
+
+        __m512 w_ps = _mm512_div_ps(ones, _mm512_fmadd_ps(_mm512_mul_ps(drpdds, drpdds),
+                                    _mm512_mul_ps(depthVarFacs, _mm512_maskz_loadu_ps(valid, buf_idepthVar+i)),
+                                    sigma_i2s));
+
+        __m512 weighted_rps = _mm512_abs_ps(_mm512_mul_ps(rps, _mm512_sqrt_ps(w_ps)));
+
+        __m512 whs = _mm512_mask_blend_ps(
+                         _mm512_cmp_ps_mask(weighted_rps, huber_res_ponlys, _CMP_LT_OQ),
+                         _mm512_div_ps(huber_res_ponlys, weighted_rps), ones);
+
+        __m512 weights = _mm512_mul_ps(whs, w_ps);
+        _mm512_mask_storeu_ps(buf_weight_p+i, valid, weights);
+
+        sumResP = _mm512_mask_add_ps(sumResP, valid, sumResP,
+                                     _mm512_mul_ps(weights, _mm512_mul_ps(rps, rps)));
+    }
+
+    return _mm512_reduce_add_ps(sumResP) / buf_warped_size;
+}
+#endif
+
+
 
 #if defined(ENABLE_NEON)
 float SE3Tracker::calcWeightsAndResidualNEON(
@@ -890,8 +1110,7 @@ void SE3Tracker::calcResidualAndBuffers_debugFinish(int w)
 
 #if defined(ENABLE_SSE)
 float SE3Tracker::calcResidualAndBuffersSSE(
-    const Eigen::Vector3f* refPoint,
-    const Eigen::Vector2f* refColVar,
+    const PointCloudSoA& refData,
     int* idxBuf,
     int refNum,
     Frame* frame,
@@ -899,15 +1118,401 @@ float SE3Tracker::calcResidualAndBuffersSSE(
     int level,
     bool plotResidual)
 {
-    return calcResidualAndBuffers(refPoint, refColVar, idxBuf, refNum, frame,
+    return calcResidualAndBuffers(refData, idxBuf, refNum, frame,
                                   referenceToFrame, level, plotResidual);
 }
 #endif
 
+#if defined(ENABLE_AVX2)
+TARGET_AVX2 float SE3Tracker::calcResidualAndBuffersAVX2(
+    const PointCloudSoA& refData,
+    int* idxBuf,
+    int refNum,
+    Frame* frame,
+    const Sophus::SE3f& referenceToFrame,
+    int level,
+    bool plotResidual)
+{
+    // debug images are drawn pixel by pixel, leave that to the scalar version.
+    if(plotTrackingIterationInfo || saveAllTrackingStagesInternal || plotResidual)
+        return calcResidualAndBuffers(refData, idxBuf, refNum, frame,
+                                      referenceToFrame, level, plotResidual);
+
+    int w = frame->width(level);
+    int h = frame->height(level);
+    Eigen::Matrix3f KLvl = frame->K(level);
+    const __m256 fx_l = _mm256_set1_ps(KLvl(0,0));
+    const __m256 fy_l = _mm256_set1_ps(KLvl(1,1));
+    const __m256 cx_l = _mm256_set1_ps(KLvl(0,2));
+    const __m256 cy_l = _mm256_set1_ps(KLvl(1,2));
+
+    Eigen::Matrix3f rotMat = referenceToFrame.rotationMatrix();
+    Eigen::Vector3f transVec = referenceToFrame.translation();
+    __m256 R[3][3];
+    for(int r=0; r<3; r++)
+        for(int c=0; c<3; c++)
+            R[r][c] = _mm256_set1_ps(rotMat(r,c));
+    const __m256 t0 = _mm256_set1_ps(transVec[0]);
+    const __m256 t1 = _mm256_set1_ps(transVec[1]);
+    const __m256 t2 = _mm256_set1_ps(transVec[2]);
+
+    const float* frame_gradients = (const float*)frame->gradients(level);
+
+    bool* isGoodOutBuffer = idxBuf != 0 ? frame->refPixelWasGood() : 0;
+
+    const __m256i laneIdx = _mm256_setr_epi32(0,1,2,3,4,5,6,7);
+    const __m256i widthI = _mm256_set1_epi32(w);
+    const __m256i offRight = _mm256_set1_epi32(4);
+    const __m256i offDown = _mm256_set1_epi32(4*w);
+
+    const __m256 zeros = _mm256_setzero_ps();
+    const __m256 ones = _mm256_set1_ps(1.0f);
+    const __m256 fives = _mm256_set1_ps(5.0f);
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    const __m256 maxU = _mm256_set1_ps(w-2);
+    const __m256 maxV = _mm256_set1_ps(h-2);
+    const __m256 affA = _mm256_set1_ps(affineEstimation_a);
+    const __m256 affB = _mm256_set1_ps(affineEstimation_b);
+    const __m256 maxDiffConst = _mm256_set1_ps(MAX_DIFF_CONSTANT);
+    const __m256 maxDiffGradMult = _mm256_set1_ps(MAX_DIFF_GRAD_MULT);
+
+    __m256 sxx = zeros, syy = zeros, sx = zeros, sy = zeros, sw = zeros;
+    __m256 sumResUnweighted = zeros, sumSignedRes = zeros, usageCount = zeros;
+    int goodCount = 0;
+    int badCount = 0;
+    int idx = 0;
+
+    for(int i=0; i<refNum; i+=8)
+    {
+        const __m256 inRange = _mm256_castsi256_ps(_mm256_cmpgt_epi32(
+                                   _mm256_set1_epi32(refNum-i), laneIdx));
+        __m256 rx = _mm256_load_ps(refData.x+i);
+        __m256 ry = _mm256_load_ps(refData.y+i);
+        __m256 rz = _mm256_load_ps(refData.z+i);
+
+        // Wxp = rotMat * refPoint + transVec;
+        __m256 Wx = _mm256_fmadd_ps(R[0][0], rx, _mm256_fmadd_ps(R[0][1], ry,
+                                    _mm256_fmadd_ps(R[0][2], rz, t0)));
+        __m256 Wy = _mm256_fmadd_ps(R[1][0], rx, _mm256_fmadd_ps(R[1][1], ry,
+                                    _mm256_fmadd_ps(R[1][2], rz, t1)));
+        __m256 Wz = _mm256_fmadd_ps(R[2][0], rx, _mm256_fmadd_ps(R[2][1], ry,
+                                    _mm256_fmadd_ps(R[2][2], rz, t2)));
+        __m256 u_new = _mm256_fmadd_ps(_mm256_div_ps(Wx, Wz), fx_l, cx_l);
+        __m256 v_new = _mm256_fmadd_ps(_mm256_div_ps(Wy, Wz), fy_l, cy_l);
+
+        // step 1a: coordinates have to be in image (ordered compares exclude NANs)
+        __m256 valid = _mm256_and_ps(
+                           _mm256_and_ps(_mm256_cmp_ps(u_new, ones, _CMP_GT_OQ),
+                                         _mm256_cmp_ps(v_new, ones, _CMP_GT_OQ)),
+                           _mm256_and_ps(_mm256_cmp_ps(u_new, maxU, _CMP_LT_OQ),
+                                         _mm256_cmp_ps(v_new, maxV, _CMP_LT_OQ)));
+        valid = _mm256_and_ps(valid, inRange);
+        int validBits = _mm256_movemask_ps(valid);
+
+        if(validBits == 0)
+        {
+            if(isGoodOutBuffer != 0)
+                for(int l=0; l<8 && i+l<refNum; l++)
+                    isGoodOutBuffer[idxBuf[i+l]] = false;
+            continue;
+        }
+
+        // getInterpolatedElement43, only gathering from pixels that are in the image.
+        __m256i ix = _mm256_cvttps_epi32(u_new);
+        __m256i iy = _mm256_cvttps_epi32(v_new);
+        __m256 dx = _mm256_sub_ps(u_new, _mm256_cvtepi32_ps(ix));
+        __m256 dy = _mm256_sub_ps(v_new, _mm256_cvtepi32_ps(iy));
+        __m256 dxdy = _mm256_mul_ps(dx, dy);
+        __m256 w11 = dxdy;
+        __m256 w01 = _mm256_sub_ps(dy, dxdy);
+        __m256 w10 = _mm256_sub_ps(dx, dxdy);
+        __m256 w00 = _mm256_add_ps(_mm256_sub_ps(_mm256_sub_ps(ones, dx), dy), dxdy);
+
+        __m256i o00 = _mm256_slli_epi32(_mm256_add_epi32(ix, _mm256_mullo_epi32(iy,
+                                         widthI)), 2);
+        __m256i o10 = _mm256_add_epi32(o00, offRight);
+        __m256i o01 = _mm256_add_epi32(o00, offDown);
+        __m256i o11 = _mm256_add_epi32(o01, offRight);
+
+        __m256 resInterp[3];
+        for(int c=0; c<3; c++)
+        {
+            const float* base = frame_gradients + c;
+            __m256 p00 = _mm256_mask_i32gather_ps(zeros, base, o00, valid, 4);
+            __m256 p10 = _mm256_mask_i32gather_ps(zeros, base, o10, valid, 4);
+            __m256 p01 = _mm256_mask_i32gather_ps(zeros, base, o01, valid, 4);
+            __m256 p11 = _mm256_mask_i32gather_ps(zeros, base, o11, valid, 4);
+            resInterp[c] = _mm256_and_ps(valid, _mm256_fmadd_ps(w11, p11,
+                                         _mm256_fmadd_ps(w01, p01, _mm256_fmadd_ps(w10, p10, _mm256_mul_ps(w00, p00)))));
+        }
+
+        __m256 color = _mm256_load_ps(refData.color+i);
+        __m256 idepthVar = _mm256_load_ps(refData.var+i);
+
+        __m256 c1 = _mm256_fmadd_ps(affA, color, affB);
+        __m256 c2 = resInterp[2];
+        __m256 residual = _mm256_sub_ps(c1, c2);
+
+        // float weight = fabsf(residual) < 5.0f ? 1 : 5.0f / fabsf(residual);
+        __m256 absRes = _mm256_andnot_ps(signMask, residual);
+        __m256 weight = _mm256_blendv_ps(_mm256_div_ps(fives, absRes), ones,
+                                         _mm256_cmp_ps(absRes, fives, _CMP_LT_OQ));
+        weight = _mm256_and_ps(valid, weight);
+        __m256 c1w = _mm256_mul_ps(c1, weight);
+        __m256 c2w = _mm256_mul_ps(c2, weight);
+        sxx = _mm256_fmadd_ps(c1w, c1, sxx);
+        syy = _mm256_fmadd_ps(c2w, c2, syy);
+        sx = _mm256_add_ps(sx, c1w);
+        sy = _mm256_add_ps(sy, c2w);
+        sw = _mm256_add_ps(sw, weight);
+
+        __m256 res2 = _mm256_mul_ps(residual, residual);
+        __m256 gradNorm = _mm256_fmadd_ps(resInterp[0], resInterp[0],
+                                          _mm256_mul_ps(resInterp[1], resInterp[1]));
+        __m256 isGood = _mm256_cmp_ps(_mm256_div_ps(res2, _mm256_fmadd_ps(maxDiffGradMult,
+                                      gradNorm, maxDiffConst)), ones, _CMP_LT_OQ);
+        isGood = _mm256_and_ps(valid, isGood);
+        int goodBits = _mm256_movemask_ps(isGood);
+
+        if(isGoodOutBuffer != 0)
+            for(int l=0; l<8 && i+l<refNum; l++)
+                isGoodOutBuffer[idxBuf[i+l]] = (goodBits >> l) & 1;
+
+        sumResUnweighted = _mm256_add_ps(sumResUnweighted, _mm256_and_ps(isGood, res2));
+        sumSignedRes = _mm256_add_ps(sumSignedRes, _mm256_and_ps(isGood, residual));
+        int numValid = _mm_popcnt_u32(validBits);
+        int numGood = _mm_popcnt_u32(goodBits);
+        goodCount += numGood;
+        badCount += numValid - numGood;
+
+        // if depth becomes larger: pixel becomes "smaller", hence count it less.
+        __m256 depthChange = _mm256_div_ps(rz, Wz);
+        usageCount = _mm256_add_ps(usageCount, _mm256_and_ps(valid,
+                                   _mm256_min_ps(depthChange, ones)));
+
+        // compact the valid lanes to the front and append them to the buffers.
+        // the store may write up to 7 floats past the new end, the buffers
+        // have the slack for that.
+        __m256i pack = _mm256_loadu_si256((const __m256i*)leftPackTableAVX2.idx[validBits]);
+        _mm256_storeu_ps(buf_warped_x+idx, _mm256_permutevar8x32_ps(Wx, pack));
+        _mm256_storeu_ps(buf_warped_y+idx, _mm256_permutevar8x32_ps(Wy, pack));
+        _mm256_storeu_ps(buf_warped_z+idx, _mm256_permutevar8x32_ps(Wz, pack));
+        _mm256_storeu_ps(buf_warped_dx+idx, _mm256_permutevar8x32_ps(_mm256_mul_ps(fx_l,
+                         resInterp[0]), pack));
+        _mm256_storeu_ps(buf_warped_dy+idx, _mm256_permutevar8x32_ps(_mm256_mul_ps(fy_l,
+                         resInterp[1]), pack));
+        _mm256_storeu_ps(buf_warped_residual+idx, _mm256_permutevar8x32_ps(residual, pack));
+        _mm256_storeu_ps(buf_d+idx, _mm256_permutevar8x32_ps(_mm256_div_ps(ones, rz),
+                         pack));
+        _mm256_storeu_ps(buf_idepthVar+idx, _mm256_permutevar8x32_ps(idepthVar, pack));
+        idx += numValid;
+    }
+
+    buf_warped_size = idx;
+
+    pointUsage = hsumAVX2(usageCount) / (float)refNum;
+    lastGoodCount = goodCount;
+    lastBadCount = badCount;
+    lastMeanRes = hsumAVX2(sumSignedRes) / goodCount;
+
+    float sxxs = hsumAVX2(sxx), syys = hsumAVX2(syy);
+    float sxs = hsumAVX2(sx), sys = hsumAVX2(sy), sws = hsumAVX2(sw);
+    affineEstimation_a_lastIt = sqrtf((syys - sys*sys/sws) / (sxxs - sxs*sxs/sws));
+    affineEstimation_b_lastIt = (sys - affineEstimation_a_lastIt*sxs)/sws;
+
+    return hsumAVX2(sumResUnweighted) / goodCount;
+}
+#endif
+
+#if defined(ENABLE_AVX512)
+TARGET_AVX512 float SE3Tracker::calcResidualAndBuffersAVX512(
+    const PointCloudSoA& refData,
+    int* idxBuf,
+    int refNum,
+    Frame* frame,
+    const Sophus::SE3f& referenceToFrame,
+    int level,
+    bool plotResidual)
+{
+    // debug images are drawn pixel by pixel, leave that to the scalar version.
+    if(plotTrackingIterationInfo || saveAllTrackingStagesInternal || plotResidual)
+        return calcResidualAndBuffers(refData, idxBuf, refNum, frame,
+                                      referenceToFrame, level, plotResidual);
+
+    int w = frame->width(level);
+    int h = frame->height(level);
+    Eigen::Matrix3f KLvl = frame->K(level);
+    const __m512 fx_l = _mm512_set1_ps(KLvl(0,0));
+    const __m512 fy_l = _mm512_set1_ps(KLvl(1,1));
+    const __m512 cx_l = _mm512_set1_ps(KLvl(0,2));
+    const __m512 cy_l = _mm512_set1_ps(KLvl(1,2));
+
+    Eigen::Matrix3f rotMat = referenceToFrame.rotationMatrix();
+    Eigen::Vector3f transVec = referenceToFrame.translation();
+    __m512 R[3][3];
+    for(int r=0; r<3; r++)
+        for(int c=0; c<3; c++)
+            R[r][c] = _mm512_set1_ps(rotMat(r,c));
+    const __m512 t0 = _mm512_set1_ps(transVec[0]);
+    const __m512 t1 = _mm512_set1_ps(transVec[1]);
+    const __m512 t2 = _mm512_set1_ps(transVec[2]);
+
+    const float* frame_gradients = (const float*)frame->gradients(level);
+
+    bool* isGoodOutBuffer = idxBuf != 0 ? frame->refPixelWasGood() : 0;
+
+    const __m512i widthI = _mm512_set1_epi32(w);
+    const __m512i offRight = _mm512_set1_epi32(4);
+    const __m512i offDown = _mm512_set1_epi32(4*w);
+
+    const __m512 zeros = _mm512_setzero_ps();
+    const __m512 ones = _mm512_set1_ps(1.0f);
+    const __m512 fives = _mm512_set1_ps(5.0f);
+    const __m512 maxU = _mm512_set1_ps(w-2);
+    const __m512 maxV = _mm512_set1_ps(h-2);
+    const __m512 affA = _mm512_set1_ps(affineEstimation_a);
+    const __m512 affB = _mm512_set1_ps(affineEstimation_b);
+    const __m512 maxDiffConst = _mm512_set1_ps(MAX_DIFF_CONSTANT);
+    const __m512 maxDiffGradMult = _mm512_set1_ps(MAX_DIFF_GRAD_MULT);
+
+    __m512 sxx = zeros, syy = zeros, sx = zeros, sy = zeros, sw = zeros;
+    __m512 sumResUnweighted = zeros, sumSignedRes = zeros, usageCount = zeros;
+    int goodCount = 0;
+    int badCount = 0;
+    int idx = 0;
+
+    for(int i=0; i<refNum; i+=16)
+    {
+        const __mmask16 inRange = laneMaskAVX512(refNum-i);
+        __m512 rx = _mm512_load_ps(refData.x+i);
+        __m512 ry = _mm512_load_ps(refData.y+i);
+        __m512 rz = _mm512_load_ps(refData.z+i);
+
+        __m512 Wx = _mm512_fmadd_ps(R[0][0], rx, _mm512_fmadd_ps(R[0][1], ry,
+                                    _mm512_fmadd_ps(R[0][2], rz, t0)));
+        __m512 Wy = _mm512_fmadd_ps(R[1][0], rx, _mm512_fmadd_ps(R[1][1], ry,
+                                    _mm512_fmadd_ps(R[1][2], rz, t1)));
+        __m512 Wz = _mm512_fmadd_ps(R[2][0], rx, _mm512_fmadd_ps(R[2][1], ry,
+                                    _mm512_fmadd_ps(R[2][2], rz, t2)));
+        __m512 u_new = _mm512_fmadd_ps(_mm512_div_ps(Wx, Wz), fx_l, cx_l);
+        __m512 v_new = _mm512_fmadd_ps(_mm512_div_ps(Wy, Wz), fy_l, cy_l);
+
+        __mmask16 valid = inRange;
+        valid = _mm512_mask_cmp_ps_mask(valid, u_new, ones, _CMP_GT_OQ);
+        valid = _mm512_mask_cmp_ps_mask(valid, v_new, ones, _CMP_GT_OQ);
+        valid = _mm512_mask_cmp_ps_mask(valid, u_new, maxU, _CMP_LT_OQ);
+        valid = _mm512_mask_cmp_ps_mask(valid, v_new, maxV, _CMP_LT_OQ);
+
+        if(valid == 0)
+        {
+            if(isGoodOutBuffer != 0)
+                for(int l=0; l<16 && i+l<refNum; l++)
+                    isGoodOutBuffer[idxBuf[i+l]] = false;
+            continue;
+        }
+
+        __m512i ix = _mm512_cvttps_epi32(u_new);
+        __m512i iy = _mm512_cvttps_epi32(v_new);
+        __m512 dx = _mm512_sub_ps(u_new, _mm512_cvtepi32_ps(ix));
+        __m512 dy = _mm512_sub_ps(v_new, _mm512_cvtepi32_ps(iy));
+        __m512 dxdy = _mm512_mul_ps(dx, dy);
+        __m512 w11 = dxdy;
+        __m512 w01 = _mm512_sub_ps(dy, dxdy);
+        __m512 w10 = _mm512_sub_ps(dx, dxdy);
+        __m512 w00 = _mm512_add_ps(_mm512_sub_ps(_mm512_sub_ps(ones, dx), dy), dxdy);
+
+        __m512i o00 = _mm512_slli_epi32(_mm512_add_epi32(ix, _mm512_mullo_epi32(iy,
+                                         widthI)), 2);
+        __m512i o10 = _mm512_add_epi32(o00, offRight);
+        __m512i o01 = _mm512_add_epi32(o00, offDown);
+        __m512i o11 = _mm512_add_epi32(o01, offRight);
+
+        __m512 resInterp[3];
+        for(int c=0; c<3; c++)
+        {
+            const float* base = frame_gradients + c;
+            __m512 p00 = _mm512_mask_i32gather_ps(zeros, valid, o00, base, 4);
+            __m512 p10 = _mm512_mask_i32gather_ps(zeros, valid, o10, base, 4);
+            __m512 p01 = _mm512_mask_i32gather_ps(zeros, valid, o01, base, 4);
+            __m512 p11 = _mm512_mask_i32gather_ps(zeros, valid, o11, base, 4);
+            resInterp[c] = _mm512_maskz_fmadd_ps(valid, w11, p11,
+                                                 _mm512_fmadd_ps(w01, p01, _mm512_fmadd_ps(w10, p10, _mm512_mul_ps(w00, p00))));
+        }
+
+        __m512 color = _mm512_load_ps(refData.color+i);
+        __m512 idepthVar = _mm512_load_ps(refData.var+i);
+
+        __m512 c1 = _mm512_fmadd_ps(affA, color, affB);
+        __m512 c2 = resInterp[2];
+        __m512 residual = _mm512_sub_ps(c1, c2);
+
+        __m512 absRes = _mm512_abs_ps(residual);
+        __m512 weight = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(absRes, fives, _CMP_LT_OQ),
+                                             _mm512_div_ps(fives, absRes), ones);
+        weight = _mm512_maskz_mov_ps(valid, weight);
+        __m512 c1w = _mm512_mul_ps(c1, weight);
+        __m512 c2w = _mm512_mul_ps(c2, weight);
+        sxx = _mm512_fmadd_ps(c1w, c1, sxx);
+        syy = _mm512_fmadd_ps(c2w, c2, syy);
+        sx = _mm512_add_ps(sx, c1w);
+        sy = _mm512_add_ps(sy, c2w);
+        sw = _mm512_add_ps(sw, weight);
+
+        __m512 res2 = _mm512_mul_ps(residual, residual);
+        __m512 gradNorm = _mm512_fmadd_ps(resInterp[0], resInterp[0],
+                                          _mm512_mul_ps(resInterp[1], resInterp[1]));
+        __mmask16 isGood = _mm512_mask_cmp_ps_mask(valid, _mm512_div_ps(res2,
+                           _mm512_fmadd_ps(maxDiffGradMult, gradNorm, maxDiffConst)), ones, _CMP_LT_OQ);
+
+        if(isGoodOutBuffer != 0)
+            for(int l=0; l<16 && i+l<refNum; l++)
+                isGoodOutBuffer[idxBuf[i+l]] = (isGood >> l) & 1;
+
+        sumResUnweighted = _mm512_mask_add_ps(sumResUnweighted, isGood, sumResUnweighted,
+                                              res2);
+        sumSignedRes = _mm512_mask_add_ps(sumSignedRes, isGood, sumSignedRes, residual);
+        int numValid = _mm_popcnt_u32(valid);
+        int numGood = _mm_popcnt_u32(isGood);
+        goodCount += numGood;
+        badCount += numValid - numGood;
+
+        __m512 depthChange = _mm512_div_ps(rz, Wz);
+        usageCount = _mm512_mask_add_ps(usageCount, valid, usageCount,
+                                        _mm512_min_ps(depthChange, ones));
+
+        _mm512_mask_compressstoreu_ps(buf_warped_x+idx, valid, Wx);
+        _mm512_mask_compressstoreu_ps(buf_warped_y+idx, valid, Wy);
+        _mm512_mask_compressstoreu_ps(buf_warped_z+idx, valid, Wz);
+        _mm512_mask_compressstoreu_ps(buf_warped_dx+idx, valid, _mm512_mul_ps(fx_l,
+                                      resInterp[0]));
+        _mm512_mask_compressstoreu_ps(buf_warped_dy+idx, valid, _mm512_mul_ps(fy_l,
+                                      resInterp[1]));
+        _mm512_mask_compressstoreu_ps(buf_warped_residual+idx, valid, residual);
+        _mm512_mask_compressstoreu_ps(buf_d+idx, valid, _mm512_div_ps(ones, rz));
+        _mm512_mask_compressstoreu_ps(buf_idepthVar+idx, valid, idepthVar);
+        idx += numValid;
+    }
+
+    buf_warped_size = idx;
+
+    pointUsage = _mm512_reduce_add_ps(usageCount) / (float)refNum;
+    lastGoodCount = goodCount;
+    lastBadCount = badCount;
+    lastMeanRes = _mm512_reduce_add_ps(sumSignedRes) / goodCount;
+
+    float sxxs = _mm512_reduce_add_ps(sxx), syys = _mm512_reduce_add_ps(syy);
+    float sxs = _mm512_reduce_add_ps(sx), sys = _mm512_reduce_add_ps(sy);
+    float sws = _mm512_reduce_add_ps(sw);
+    affineEstimation_a_lastIt = sqrtf((syys - sys*sys/sws) / (sxxs - sxs*sxs/sws));
+    affineEstimation_b_lastIt = (sys - affineEstimation_a_lastIt*sxs)/sws;
+
+    return _mm512_reduce_add_ps(sumResUnweighted) / goodCount;
+}
+#endif
+
 #if defined(ENABLE_NEON)
 float SE3Tracker::calcResidualAndBuffersNEON(
-    const Eigen::Vector3f* refPoint,
-    const Eigen::Vector2f* refColVar,
+    const PointCloudSoA& refData,
     int* idxBuf,
     int refNum,
     Frame* frame,
@@ -915,15 +1520,14 @@ float SE3Tracker::calcResidualAndBuffersNEON(
     int level,
     bool plotResidual)
 {
-    return calcResidualAndBuffers(refPoint, refColVar, idxBuf, refNum, frame,
+    return calcResidualAndBuffers(refData, idxBuf, refNum, frame,
                                   referenceToFrame, level, plotResidual);
 }
 #endif
 
 
 float SE3Tracker::calcResidualAndBuffers(
-    const Eigen::Vector3f* refPoint,
-    const Eigen::Vector2f* refColVar,
+    const PointCloudSoA& refData,
     int* idxBuf,
     int refNum,
     Frame* frame,
@@ -948,7 +1552,6 @@ float SE3Tracker::calcResidualAndBuffers(
     Eigen::Matrix3f rotMat = referenceToFrame.rotationMatrix();
     Eigen::Vector3f transVec = referenceToFrame.translation();
 
-    const Eigen::Vector3f* refPoint_max = refPoint + refNum;
 
 
     const Eigen::Vector4f* frame_gradients = frame->gradients(level);
@@ -970,10 +1573,13 @@ float SE3Tracker::calcResidualAndBuffers(
 
     float usageCount = 0;
 
-    for(; refPoint<refPoint_max; refPoint++, refColVar++, idxBuf++)
+    for(int i=0; i<refNum; i++)
     {
+        Eigen::Vector3f refPoint(refData.x[i], refData.y[i], refData.z[i]);
+        float refColor = refData.color[i];
+        float refVar = refData.var[i];
 
-        Eigen::Vector3f Wxp = rotMat * (*refPoint) + transVec;
+        Eigen::Vector3f Wxp = rotMat * refPoint + transVec;
         float u_new = (Wxp[0]/Wxp[2])*fx_l + cx_l;
         float v_new = (Wxp[1]/Wxp[2])*fy_l + cy_l;
 
@@ -982,14 +1588,14 @@ float SE3Tracker::calcResidualAndBuffers(
         if(!(u_new > 1 && v_new > 1 && u_new < w-2 && v_new < h-2))
         {
             if(isGoodOutBuffer != 0)
-                isGoodOutBuffer[*idxBuf] = false;
+                isGoodOutBuffer[idxBuf[i]] = false;
             continue;
         }
 
         Eigen::Vector3f resInterp = getInterpolatedElement43(frame_gradients, u_new,
                                     v_new, w);
 
-        float c1 = affineEstimation_a * (*refColVar)[0] + affineEstimation_b;
+        float c1 = affineEstimation_a * refColor + affineEstimation_b;
         float c2 = resInterp[2];
         float residual = c1 - c2;
 
@@ -1004,7 +1610,7 @@ float SE3Tracker::calcResidualAndBuffers(
                                            (resInterp[0]*resInterp[0] + resInterp[1]*resInterp[1])) < 1;
 
         if(isGoodOutBuffer != 0)
-            isGoodOutBuffer[*idxBuf] = isGood;
+            isGoodOutBuffer[idxBuf[i]] = isGood;
 
         *(buf_warped_x+idx) = Wxp(0);
         *(buf_warped_y+idx) = Wxp(1);
@@ -1014,8 +1620,8 @@ float SE3Tracker::calcResidualAndBuffers(
         *(buf_warped_dy+idx) = fy_l * resInterp[1];
         *(buf_warped_residual+idx) = residual;
 
-        *(buf_d+idx) = 1.0f / (*refPoint)[2];
-        *(buf_idepthVar+idx) = (*refColVar)[1];
+        *(buf_d+idx) = 1.0f / refPoint[2];
+        *(buf_idepthVar+idx) = refVar;
         idx++;
 
 
@@ -1028,7 +1634,7 @@ float SE3Tracker::calcResidualAndBuffers(
         else
             badCount++;
 
-        float depthChange = (*refPoint)[2] /
+        float depthChange = refPoint[2] /
                             Wxp[2];	// if depth becomes larger: pixel becomes "smaller", hence count it less.
         usageCount += depthChange < 1 ? depthChange : 1;
 
@@ -1038,7 +1644,7 @@ float SE3Tracker::calcResidualAndBuffers(
         {
             // for debug plot only: find x,y again.
             // horribly inefficient, but who cares at this point...
-            Eigen::Vector3f point = KLvl * (*refPoint);
+            Eigen::Vector3f point = KLvl * refPoint;
             int x = point[0] / point[2] + 0.5f;
             int y = point[1] / point[2] + 0.5f;
 
@@ -1196,6 +1802,163 @@ Vector6 SE3Tracker::calculateWarpUpdateSSE(
 #endif
 
 
+#if defined(ENABLE_AVX2)
+TARGET_AVX2 Vector6 SE3Tracker::calculateWarpUpdateAVX2(
+    NormalEquationsLeastSquares &ls)
+{
+    ls.initialize(width*height);
+
+    const __m256 ones = _mm256_set1_ps(1.0f);
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    const __m256i laneIdx = _mm256_setr_epi32(0,1,2,3,4,5,6,7);
+
+    // per-lane sums of w*J*J^T (upper triangle, row by row), w*r*J and w*r*r.
+    __m256 sumJJ[21];
+    __m256 sumJr[6];
+    __m256 sumRR = _mm256_setzero_ps();
+    for(int k=0; k<21; k++) sumJJ[k] = _mm256_setzero_ps();
+    for(int k=0; k<6; k++) sumJr[k] = _mm256_setzero_ps();
+
+    for(int i=0; i<buf_warped_size; i+=8)
+    {
+        const __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(buf_warped_size-i),
+                              laneIdx);
+
+        // lanes past the end are loaded as zero, except z=1 to keep J finite.
+        __m256 pz = _mm256_blendv_ps(ones, _mm256_maskload_ps(buf_warped_z+i, valid),
+                                     _mm256_castsi256_ps(valid));
+        __m256 px = _mm256_maskload_ps(buf_warped_x+i, valid);
+        __m256 py = _mm256_maskload_ps(buf_warped_y+i, valid);
+        __m256 gx = _mm256_maskload_ps(buf_warped_dx+i, valid);
+        __m256 gy = _mm256_maskload_ps(buf_warped_dy+i, valid);
+        __m256 r = _mm256_maskload_ps(buf_warped_residual+i, valid);
+        __m256 wp = _mm256_maskload_ps(buf_weight_p+i, valid);
+
+        __m256 z = _mm256_div_ps(ones, pz);
+        __m256 z_sqr = _mm256_mul_ps(z, z);
+
+        // px * z_sqr * gx + py * z_sqr * gy
+        __m256 s = _mm256_fmadd_ps(_mm256_mul_ps(px, z_sqr), gx,
+                                   _mm256_mul_ps(_mm256_mul_ps(py, z_sqr), gy));
+
+        __m256 v[6];
+        v[0] = _mm256_mul_ps(z, gx);
+        v[1] = _mm256_mul_ps(z, gy);
+        v[2] = _mm256_xor_ps(s, signMask);
+        v[3] = _mm256_xor_ps(_mm256_fmadd_ps(py, s, gy), signMask);
+        v[4] = _mm256_fmadd_ps(px, s, gx);
+        v[5] = _mm256_mul_ps(z, _mm256_fmsub_ps(px, gy, _mm256_mul_ps(py, gx)));
+
+        // step 6: integrate into A and b:
+        __m256 wr = _mm256_mul_ps(wp, r);
+        int k = 0;
+        for(int a=0; a<6; a++)
+        {
+            __m256 wv = _mm256_mul_ps(wp, v[a]);
+            for(int b=a; b<6; b++, k++)
+                sumJJ[k] = _mm256_fmadd_ps(wv, v[b], sumJJ[k]);
+            sumJr[a] = _mm256_fmadd_ps(v[a], wr, sumJr[a]);
+        }
+        sumRR = _mm256_fmadd_ps(wr, r, sumRR);
+    }
+
+    Matrix6x6 JtJ;
+    Vector6 Jtr;
+    int k = 0;
+    for(int a=0; a<6; a++)
+    {
+        for(int b=a; b<6; b++, k++)
+            JtJ(a,b) = JtJ(b,a) = hsumAVX2(sumJJ[k]);
+        Jtr[a] = hsumAVX2(sumJr[a]);
+    }
+    ls.updateSummed(JtJ, Jtr, hsumAVX2(sumRR), buf_warped_size);
+
+    Vector6 result;
+
+    // solve ls
+    ls.finish();
+    ls.solve(result);
+
+    return result;
+}
+#endif
+
+
+#if defined(ENABLE_AVX512)
+TARGET_AVX512 Vector6 SE3Tracker::calculateWarpUpdateAVX512(
+    NormalEquationsLeastSquares &ls)
+{
+    ls.initialize(width*height);
+
+    const __m512 zeros = _mm512_setzero_ps();
+    const __m512 ones = _mm512_set1_ps(1.0f);
+
+    __m512 sumJJ[21];
+    __m512 sumJr[6];
+    __m512 sumRR = zeros;
+    for(int k=0; k<21; k++) sumJJ[k] = zeros;
+    for(int k=0; k<6; k++) sumJr[k] = zeros;
+
+    for(int i=0; i<buf_warped_size; i+=16)
+    {
+        const __mmask16 valid = laneMaskAVX512(buf_warped_size-i);
+
+        __m512 pz = _mm512_mask_loadu_ps(ones, valid, buf_warped_z+i);
+        __m512 px = _mm512_maskz_loadu_ps(valid, buf_warped_x+i);
+        __m512 py = _mm512_maskz_loadu_ps(valid, buf_warped_y+i);
+        __m512 gx = _mm512_maskz_loadu_ps(valid, buf_warped_dx+i);
+        __m512 gy = _mm512_maskz_loadu_ps(valid, buf_warped_dy+i);
+        __m512 r = _mm512_maskz_loadu_ps(valid, buf_warped_residual+i);
+        __m512 wp = _mm512_maskz_loadu_ps(valid, buf_weight_p+i);
+
+        __m512 z = _mm512_div_ps(ones, pz);
+        __m512 z_sqr = _mm512_mul_ps(z, z);
+
+        __m512 s = _mm512_fmadd_ps(_mm512_mul_ps(px, z_sqr), gx,
+                                   _mm512_mul_ps(_mm512_mul_ps(py, z_sqr), gy));
+
+        __m512 v[6];
+        v[0] = _mm512_mul_ps(z, gx);
+        v[1] = _mm512_mul_ps(z, gy);
+        v[2] = _mm512_sub_ps(zeros, s);
+        v[3] = _mm512_fnmsub_ps(py, s, gy);
+        v[4] = _mm512_fmadd_ps(px, s, gx);
+        v[5] = _mm512_mul_ps(z, _mm512_fmsub_ps(px, gy, _mm512_mul_ps(py, gx)));
+
+        __m512 wr = _mm512_mul_ps(wp, r);
+        int k = 0;
+        for(int a=0; a<6; a++)
+        {
+            __m512 wv = _mm512_mul_ps(wp, v[a]);
+            for(int b=a; b<6; b++, k++)
+                sumJJ[k] = _mm512_fmadd_ps(wv, v[b], sumJJ[k]);
+            sumJr[a] = _mm512_fmadd_ps(v[a], wr, sumJr[a]);
+        }
+        sumRR = _mm512_fmadd_ps(wr, r, sumRR);
+    }
+
+    Matrix6x6 JtJ;
+    Vector6 Jtr;
+    int k = 0;
+    for(int a=0; a<6; a++)
+    {
+        for(int b=a; b<6; b++, k++)
+            JtJ(a,b) = JtJ(b,a) = _mm512_reduce_add_ps(sumJJ[k]);
+        Jtr[a] = _mm512_reduce_add_ps(sumJr[a]);
+    }
+    ls.updateSummed(JtJ, Jtr, _mm512_reduce_add_ps(sumRR), buf_warped_size);
+
+    Vector6 result;
+
+    // solve ls
+    ls.finish();
+    ls.solve(result);
+
+    return result;
+}
+#endif
+
+
 #if defined(ENABLE_NEON)
 Vector6 SE3Tracker::calculateWarpUpdateNEON(
     NormalEquationsLeastSquares &ls)
@@ -1368,5 +2131,847 @@ Vector6 SE3Tracker::calculateWarpUpdate(
 
 
 
+bool SE3Tracker::canUseFusedPass(bool plotResidual) const
+{
+    // debug images are drawn from the warped buffers, which the fused pass does not fill.
+    return !(plotTrackingIterationInfo || saveAllTrackingStagesInternal || plotResidual);
 }
 
+float SE3Tracker::calcResidualAndUpdate(
+    NormalEquationsLeastSquares &ls,
+    const PointCloudSoA& refData,
+    int* idxBuf,
+    int refNum,
+    Frame* frame,
+    const Sophus::SE3f& referenceToFrame,
+    int level,
+    bool inverseCompositional,
+    bool plotResidual)
+{
+    bool useFused = canUseFusedPass(plotResidual);
+    assert(!inverseCompositional || (useFused && refData.hasJacobians));
+
+    int numChunks = 1;
+    if(useFused && multiThreading && trackingThreads > 1)
+        numChunks = std::max(1, std::min(trackingThreads,
+                                         refNum / SE3TRACKING_MIN_POINTS_PER_THREAD));
+
+#if defined(ENABLE_SSE) || defined(ENABLE_NEON)
+    // single threaded, the SSE / NEON buffered kernels beat the scalar fused pass.
+    if(numChunks == 1 && simdLevel < SIMD_AVX2 && !inverseCompositional)
+        useFused = false;
+#endif
+
+    lsAccumulated = useFused;
+    if(!useFused)
+    {
+        callOptimized(calcResidualAndBuffers, (refData, idxBuf, refNum, frame,
+                                               referenceToFrame, level, plotResidual));
+        if(buf_warped_size < MIN_GOODPERALL_PIXEL_ABSMIN * frame->width(level)*frame->height(level))
+            return 0;	// diverged, the caller bails out.
+
+        return callOptimized(calcWeightsAndResidual,(referenceToFrame));
+    }
+
+    if(refNum == 0)
+    {
+        buf_warped_size = 0;
+        return 0;	// no points, the caller bails out.
+    }
+
+    // chunks start at multiples of PointCloudSoA::SIMD_WIDTH, to keep the loads aligned.
+    int chunkSize = (refNum + numChunks - 1) / numChunks;
+    chunkSize = ((chunkSize + PointCloudSoA::SIMD_WIDTH - 1) / PointCloudSoA::SIMD_WIDTH) *
+                PointCloudSoA::SIMD_WIDTH;
+    numChunks = std::max(1, (refNum + chunkSize - 1) / chunkSize);
+    if((int)fusedSums.size() < numChunks)
+        fusedSums.resize(numChunks);
+    fusedInverseCompositional = inverseCompositional;
+
+    if(numChunks == 1)
+        calcResidualAndUpdateChunk(0, refNum, &refData, idxBuf, frame, &referenceToFrame,
+                                   level, chunkSize);
+    else
+    {
+        if(threadReducer == 0)
+            threadReducer = new IndexThreadReduce(trackingThreads);
+        threadReducer->reduce(boost::bind(&SE3Tracker::calcResidualAndUpdateChunk, this,
+                                          _1, _2, &refData, idxBuf, frame, &referenceToFrame, level, chunkSize),
+                              0, refNum, chunkSize);
+    }
+
+    // combine in chunk order, so the result does not depend on thread timing.
+    ls.initialize(width*height);
+    FusedPassSums total = fusedSums[0];
+    ls.combine(fusedSums[0].ls);
+    for(int i=1; i<numChunks; i++)
+    {
+        const FusedPassSums& c = fusedSums[i];
+        ls.combine(c.ls);
+        total.num += c.num;
+        total.goodCount += c.goodCount;
+        total.badCount += c.badCount;
+        total.sumResUnweighted += c.sumResUnweighted;
+        total.sumSignedRes += c.sumSignedRes;
+        total.usageCount += c.usageCount;
+        total.sxx += c.sxx;
+        total.syy += c.syy;
+        total.sx += c.sx;
+        total.sy += c.sy;
+        total.sw += c.sw;
+    }
+
+    // only the size is kept, for the divergence check of the caller.
+    buf_warped_size = total.num;
+
+    pointUsage = total.usageCount / (float)refNum;
+    lastGoodCount = total.goodCount;
+    lastBadCount = total.badCount;
+    lastMeanRes = total.sumSignedRes / total.goodCount;
+
+    affineEstimation_a_lastIt = sqrtf((total.syy - total.sy*total.sy/total.sw) /
+                                      (total.sxx - total.sx*total.sx/total.sw));
+    affineEstimation_b_lastIt = (total.sy - affineEstimation_a_lastIt*total.sx)/total.sw;
+
+    float error = ls.error / total.num;
+    ls.finish();
+    return error;
+}
+
+
+void SE3Tracker::calcResidualAndUpdateChunk(
+    int first,
+    int end,
+    const PointCloudSoA* refData,
+    int* idxBuf,
+    Frame* frame,
+    const Sophus::SE3f* referenceToFrame,
+    int level,
+    int chunkSize)
+{
+    FusedPassSums& sums = fusedSums[first / chunkSize];
+
+#if defined(ENABLE_AVX512)
+    if(simdLevel >= SIMD_AVX512)
+    {
+        if(fusedInverseCompositional)
+            calcResidualAndUpdateFusedAVX512<true>(sums, *refData, idxBuf, first, end, frame,
+                                                   *referenceToFrame, level);
+        else
+            calcResidualAndUpdateFusedAVX512<false>(sums, *refData, idxBuf, first, end, frame,
+                                                    *referenceToFrame, level);
+        return;
+    }
+#endif
+#if defined(ENABLE_AVX2)
+    if(simdLevel >= SIMD_AVX2)
+    {
+        if(fusedInverseCompositional)
+            calcResidualAndUpdateFusedAVX2<true>(sums, *refData, idxBuf, first, end, frame,
+                                                 *referenceToFrame, level);
+        else
+            calcResidualAndUpdateFusedAVX2<false>(sums, *refData, idxBuf, first, end, frame,
+                                                  *referenceToFrame, level);
+        return;
+    }
+#endif
+    if(fusedInverseCompositional)
+        calcResidualAndUpdateFused<true>(sums, *refData, idxBuf, first, end, frame,
+                                         *referenceToFrame, level);
+    else
+        calcResidualAndUpdateFused<false>(sums, *refData, idxBuf, first, end, frame,
+                                          *referenceToFrame, level);
+}
+
+template<bool inverseCompositional>
+void SE3Tracker::calcResidualAndUpdateFused(
+    FusedPassSums& sums,
+    const PointCloudSoA& refData,
+    int* idxBuf,
+    int first,
+    int end,
+    Frame* frame,
+    const Sophus::SE3f& referenceToFrame,
+    int level)
+{
+    NormalEquationsLeastSquares& ls = sums.ls;
+    ls.initialize(width*height);
+
+    int w = frame->width(level);
+    int h = frame->height(level);
+    Eigen::Matrix3f KLvl = frame->K(level);
+    float fx_l = KLvl(0,0);
+    float fy_l = KLvl(1,1);
+    float cx_l = KLvl(0,2);
+    float cy_l = KLvl(1,2);
+
+    Eigen::Matrix3f rotMat = referenceToFrame.rotationMatrix();
+    Eigen::Vector3f transVec = referenceToFrame.translation();
+    float tx = transVec[0];
+    float ty = transVec[1];
+    float tz = transVec[2];
+
+
+    const Eigen::Vector4f* frame_gradients = frame->gradients(level);
+    const float* frame_image = frame->image(level);
+
+    int idx=0;
+
+    float sumResUnweighted = 0;
+
+    bool* isGoodOutBuffer = idxBuf != 0 ? frame->refPixelWasGood() : 0;
+
+    int goodCount = 0;
+    int badCount = 0;
+
+    float sumSignedRes = 0;
+
+    float sxx=0,syy=0,sx=0,sy=0,sw=0;
+
+    float usageCount = 0;
+
+    for(int i=first; i<end; i++)
+    {
+        Eigen::Vector3f refPoint(refData.x[i], refData.y[i], refData.z[i]);
+        float refColor = refData.color[i];
+        float refVar = refData.var[i];
+        // residual, as in calcResidualAndBuffers.
+        Eigen::Vector3f Wxp = rotMat * refPoint + transVec;
+        float u_new = (Wxp[0]/Wxp[2])*fx_l + cx_l;
+        float v_new = (Wxp[1]/Wxp[2])*fy_l + cy_l;
+
+        if(!(u_new > 1 && v_new > 1 && u_new < w-2 && v_new < h-2))
+        {
+            if(isGoodOutBuffer != 0)
+                isGoodOutBuffer[idxBuf[i]] = false;
+            continue;
+        }
+
+        // inverse compositional only needs the intensity of the new frame,
+        // the gradients are the ones of the reference point.
+        Eigen::Vector3f resInterp;
+        if(inverseCompositional)
+            resInterp = Eigen::Vector3f(refData.gradX[i], refData.gradY[i],
+                                        getInterpolatedElement(frame_image, u_new, v_new, w));
+        else
+            resInterp = getInterpolatedElement43(frame_gradients, u_new, v_new, w);
+
+        float c1 = affineEstimation_a * refColor + affineEstimation_b;
+        float c2 = resInterp[2];
+        float rp = c1 - c2;
+
+        float weight = fabsf(rp) < 5.0f ? 1 : 5.0f / fabsf(rp);
+        sxx += c1*c1*weight;
+        syy += c2*c2*weight;
+        sx += c1*weight;
+        sy += c2*weight;
+        sw += weight;
+
+        bool isGood = rp*rp / (MAX_DIFF_CONSTANT + MAX_DIFF_GRAD_MULT*
+                               (resInterp[0]*resInterp[0] + resInterp[1]*resInterp[1])) < 1;
+
+        if(isGoodOutBuffer != 0)
+            isGoodOutBuffer[idxBuf[i]] = isGood;
+
+        if(isGood)
+        {
+            sumResUnweighted += rp*rp;
+            sumSignedRes += rp;
+            goodCount++;
+        }
+        else
+            badCount++;
+
+        float depthChange = refPoint[2] / Wxp[2];
+        usageCount += depthChange < 1 ? depthChange : 1;
+        idx++;
+
+        // weight, as in calcWeightsAndResidual.
+        float px = Wxp[0];
+        float py = Wxp[1];
+        float pz = Wxp[2];
+        float d = 1.0f / refPoint[2];
+        float gx = fx_l * resInterp[0];
+        float gy = fy_l * resInterp[1];
+        float s = settings.var_weight * refVar;
+
+        float g0 = (tx * pz - tz * px) / (pz*pz*d);
+        float g1 = (ty * pz - tz * py) / (pz*pz*d);
+
+        float drpdd = gx * g0 + gy * g1;
+        float w_p = 1.0f / ((cameraPixelNoise2) + s * drpdd * drpdd);
+
+        float weighted_rp = fabs(rp*sqrtf(w_p));
+
+        float wh = fabs(weighted_rp < (settings.huber_d/2) ? 1 :
+                        (settings.huber_d/2) / weighted_rp);
+
+        if(inverseCompositional)
+        {
+            // the residual depends on the reference image through c1 = a*I + b.
+            Vector6 v;
+            for(int k=0; k<6; k++)
+                v[k] = affineEstimation_a * refData.jac[k][i];
+            ls.update(v, rp, wh * w_p);
+            continue;
+        }
+
+        // jacobian, as in calculateWarpUpdate.
+        float z = 1.0f / pz;
+        float z_sqr = 1.0f / (pz*pz);
+        Vector6 v;
+        v[0] = z*gx + 0;
+        v[1] = 0 +         z*gy;
+        v[2] = (-px * z_sqr) * gx +
+               (-py * z_sqr) * gy;
+        v[3] = (-px * py * z_sqr) * gx +
+               (-(1.0 + py * py * z_sqr)) * gy;
+        v[4] = (1.0 + px * px * z_sqr) * gx +
+               (px * py * z_sqr) * gy;
+        v[5] = (-py * z) * gx +
+               (px * z) * gy;
+
+        ls.update(v, rp, wh * w_p);
+    }
+
+    sums.num = idx;
+    sums.goodCount = goodCount;
+    sums.badCount = badCount;
+    sums.sumResUnweighted = sumResUnweighted;
+    sums.sumSignedRes = sumSignedRes;
+    sums.usageCount = usageCount;
+    sums.sxx = sxx;
+    sums.syy = syy;
+    sums.sx = sx;
+    sums.sy = sy;
+    sums.sw = sw;
+}
+
+
+#if defined(ENABLE_AVX2)
+template<bool inverseCompositional>
+TARGET_AVX2 void SE3Tracker::calcResidualAndUpdateFusedAVX2(
+    FusedPassSums& sums,
+    const PointCloudSoA& refData,
+    int* idxBuf,
+    int first,
+    int end,
+    Frame* frame,
+    const Sophus::SE3f& referenceToFrame,
+    int level)
+{
+    NormalEquationsLeastSquares& ls = sums.ls;
+    ls.initialize(width*height);
+
+    int w = frame->width(level);
+    int h = frame->height(level);
+    Eigen::Matrix3f KLvl = frame->K(level);
+    const __m256 fx_l = _mm256_set1_ps(KLvl(0,0));
+    const __m256 fy_l = _mm256_set1_ps(KLvl(1,1));
+    const __m256 cx_l = _mm256_set1_ps(KLvl(0,2));
+    const __m256 cy_l = _mm256_set1_ps(KLvl(1,2));
+
+    Eigen::Matrix3f rotMat = referenceToFrame.rotationMatrix();
+    Eigen::Vector3f transVec = referenceToFrame.translation();
+    __m256 R[3][3];
+    for(int r=0; r<3; r++)
+        for(int c=0; c<3; c++)
+            R[r][c] = _mm256_set1_ps(rotMat(r,c));
+    const __m256 t0 = _mm256_set1_ps(transVec[0]);
+    const __m256 t1 = _mm256_set1_ps(transVec[1]);
+    const __m256 t2 = _mm256_set1_ps(transVec[2]);
+
+    // inverse compositional interpolates the intensity only, from the plain image.
+    const float* frame_gradients = (const float*)frame->gradients(level);
+    const float* frame_image = frame->image(level);
+    const int pixelStride = inverseCompositional ? 1 : 4;
+
+    bool* isGoodOutBuffer = idxBuf != 0 ? frame->refPixelWasGood() : 0;
+
+    const __m256i laneIdx = _mm256_setr_epi32(0,1,2,3,4,5,6,7);
+    const __m256i widthI = _mm256_set1_epi32(w);
+    const __m256i offRight = _mm256_set1_epi32(pixelStride);
+    const __m256i offDown = _mm256_set1_epi32(pixelStride*w);
+
+    const __m256 zeros = _mm256_setzero_ps();
+    const __m256 ones = _mm256_set1_ps(1.0f);
+    const __m256 fives = _mm256_set1_ps(5.0f);
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    const __m256 maxU = _mm256_set1_ps(w-2);
+    const __m256 maxV = _mm256_set1_ps(h-2);
+    const __m256 affA = _mm256_set1_ps(affineEstimation_a);
+    const __m256 affB = _mm256_set1_ps(affineEstimation_b);
+    const __m256 maxDiffConst = _mm256_set1_ps(MAX_DIFF_CONSTANT);
+    const __m256 maxDiffGradMult = _mm256_set1_ps(MAX_DIFF_GRAD_MULT);
+    const __m256 depthVarFacs = _mm256_set1_ps((float)settings.var_weight);
+    const __m256 sigma_i2s = _mm256_set1_ps((float)cameraPixelNoise2);
+    const __m256 huber_res_ponlys = _mm256_set1_ps((float)(settings.huber_d/2));
+
+    __m256 sxx = zeros, syy = zeros, sx = zeros, sy = zeros, sw = zeros;
+    __m256 sumResUnweighted = zeros, sumSignedRes = zeros, usageCount = zeros;
+    int goodCount = 0;
+    int badCount = 0;
+    int idx = 0;
+
+    // per-lane sums of w*J*J^T (upper triangle, row by row), w*r*J and w*r*r.
+    __m256 sumJJ[21];
+    __m256 sumJr[6];
+    __m256 sumRR = zeros;
+    for(int k=0; k<21; k++) sumJJ[k] = zeros;
+    for(int k=0; k<6; k++) sumJr[k] = zeros;
+
+    for(int i=first; i<end; i+=8)
+    {
+        const __m256 inRange = _mm256_castsi256_ps(_mm256_cmpgt_epi32(
+                                   _mm256_set1_epi32(end-i), laneIdx));
+        __m256 rx = _mm256_load_ps(refData.x+i);
+        __m256 ry = _mm256_load_ps(refData.y+i);
+        __m256 rz = _mm256_load_ps(refData.z+i);
+
+        __m256 Wx = _mm256_fmadd_ps(R[0][0], rx, _mm256_fmadd_ps(R[0][1], ry,
+                                    _mm256_fmadd_ps(R[0][2], rz, t0)));
+        __m256 Wy = _mm256_fmadd_ps(R[1][0], rx, _mm256_fmadd_ps(R[1][1], ry,
+                                    _mm256_fmadd_ps(R[1][2], rz, t1)));
+        __m256 Wz = _mm256_fmadd_ps(R[2][0], rx, _mm256_fmadd_ps(R[2][1], ry,
+                                    _mm256_fmadd_ps(R[2][2], rz, t2)));
+        __m256 u_new = _mm256_fmadd_ps(_mm256_div_ps(Wx, Wz), fx_l, cx_l);
+        __m256 v_new = _mm256_fmadd_ps(_mm256_div_ps(Wy, Wz), fy_l, cy_l);
+
+        __m256 valid = _mm256_and_ps(
+                           _mm256_and_ps(_mm256_cmp_ps(u_new, ones, _CMP_GT_OQ),
+                                         _mm256_cmp_ps(v_new, ones, _CMP_GT_OQ)),
+                           _mm256_and_ps(_mm256_cmp_ps(u_new, maxU, _CMP_LT_OQ),
+                                         _mm256_cmp_ps(v_new, maxV, _CMP_LT_OQ)));
+        valid = _mm256_and_ps(valid, inRange);
+        int validBits = _mm256_movemask_ps(valid);
+
+        if(validBits == 0)
+        {
+            if(isGoodOutBuffer != 0)
+                for(int l=0; l<8 && i+l<end; l++)
+                    isGoodOutBuffer[idxBuf[i+l]] = false;
+            continue;
+        }
+
+        __m256i ix = _mm256_cvttps_epi32(u_new);
+        __m256i iy = _mm256_cvttps_epi32(v_new);
+        __m256 dx = _mm256_sub_ps(u_new, _mm256_cvtepi32_ps(ix));
+        __m256 dy = _mm256_sub_ps(v_new, _mm256_cvtepi32_ps(iy));
+        __m256 dxdy = _mm256_mul_ps(dx, dy);
+        __m256 w11 = dxdy;
+        __m256 w01 = _mm256_sub_ps(dy, dxdy);
+        __m256 w10 = _mm256_sub_ps(dx, dxdy);
+        __m256 w00 = _mm256_add_ps(_mm256_sub_ps(_mm256_sub_ps(ones, dx), dy), dxdy);
+
+        __m256i o00 = _mm256_add_epi32(ix, _mm256_mullo_epi32(iy, widthI));
+        if(!inverseCompositional)
+            o00 = _mm256_slli_epi32(o00, 2);
+        __m256i o10 = _mm256_add_epi32(o00, offRight);
+        __m256i o01 = _mm256_add_epi32(o00, offDown);
+        __m256i o11 = _mm256_add_epi32(o01, offRight);
+
+        __m256 resInterp[3];
+        if(inverseCompositional)
+        {
+            resInterp[0] = _mm256_and_ps(valid, _mm256_load_ps(refData.gradX+i));
+            resInterp[1] = _mm256_and_ps(valid, _mm256_load_ps(refData.gradY+i));
+        }
+        for(int c=inverseCompositional ? 2 : 0; c<3; c++)
+        {
+            const float* base = inverseCompositional ? frame_image : frame_gradients + c;
+            __m256 p00 = _mm256_mask_i32gather_ps(zeros, base, o00, valid, 4);
+            __m256 p10 = _mm256_mask_i32gather_ps(zeros, base, o10, valid, 4);
+            __m256 p01 = _mm256_mask_i32gather_ps(zeros, base, o01, valid, 4);
+            __m256 p11 = _mm256_mask_i32gather_ps(zeros, base, o11, valid, 4);
+            resInterp[c] = _mm256_and_ps(valid, _mm256_fmadd_ps(w11, p11,
+                                         _mm256_fmadd_ps(w01, p01, _mm256_fmadd_ps(w10, p10, _mm256_mul_ps(w00, p00)))));
+        }
+
+        __m256 color = _mm256_load_ps(refData.color+i);
+        __m256 idepthVar = _mm256_load_ps(refData.var+i);
+
+        __m256 c1 = _mm256_fmadd_ps(affA, color, affB);
+        __m256 c2 = resInterp[2];
+        __m256 rp = _mm256_and_ps(valid, _mm256_sub_ps(c1, c2));
+
+        __m256 absRes = _mm256_andnot_ps(signMask, rp);
+        __m256 weight = _mm256_blendv_ps(_mm256_div_ps(fives, absRes), ones,
+                                         _mm256_cmp_ps(absRes, fives, _CMP_LT_OQ));
+        weight = _mm256_and_ps(valid, weight);
+        __m256 c1w = _mm256_mul_ps(c1, weight);
+        __m256 c2w = _mm256_mul_ps(c2, weight);
+        sxx = _mm256_fmadd_ps(c1w, c1, sxx);
+        syy = _mm256_fmadd_ps(c2w, c2, syy);
+        sx = _mm256_add_ps(sx, c1w);
+        sy = _mm256_add_ps(sy, c2w);
+        sw = _mm256_add_ps(sw, weight);
+
+        __m256 res2 = _mm256_mul_ps(rp, rp);
+        __m256 gradNorm = _mm256_fmadd_ps(resInterp[0], resInterp[0],
+                                          _mm256_mul_ps(resInterp[1], resInterp[1]));
+        __m256 isGood = _mm256_cmp_ps(_mm256_div_ps(res2, _mm256_fmadd_ps(maxDiffGradMult,
+                                      gradNorm, maxDiffConst)), ones, _CMP_LT_OQ);
+        isGood = _mm256_and_ps(valid, isGood);
+        int goodBits = _mm256_movemask_ps(isGood);
+
+        if(isGoodOutBuffer != 0)
+            for(int l=0; l<8 && i+l<end; l++)
+                isGoodOutBuffer[idxBuf[i+l]] = (goodBits >> l) & 1;
+
+        sumResUnweighted = _mm256_add_ps(sumResUnweighted, _mm256_and_ps(isGood, res2));
+        sumSignedRes = _mm256_add_ps(sumSignedRes, _mm256_and_ps(isGood, rp));
+        int numValid = _mm_popcnt_u32(validBits);
+        int numGood = _mm_popcnt_u32(goodBits);
+        goodCount += numGood;
+        badCount += numValid - numGood;
+
+        __m256 depthChange = _mm256_div_ps(rz, Wz);
+        usageCount = _mm256_add_ps(usageCount, _mm256_and_ps(valid,
+                                   _mm256_min_ps(depthChange, ones)));
+        idx += numValid;
+
+        // weight. lanes outside the image get z=1 and x=y=g=r=0, hence weight and
+        // jacobian stay finite, and their weight is zeroed below.
+        __m256 pz = _mm256_blendv_ps(ones, Wz, valid);
+        __m256 px = _mm256_and_ps(valid, Wx);
+        __m256 py = _mm256_and_ps(valid, Wy);
+        __m256 gx = _mm256_mul_ps(fx_l, resInterp[0]);
+        __m256 gy = _mm256_mul_ps(fy_l, resInterp[1]);
+
+        // pz*pz*d with d = 1/rz
+        __m256 pz2ds = _mm256_div_ps(_mm256_mul_ps(pz, pz), _mm256_blendv_ps(ones, rz, valid));
+        __m256 g0s = _mm256_div_ps(_mm256_fmsub_ps(pz, t0, _mm256_mul_ps(px, t2)), pz2ds);
+        __m256 g1s = _mm256_div_ps(_mm256_fmsub_ps(pz, t1, _mm256_mul_ps(py, t2)), pz2ds);
+        __m256 drpdds = _mm256_fmadd_ps(g0s, gx, _mm256_mul_ps(g1s, gy));
+        __m256 w_ps = _mm256_div_ps(ones, _mm256_fmadd_ps(_mm256_mul_ps(drpdds, drpdds),
+                                    _mm256_mul_ps(depthVarFacs, idepthVar), sigma_i2s));
+        __m256 weighted_rps = _mm256_andnot_ps(signMask,
+                                               _mm256_mul_ps(rp, _mm256_sqrt_ps(w_ps)));
+        __m256 whs = _mm256_blendv_ps(_mm256_div_ps(huber_res_ponlys, weighted_rps), ones,
+                                      _mm256_cmp_ps(weighted_rps, huber_res_ponlys, _CMP_LT_OQ));
+        __m256 wp = _mm256_and_ps(valid, _mm256_mul_ps(whs, w_ps));
+
+        // jacobian. the inverse compositional one is scaled with a after the loop.
+        __m256 v[6];
+        if(inverseCompositional)
+        {
+            for(int a=0; a<6; a++)
+                v[a] = _mm256_load_ps(refData.jac[a]+i);
+        }
+        else
+        {
+            __m256 z = _mm256_div_ps(ones, pz);
+            __m256 z_sqr = _mm256_mul_ps(z, z);
+            __m256 s = _mm256_fmadd_ps(_mm256_mul_ps(px, z_sqr), gx,
+                                       _mm256_mul_ps(_mm256_mul_ps(py, z_sqr), gy));
+
+            v[0] = _mm256_mul_ps(z, gx);
+            v[1] = _mm256_mul_ps(z, gy);
+            v[2] = _mm256_xor_ps(s, signMask);
+            v[3] = _mm256_xor_ps(_mm256_fmadd_ps(py, s, gy), signMask);
+            v[4] = _mm256_fmadd_ps(px, s, gx);
+            v[5] = _mm256_mul_ps(z, _mm256_fmsub_ps(px, gy, _mm256_mul_ps(py, gx)));
+        }
+
+        __m256 wr = _mm256_mul_ps(wp, rp);
+        int k = 0;
+        for(int a=0; a<6; a++)
+        {
+            __m256 wv = _mm256_mul_ps(wp, v[a]);
+            for(int b=a; b<6; b++, k++)
+                sumJJ[k] = _mm256_fmadd_ps(wv, v[b], sumJJ[k]);
+            sumJr[a] = _mm256_fmadd_ps(v[a], wr, sumJr[a]);
+        }
+        sumRR = _mm256_fmadd_ps(wr, rp, sumRR);
+    }
+
+    sums.num = idx;
+    sums.goodCount = goodCount;
+    sums.badCount = badCount;
+    sums.sumResUnweighted = hsumAVX2(sumResUnweighted);
+    sums.sumSignedRes = hsumAVX2(sumSignedRes);
+    sums.usageCount = hsumAVX2(usageCount);
+    sums.sxx = hsumAVX2(sxx);
+    sums.syy = hsumAVX2(syy);
+    sums.sx = hsumAVX2(sx);
+    sums.sy = hsumAVX2(sy);
+    sums.sw = hsumAVX2(sw);
+
+    Matrix6x6 JtJ;
+    Vector6 Jtr;
+    int k = 0;
+    for(int a=0; a<6; a++)
+    {
+        for(int b=a; b<6; b++, k++)
+            JtJ(a,b) = JtJ(b,a) = hsumAVX2(sumJJ[k]);
+        Jtr[a] = hsumAVX2(sumJr[a]);
+    }
+    if(inverseCompositional)
+    {
+        JtJ *= affineEstimation_a * affineEstimation_a;
+        Jtr *= affineEstimation_a;
+    }
+    ls.updateSummed(JtJ, Jtr, hsumAVX2(sumRR), idx);
+}
+#endif
+
+
+#if defined(ENABLE_AVX512)
+template<bool inverseCompositional>
+TARGET_AVX512 void SE3Tracker::calcResidualAndUpdateFusedAVX512(
+    FusedPassSums& sums,
+    const PointCloudSoA& refData,
+    int* idxBuf,
+    int first,
+    int end,
+    Frame* frame,
+    const Sophus::SE3f& referenceToFrame,
+    int level)
+{
+    NormalEquationsLeastSquares& ls = sums.ls;
+    ls.initialize(width*height);
+
+    int w = frame->width(level);
+    int h = frame->height(level);
+    Eigen::Matrix3f KLvl = frame->K(level);
+    const __m512 fx_l = _mm512_set1_ps(KLvl(0,0));
+    const __m512 fy_l = _mm512_set1_ps(KLvl(1,1));
+    const __m512 cx_l = _mm512_set1_ps(KLvl(0,2));
+    const __m512 cy_l = _mm512_set1_ps(KLvl(1,2));
+
+    Eigen::Matrix3f rotMat = referenceToFrame.rotationMatrix();
+    Eigen::Vector3f transVec = referenceToFrame.translation();
+    __m512 R[3][3];
+    for(int r=0; r<3; r++)
+        for(int c=0; c<3; c++)
+            R[r][c] = _mm512_set1_ps(rotMat(r,c));
+    const __m512 t0 = _mm512_set1_ps(transVec[0]);
+    const __m512 t1 = _mm512_set1_ps(transVec[1]);
+    const __m512 t2 = _mm512_set1_ps(transVec[2]);
+
+    const float* frame_gradients = (const float*)frame->gradients(level);
+    const float* frame_image = frame->image(level);
+    const int pixelStride = inverseCompositional ? 1 : 4;
+
+    bool* isGoodOutBuffer = idxBuf != 0 ? frame->refPixelWasGood() : 0;
+
+    const __m512i widthI = _mm512_set1_epi32(w);
+    const __m512i offRight = _mm512_set1_epi32(pixelStride);
+    const __m512i offDown = _mm512_set1_epi32(pixelStride*w);
+
+    const __m512 zeros = _mm512_setzero_ps();
+    const __m512 ones = _mm512_set1_ps(1.0f);
+    const __m512 fives = _mm512_set1_ps(5.0f);
+    const __m512 maxU = _mm512_set1_ps(w-2);
+    const __m512 maxV = _mm512_set1_ps(h-2);
+    const __m512 affA = _mm512_set1_ps(affineEstimation_a);
+    const __m512 affB = _mm512_set1_ps(affineEstimation_b);
+    const __m512 maxDiffConst = _mm512_set1_ps(MAX_DIFF_CONSTANT);
+    const __m512 maxDiffGradMult = _mm512_set1_ps(MAX_DIFF_GRAD_MULT);
+    const __m512 depthVarFacs = _mm512_set1_ps((float)settings.var_weight);
+    const __m512 sigma_i2s = _mm512_set1_ps((float)cameraPixelNoise2);
+    const __m512 huber_res_ponlys = _mm512_set1_ps((float)(settings.huber_d/2));
+
+    __m512 sxx = zeros, syy = zeros, sx = zeros, sy = zeros, sw = zeros;
+    __m512 sumResUnweighted = zeros, sumSignedRes = zeros, usageCount = zeros;
+    int goodCount = 0;
+    int badCount = 0;
+    int idx = 0;
+
+    __m512 sumJJ[21];
+    __m512 sumJr[6];
+    __m512 sumRR = zeros;
+    for(int k=0; k<21; k++) sumJJ[k] = zeros;
+    for(int k=0; k<6; k++) sumJr[k] = zeros;
+
+    for(int i=first; i<end; i+=16)
+    {
+        const __mmask16 inRange = laneMaskAVX512(end-i);
+        __m512 rx = _mm512_load_ps(refData.x+i);
+        __m512 ry = _mm512_load_ps(refData.y+i);
+        __m512 rz = _mm512_load_ps(refData.z+i);
+
+        __m512 Wx = _mm512_fmadd_ps(R[0][0], rx, _mm512_fmadd_ps(R[0][1], ry,
+                                    _mm512_fmadd_ps(R[0][2], rz, t0)));
+        __m512 Wy = _mm512_fmadd_ps(R[1][0], rx, _mm512_fmadd_ps(R[1][1], ry,
+                                    _mm512_fmadd_ps(R[1][2], rz, t1)));
+        __m512 Wz = _mm512_fmadd_ps(R[2][0], rx, _mm512_fmadd_ps(R[2][1], ry,
+                                    _mm512_fmadd_ps(R[2][2], rz, t2)));
+        __m512 u_new = _mm512_fmadd_ps(_mm512_div_ps(Wx, Wz), fx_l, cx_l);
+        __m512 v_new = _mm512_fmadd_ps(_mm512_div_ps(Wy, Wz), fy_l, cy_l);
+
+        __mmask16 valid = inRange;
+        valid = _mm512_mask_cmp_ps_mask(valid, u_new, ones, _CMP_GT_OQ);
+        valid = _mm512_mask_cmp_ps_mask(valid, v_new, ones, _CMP_GT_OQ);
+        valid = _mm512_mask_cmp_ps_mask(valid, u_new, maxU, _CMP_LT_OQ);
+        valid = _mm512_mask_cmp_ps_mask(valid, v_new, maxV, _CMP_LT_OQ);
+
+        if(valid == 0)
+        {
+            if(isGoodOutBuffer != 0)
+                for(int l=0; l<16 && i+l<end; l++)
+                    isGoodOutBuffer[idxBuf[i+l]] = false;
+            continue;
+        }
+
+        __m512i ix = _mm512_cvttps_epi32(u_new);
+        __m512i iy = _mm512_cvttps_epi32(v_new);
+        __m512 dx = _mm512_sub_ps(u_new, _mm512_cvtepi32_ps(ix));
+        __m512 dy = _mm512_sub_ps(v_new, _mm512_cvtepi32_ps(iy));
+        __m512 dxdy = _mm512_mul_ps(dx, dy);
+        __m512 w11 = dxdy;
+        __m512 w01 = _mm512_sub_ps(dy, dxdy);
+        __m512 w10 = _mm512_sub_ps(dx, dxdy);
+        __m512 w00 = _mm512_add_ps(_mm512_sub_ps(_mm512_sub_ps(ones, dx), dy), dxdy);
+
+        __m512i o00 = _mm512_add_epi32(ix, _mm512_mullo_epi32(iy, widthI));
+        if(!inverseCompositional)
+            o00 = _mm512_slli_epi32(o00, 2);
+        __m512i o10 = _mm512_add_epi32(o00, offRight);
+        __m512i o01 = _mm512_add_epi32(o00, offDown);
+        __m512i o11 = _mm512_add_epi32(o01, offRight);
+
+        __m512 resInterp[3];
+        if(inverseCompositional)
+        {
+            resInterp[0] = _mm512_maskz_load_ps(valid, refData.gradX+i);
+            resInterp[1] = _mm512_maskz_load_ps(valid, refData.gradY+i);
+        }
+        for(int c=inverseCompositional ? 2 : 0; c<3; c++)
+        {
+            const float* base = inverseCompositional ? frame_image : frame_gradients + c;
+            __m512 p00 = _mm512_mask_i32gather_ps(zeros, valid, o00, base, 4);
+            __m512 p10 = _mm512_mask_i32gather_ps(zeros, valid, o10, base, 4);
+            __m512 p01 = _mm512_mask_i32gather_ps(zeros, valid, o01, base, 4);
+            __m512 p11 = _mm512_mask_i32gather_ps(zeros, valid, o11, base, 4);
+            resInterp[c] = _mm512_maskz_fmadd_ps(valid, w11, p11,
+                                                 _mm512_fmadd_ps(w01, p01, _mm512_fmadd_ps(w10, p10, _mm512_mul_ps(w00, p00))));
+        }
+
+        __m512 color = _mm512_load_ps(refData.color+i);
+        __m512 idepthVar = _mm512_load_ps(refData.var+i);
+
+        __m512 c1 = _mm512_fmadd_ps(affA, color, affB);
+        __m512 c2 = resInterp[2];
+        __m512 rp = _mm512_maskz_sub_ps(valid, c1, c2);
+
+        __m512 absRes = _mm512_abs_ps(rp);
+        __m512 weight = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(absRes, fives, _CMP_LT_OQ),
+                                             _mm512_div_ps(fives, absRes), ones);
+        weight = _mm512_maskz_mov_ps(valid, weight);
+        __m512 c1w = _mm512_mul_ps(c1, weight);
+        __m512 c2w = _mm512_mul_ps(c2, weight);
+        sxx = _mm512_fmadd_ps(c1w, c1, sxx);
+        syy = _mm512_fmadd_ps(c2w, c2, syy);
+        sx = _mm512_add_ps(sx, c1w);
+        sy = _mm512_add_ps(sy, c2w);
+        sw = _mm512_add_ps(sw, weight);
+
+        __m512 res2 = _mm512_mul_ps(rp, rp);
+        __m512 gradNorm = _mm512_fmadd_ps(resInterp[0], resInterp[0],
+                                          _mm512_mul_ps(resInterp[1], resInterp[1]));
+        __mmask16 isGood = _mm512_mask_cmp_ps_mask(valid, _mm512_div_ps(res2,
+                           _mm512_fmadd_ps(maxDiffGradMult, gradNorm, maxDiffConst)), ones, _CMP_LT_OQ);
+
+        if(isGoodOutBuffer != 0)
+            for(int l=0; l<16 && i+l<end; l++)
+                isGoodOutBuffer[idxBuf[i+l]] = (isGood >> l) & 1;
+
+        sumResUnweighted = _mm512_mask_add_ps(sumResUnweighted, isGood, sumResUnweighted,
+                                              res2);
+        sumSignedRes = _mm512_mask_add_ps(sumSignedRes, isGood, sumSignedRes, rp);
+        int numValid = _mm_popcnt_u32(valid);
+        int numGood = _mm_popcnt_u32(isGood);
+        goodCount += numGood;
+        badCount += numValid - numGood;
+
+        __m512 depthChange = _mm512_div_ps(rz, Wz);
+        usageCount = _mm512_mask_add_ps(usageCount, valid, usageCount,
+                                        _mm512_min_ps(depthChange, ones));
+        idx += numValid;
+
+        // weight. lanes outside the image get z=1 and x=y=g=r=0, see the AVX2 version.
+        __m512 pz = _mm512_mask_mov_ps(ones, valid, Wz);
+        __m512 px = _mm512_maskz_mov_ps(valid, Wx);
+        __m512 py = _mm512_maskz_mov_ps(valid, Wy);
+        __m512 gx = _mm512_mul_ps(fx_l, resInterp[0]);
+        __m512 gy = _mm512_mul_ps(fy_l, resInterp[1]);
+
+        __m512 pz2ds = _mm512_div_ps(_mm512_mul_ps(pz, pz), _mm512_mask_mov_ps(ones, valid, rz));
+        __m512 g0s = _mm512_div_ps(_mm512_fmsub_ps(pz, t0, _mm512_mul_ps(px, t2)), pz2ds);
+        __m512 g1s = _mm512_div_ps(_mm512_fmsub_ps(pz, t1, _mm512_mul_ps(py, t2)), pz2ds);
+        __m512 drpdds = _mm512_fmadd_ps(g0s, gx, _mm512_mul_ps(g1s, gy));
+        __m512 w_ps = _mm512_div_ps(ones, _mm512_fmadd_ps(_mm512_mul_ps(drpdds, drpdds),
+                                    _mm512_mul_ps(depthVarFacs, idepthVar), sigma_i2s));
+        __m512 weighted_rps = _mm512_abs_ps(_mm512_mul_ps(rp, _mm512_sqrt_ps(w_ps)));
+        __m512 whs = _mm512_mask_blend_ps(
+                         _mm512_cmp_ps_mask(weighted_rps, huber_res_ponlys, _CMP_LT_OQ),
+                         _mm512_div_ps(huber_res_ponlys, weighted_rps), ones);
+        __m512 wp = _mm512_maskz_mul_ps(valid, whs, w_ps);
+
+        // jacobian. the inverse compositional one is scaled with a after the loop.
+        __m512 v[6];
+        if(inverseCompositional)
+        {
+            for(int a=0; a<6; a++)
+                v[a] = _mm512_load_ps(refData.jac[a]+i);
+        }
+        else
+        {
+            __m512 z = _mm512_div_ps(ones, pz);
+            __m512 z_sqr = _mm512_mul_ps(z, z);
+            __m512 s = _mm512_fmadd_ps(_mm512_mul_ps(px, z_sqr), gx,
+                                       _mm512_mul_ps(_mm512_mul_ps(py, z_sqr), gy));
+
+            v[0] = _mm512_mul_ps(z, gx);
+            v[1] = _mm512_mul_ps(z, gy);
+            v[2] = _mm512_sub_ps(zeros, s);
+            v[3] = _mm512_fnmsub_ps(py, s, gy);
+            v[4] = _mm512_fmadd_ps(px, s, gx);
+            v[5] = _mm512_mul_ps(z, _mm512_fmsub_ps(px, gy, _mm512_mul_ps(py, gx)));
+        }
+
+        __m512 wr = _mm512_mul_ps(wp, rp);
+        int k = 0;
+        for(int a=0; a<6; a++)
+        {
+            __m512 wv = _mm512_mul_ps(wp, v[a]);
+            for(int b=a; b<6; b++, k++)
+                sumJJ[k] = _mm512_fmadd_ps(wv, v[b], sumJJ[k]);
+            sumJr[a] = _mm512_fmadd_ps(v[a], wr, sumJr[a]);
+        }
+        sumRR = _mm512_fmadd_ps(wr, rp, sumRR);
+    }
+
+    sums.num = idx;
+    sums.goodCount = goodCount;
+    sums.badCount = badCount;
+    sums.sumResUnweighted = _mm512_reduce_add_ps(sumResUnweighted);
+    sums.sumSignedRes = _mm512_reduce_add_ps(sumSignedRes);
+    sums.usageCount = _mm512_reduce_add_ps(usageCount);
+    sums.sxx = _mm512_reduce_add_ps(sxx);
+    sums.syy = _mm512_reduce_add_ps(syy);
+    sums.sx = _mm512_reduce_add_ps(sx);
+    sums.sy = _mm512_reduce_add_ps(sy);
+    sums.sw = _mm512_reduce_add_ps(sw);
+
+    Matrix6x6 JtJ;
+    Vector6 Jtr;
+    int k = 0;
+    for(int a=0; a<6; a++)
+    {
+        for(int b=a; b<6; b++, k++)
+            JtJ(a,b) = JtJ(b,a) = _mm512_reduce_add_ps(sumJJ[k]);
+        Jtr[a] = _mm512_reduce_add_ps(sumJr[a]);
+    }
+    if(inverseCompositional)
+    {
+        JtJ *= affineEstimation_a * affineEstimation_a;
+        Jtr *= affineEstimation_a;
+    }
+    ls.updateSummed(JtJ, Jtr, _mm512_reduce_add_ps(sumRR), idx);
+}
+#endif
+
+
+}
@@ -19,11 +19,13 @@
 */
 
 #pragma once
+#include <vector>
 #include <opencv2/core/core.hpp>
 #include "util/settings.h"
 #include "util/eigen_core_include.h"
 #include "util/sophus_util.h"
 #include "tracking/least_squares.h"
+#include "tracking/point_cloud_soa.h"
 
 
 namespace lsd_slam
@@ -31,10 +33,12 @@ namespace lsd_slam
 
 class TrackingReference;
 class Frame;
+class IndexThreadReduce;
 
 
 class SE3Tracker
 {
+    friend class SimdKernelCheck;
 public:
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
@@ -62,10 +66,13 @@ public:
     ~SE3Tracker();
 
 
+    // startLevel: coarsest pyramid level to track on, a finer one can be used
+    // if the initial estimate is known to be good.
     SE3 trackFrame(
         TrackingReference* reference,
         Frame* frame,
-        const SE3& frameToReference_initialEstimate);
+        const SE3& frameToReference_initialEstimate,
+        int startLevel = SE3TRACKING_MAX_LEVEL-1);
 
 
     SE3 trackFrameOnPermaref(
@@ -91,6 +98,12 @@ public:
 
     bool diverged;
     bool trackingWasGood;
+
+    // per level statistics of the last trackFrame call, for tuning the level
+    // scheduling: residual evaluations and LM iterations, 0 for skipped levels.
+    int numCalcResidualCalls[PYRAMID_LEVELS];
+    int numCalcWarpUpdateCalls[PYRAMID_LEVELS];
+    bool lastExitedEarly;
 private:
 
 
@@ -110,8 +123,7 @@ private:
 
 
     float calcResidualAndBuffers(
-        const Eigen::Vector3f* refPoint,
-        const Eigen::Vector2f* refColVar,
+        const PointCloudSoA& refData,
         int* idxBuf,
         int refNum,
         Frame* frame,
@@ -121,8 +133,27 @@ private:
 
 #if defined(ENABLE_SSE)
     float calcResidualAndBuffersSSE(
-        const Eigen::Vector3f* refPoint,
-        const Eigen::Vector2f* refColVar,
+        const PointCloudSoA& refData,
+        int* idxBuf,
+        int refNum,
+        Frame* frame,
+        const Sophus::SE3f& referenceToFrame,
+        int level,
+        bool plotResidual = false);
+#endif
+#if defined(ENABLE_AVX2)
+    float calcResidualAndBuffersAVX2(
+        const PointCloudSoA& refData,
+        int* idxBuf,
+        int refNum,
+        Frame* frame,
+        const Sophus::SE3f& referenceToFrame,
+        int level,
+        bool plotResidual = false);
+#endif
+#if defined(ENABLE_AVX512)
+    float calcResidualAndBuffersAVX512(
+        const PointCloudSoA& refData,
         int* idxBuf,
         int refNum,
         Frame* frame,
@@ -132,8 +163,7 @@ private:
 #endif
 #if defined(ENABLE_NEON)
     float calcResidualAndBuffersNEON(
-        const Eigen::Vector3f* refPoint,
-        const Eigen::Vector2f* refColVar,
+        const PointCloudSoA& refData,
         int* idxBuf,
         int refNum,
         Frame* frame,
@@ -153,6 +183,14 @@ private:
     float calcWeightsAndResidualSSE(
         const Sophus::SE3f& referenceToFrame);
 #endif
+#if defined(ENABLE_AVX2)
+    float calcWeightsAndResidualAVX2(
+        const Sophus::SE3f& referenceToFrame);
+#endif
+#if defined(ENABLE_AVX512)
+    float calcWeightsAndResidualAVX512(
+        const Sophus::SE3f& referenceToFrame);
+#endif
 #if defined(ENABLE_NEON)
     float calcWeightsAndResidualNEON(
         const Sophus::SE3f& referenceToFrame);
@@ -169,11 +207,104 @@ private:
     Vector6 calculateWarpUpdateSSE(
         NormalEquationsLeastSquares &ls);
 #endif
+#if defined(ENABLE_AVX2)
+    Vector6 calculateWarpUpdateAVX2(
+        NormalEquationsLeastSquares &ls);
+#endif
+#if defined(ENABLE_AVX512)
+    Vector6 calculateWarpUpdateAVX512(
+        NormalEquationsLeastSquares &ls);
+#endif
 #if defined(ENABLE_NEON)
     Vector6 calculateWarpUpdateNEON(
         NormalEquationsLeastSquares &ls);
 #endif
 
+    // partial sums of the fused pass over one range of reference points.
+    struct FusedPassSums
+    {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+        NormalEquationsLeastSquares ls;
+        float sxx, syy, sx, sy, sw;
+        float sumResUnweighted, sumSignedRes, usageCount;
+        int goodCount, badCount, num;
+    };
+    std::vector<FusedPassSums, Eigen::aligned_allocator<FusedPassSums> > fusedSums;
+
+    // splits the fused pass over trackingThreads workers on large levels.
+    IndexThreadReduce* threadReducer;
+
+    // whether the fused pass may be used, i.e. no debug image needs the warped buffers.
+    bool canUseFusedPass(bool plotResidual) const;
+
+    // one pass over the reference points that warps, weights and directly
+    // accumulates the normal equations into ls, without going through the
+    // warped buffers. falls back to calcResidualAndBuffers and
+    // calcWeightsAndResidual when debug images need the buffers, or when the
+    // buffered SSE / NEON kernels are faster; ls is then left untouched, and
+    // has to be built from the buffers with calculateWarpUpdate if needed.
+    // with inverseCompositional, the precomputed jacobians of refData are used
+    // (and the caller has to apply the increment as referenceToFrame * exp(inc));
+    // requires refData.hasJacobians and canUseFusedPass().
+    float calcResidualAndUpdate(
+        NormalEquationsLeastSquares &ls,
+        const PointCloudSoA& refData,
+        int* idxBuf,
+        int refNum,
+        Frame* frame,
+        const Sophus::SE3f& referenceToFrame,
+        int level,
+        bool inverseCompositional,
+        bool plotResidual = false);
+    bool fusedInverseCompositional;	// of the pass currently running, read by the chunks.
+    bool lsAccumulated;	// whether the last calcResidualAndUpdate call filled ls.
+
+    void calcResidualAndUpdateChunk(
+        int first,
+        int end,
+        const PointCloudSoA* refData,
+        int* idxBuf,
+        Frame* frame,
+        const Sophus::SE3f* referenceToFrame,
+        int level,
+        int chunkSize);
+
+    template<bool inverseCompositional>
+    void calcResidualAndUpdateFused(
+        FusedPassSums& sums,
+        const PointCloudSoA& refData,
+        int* idxBuf,
+        int first,
+        int end,
+        Frame* frame,
+        const Sophus::SE3f& referenceToFrame,
+        int level);
+#if defined(ENABLE_AVX2)
+    template<bool inverseCompositional>
+    TARGET_AVX2 void calcResidualAndUpdateFusedAVX2(
+        FusedPassSums& sums,
+        const PointCloudSoA& refData,
+        int* idxBuf,
+        int first,
+        int end,
+        Frame* frame,
+        const Sophus::SE3f& referenceToFrame,
+        int level);
+#endif
+#if defined(ENABLE_AVX512)
+    template<bool inverseCompositional>
+    TARGET_AVX512 void calcResidualAndUpdateFusedAVX512(
+        FusedPassSums& sums,
+        const PointCloudSoA& refData,
+        int* idxBuf,
+        int first,
+        int end,
+        Frame* frame,
+        const Sophus::SE3f& referenceToFrame,
+        int level);
+#endif
+
     void calcResidualAndBuffers_debugStart();
     void calcResidualAndBuffers_debugFinish(int w);
 
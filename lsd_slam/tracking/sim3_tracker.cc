@@ -27,6 +27,10 @@
 #include "io_wrapper/image_display.h"
 #include "tracking/least_squares.h"
 
+#if defined(ENABLE_AVX2)
+#include <immintrin.h>
+#endif
+
 namespace lsd_slam
 {
 
@@ -35,13 +39,96 @@ namespace lsd_slam
 #define callOptimized(function, arguments) function##NEON arguments
 #else
 #if defined(ENABLE_SSE)
-#define callOptimized(function, arguments) (USESSE ? function##SSE arguments : function arguments)
+#define callOptimized(function, arguments) (simdLevel >= SIMD_AVX2 ? function##AVX2 arguments : \
+        (USESSE ? function##SSE arguments : function arguments))
 #else
 #define callOptimized(function, arguments) function arguments
 #endif
 #endif
 
 
+#if defined(ENABLE_AVX2)
+TARGET_AVX2 static inline float hsumAVX2(__m256 v)
+{
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    return _mm_cvtss_f32(s);
+}
+
+// per-lane sums of w*J*J^T (upper triangle, row by row), w*r*J and w*r*r
+// of an n-dimensional system, see calcSim3LGSAVX2.
+template<int n>
+struct LGSSumsAVX2
+{
+    __m256 JJ[n*(n+1)/2];
+    __m256 Jr[n];
+    __m256 rr;
+
+    TARGET_AVX2 inline void setZero()
+    {
+        for(int k=0; k<n*(n+1)/2; k++) JJ[k] = _mm256_setzero_ps();
+        for(int k=0; k<n; k++) Jr[k] = _mm256_setzero_ps();
+        rr = _mm256_setzero_ps();
+    }
+
+    TARGET_AVX2 inline void update(const __m256* v, __m256 r, __m256 w)
+    {
+        __m256 wr = _mm256_mul_ps(w, r);
+        int k = 0;
+        for(int a=0; a<n; a++)
+        {
+            __m256 wv = _mm256_mul_ps(w, v[a]);
+            for(int b=a; b<n; b++, k++)
+                JJ[k] = _mm256_fmadd_ps(wv, v[b], JJ[k]);
+            Jr[a] = _mm256_fmadd_ps(v[a], wr, Jr[a]);
+        }
+        rr = _mm256_fmadd_ps(wr, r, rr);
+    }
+
+    template<typename MatrixType, typename VectorType>
+    TARGET_AVX2 inline void reduce(MatrixType& JtJ, VectorType& Jtr, float& err) const
+    {
+        int k = 0;
+        for(int a=0; a<n; a++)
+        {
+            for(int b=a; b<n; b++, k++)
+                JtJ(a,b) = JtJ(b,a) = hsumAVX2(JJ[k]);
+            Jtr[a] = hsumAVX2(Jr[a]);
+        }
+        err = hsumAVX2(rr);
+    }
+};
+
+// the jacobians of the photometric (6dof) and the depth (4dof) residual of
+// a warped point, as in calcSim3LGS. lanes with pz == 0 have to be masked out.
+TARGET_AVX2 static inline void sim3JacobiansAVX2(__m256 px, __m256 py, __m256 pz,
+        __m256 gx, __m256 gy, __m256* v, __m256* v4)
+{
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+
+    __m256 z = _mm256_div_ps(_mm256_set1_ps(1.0f), pz);
+    __m256 z_sqr = _mm256_mul_ps(z, z);
+
+    // px * z_sqr * gx + py * z_sqr * gy
+    __m256 s = _mm256_fmadd_ps(_mm256_mul_ps(px, z_sqr), gx,
+                               _mm256_mul_ps(_mm256_mul_ps(py, z_sqr), gy));
+
+    v[0] = _mm256_mul_ps(z, gx);
+    v[1] = _mm256_mul_ps(z, gy);
+    v[2] = _mm256_xor_ps(s, signMask);
+    v[3] = _mm256_xor_ps(_mm256_fmadd_ps(py, s, gy), signMask);
+    v[4] = _mm256_fmadd_ps(px, s, gx);
+    v[5] = _mm256_mul_ps(z, _mm256_fmsub_ps(px, gy, _mm256_mul_ps(py, gx)));
+
+    v4[0] = z_sqr;
+    v4[1] = _mm256_mul_ps(z_sqr, py);
+    v4[2] = _mm256_xor_ps(_mm256_mul_ps(z_sqr, px), signMask);
+    v4[3] = z;
+}
+#endif
+
+
 
 Sim3Tracker::Sim3Tracker(int w, int h, Eigen::Matrix3f K)
 {
@@ -84,6 +171,7 @@ Sim3Tracker::Sim3Tracker(int w, int h, Eigen::Matrix3f K)
     buf_weight_VarD = new float[w*h];
 
     buf_warped_size = 0;
+    ls7Accumulated = false;
 
     debugImageWeights = cv::Mat(height,width,CV_8UC3);
     debugImageResiduals = cv::Mat(height,width,CV_8UC3);
@@ -165,7 +253,9 @@ Sim3 Sim3Tracker::trackFrameSim3(
 
     // ============ track frame ============
     Sim3 referenceToFrame = frameToReference_initialEstimate.inverse();
-    NormalEquationsLeastSquares7 ls7;
+    // ls7 holds the LGS at referenceToFrame, ls7_new the one of the increment
+    // currently being tried (only filled by the fused pass).
+    NormalEquationsLeastSquares7 ls7, ls7_new;
 
 
     int numCalcResidualCalls[PYRAMID_LEVELS];
@@ -179,26 +269,24 @@ Sim3 Sim3Tracker::trackFrameSim3(
     {
         numCalcResidualCalls[lvl] = 0;
         numCalcWarpUpdateCalls[lvl] = 0;
+        warp_update_up_to_date = false;
 
         if(settings.maxItsPerLvl[lvl] == 0)
             continue;
 
         reference->makePointCloud(lvl);
 
-        // evaluate baseline-residual.
-        callOptimized(calcSim3Buffers, (reference, frame, referenceToFrame, lvl));
+        // evaluate baseline-residual, with the fused pass also the LGS at it.
+        Sim3ResidualStruct lastErr = calcSim3ResidualAndLGS(ls7, reference, frame,
+                                     referenceToFrame, lvl);
         if(buf_warped_size < 0.5 * MIN_GOODPERALL_PIXEL_ABSMIN * (width>>lvl)*
                 (height>>lvl) || buf_warped_size < 10)
         {
             diverged = true;
             return Sim3();
         }
-
-        Sim3ResidualStruct lastErr = callOptimized(calcSim3WeightsAndResidual,
-                                     (referenceToFrame));
-        if(plotSim3TrackingIterationInfo) callOptimized(calcSim3Buffers,(reference,
-                    frame, referenceToFrame, lvl, true));
         numCalcResidualCalls[lvl]++;
+        warp_update_up_to_date = ls7Accumulated;
 
         if(useAffineLightningEstimation)
         {
@@ -208,13 +296,16 @@ Sim3 Sim3Tracker::trackFrameSim3(
 
         float LM_lambda = settings.lambdaInitial[lvl];
 
-        warp_update_up_to_date = false;
         for(int iteration=0; iteration < settings.maxItsPerLvl[lvl]; iteration++)
         {
 
-            // calculate LS System, result is saved in ls.
-            callOptimized(calcSim3LGS,(ls7));
-            warp_update_up_to_date = true;
+            // calculate LS System, result is saved in ls7. the fused pass already
+            // did while evaluating the residual at referenceToFrame.
+            if(!warp_update_up_to_date)
+            {
+                callOptimized(calcSim3LGS,(ls7));
+                warp_update_up_to_date = true;
+            }
             numCalcWarpUpdateCalls[lvl]++;
 
             iterationNumber = iteration;
@@ -244,19 +335,16 @@ Sim3 Sim3Tracker::trackFrameSim3(
                 //Sim3 new_referenceToFrame = referenceToFrame * Sim3::exp((inc));
 
 
-                // re-evaluate residual
-                callOptimized(calcSim3Buffers,(reference, frame, new_referenceToFrame, lvl));
+                // re-evaluate residual (with the fused pass also the LGS, in case
+                // the increment is accepted).
+                Sim3ResidualStruct error = calcSim3ResidualAndLGS(ls7_new, reference, frame,
+                                           new_referenceToFrame, lvl);
                 if(buf_warped_size < 0.5 * MIN_GOODPERALL_PIXEL_ABSMIN * (width>>lvl)*
                         (height>>lvl) || buf_warped_size < 10)
                 {
                     diverged = true;
                     return Sim3();
                 }
-
-                Sim3ResidualStruct error = callOptimized(calcSim3WeightsAndResidual,
-                                           (new_referenceToFrame));
-                if(plotSim3TrackingIterationInfo) callOptimized(calcSim3Buffers,(reference,
-                            frame, new_referenceToFrame, lvl, true));
                 numCalcResidualCalls[lvl]++;
 
 
@@ -265,7 +353,10 @@ Sim3 Sim3Tracker::trackFrameSim3(
                 {
                     // accept inc
                     referenceToFrame = new_referenceToFrame;
-                    warp_update_up_to_date = false;
+                    if(ls7Accumulated)
+                        ls7 = ls7_new;
+                    else
+                        warp_update_up_to_date = false;
 
                     if(useAffineLightningEstimation)
                     {
@@ -370,10 +461,10 @@ Sim3 Sim3Tracker::trackFrameSim3(
     if (!warp_update_up_to_date)
     {
         reference->makePointCloud(finalLevel);
-        callOptimized(calcSim3Buffers,(reference, frame, referenceToFrame,
-                                       finalLevel));
-        finalResidual = callOptimized(calcSim3WeightsAndResidual,(referenceToFrame));
-        callOptimized(calcSim3LGS,(ls7));
+        finalResidual = calcSim3ResidualAndLGS(ls7, reference, frame, referenceToFrame,
+                                               finalLevel);
+        if(!ls7Accumulated)
+            callOptimized(calcSim3LGS,(ls7));
     }
 
     lastSim3Hessian = ls7.A;
@@ -411,6 +502,23 @@ void Sim3Tracker::calcSim3BuffersSSE(
 }
 #endif
 
+#if defined(ENABLE_AVX2)
+void Sim3Tracker::calcSim3BuffersAVX2(
+    const TrackingReference* reference,
+    Frame* frame,
+    const Sim3& referenceToFrame,
+    int level, bool plotWeights)
+{
+    // the warped buffers are only needed for the debug plots (or on machines
+    // without AVX2), the vectorized warp lives in calcSim3ResidualAndLGSFusedAVX2.
+    calcSim3Buffers(
+        reference,
+        frame,
+        referenceToFrame,
+        level, plotWeights);
+}
+#endif
+
 #if defined(ENABLE_NEON)
 void Sim3Tracker::calcSim3BuffersNEON(
     const TrackingReference* reference,
@@ -478,11 +586,7 @@ void Sim3Tracker::calcSim3Buffers(
     float yRoll1 = rollMat(1, 1);
 
 
-    const Eigen::Vector3f* refPoint_max = reference->posData[level] +
-                                          reference->numData[level];
-    const Eigen::Vector3f* refPoint = reference->posData[level];
-    const Eigen::Vector2f* refColVar = reference->colorAndVarData[level];
-    const Eigen::Vector2f* refGrad = reference->gradData[level];
+    const PointCloudSoA& refData = reference->pointData[level];
 
     const float* 			frame_idepth = frame->idepth(level);
     const float* 			frame_idepthVar = frame->idepthVar(level);
@@ -494,9 +598,10 @@ void Sim3Tracker::calcSim3Buffers(
     float usageCount = 0;
 
     int idx=0;
-    for(; refPoint<refPoint_max; refPoint++, refGrad++, refColVar++)
+    for(int i=0; i<reference->numData[level]; i++)
     {
-        Eigen::Vector3f Wxp = rotMat * (*refPoint) + transVec;
+        Eigen::Vector3f refPoint(refData.x[i], refData.y[i], refData.z[i]);
+        Eigen::Vector3f Wxp = rotMat * refPoint + transVec;
         float u_new = (Wxp[0]/Wxp[2])*fx_l + cx_l;
         float v_new = (Wxp[1]/Wxp[2])*fy_l + cy_l;
 
@@ -516,8 +621,8 @@ void Sim3Tracker::calcSim3Buffers(
         // save values
 #if USE_ESM_TRACKING == 1
         // get rotated gradient of point
-        float rotatedGradX = xRoll0 * (*refGrad)[0] + xRoll1 * (*refGrad)[1];
-        float rotatedGradY = yRoll0 * (*refGrad)[0] + yRoll1 * (*refGrad)[1];
+        float rotatedGradX = xRoll0 * refData.gradX[i] + xRoll1 * refData.gradY[i];
+        float rotatedGradY = yRoll0 * refData.gradX[i] + yRoll1 * refData.gradY[i];
 
         *(buf_warped_dx+idx) = fx_l * 0.5f * (resInterp[0] + rotatedGradX);
         *(buf_warped_dy+idx) = fy_l * 0.5f * (resInterp[1] + rotatedGradY);
@@ -527,7 +632,7 @@ void Sim3Tracker::calcSim3Buffers(
 #endif
 
 
-        float c1 = affineEstimation_a * (*refColVar)[0] + affineEstimation_b;
+        float c1 = affineEstimation_a * refData.color[i] + affineEstimation_b;
         float c2 = resInterp[2];
         float residual_p = c1 - c2;
 
@@ -540,14 +645,14 @@ void Sim3Tracker::calcSim3Buffers(
 
 
         *(buf_warped_residual+idx) = residual_p;
-        *(buf_idepthVar+idx) = (*refColVar)[1];
+        *(buf_idepthVar+idx) = refData.var[i];
 
 
         // new (only for Sim3):
         int idx_rounded = (int)(u_new+0.5f) + w*(int)(v_new+0.5f);
         float var_frameDepth = frame_idepthVar[idx_rounded];
         float ref_idepth = 1.0f / Wxp[2];
-        *(buf_d+idx) = 1.0f / (*refPoint)[2];
+        *(buf_d+idx) = 1.0f / refPoint[2];
         if(var_frameDepth > 0)
         {
             float residual_d = ref_idepth - frame_idepth[idx_rounded];
@@ -566,7 +671,7 @@ void Sim3Tracker::calcSim3Buffers(
         {
             // for debug plot only: find x,y again.
             // horribly inefficient, but who cares at this point...
-            Eigen::Vector3f point = KLvl * (*refPoint);
+            Eigen::Vector3f point = KLvl * refPoint;
             int x = point[0] / point[2] + 0.5f;
             int y = point[1] / point[2] + 0.5f;
 
@@ -607,7 +712,7 @@ void Sim3Tracker::calcSim3Buffers(
 
         idx++;
 
-        float depthChange = (*refPoint)[2] / Wxp[2];
+        float depthChange = refPoint[2] / Wxp[2];
         usageCount += depthChange < 1 ? depthChange : 1;
     }
     buf_warped_size = idx;
@@ -779,6 +884,111 @@ Sim3ResidualStruct Sim3Tracker::calcSim3WeightsAndResidualSSE(
 }
 #endif
 
+#if defined(ENABLE_AVX2)
+TARGET_AVX2 Sim3ResidualStruct Sim3Tracker::calcSim3WeightsAndResidualAVX2(
+    const Sim3& referenceToFrame)
+{
+    const __m256 txs = _mm256_set1_ps((float)(referenceToFrame.translation()[0]));
+    const __m256 tys = _mm256_set1_ps((float)(referenceToFrame.translation()[1]));
+    const __m256 tzs = _mm256_set1_ps((float)(referenceToFrame.translation()[2]));
+
+    const __m256 zeros = _mm256_setzero_ps();
+    const __m256 ones = _mm256_set1_ps(1.0f);
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    const __m256i laneIdx = _mm256_setr_epi32(0,1,2,3,4,5,6,7);
+
+    const __m256 depthVarFacs = _mm256_set1_ps((float)settings.var_weight);
+    const __m256 sigma_i2s = _mm256_set1_ps((float)cameraPixelNoise2);
+    const __m256 huber_ress = _mm256_set1_ps((float)(settings.huber_d));
+
+    __m256 sumResP = zeros;
+    __m256 sumResD = zeros;
+    int numTermsD = 0;
+
+    for(int i=0; i<buf_warped_size; i+=8)
+    {
+        // lanes past the end of the buffers are neither loaded nor stored.
+        const __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(buf_warped_size-i),
+                              laneIdx);
+
+        __m256 pzs = _mm256_maskload_ps(buf_warped_z+i, valid);
+        __m256 rps = _mm256_maskload_ps(buf_warped_residual+i, valid);
+        __m256 rds = _mm256_maskload_ps(buf_residual_d+i, valid);
+        __m256 ss = _mm256_mul_ps(depthVarFacs, _mm256_maskload_ps(buf_idepthVar+i,
+                                  valid));
+        __m256 warpedVars = _mm256_maskload_ps(buf_warped_idepthVar+i, valid);
+
+        // float g0 = (tx * pz - tz * px) / (pz*pz*d);
+        // float g1 = (ty * pz - tz * py) / (pz*pz*d);
+        // float g2 = (pz - tz) / (pz*pz*d);
+        __m256 pz2ds = _mm256_mul_ps(_mm256_mul_ps(pzs, pzs),
+                                     _mm256_maskload_ps(buf_d+i, valid));
+        __m256 g0s = _mm256_div_ps(_mm256_fmsub_ps(pzs, txs,
+                                   _mm256_mul_ps(_mm256_maskload_ps(buf_warped_x+i, valid), tzs)), pz2ds);
+        __m256 g1s = _mm256_div_ps(_mm256_fmsub_ps(pzs, tys,
+                                   _mm256_mul_ps(_mm256_maskload_ps(buf_warped_y+i, valid), tzs)), pz2ds);
+        __m256 g2s = _mm256_div_ps(_mm256_sub_ps(pzs, tzs), pz2ds);
+
+        // float drpdd = gx * g0 + gy * g1;	// ommitting the minus
+        __m256 drpdds = _mm256_fmadd_ps(g0s, _mm256_maskload_ps(buf_warped_dx+i, valid),
+                                        _mm256_mul_ps(g1s, _mm256_maskload_ps(buf_warped_dy+i, valid)));
+
+        // float w_p = 1.0f / (sigma_i2 + s * drpdd * drpdd);
+        // float w_d = 1.0f / (sv + g2*g2*s);
+        __m256 w_ps = _mm256_div_ps(ones, _mm256_fmadd_ps(_mm256_mul_ps(drpdds, drpdds),
+                                    ss, sigma_i2s));
+        __m256 w_ds = _mm256_div_ps(ones, _mm256_fmadd_ps(_mm256_mul_ps(g2s, g2s), ss,
+                                    _mm256_mul_ps(depthVarFacs, warpedVars)));
+
+        // float weighted_rp = fabs(rp*sqrtf(w_p));
+        // float weighted_rd = fabs(rd*sqrtf(w_d));
+        __m256 weighted_rps = _mm256_andnot_ps(signMask,
+                                               _mm256_mul_ps(rps, _mm256_sqrt_ps(w_ps)));
+        __m256 weighted_rds = _mm256_andnot_ps(signMask,
+                                               _mm256_mul_ps(rds, _mm256_sqrt_ps(w_ds)));
+
+        // depthValid = sv > 0, only for lanes within the buffers (loaded as 0 otherwise).
+        __m256 depthValid = _mm256_cmp_ps(warpedVars, zeros, _CMP_GT_OQ);
+
+        // float weighted_abs_res = sv > 0 ? weighted_rd+weighted_rp : weighted_rp;
+        __m256 weighted_abs_ress = _mm256_add_ps(_mm256_and_ps(depthValid, weighted_rds),
+                                   weighted_rps);
+
+        // float wh = fabs(weighted_abs_res < huber_res ? 1 : huber_res / weighted_abs_res);
+        __m256 whs = _mm256_blendv_ps(_mm256_div_ps(huber_ress, weighted_abs_ress), ones,
+                                      _mm256_cmp_ps(weighted_abs_ress, huber_ress, _CMP_LT_OQ));
+
+        // *(buf_weight_p+i) = wh * w_p;
+        // if(sv > 0) *(buf_weight_d+i) = wh * w_d; else *(buf_weight_d+i) = 0;
+        __m256 wps = _mm256_mul_ps(whs, w_ps);
+        __m256 wds = _mm256_and_ps(depthValid, _mm256_mul_ps(whs, w_ds));
+        _mm256_maskstore_ps(buf_weight_p+i, valid, wps);
+        _mm256_maskstore_ps(buf_weight_d+i, valid, wds);
+
+        // sumRes.sumResP += wh * w_p * rp*rp;
+        // if(sv > 0) sumRes.sumResD += wh * w_d * rd*rd;
+        sumResP = _mm256_add_ps(sumResP, _mm256_and_ps(_mm256_castsi256_ps(valid),
+                                _mm256_mul_ps(wps, _mm256_mul_ps(rps, rps))));
+        sumResD = _mm256_add_ps(sumResD, _mm256_and_ps(depthValid,
+                                _mm256_mul_ps(wds, _mm256_mul_ps(rds, rds))));
+        numTermsD += _mm_popcnt_u32(_mm256_movemask_ps(depthValid));
+    }
+
+    Sim3ResidualStruct sumRes;
+    sumRes.sumResP = hsumAVX2(sumResP);
+    sumRes.numTermsP = buf_warped_size;
+    sumRes.sumResD = hsumAVX2(sumResD);
+    sumRes.numTermsD = numTermsD;
+
+    sumRes.mean = (sumRes.sumResD + sumRes.sumResP) / (sumRes.numTermsD +
+                  sumRes.numTermsP);
+    sumRes.meanD = (sumRes.sumResD) / (sumRes.numTermsD);
+    sumRes.meanP = (sumRes.sumResP) / (sumRes.numTermsP);
+
+    return sumRes;
+}
+#endif
+
 #if defined(ENABLE_NEON)
 Sim3ResidualStruct Sim3Tracker::calcSim3WeightsAndResidualNEON(
     const Sim3& referenceToFrame)
@@ -1058,6 +1268,62 @@ void Sim3Tracker::calcSim3LGSSSE(NormalEquationsLeastSquares7 &ls7)
 }
 #endif
 
+#if defined(ENABLE_AVX2)
+TARGET_AVX2 void Sim3Tracker::calcSim3LGSAVX2(NormalEquationsLeastSquares7 &ls7)
+{
+    NormalEquationsLeastSquares4 ls4;
+    NormalEquationsLeastSquares ls6;
+    ls6.initialize(width*height);
+    ls4.initialize(width*height);
+
+    const __m256 ones = _mm256_set1_ps(1.0f);
+    const __m256i laneIdx = _mm256_setr_epi32(0,1,2,3,4,5,6,7);
+
+    LGSSumsAVX2<6> sums6;
+    LGSSumsAVX2<4> sums4;
+    sums6.setZero();
+    sums4.setZero();
+
+    for(int i=0; i<buf_warped_size; i+=8)
+    {
+        const __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(buf_warped_size-i),
+                              laneIdx);
+
+        // lanes past the end are loaded as zero (weight 0), except z=1 to keep J finite.
+        __m256 pz = _mm256_blendv_ps(ones, _mm256_maskload_ps(buf_warped_z+i, valid),
+                                     _mm256_castsi256_ps(valid));
+
+        __m256 v[6], v4[4];
+        sim3JacobiansAVX2(_mm256_maskload_ps(buf_warped_x+i, valid),
+                          _mm256_maskload_ps(buf_warped_y+i, valid), pz,
+                          _mm256_maskload_ps(buf_warped_dx+i, valid),
+                          _mm256_maskload_ps(buf_warped_dy+i, valid), v, v4);
+
+        // step 6: integrate into A and b:
+        sums6.update(v, _mm256_maskload_ps(buf_warped_residual+i, valid),
+                     _mm256_maskload_ps(buf_weight_p+i, valid));
+        sums4.update(v4, _mm256_maskload_ps(buf_residual_d+i, valid),
+                     _mm256_maskload_ps(buf_weight_d+i, valid));
+    }
+
+    Matrix6x6 JtJ6;
+    Vector6 Jtr6;
+    Matrix4x4 JtJ4;
+    Vector4 Jtr4;
+    float err6, err4;
+    sums6.reduce(JtJ6, Jtr6, err6);
+    sums4.reduce(JtJ4, Jtr4, err4);
+    ls6.updateSummed(JtJ6, Jtr6, err6, buf_warped_size);
+    ls4.updateSummed(JtJ4, Jtr4, err4, buf_warped_size);
+
+    ls4.finishNoDivide();
+    ls6.finishNoDivide();
+
+
+    ls7.initializeFrom(ls6, ls4);
+}
+#endif
+
 #if defined(ENABLE_NEON)
 void Sim3Tracker::calcSim3LGSNEON(NormalEquationsLeastSquares7 &ls7)
 {
@@ -1123,6 +1389,520 @@ void Sim3Tracker::calcSim3LGS(NormalEquationsLeastSquares7 &ls7)
 
 }
 
+
+bool Sim3Tracker::canUseFusedSim3Pass() const
+{
+    // debug images are drawn from the warped buffers, which the fused pass does not fill.
+    return !plotSim3TrackingIterationInfo;
+}
+
+Sim3ResidualStruct Sim3Tracker::calcSim3ResidualAndLGS(
+    NormalEquationsLeastSquares7 &ls7,
+    const TrackingReference* reference,
+    Frame* frame,
+    const Sim3& referenceToFrame,
+    int level)
+{
+    bool useFused = canUseFusedSim3Pass();
+
+#if defined(ENABLE_SSE)
+    // without AVX2, the SSE buffered kernels beat the scalar fused pass.
+    if(USESSE && simdLevel < SIMD_AVX2)
+        useFused = false;
+#endif
+
+    ls7Accumulated = useFused;
+    if(!useFused)
+    {
+        callOptimized(calcSim3Buffers, (reference, frame, referenceToFrame, level));
+        if(buf_warped_size < 0.5 * MIN_GOODPERALL_PIXEL_ABSMIN * (width>>level)*
+                (height>>level) || buf_warped_size < 10)
+            return Sim3ResidualStruct();	// diverged, the caller bails out.
+
+        Sim3ResidualStruct error = callOptimized(calcSim3WeightsAndResidual,
+                                   (referenceToFrame));
+        if(plotSim3TrackingIterationInfo) callOptimized(calcSim3Buffers,(reference,
+                    frame, referenceToFrame, level, true));
+        return error;
+    }
+
+#if defined(ENABLE_AVX2)
+    if(simdLevel >= SIMD_AVX2)
+        return calcSim3ResidualAndLGSFusedAVX2(ls7, reference, frame, referenceToFrame,
+                                               level);
+#endif
+    return calcSim3ResidualAndLGSFused(ls7, reference, frame, referenceToFrame,
+                                       level);
+}
+
+
+Sim3ResidualStruct Sim3Tracker::calcSim3ResidualAndLGSFused(
+    NormalEquationsLeastSquares7 &ls7,
+    const TrackingReference* reference,
+    Frame* frame,
+    const Sim3& referenceToFrame,
+    int level)
+{
+    NormalEquationsLeastSquares4 ls4;
+    NormalEquationsLeastSquares ls6;
+    ls6.initialize(width*height);
+    ls4.initialize(width*height);
+
+    // get static values
+    int w = frame->width(level);
+    int h = frame->height(level);
+    Eigen::Matrix3f KLvl = frame->K(level);
+    float fx_l = KLvl(0,0);
+    float fy_l = KLvl(1,1);
+    float cx_l = KLvl(0,2);
+    float cy_l = KLvl(1,2);
+
+    Eigen::Matrix3f rotMat = referenceToFrame.rxso3().matrix().cast<float>();
+    Eigen::Matrix3f rotMatUnscaled =
+        referenceToFrame.rotationMatrix().cast<float>();
+    Eigen::Vector3f transVec = referenceToFrame.translation().cast<float>();
+    float tx = transVec[0];
+    float ty = transVec[1];
+    float tz = transVec[2];
+
+    // Calculate rotation around optical axis for rotating source frame gradients
+    Eigen::Vector3f forwardVector(0, 0, -1);
+    Eigen::Vector3f rotatedForwardVector = rotMatUnscaled * forwardVector;
+    Eigen::Quaternionf shortestBackRotation;
+    shortestBackRotation.setFromTwoVectors(rotatedForwardVector, forwardVector);
+    Eigen::Matrix3f rollMat = shortestBackRotation.toRotationMatrix() *
+                              rotMatUnscaled;
+    float xRoll0 = rollMat(0, 0);
+    float xRoll1 = rollMat(0, 1);
+    float yRoll0 = rollMat(1, 0);
+    float yRoll1 = rollMat(1, 1);
+
+
+    const PointCloudSoA& refData = reference->pointData[level];
+
+    const float* 			frame_idepth = frame->idepth(level);
+    const float* 			frame_idepthVar = frame->idepthVar(level);
+    const Eigen::Vector4f* 	frame_intensityAndGradients = frame->gradients(level);
+
+
+    Sim3ResidualStruct sumRes;
+
+    float sxx=0,syy=0,sx=0,sy=0,sw=0;
+
+    float usageCount = 0;
+
+    int num=0;
+    for(int i=0; i<reference->numData[level]; i++)
+    {
+        Eigen::Vector3f refPoint(refData.x[i], refData.y[i], refData.z[i]);
+        Eigen::Vector3f Wxp = rotMat * refPoint + transVec;
+        float u_new = (Wxp[0]/Wxp[2])*fx_l + cx_l;
+        float v_new = (Wxp[1]/Wxp[2])*fy_l + cy_l;
+
+        // step 1a: coordinates have to be in image:
+        // (inverse test to exclude NANs)
+        if(!(u_new > 1 && v_new > 1 && u_new < w-2 && v_new < h-2))
+            continue;
+
+        float px = Wxp[0];	// x'
+        float py = Wxp[1];	// y'
+        float pz = Wxp[2];	// z'
+
+        Eigen::Vector3f resInterp = getInterpolatedElement43(
+                                        frame_intensityAndGradients, u_new, v_new, w);
+
+#if USE_ESM_TRACKING == 1
+        // get rotated gradient of point
+        float rotatedGradX = xRoll0 * refData.gradX[i] + xRoll1 * refData.gradY[i];
+        float rotatedGradY = yRoll0 * refData.gradX[i] + yRoll1 * refData.gradY[i];
+
+        float gx = fx_l * 0.5f * (resInterp[0] + rotatedGradX);	// \delta_x I
+        float gy = fy_l * 0.5f * (resInterp[1] + rotatedGradY);	// \delta_y I
+#else
+        float gx = fx_l * resInterp[0];
+        float gy = fy_l * resInterp[1];
+#endif
+
+
+        float c1 = affineEstimation_a * refData.color[i] + affineEstimation_b;
+        float c2 = resInterp[2];
+        float rp = c1 - c2;	// r_p
+
+        float weight = fabsf(rp) < 2.0f ? 1 : 2.0f / fabsf(rp);
+        sxx += c1*c1*weight;
+        syy += c2*c2*weight;
+        sx += c1*weight;
+        sy += c2*weight;
+        sw += weight;
+
+
+        // depth residual at the rounded pixel (only for Sim3).
+        int idx_rounded = (int)(u_new+0.5f) + w*(int)(v_new+0.5f);
+        float var_frameDepth = frame_idepthVar[idx_rounded];
+        bool depthValid = var_frameDepth > 0;
+        float rd = depthValid ? 1.0f / pz - frame_idepth[idx_rounded] : -1;	// r_d
+
+        float d = 1.0f / refPoint[2];	// d
+        float s = settings.var_weight * refData.var[i];	// \sigma_d^2
+        float sv = settings.var_weight * var_frameDepth;	// \sigma_d^2'
+
+
+        // weights, as in calcSim3WeightsAndResidual.
+        float g0 = (tx * pz - tz * px) / (pz*pz*d);
+        float g1 = (ty * pz - tz * py) / (pz*pz*d);
+        float g2 = (pz - tz) / (pz*pz*d);
+
+        float drpdd = gx * g0 + gy * g1;	// ommitting the minus
+        float w_p = 1.0f / (cameraPixelNoise2 + s * drpdd * drpdd);
+
+        float w_d = 1.0f / (sv + g2*g2*s);
+
+        float weighted_rd = fabs(rd*sqrtf(w_d));
+        float weighted_rp = fabs(rp*sqrtf(w_p));
+
+        float weighted_abs_res = depthValid ? weighted_rd+weighted_rp : weighted_rp;
+        float wh = fabs(weighted_abs_res < settings.huber_d ? 1 : settings.huber_d /
+                        weighted_abs_res);
+
+        float wp = wh * w_p;
+        float wd = depthValid ? wh * w_d : 0;
+
+        if(depthValid)
+        {
+            sumRes.sumResD += wd * rd*rd;
+            sumRes.numTermsD++;
+        }
+
+        sumRes.sumResP += wp * rp*rp;
+        sumRes.numTermsP++;
+
+
+        // LGS, as in calcSim3LGS.
+        float z = 1.0f / pz;
+        float z_sqr = 1.0f / (pz*pz);
+        Vector6 v;
+        Vector4 v4;
+        v[0] = z*gx + 0;
+        v[1] = 0 +         z*gy;
+        v[2] = (-px * z_sqr) * gx +
+               (-py * z_sqr) * gy;
+        v[3] = (-px * py * z_sqr) * gx +
+               (-(1.0 + py * py * z_sqr)) * gy;
+        v[4] = (1.0 + px * px * z_sqr) * gx +
+               (px * py * z_sqr) * gy;
+        v[5] = (-py * z) * gx +
+               (px * z) * gy;
+
+        v4[0] = z_sqr;
+        v4[1] = z_sqr * py;
+        v4[2] = -z_sqr * px;
+        v4[3] = z;
+
+        ls6.update(v, rp, wp);		// Jac = - v
+        ls4.update(v4, rd, wd);	// Jac = v4
+
+        num++;
+
+        float depthChange = refPoint[2] / pz;
+        usageCount += depthChange < 1 ? depthChange : 1;
+    }
+
+    // only the size is kept, for the divergence check of the caller.
+    buf_warped_size = num;
+
+    pointUsage = usageCount / (float)reference->numData[level];
+
+    affineEstimation_a_lastIt = sqrtf((syy - sy*sy/sw) / (sxx - sx*sx/sw));
+    affineEstimation_b_lastIt = (sy - affineEstimation_a_lastIt*sx)/sw;
+
+    sumRes.mean = (sumRes.sumResD + sumRes.sumResP) / (sumRes.numTermsD +
+                  sumRes.numTermsP);
+    sumRes.meanD = (sumRes.sumResD) / (sumRes.numTermsD);
+    sumRes.meanP = (sumRes.sumResP) / (sumRes.numTermsP);
+
+    ls4.finishNoDivide();
+    ls6.finishNoDivide();
+
+    ls7.initializeFrom(ls6, ls4);
+
+    return sumRes;
+}
+
+
+#if defined(ENABLE_AVX2)
+TARGET_AVX2 Sim3ResidualStruct Sim3Tracker::calcSim3ResidualAndLGSFusedAVX2(
+    NormalEquationsLeastSquares7 &ls7,
+    const TrackingReference* reference,
+    Frame* frame,
+    const Sim3& referenceToFrame,
+    int level)
+{
+    NormalEquationsLeastSquares4 ls4;
+    NormalEquationsLeastSquares ls6;
+    ls6.initialize(width*height);
+    ls4.initialize(width*height);
+
+    int w = frame->width(level);
+    int h = frame->height(level);
+    Eigen::Matrix3f KLvl = frame->K(level);
+    const __m256 fx_l = _mm256_set1_ps(KLvl(0,0));
+    const __m256 fy_l = _mm256_set1_ps(KLvl(1,1));
+    const __m256 cx_l = _mm256_set1_ps(KLvl(0,2));
+    const __m256 cy_l = _mm256_set1_ps(KLvl(1,2));
+
+    Eigen::Matrix3f rotMat = referenceToFrame.rxso3().matrix().cast<float>();
+    Eigen::Matrix3f rotMatUnscaled =
+        referenceToFrame.rotationMatrix().cast<float>();
+    Eigen::Vector3f transVec = referenceToFrame.translation().cast<float>();
+    __m256 R[3][3];
+    for(int r=0; r<3; r++)
+        for(int c=0; c<3; c++)
+            R[r][c] = _mm256_set1_ps(rotMat(r,c));
+    const __m256 t0 = _mm256_set1_ps(transVec[0]);
+    const __m256 t1 = _mm256_set1_ps(transVec[1]);
+    const __m256 t2 = _mm256_set1_ps(transVec[2]);
+
+    // Calculate rotation around optical axis for rotating source frame gradients
+    Eigen::Vector3f forwardVector(0, 0, -1);
+    Eigen::Vector3f rotatedForwardVector = rotMatUnscaled * forwardVector;
+    Eigen::Quaternionf shortestBackRotation;
+    shortestBackRotation.setFromTwoVectors(rotatedForwardVector, forwardVector);
+    Eigen::Matrix3f rollMat = shortestBackRotation.toRotationMatrix() *
+                              rotMatUnscaled;
+    const __m256 xRoll0 = _mm256_set1_ps(rollMat(0, 0));
+    const __m256 xRoll1 = _mm256_set1_ps(rollMat(0, 1));
+    const __m256 yRoll0 = _mm256_set1_ps(rollMat(1, 0));
+    const __m256 yRoll1 = _mm256_set1_ps(rollMat(1, 1));
+
+
+    const PointCloudSoA& refData = reference->pointData[level];
+    int refNum = reference->numData[level];
+
+    const float* frame_idepth = frame->idepth(level);
+    const float* frame_idepthVar = frame->idepthVar(level);
+    const float* frame_gradients = (const float*)frame->gradients(level);
+
+    const __m256i laneIdx = _mm256_setr_epi32(0,1,2,3,4,5,6,7);
+    const __m256i widthI = _mm256_set1_epi32(w);
+    const __m256i offRight = _mm256_set1_epi32(4);
+    const __m256i offDown = _mm256_set1_epi32(4*w);
+
+    const __m256 zeros = _mm256_setzero_ps();
+    const __m256 ones = _mm256_set1_ps(1.0f);
+    const __m256 halfs = _mm256_set1_ps(0.5f);
+    const __m256 twos = _mm256_set1_ps(2.0f);
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    const __m256 maxU = _mm256_set1_ps(w-2);
+    const __m256 maxV = _mm256_set1_ps(h-2);
+    const __m256 affA = _mm256_set1_ps(affineEstimation_a);
+    const __m256 affB = _mm256_set1_ps(affineEstimation_b);
+    const __m256 depthVarFacs = _mm256_set1_ps((float)settings.var_weight);
+    const __m256 sigma_i2s = _mm256_set1_ps((float)cameraPixelNoise2);
+    const __m256 huber_ress = _mm256_set1_ps((float)(settings.huber_d));
+
+    __m256 sxx = zeros, syy = zeros, sx = zeros, sy = zeros, sw = zeros;
+    __m256 sumResP = zeros, sumResD = zeros, usageCount = zeros;
+    int numTermsP = 0;
+    int numTermsD = 0;
+
+    LGSSumsAVX2<6> sums6;
+    LGSSumsAVX2<4> sums4;
+    sums6.setZero();
+    sums4.setZero();
+
+    for(int i=0; i<refNum; i+=8)
+    {
+        const __m256 inRange = _mm256_castsi256_ps(_mm256_cmpgt_epi32(
+                                   _mm256_set1_epi32(refNum-i), laneIdx));
+        __m256 rx = _mm256_load_ps(refData.x+i);
+        __m256 ry = _mm256_load_ps(refData.y+i);
+        __m256 rz = _mm256_load_ps(refData.z+i);
+
+        // Wxp = rotMat * refPoint + transVec;
+        __m256 Wx = _mm256_fmadd_ps(R[0][0], rx, _mm256_fmadd_ps(R[0][1], ry,
+                                    _mm256_fmadd_ps(R[0][2], rz, t0)));
+        __m256 Wy = _mm256_fmadd_ps(R[1][0], rx, _mm256_fmadd_ps(R[1][1], ry,
+                                    _mm256_fmadd_ps(R[1][2], rz, t1)));
+        __m256 Wz = _mm256_fmadd_ps(R[2][0], rx, _mm256_fmadd_ps(R[2][1], ry,
+                                    _mm256_fmadd_ps(R[2][2], rz, t2)));
+        __m256 u_new = _mm256_fmadd_ps(_mm256_div_ps(Wx, Wz), fx_l, cx_l);
+        __m256 v_new = _mm256_fmadd_ps(_mm256_div_ps(Wy, Wz), fy_l, cy_l);
+
+        // step 1a: coordinates have to be in image (ordered compares exclude NANs)
+        __m256 valid = _mm256_and_ps(
+                           _mm256_and_ps(_mm256_cmp_ps(u_new, ones, _CMP_GT_OQ),
+                                         _mm256_cmp_ps(v_new, ones, _CMP_GT_OQ)),
+                           _mm256_and_ps(_mm256_cmp_ps(u_new, maxU, _CMP_LT_OQ),
+                                         _mm256_cmp_ps(v_new, maxV, _CMP_LT_OQ)));
+        valid = _mm256_and_ps(valid, inRange);
+        int validBits = _mm256_movemask_ps(valid);
+        if(validBits == 0)
+            continue;
+
+        // getInterpolatedElement43, only gathering from pixels that are in the image.
+        __m256i ix = _mm256_cvttps_epi32(u_new);
+        __m256i iy = _mm256_cvttps_epi32(v_new);
+        __m256 dx = _mm256_sub_ps(u_new, _mm256_cvtepi32_ps(ix));
+        __m256 dy = _mm256_sub_ps(v_new, _mm256_cvtepi32_ps(iy));
+        __m256 dxdy = _mm256_mul_ps(dx, dy);
+        __m256 w11 = dxdy;
+        __m256 w01 = _mm256_sub_ps(dy, dxdy);
+        __m256 w10 = _mm256_sub_ps(dx, dxdy);
+        __m256 w00 = _mm256_add_ps(_mm256_sub_ps(_mm256_sub_ps(ones, dx), dy), dxdy);
+
+        __m256i o00 = _mm256_slli_epi32(_mm256_add_epi32(ix, _mm256_mullo_epi32(iy,
+                                         widthI)), 2);
+        __m256i o10 = _mm256_add_epi32(o00, offRight);
+        __m256i o01 = _mm256_add_epi32(o00, offDown);
+        __m256i o11 = _mm256_add_epi32(o01, offRight);
+
+        __m256 resInterp[3];
+        for(int c=0; c<3; c++)
+        {
+            const float* base = frame_gradients + c;
+            __m256 p00 = _mm256_mask_i32gather_ps(zeros, base, o00, valid, 4);
+            __m256 p10 = _mm256_mask_i32gather_ps(zeros, base, o10, valid, 4);
+            __m256 p01 = _mm256_mask_i32gather_ps(zeros, base, o01, valid, 4);
+            __m256 p11 = _mm256_mask_i32gather_ps(zeros, base, o11, valid, 4);
+            resInterp[c] = _mm256_and_ps(valid, _mm256_fmadd_ps(w11, p11,
+                                         _mm256_fmadd_ps(w01, p01, _mm256_fmadd_ps(w10, p10, _mm256_mul_ps(w00, p00)))));
+        }
+
+#if USE_ESM_TRACKING == 1
+        // get rotated gradient of point
+        __m256 refGx = _mm256_and_ps(valid, _mm256_load_ps(refData.gradX+i));
+        __m256 refGy = _mm256_and_ps(valid, _mm256_load_ps(refData.gradY+i));
+        __m256 rotatedGradX = _mm256_fmadd_ps(xRoll0, refGx, _mm256_mul_ps(xRoll1, refGy));
+        __m256 rotatedGradY = _mm256_fmadd_ps(yRoll0, refGx, _mm256_mul_ps(yRoll1, refGy));
+
+        __m256 gx = _mm256_mul_ps(_mm256_mul_ps(fx_l, halfs),
+                                  _mm256_add_ps(resInterp[0], rotatedGradX));
+        __m256 gy = _mm256_mul_ps(_mm256_mul_ps(fy_l, halfs),
+                                  _mm256_add_ps(resInterp[1], rotatedGradY));
+#else
+        __m256 gx = _mm256_mul_ps(fx_l, resInterp[0]);
+        __m256 gy = _mm256_mul_ps(fy_l, resInterp[1]);
+#endif
+
+        __m256 c1 = _mm256_fmadd_ps(affA, _mm256_load_ps(refData.color+i), affB);
+        __m256 c2 = resInterp[2];
+        __m256 rp = _mm256_and_ps(valid, _mm256_sub_ps(c1, c2));
+
+        // float weight = fabsf(rp) < 2.0f ? 1 : 2.0f / fabsf(rp);
+        __m256 absRes = _mm256_andnot_ps(signMask, rp);
+        __m256 weight = _mm256_blendv_ps(_mm256_div_ps(twos, absRes), ones,
+                                         _mm256_cmp_ps(absRes, twos, _CMP_LT_OQ));
+        weight = _mm256_and_ps(valid, weight);
+        __m256 c1w = _mm256_mul_ps(c1, weight);
+        __m256 c2w = _mm256_mul_ps(c2, weight);
+        sxx = _mm256_fmadd_ps(c1w, c1, sxx);
+        syy = _mm256_fmadd_ps(c2w, c2, syy);
+        sx = _mm256_add_ps(sx, c1w);
+        sy = _mm256_add_ps(sy, c2w);
+        sw = _mm256_add_ps(sw, weight);
+
+        // lanes outside the image continue with a harmless point, they get weight 0.
+        __m256 px = _mm256_and_ps(valid, Wx);
+        __m256 py = _mm256_and_ps(valid, Wy);
+        __m256 pz = _mm256_blendv_ps(ones, Wz, valid);
+
+        // depth residual at the rounded pixel (only for Sim3).
+        __m256i idxRounded = _mm256_add_epi32(
+                                 _mm256_cvttps_epi32(_mm256_add_ps(u_new, halfs)),
+                                 _mm256_mullo_epi32(_mm256_cvttps_epi32(_mm256_add_ps(v_new, halfs)), widthI));
+        __m256 varFrameDepth = _mm256_mask_i32gather_ps(zeros, frame_idepthVar,
+                               idxRounded, valid, 4);
+        __m256 depthValid = _mm256_and_ps(valid, _mm256_cmp_ps(varFrameDepth, zeros,
+                                          _CMP_GT_OQ));
+        __m256 frameIdepth = _mm256_mask_i32gather_ps(zeros, frame_idepth, idxRounded,
+                             depthValid, 4);
+        __m256 rd = _mm256_and_ps(depthValid, _mm256_sub_ps(_mm256_div_ps(ones, pz),
+                                  frameIdepth));
+
+        // weights, as in calcSim3WeightsAndResidual.
+        __m256 s = _mm256_mul_ps(depthVarFacs, _mm256_load_ps(refData.var+i));
+        __m256 sv = _mm256_mul_ps(depthVarFacs, varFrameDepth);
+
+        __m256 pz2d = _mm256_div_ps(_mm256_mul_ps(pz, pz), rz);
+        __m256 g0 = _mm256_div_ps(_mm256_fmsub_ps(pz, t0, _mm256_mul_ps(px, t2)), pz2d);
+        __m256 g1 = _mm256_div_ps(_mm256_fmsub_ps(pz, t1, _mm256_mul_ps(py, t2)), pz2d);
+        __m256 g2 = _mm256_div_ps(_mm256_sub_ps(pz, t2), pz2d);
+
+        __m256 drpdd = _mm256_fmadd_ps(g0, gx, _mm256_mul_ps(g1, gy));
+        __m256 w_p = _mm256_div_ps(ones, _mm256_fmadd_ps(_mm256_mul_ps(drpdd, drpdd), s,
+                                   sigma_i2s));
+        __m256 w_d = _mm256_div_ps(ones, _mm256_fmadd_ps(_mm256_mul_ps(g2, g2), s, sv));
+
+        __m256 weighted_rp = _mm256_andnot_ps(signMask,
+                                              _mm256_mul_ps(rp, _mm256_sqrt_ps(w_p)));
+        __m256 weighted_rd = _mm256_and_ps(depthValid, _mm256_andnot_ps(signMask,
+                                           _mm256_mul_ps(rd, _mm256_sqrt_ps(w_d))));
+
+        __m256 weighted_abs_res = _mm256_add_ps(weighted_rd, weighted_rp);
+        __m256 wh = _mm256_blendv_ps(_mm256_div_ps(huber_ress, weighted_abs_res), ones,
+                                     _mm256_cmp_ps(weighted_abs_res, huber_ress, _CMP_LT_OQ));
+
+        __m256 wp = _mm256_and_ps(valid, _mm256_mul_ps(wh, w_p));
+        __m256 wd = _mm256_and_ps(depthValid, _mm256_mul_ps(wh, w_d));
+
+        sumResP = _mm256_fmadd_ps(wp, _mm256_mul_ps(rp, rp), sumResP);
+        sumResD = _mm256_fmadd_ps(wd, _mm256_mul_ps(rd, rd), sumResD);
+        numTermsP += _mm_popcnt_u32(validBits);
+        numTermsD += _mm_popcnt_u32(_mm256_movemask_ps(depthValid));
+
+        // LGS, as in calcSim3LGS.
+        __m256 v[6], v4[4];
+        sim3JacobiansAVX2(px, py, pz, gx, gy, v, v4);
+        sums6.update(v, rp, wp);
+        sums4.update(v4, rd, wd);
+
+        // if depth becomes larger: pixel becomes "smaller", hence count it less.
+        usageCount = _mm256_add_ps(usageCount, _mm256_and_ps(valid,
+                                   _mm256_min_ps(_mm256_div_ps(rz, pz), ones)));
+    }
+
+    Matrix6x6 JtJ6;
+    Vector6 Jtr6;
+    Matrix4x4 JtJ4;
+    Vector4 Jtr4;
+    float err6, err4;
+    sums6.reduce(JtJ6, Jtr6, err6);
+    sums4.reduce(JtJ4, Jtr4, err4);
+    // as in the separate passes, every warped point counts as a depth constraint.
+    ls6.updateSummed(JtJ6, Jtr6, err6, numTermsP);
+    ls4.updateSummed(JtJ4, Jtr4, err4, numTermsP);
+
+    ls4.finishNoDivide();
+    ls6.finishNoDivide();
+
+    ls7.initializeFrom(ls6, ls4);
+
+    // only the size is kept, for the divergence check of the caller.
+    buf_warped_size = numTermsP;
+
+    pointUsage = hsumAVX2(usageCount) / (float)refNum;
+
+    float sxxs = hsumAVX2(sxx), syys = hsumAVX2(syy);
+    float sxs = hsumAVX2(sx), sys = hsumAVX2(sy), sws = hsumAVX2(sw);
+    affineEstimation_a_lastIt = sqrtf((syys - sys*sys/sws) / (sxxs - sxs*sxs/sws));
+    affineEstimation_b_lastIt = (sys - affineEstimation_a_lastIt*sxs)/sws;
+
+    Sim3ResidualStruct sumRes;
+    sumRes.sumResP = hsumAVX2(sumResP);
+    sumRes.numTermsP = numTermsP;
+    sumRes.sumResD = hsumAVX2(sumResD);
+    sumRes.numTermsD = numTermsD;
+
+    sumRes.mean = (sumRes.sumResD + sumRes.sumResP) / (sumRes.numTermsD +
+                  sumRes.numTermsP);
+    sumRes.meanD = (sumRes.sumResD) / (sumRes.numTermsD);
+    sumRes.meanP = (sumRes.sumResP) / (sumRes.numTermsP);
+
+    return sumRes;
+}
+#endif
+
+
 void Sim3Tracker::calcResidualAndBuffers_debugStart()
 {
     if(plotTrackingIterationInfo || saveAllTrackingStagesInternal)
@@ -152,6 +152,14 @@ private:
         int level,
         bool plotWeights = false);
 #endif
+#if defined(ENABLE_AVX2)
+    void calcSim3BuffersAVX2(
+        const TrackingReference* reference,
+        Frame* frame,
+        const Sim3& referenceToFrame,
+        int level,
+        bool plotWeights = false);
+#endif
 #if defined(ENABLE_NEON)
     void calcSim3BuffersNEON(
         const TrackingReference* reference,
@@ -172,6 +180,10 @@ private:
     Sim3ResidualStruct calcSim3WeightsAndResidualSSE(
         const Sim3& referenceToFrame);
 #endif
+#if defined(ENABLE_AVX2)
+    Sim3ResidualStruct calcSim3WeightsAndResidualAVX2(
+        const Sim3& referenceToFrame);
+#endif
 #if defined(ENABLE_NEON)
     Sim3ResidualStruct calcSim3WeightsAndResidualNEON(
         const Sim3& referenceToFrame);
@@ -183,11 +195,48 @@ private:
 #if defined(ENABLE_SSE)
     void calcSim3LGSSSE(NormalEquationsLeastSquares7 &ls7);
 #endif
+#if defined(ENABLE_AVX2)
+    void calcSim3LGSAVX2(NormalEquationsLeastSquares7 &ls7);
+#endif
 #if defined(ENABLE_NEON)
     void calcSim3LGSNEON(NormalEquationsLeastSquares7 &ls7);
 #endif
 
 
+    // whether the fused pass may be used, i.e. no debug image needs the warped buffers.
+    bool canUseFusedSim3Pass() const;
+
+    // one pass over the reference points that warps, weights and directly
+    // accumulates ls7 (via the 6dof and 4dof systems), without going through
+    // the warped buffers. only buf_warped_size is set by the fused pass, for
+    // the divergence check of the caller. falls back to calcSim3Buffers and
+    // calcSim3WeightsAndResidual when debug images need the buffers, or when
+    // the SSE kernels are faster; ls7 is then left untouched, and has to be
+    // built from the buffers with calcSim3LGS if needed.
+    Sim3ResidualStruct calcSim3ResidualAndLGS(
+        NormalEquationsLeastSquares7 &ls7,
+        const TrackingReference* reference,
+        Frame* frame,
+        const Sim3& referenceToFrame,
+        int level);
+    bool ls7Accumulated;	// whether the last calcSim3ResidualAndLGS call filled ls7.
+
+    Sim3ResidualStruct calcSim3ResidualAndLGSFused(
+        NormalEquationsLeastSquares7 &ls7,
+        const TrackingReference* reference,
+        Frame* frame,
+        const Sim3& referenceToFrame,
+        int level);
+#if defined(ENABLE_AVX2)
+    Sim3ResidualStruct calcSim3ResidualAndLGSFusedAVX2(
+        NormalEquationsLeastSquares7 &ls7,
+        const TrackingReference* reference,
+        Frame* frame,
+        const Sim3& referenceToFrame,
+        int level);
+#endif
+
+
 
     void calcResidualAndBuffers_debugStart();
     void calcResidualAndBuffers_debugFinish(int w);
@@ -36,9 +36,6 @@ TrackingReference::TrackingReference()
     wh_allocated = 0;
     for (int level = 0; level < PYRAMID_LEVELS; ++ level)
     {
-        posData[level] = nullptr;
-        gradData[level] = nullptr;
-        colorAndVarData[level] = nullptr;
         pointPosInXYGrid[level] = nullptr;
         numData[level] = 0;
     }
@@ -47,10 +44,9 @@ void TrackingReference::releaseAll()
 {
     for (int level = 0; level < PYRAMID_LEVELS; ++ level)
     {
-        if(posData[level] != nullptr) delete[] posData[level];
-        if(gradData[level] != nullptr) delete[] gradData[level];
-        if(colorAndVarData[level] != nullptr) delete[] colorAndVarData[level];
         if(pointPosInXYGrid[level] != nullptr) delete[] pointPosInXYGrid[level];
+        pointPosInXYGrid[level] = nullptr;
+        pointData[level].release();
         numData[level] = 0;
     }
     wh_allocated = 0;
@@ -113,16 +109,17 @@ void TrackingReference::makePointCloud(int level)
     const float* pyrColorSource = keyframe->image(level);
     const Eigen::Vector4f* pyrGradSource = keyframe->gradients(level);
 
-    if(posData[level] == nullptr) posData[level] = new Eigen::Vector3f[w*h];
     if(pointPosInXYGrid[level] == nullptr) pointPosInXYGrid[level] = new int[w*h];
-    if(gradData[level] == nullptr) gradData[level] = new Eigen::Vector2f[w*h];
-    if(colorAndVarData[level] == nullptr) colorAndVarData[level] = new
-        Eigen::Vector2f[w*h];
 
-    Eigen::Vector3f* posDataPT = posData[level];
-    int* idxPT = pointPosInXYGrid[level];
-    Eigen::Vector2f* gradDataPT = gradData[level];
-    Eigen::Vector2f* colorAndVarDataPT = colorAndVarData[level];
+    PointCloudSoA& soa = pointData[level];
+    soa.reserve(w*h);
+    bool makeJacobians = useInverseCompositionalTracking;
+    if(makeJacobians)
+        soa.reserveJacobians();
+    float fxLevel = keyframe->fx(level);
+    float fyLevel = keyframe->fy(level);
+
+    int i = 0;
 
     for(int x=1; x<w-1; x++)
         for(int y=1; y<h-1; y++)
@@ -131,20 +128,42 @@ void TrackingReference::makePointCloud(int level)
 
             if(pyrIdepthVarSource[idx] <= 0 || pyrIdepthSource[idx] == 0) continue;
 
-            *posDataPT = (1.0f / pyrIdepthSource[idx]) * Eigen::Vector3f(
-                             fxInvLevel*x+cxInvLevel,fyInvLevel*y+cyInvLevel,1);
-            *gradDataPT = pyrGradSource[idx].head<2>();
-            *colorAndVarDataPT = Eigen::Vector2f(pyrColorSource[idx],
-                                                 pyrIdepthVarSource[idx]);
-            *idxPT = idx;
-
-            posDataPT++;
-            gradDataPT++;
-            colorAndVarDataPT++;
-            idxPT++;
+            Eigen::Vector3f pos = (1.0f / pyrIdepthSource[idx]) * Eigen::Vector3f(
+                                      fxInvLevel*x+cxInvLevel,fyInvLevel*y+cyInvLevel,1);
+            pointPosInXYGrid[level][i] = idx;
+            soa.x[i] = pos[0];
+            soa.y[i] = pos[1];
+            soa.z[i] = pos[2];
+            soa.color[i] = pyrColorSource[idx];
+            soa.var[i] = pyrIdepthVarSource[idx];
+            soa.gradX[i] = pyrGradSource[idx][0];
+            soa.gradY[i] = pyrGradSource[idx][1];
+
+            if(makeJacobians)
+            {
+                // jacobian of I_ref(pi(exp(xi) * p)) at xi = 0, same formula as
+                // in SE3Tracker::calculateWarpUpdate, but with the keyframe gradient.
+                float px = soa.x[i];
+                float py = soa.y[i];
+                float z = 1.0f / soa.z[i];
+                float z_sqr = z*z;
+                float gx = fxLevel * soa.gradX[i];
+                float gy = fyLevel * soa.gradY[i];
+
+                soa.jac[0][i] = z*gx;
+                soa.jac[1][i] = z*gy;
+                soa.jac[2][i] = (-px * z_sqr) * gx + (-py * z_sqr) * gy;
+                soa.jac[3][i] = (-px * py * z_sqr) * gx + (-(1.0f + py * py * z_sqr)) * gy;
+                soa.jac[4][i] = (1.0f + px * px * z_sqr) * gx + (px * py * z_sqr) * gy;
+                soa.jac[5][i] = (-py * z) * gx + (px * z) * gy;
+            }
+
+            i++;
         }
 
-    numData[level] = posDataPT - posData[level];
+    numData[level] = i;
+    soa.setNum(numData[level]);
+    soa.hasJacobians = makeJacobians;
 }
 
 }
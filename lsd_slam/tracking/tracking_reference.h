@@ -21,6 +21,7 @@
 #pragma once
 #include "util/settings.h"
 #include "util/eigen_core_include.h"
+#include "tracking/point_cloud_soa.h"
 #include "boost/thread/mutex.hpp"
 #include <boost/thread/shared_mutex.hpp>
 
@@ -60,9 +61,7 @@ public:
     void makePointCloud(int level);
     void clearAll();
     void invalidate();
-    Eigen::Vector3f* posData[PYRAMID_LEVELS];	// (x,y,z)
-    Eigen::Vector2f* gradData[PYRAMID_LEVELS];	// (dx, dy)
-    Eigen::Vector2f* colorAndVarData[PYRAMID_LEVELS];	// (I, Var)
+    PointCloudSoA pointData[PYRAMID_LEVELS];	// x[], y[], z[], I[], Var[], dx[], dy[]; read by the trackers.
     int* pointPosInXYGrid[PYRAMID_LEVELS];	// x + y*width
     int numData[PYRAMID_LEVELS];
 
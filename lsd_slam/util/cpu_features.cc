@@ -0,0 +1,97 @@
+/**
+* This file is part of LSD-SLAM.
+*
+* Copyright 2013 Jakob Engel <engelj at in dot tum dot de> (Technical University of Munich)
+* For more information see <http://vision.in.tum.de/lsdslam>
+*
+* LSD-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* LSD-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with LSD-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/cpu_features.h"
+
+#if defined(ENABLE_SSE) && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+
+namespace lsd_slam
+{
+
+SimdLevel detectSimdLevel()
+{
+#if defined(ENABLE_NEON)
+    return SIMD_NEON;
+#elif defined(ENABLE_SSE)
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+
+    __cpuid(info, 1);
+    bool fma = (info[2] & (1<<12)) != 0;
+    bool osxsave = (info[2] & (1<<27)) != 0;
+
+    bool avx2 = false, avx512f = false;
+    if(maxLeaf >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1<<5)) != 0;
+        avx512f = (info[1] & (1<<16)) != 0;
+    }
+
+    // the OS also has to save the ymm / zmm registers on context switches.
+    unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    bool ymmState = (xcr0 & 0x06) == 0x06;
+    bool zmmState = (xcr0 & 0xe6) == 0xe6;
+
+    if(avx512f && avx2 && fma && zmmState)
+        return SIMD_AVX512;
+    if(avx2 && fma && ymmState)
+        return SIMD_AVX2;
+    return SIMD_SSE;
+#else
+    // also checks that the OS saves the extended register state.
+    __builtin_cpu_init();
+    bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+
+    if(avx2 && __builtin_cpu_supports("avx512f"))
+        return SIMD_AVX512;
+    if(avx2)
+        return SIMD_AVX2;
+    return SIMD_SSE;
+#endif
+#else
+    return SIMD_NONE;
+#endif
+}
+
+const char* simdLevelName(SimdLevel level)
+{
+    switch(level)
+    {
+    case SIMD_NEON:
+        return "NEON";
+    case SIMD_SSE:
+        return "SSE";
+    case SIMD_AVX2:
+        return "AVX2";
+    case SIMD_AVX512:
+        return "AVX512";
+    default:
+        return "scalar";
+    }
+}
+
+}
@@ -0,0 +1,38 @@
+/**
+* This file is part of LSD-SLAM.
+*
+* Copyright 2013 Jakob Engel <engelj at in dot tum dot de> (Technical University of Munich)
+* For more information see <http://vision.in.tum.de/lsdslam>
+*
+* LSD-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* LSD-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with LSD-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "util/settings.h"
+
+
+namespace lsd_slam
+{
+
+/**
+ * Returns the widest SIMD code path that is compiled in and that the CPU
+ * (and OS) running this binary supports. Queries CPUID, so call it once and
+ * store the result in simdLevel.
+ */
+SimdLevel detectSimdLevel();
+
+/** Short name of a SimdLevel, e.g. for timing output. */
+const char* simdLevelName(SimdLevel level);
+
+}
@@ -23,6 +23,7 @@
 #include "boost/thread.hpp"
 #include <stdio.h>
 #include <iostream>
+#include <vector>
 
 
 
@@ -33,8 +34,12 @@ class IndexThreadReduce
 {
 
 public:
-    inline IndexThreadReduce()
+    inline IndexThreadReduce(int numThreads = MAPPING_THREADS)
     {
+        this->numThreads = numThreads;
+        workerThreads.resize(numThreads);
+        isDone.resize(numThreads);
+
         nextIndex = 0;
         maxIndex = 0;
         stepSize = 1;
@@ -42,7 +47,7 @@ public:
                                    _2, _3);
 
         running = true;
-        for(int i=0; i<MAPPING_THREADS; i++)
+        for(int i=0; i<numThreads; i++)
         {
             isDone[i] = false;
             workerThreads[i] = boost::thread(&IndexThreadReduce::workerLoop, this, i);
@@ -58,7 +63,7 @@ public:
         todo_signal.notify_all();
         exMutex.unlock();
 
-        for(int i=0; i<MAPPING_THREADS; i++)
+        for(int i=0; i<numThreads; i++)
             workerThreads[i].join();
 
 
@@ -78,7 +83,7 @@ public:
 
 
         if(stepSize == 0)
-            stepSize = ((end-first)+MAPPING_THREADS-1)/MAPPING_THREADS;
+            stepSize = ((end-first)+numThreads-1)/numThreads;
 
 
         //printf("reduce called\n");
@@ -92,7 +97,7 @@ public:
         this->stepSize = stepSize;
 
         // go worker threads!
-        for(int i=0; i<MAPPING_THREADS; i++)
+        for(int i=0; i<numThreads; i++)
             isDone[i] = false;
 
         // let them start!
@@ -109,7 +114,7 @@ public:
 
             // check if actually all are finished.
             bool allDone = true;
-            for(int i=0; i<MAPPING_THREADS; i++)
+            for(int i=0; i<numThreads; i++)
                 allDone = allDone && isDone[i];
 
             // all are finished! exit.
@@ -127,8 +132,9 @@ public:
 
 
 private:
-    boost::thread workerThreads[MAPPING_THREADS];
-    bool isDone[MAPPING_THREADS];
+    int numThreads;
+    std::vector<boost::thread> workerThreads;
+    std::vector<bool> isDone;
 
     boost::mutex exMutex;
     boost::condition_variable todo_signal;
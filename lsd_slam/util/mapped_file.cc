@@ -0,0 +1,100 @@
+/**
+* This file is part of LSD-SLAM.
+*
+* Copyright 2013 Jakob Engel <engelj at in dot tum dot de> (Technical University of Munich)
+* For more information see <http://vision.in.tum.de/lsdslam>
+*
+* LSD-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* LSD-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with LSD-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "util/mapped_file.h"
+
+#include <cstdio>
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+namespace lsd_slam
+{
+
+MappedFile::MappedFile()
+    : begin(0), length(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const std::string& filename)
+{
+    close();
+
+#ifndef _WIN32
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size <= 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void* mapping = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);	// the mapping stays valid.
+    if(mapping == MAP_FAILED)
+        return false;
+
+    begin = static_cast<const char*>(mapping);
+    length = st.st_size;
+#else
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if(!file.is_open())
+        return false;
+
+    copy.resize((size_t)file.tellg());
+    file.seekg(0);
+    if(copy.empty() || !file.read(copy.data(), copy.size()))
+    {
+        copy.clear();
+        return false;
+    }
+
+    begin = copy.data();
+    length = copy.size();
+#endif
+    return true;
+}
+
+void MappedFile::close()
+{
+#ifndef _WIN32
+    if(begin != 0)
+        munmap(const_cast<char*>(begin), length);
+#endif
+    copy.clear();
+    begin = 0;
+    length = 0;
+}
+
+}
@@ -0,0 +1,70 @@
+/**
+* This file is part of LSD-SLAM.
+*
+* Copyright 2013 Jakob Engel <engelj at in dot tum dot de> (Technical University of Munich)
+* For more information see <http://vision.in.tum.de/lsdslam>
+*
+* LSD-SLAM is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* LSD-SLAM is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with LSD-SLAM. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+namespace lsd_slam
+{
+
+/**
+ * Read-only memory mapping of a whole file (on Windows, the file is read into
+ * memory instead). The mapping is private: nothing is copied until pages are touched.
+ */
+class MappedFile
+{
+public:
+    MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    /** Maps filename, closing any previous mapping. Returns false if it can't be opened. */
+    bool open(const std::string& filename);
+    void close();
+
+    inline size_t size() const {
+        return length;
+    }
+
+    /**
+     * Returns the num Ts at offset, or 0 if they are not completely inside the
+     * file or offset is not aligned for T.
+     */
+    template<typename T>
+    inline const T* at(uint64_t offset, uint64_t num = 1) const
+    {
+        if(begin == 0 || offset > length || num > (length - offset) / sizeof(T)
+                || offset % alignof(T) != 0)
+            return 0;
+        return reinterpret_cast<const T*>(begin + offset);
+    }
+
+private:
+    const char* begin;
+    size_t length;
+    std::vector<char> copy;	// only used if mmap is not available.
+};
+
+}
@@ -28,6 +28,16 @@ namespace lsd_slam
 {
 RunningStats runningStats;
 
+// the SSE2 baseline is always there on x86-64, wider paths are enabled by
+// SlamSystem once it checked the CPU.
+#if defined(ENABLE_SSE)
+SimdLevel simdLevel = SIMD_SSE;
+#elif defined(ENABLE_NEON)
+SimdLevel simdLevel = SIMD_NEON;
+#else
+SimdLevel simdLevel = SIMD_NONE;
+#endif
+
 
 bool autoRun = true;
 bool autoRunWithinFrame = true;
@@ -86,6 +96,9 @@ bool useMotionModel = false;
 bool useSubpixelStereo = true;
 bool multiThreading = true;
 bool useAffineLightningEstimation = true;
+int trackingThreads = 2;
+int constraintSearchThreads = 2;
+bool useInverseCompositionalTracking = false;
 
 
 
@@ -99,6 +112,11 @@ int maxOptimizationIterations = 100;
 int propagateKeyFrameDepthCount = 0;
 float loopclosureStrictness = 1.5;
 float relocalizationTH = 0.7;
+int incrementalOptimizationHops = 5;
+PoseGraphSolver poseGraphSolver = POSE_GRAPH_SOLVER_CSPARSE;
+int poseGraphThreads = 0;
+int frameMemoryBudgetMB = 0;
+std::string frameSwapFile = "";
 
 
 bool saveKeyframes =  false;
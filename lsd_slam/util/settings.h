@@ -34,12 +34,37 @@ namespace lsd_slam
 #define DIVISION_EPS 1e-10f
 #define UNZERO(val) (val < 0 ? (val > -1e-10 ? -1e-10 : val) : (val < 1e-10 ? 1e-10 : val))
 
+/** SIMD code path of the optimized kernels, chosen at runtime (see util/cpu_features.h). */
+enum SimdLevel
+{
+    SIMD_NONE = 0,
+    SIMD_NEON,
+    SIMD_SSE,
+    SIMD_AVX2,
+    SIMD_AVX512
+};
+extern SimdLevel simdLevel;
+
 #if defined(ENABLE_SSE)
-#define USESSE true
+#define USESSE (simdLevel >= SIMD_SSE)
 #else
 #define USESSE false
 #endif
 
+// the wider x86 kernels are always compiled, each for its own target only,
+// and are only called if the CPU running the binary supports them.
+#if defined(ENABLE_SSE)
+#define ENABLE_AVX2
+#define ENABLE_AVX512
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_AVX2 __attribute__((target("avx2,fma,popcnt")))
+#define TARGET_AVX512 __attribute__((target("avx512f,avx2,fma,popcnt")))
+#else
+#define TARGET_AVX2
+#define TARGET_AVX512
+#endif
+#endif
+
 
 
 #define enablePrintDebugInfo true
@@ -96,6 +121,18 @@ namespace lsd_slam
 #define SE3TRACKING_MIN_LEVEL 1
 #define SE3TRACKING_MAX_LEVEL 5
 
+// levels with fewer reference points than this per thread are tracked single threaded.
+#define SE3TRACKING_MIN_POINTS_PER_THREAD 4096
+
+// motion model: the velocity of the last two tracked frames is scaled with this
+// for the prediction (1 = constant velocity).
+#define MOTION_MODEL_VELOCITY_DECAY 0.9f
+// if the predictions of this many consecutive frames were off by less than
+// MOTION_MODEL_CONFIDENT_PIXEL_ERROR (full resolution pixels), SE3 tracking
+// skips the coarsest pyramid level.
+#define MOTION_MODEL_CONFIDENT_FRAMES 3
+#define MOTION_MODEL_CONFIDENT_PIXEL_ERROR 4.0f
+
 #define SIM3TRACKING_MIN_LEVEL 1
 #define SIM3TRACKING_MAX_LEVEL 5
 
@@ -171,6 +208,10 @@ namespace lsd_slam
 
 #define MIN_NUM_MAPPED 5
 
+// the pose-graph optimizer is extended by new keyframes / constraints instead
+// of re-initialized, unless they are more than this fraction of its edges.
+#define OPTIMIZATION_REINIT_GROWTH 0.1f
+
 // settings variables
 // controlled via keystrokes
 extern bool autoRun;
@@ -216,6 +257,20 @@ extern bool useSubpixelStereo;
 extern bool multiThreading;
 extern bool useAffineLightningEstimation;
 
+// worker threads for the per-point passes of SE3 tracking (1 = single threaded).
+// read when a tracker first tracks a frame.
+extern int trackingThreads;
+
+// workers testing the loop-closure candidates of a new keyframe concurrently
+// (1 = one after the other). each holds its own trackers, i.e. a few tens of
+// MB at 640x480. read when the SlamSystem is created.
+extern int constraintSearchThreads;
+
+// track with the inverse compositional formulation: the jacobians are computed
+// once per keyframe (in TrackingReference::makePointCloud) instead of per iteration.
+// takes effect for point clouds built after it is set.
+extern bool useInverseCompositionalTracking;
+
 extern float freeDebugParam1;
 extern float freeDebugParam2;
 extern float freeDebugParam3;
@@ -230,6 +285,35 @@ extern int propagateKeyFrameDepthCount;
 extern float loopclosureStrictness;
 extern float relocalizationTH;
 
+// pose-graph optimization only moves the keyframes within this many graph hops
+// of newly added keyframes / constraints, the rest of the graph is kept fixed.
+// loop closures (new constraints between keyframes further apart than that)
+// still optimize the whole graph. 0 = always optimize the whole graph.
+extern int incrementalOptimizationHops;
+
+/** Sparse linear solver of the pose-graph optimization (see createPoseGraphAlgorithm()). */
+enum PoseGraphSolver
+{
+    POSE_GRAPH_SOLVER_CSPARSE = 0,
+    POSE_GRAPH_SOLVER_CHOLMOD,
+    POSE_GRAPH_SOLVER_EIGEN,	// sparse LDLT
+    POSE_GRAPH_SOLVER_PCG
+};
+// read when the KeyFrameGraph is created; solvers g2o / lsd_slam were built
+// without fall back to CSparse.
+extern PoseGraphSolver poseGraphSolver;
+// OpenMP threads of the pose-graph optimization (block operations in g2o, if
+// built with G2O_OPENMP). 0 = OpenMP default. needs LsdSlam_WITH_OPENMP.
+extern int poseGraphThreads;
+
+// resident size of all frame buffers (FrameMemory) in MB. above it, pooled buffers
+// are freed, then the level-0 data of the least recently active keyframes is
+// swapped out to frameSwapFile, and transparently swapped in again when required.
+// 0 = unlimited.
+extern int frameMemoryBudgetMB;
+// backing file for swapped-out keyframes. empty: packagePath + "frame_swap.bin".
+extern std::string frameSwapFile;
+
 
 extern float minUseGrad;
 extern float cameraPixelNoise2;
@@ -381,6 +465,10 @@ public:
 
         var_weight = 1.0;
         huber_d = 3;
+
+        skipLevelResidual = 0;
+        earlyExitLevel = 0;
+        earlyExitIncrement = 1e-3;
     }
 
     float lambdaSuccessFac;
@@ -397,6 +485,16 @@ public:
 
     float huber_d;
     float var_weight;
+
+    // adaptive level scheduling, only used by SE3Tracker::trackFrame.
+    // levels coarser than the finest one are not iterated on if their initial
+    // residual is below skipLevelResidual (0 = never).
+    float skipLevelResidual;
+    // if earlyExitLevel converged with a last accepted increment smaller than
+    // earlyExitIncrement, the finer levels are not iterated on (0 = never;
+    // SE3TRACKING_MIN_LEVEL+1 skips the finest level).
+    int earlyExitLevel;
+    float earlyExitIncrement;
 };
 
 extern RunningStats runningStats;